@@ -0,0 +1,49 @@
+/*! \file hash.h
+ * Fast hashing routines for integers, longs and pointers.
+ *
+ * Taken from linux/include/linux/hash.h; (C) 2002 Nadia Yvette Chambers, IBM
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+#pragma once
+
+/*! \addtogroup hashtable
+ *  @{
+ * \file hash.h */
+
+#include <stdint.h>
+
+/*
+ * These multiplicative constants approximate 2^32/phi and 2^64/phi, phi
+ * being the golden ratio.  Multiplying by them spreads the input bits
+ * over the upper bits of the result, which are used as the hash.
+ */
+#define GOLDEN_RATIO_32 0x61C88647
+#define GOLDEN_RATIO_64 0x61C8864680B583EBull
+
+#if __SIZEOF_LONG__ == 4
+#define hash_long(val, bits) hash_32(val, bits)
+#else
+#define hash_long(val, bits) hash_64(val, bits)
+#endif
+
+/*! hash a 32bit value into \a bits bits (1 to 32) */
+static inline uint32_t hash_32(uint32_t val, unsigned int bits)
+{
+	/* high bits are more random, so use them */
+	return (val * GOLDEN_RATIO_32) >> (32 - bits);
+}
+
+/*! hash a 64bit value into \a bits bits (1 to 32) */
+static inline uint32_t hash_64(uint64_t val, unsigned int bits)
+{
+	return (val * GOLDEN_RATIO_64) >> (64 - bits);
+}
+
+/*! hash a pointer into \a bits bits (1 to 32) */
+static inline uint32_t hash_ptr(const void *ptr, unsigned int bits)
+{
+	return hash_long((unsigned long)ptr, bits);
+}
+
+/*! @} */
@@ -0,0 +1,143 @@
+/*! \file hashtable.h
+ * Statically sized hash table implementation.
+ *
+ * Taken from linux/include/linux/hashtable.h; (C) 2012 Sasha Levin
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+#pragma once
+
+/*! \defgroup hashtable Statically sized hash tables
+ *  @{
+ *
+ *  A hash table is an array of hlist buckets of a size known at compile
+ *  time.  Entries embed a struct hlist_node and are added under an
+ *  integer key; lookups iterate over all entries whose key hashes into
+ *  the same bucket, so the caller still has to compare the key.
+ *
+ * \file hashtable.h */
+
+#include <stdbool.h>
+
+#include <osmocom/core/linuxlist.h>
+#include <osmocom/core/hash.h>
+#include <osmocom/core/utils.h>
+
+#define DEFINE_HASHTABLE(name, bits)						\
+	struct hlist_head name[1 << (bits)] =					\
+			{ [0 ... ((1 << (bits)) - 1)] = HLIST_HEAD_INIT }
+
+#define DECLARE_HASHTABLE(name, bits)						\
+	struct hlist_head name[1 << (bits)]
+
+#define HASH_SIZE(name) (ARRAY_SIZE(name))
+/* the table size is a constant power of two, so this folds at compile time */
+#define HASH_BITS(name) (__builtin_ctzll(HASH_SIZE(name)))
+
+/* Use hash_32 when possible to allow for fast 32bit hashing in 64bit kernels. */
+#define hash_min(val, bits)							\
+	(sizeof(val) <= 4 ? hash_32(val, bits) : hash_long(val, bits))
+
+static inline void __hash_init(struct hlist_head *ht, unsigned int sz)
+{
+	unsigned int i;
+
+	for (i = 0; i < sz; i++)
+		INIT_HLIST_HEAD(&ht[i]);
+}
+
+/*! initialize a hash table
+ *  \param hashtable hashtable to be initialized
+ *
+ *  This has to be a macro since HASH_BITS() will not work on pointers since
+ *  it calculates the size during preprocessing.
+ */
+#define hash_init(hashtable) __hash_init(hashtable, HASH_SIZE(hashtable))
+
+/*! add an object to a hashtable
+ *  \param hashtable hashtable to add to
+ *  \param node the &struct hlist_node of the object to be added
+ *  \param key the key of the object to be added
+ */
+#define hash_add(hashtable, node, key)						\
+	hlist_add_head(node, &hashtable[hash_min(key, HASH_BITS(hashtable))])
+
+/*! check whether an object is in any hashtable
+ *  \param[in] node the &struct hlist_node of the object to be checked
+ */
+static inline bool hash_hashed(struct hlist_node *node)
+{
+	return !hlist_unhashed(node);
+}
+
+static inline bool __hash_empty(struct hlist_head *ht, unsigned int sz)
+{
+	unsigned int i;
+
+	for (i = 0; i < sz; i++)
+		if (!hlist_empty(&ht[i]))
+			return false;
+
+	return true;
+}
+
+/*! check whether a hashtable is empty
+ *  \param hashtable hashtable to check
+ *
+ *  This has to be a macro since HASH_BITS() will not work on pointers since
+ *  it calculates the size during preprocessing.
+ */
+#define hash_empty(hashtable) __hash_empty(hashtable, HASH_SIZE(hashtable))
+
+/*! remove an object from a hashtable
+ *  \param[in] node &struct hlist_node of the object to remove
+ */
+static inline void hash_del(struct hlist_node *node)
+{
+	hlist_del_init(node);
+}
+
+/*! iterate over a hashtable
+ *  \param name hashtable to iterate
+ *  \param bkt integer to use as bucket loop cursor
+ *  \param obj the type * to use as a loop cursor for each entry
+ *  \param member the name of the hlist_node within the struct
+ */
+#define hash_for_each(name, bkt, obj, member)					\
+	for ((bkt) = 0, obj = NULL; obj == NULL && (bkt) < HASH_SIZE(name);	\
+			(bkt)++)						\
+		hlist_for_each_entry(obj, &name[bkt], member)
+
+/*! iterate over a hashtable safe against removal of hash entry
+ *  \param name hashtable to iterate
+ *  \param bkt integer to use as bucket loop cursor
+ *  \param tmp a &struct hlist_node used for temporary storage
+ *  \param obj the type * to use as a loop cursor for each entry
+ *  \param member the name of the hlist_node within the struct
+ */
+#define hash_for_each_safe(name, bkt, tmp, obj, member)				\
+	for ((bkt) = 0, obj = NULL; obj == NULL && (bkt) < HASH_SIZE(name);	\
+			(bkt)++)						\
+		hlist_for_each_entry_safe(obj, tmp, &name[bkt], member)
+
+/*! iterate over all possible objects hashing to the same bucket
+ *  \param name hashtable to iterate
+ *  \param obj the type * to use as a loop cursor for each entry
+ *  \param member the name of the hlist_node within the struct
+ *  \param key the key of the objects to iterate over
+ */
+#define hash_for_each_possible(name, obj, member, key)				\
+	hlist_for_each_entry(obj, &name[hash_min(key, HASH_BITS(name))], member)
+
+/*! iterate over all possible objects hashing to the same bucket safe against removals
+ *  \param name hashtable to iterate
+ *  \param obj the type * to use as a loop cursor for each entry
+ *  \param tmp a &struct hlist_node used for temporary storage
+ *  \param member the name of the hlist_node within the struct
+ *  \param key the key of the objects to iterate over
+ */
+#define hash_for_each_possible_safe(name, obj, tmp, member, key)		\
+	hlist_for_each_entry_safe(obj, tmp,					\
+		&name[hash_min(key, HASH_BITS(name))], member)
+
+/*! @} */
@@ -0,0 +1,47 @@
+/*! \file it_q.h
+ * Lock-free inter-thread queue into an osmo_select_main() loop */
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+#pragma once
+
+/*! \defgroup it_q Inter-thread queue
+ *  @{
+ * \file it_q.h */
+
+#include <osmocom/core/msgb.h>
+
+/*! Inter-thread queue; any thread may post, one select loop consumes */
+struct osmo_it_q;
+
+/*! call-back for a \ref msgb received via the queue; takes ownership */
+typedef void (*osmo_it_q_msg_cb_t)(struct osmo_it_q *q, struct msgb *msg);
+
+struct osmo_it_q *osmo_it_q_alloc(void *ctx, const char *name,
+				  unsigned int size, osmo_it_q_msg_cb_t msg_cb,
+				  void *data);
+void osmo_it_q_free(struct osmo_it_q *q);
+
+int osmo_it_q_enqueue(struct osmo_it_q *q, struct msgb *msg);
+int osmo_it_q_call(struct osmo_it_q *q, void (*cb)(void *arg), void *arg);
+
+unsigned int osmo_it_q_drain(struct osmo_it_q *q, unsigned int max);
+const char *osmo_it_q_name(const struct osmo_it_q *q);
+void *osmo_it_q_data(const struct osmo_it_q *q);
+
+/*! @} */
@@ -396,6 +396,131 @@ static inline unsigned int llist_count(struct llist_head *head)
 	return i;
 }
 
+/*
+ * Double linked lists with a single pointer list head.
+ * Mostly useful for hash tables where the two pointer list head is
+ * too wasteful.
+ * You lose the ability to access the tail in O(1).
+ */
+
+/*! single pointer list head, e.g. a hash table bucket */
+struct hlist_head {
+	struct hlist_node *first;
+};
+
+/*! entry of a list with single pointer head */
+struct hlist_node {
+	struct hlist_node *next, **pprev;
+};
+
+#define HLIST_HEAD_INIT { .first = NULL }
+#define HLIST_HEAD(name) struct hlist_head name = {  .first = NULL }
+#define INIT_HLIST_HEAD(ptr) ((ptr)->first = NULL)
+
+/*! initialize a hlist node, so that hlist_unhashed() is true */
+static inline void INIT_HLIST_NODE(struct hlist_node *h)
+{
+	h->next = NULL;
+	h->pprev = NULL;
+}
+
+/*! check whether a node is part of any hlist
+ *  \param[in] h node to check; must have been initialized or removed with hlist_del_init()
+ */
+static inline int hlist_unhashed(const struct hlist_node *h)
+{
+	return !h->pprev;
+}
+
+/*! check whether a hlist is empty */
+static inline int hlist_empty(const struct hlist_head *h)
+{
+	return !h->first;
+}
+
+static inline void __hlist_del(struct hlist_node *n)
+{
+	struct hlist_node *next = n->next;
+	struct hlist_node **pprev = n->pprev;
+
+	*pprev = next;
+	if (next)
+		next->pprev = pprev;
+}
+
+/*! delete an entry from its hlist; the entry is poisoned afterwards */
+static inline void hlist_del(struct hlist_node *n)
+{
+	__hlist_del(n);
+	n->next = (struct hlist_node *)LLIST_POISON1;
+	n->pprev = (struct hlist_node **)LLIST_POISON2;
+}
+
+/*! delete an entry from its hlist, if any, and reinitialize it */
+static inline void hlist_del_init(struct hlist_node *n)
+{
+	if (!hlist_unhashed(n)) {
+		__hlist_del(n);
+		INIT_HLIST_NODE(n);
+	}
+}
+
+/*! add an entry at the beginning of a hlist */
+static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+{
+	struct hlist_node *first = h->first;
+
+	n->next = first;
+	if (first)
+		first->pprev = &n->next;
+	h->first = n;
+	n->pprev = &h->first;
+}
+
+#define hlist_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define hlist_entry_safe(ptr, type, member) \
+	({ typeof(ptr) ____ptr = (ptr); \
+	   ____ptr ? hlist_entry(____ptr, type, member) : NULL; \
+	})
+
+/*! iterate over a hlist
+ *  \param pos the &struct hlist_node to use as a loop cursor.
+ *  \param head the head for your list.
+ */
+#define hlist_for_each(pos, head) \
+	for (pos = (head)->first; pos ; pos = pos->next)
+
+/*! iterate over a hlist, safe against removal of the current entry
+ *  \param pos the &struct hlist_node to use as a loop cursor.
+ *  \param n another &struct hlist_node to use as temporary storage.
+ *  \param head the head for your list.
+ */
+#define hlist_for_each_safe(pos, n, head) \
+	for (pos = (head)->first; pos && ({ n = pos->next; 1; }); \
+	     pos = n)
+
+/*! iterate over a hlist of given type
+ *  \param pos the type * to use as a loop cursor.
+ *  \param head the head for your list.
+ *  \param member the name of the hlist_node within the struct.
+ */
+#define hlist_for_each_entry(pos, head, member)				\
+	for (pos = hlist_entry_safe((head)->first, typeof(*(pos)), member);\
+	     pos;							\
+	     pos = hlist_entry_safe((pos)->member.next, typeof(*(pos)), member))
+
+/*! iterate over a hlist of given type, safe against removal of the current entry
+ *  \param pos the type * to use as a loop cursor.
+ *  \param n another &struct hlist_node to use as temporary storage.
+ *  \param head the head for your list.
+ *  \param member the name of the hlist_node within the struct.
+ */
+#define hlist_for_each_entry_safe(pos, n, head, member) 		\
+	for (pos = hlist_entry_safe((head)->first, typeof(*pos), member);\
+	     pos && ({ n = pos->member.next; 1; });			\
+	     pos = hlist_entry_safe(n, typeof(*pos), member))
+
 /*!
  *  @}
  */
@@ -54,7 +54,7 @@ void logp(int subsys, const char *file, int line, int cont, const char *format,
  */
 #define LOGPC(ss, level, fmt, args...) \
 	do { \
-		if (log_check_level(ss, level)) \
+		if (!log_cache_drops(ss, level) && log_check_level(ss, level)) \
 			logp2(ss, level, __BASE_FILE__, __LINE__, 1, fmt, ##args); \
 	} while(0)
 
@@ -88,7 +88,7 @@ void logp(int subsys, const char *file, int line, int cont, const char *format,
  */
 #define LOGPSRCC(ss, level, caller_file, caller_line, cont, fmt, args...) \
 	do { \
-		if (log_check_level(ss, level)) {\
+		if (!log_cache_drops(ss, level) && log_check_level(ss, level)) {\
 			if (caller_file) \
 				logp2(ss, level, caller_file, caller_line, cont, fmt, ##args); \
 			else \
@@ -96,6 +96,26 @@ void logp(int subsys, const char *file, int line, int cont, const char *format,
 		}\
 	} while(0)
 
+/*! Log a message, but at most \a rate messages per second on average
+ *  \param[in] ss logging subsystem (e.g. \ref DLGLOBAL)
+ *  \param[in] level logging level (e.g. \ref LOGL_NOTICE)
+ *  \param[in] rate messages per second, larger than 0
+ *  \param[in] burst messages logged in a row before the rate applies
+ *  \param[in] fmt format string
+ *  \param[in] args variable argument list
+ *
+ *  Each use of the macro has its own token bucket in a static struct
+ *  log_ratelimit.  Once a message passes after others were suppressed,
+ *  the number of suppressed messages is logged first.
+ */
+#define LOGP_RATELIMIT(ss, level, rate, burst, fmt, args...) \
+	do { \
+		static struct log_ratelimit _log_rl; \
+		if (!log_cache_drops(ss, level) && log_check_level(ss, level) && \
+		    log_ratelimit_check(&_log_rl, rate, burst, ss, level, __BASE_FILE__, __LINE__)) \
+			logp2(ss, level, __BASE_FILE__, __LINE__, 0, fmt, ##args); \
+	} while(0)
+
 /*! different log levels */
 #define LOGL_DEBUG	1	/*!< debugging information */
 #define LOGL_INFO	3	/*!< general information */
@@ -219,6 +239,8 @@ enum log_target_type {
 	LOG_TGT_TYPE_STDERR,	/*!< stderr logging */
 	LOG_TGT_TYPE_STRRB,	/*!< osmo_strrb-backed logging */
 	LOG_TGT_TYPE_GSMTAP,	/*!< GSMTAP network logging */
+	LOG_TGT_TYPE_BINARY,	/*!< binary file logging */
+	LOG_TGT_TYPE_RB_FILE,	/*!< memory-mapped ring buffer file */
 };
 
 /*! Whether/how to log the source filename (and line number). */
@@ -280,6 +302,21 @@ struct log_target {
 			const char *ident;
 			const char *hostname;
 		} tgt_gsmtap;
+
+		/* starts like tgt_file, see log_target_file_reopen() */
+		struct {
+			FILE *out;
+			const char *fname;
+			struct log_bin_state *state;
+			/* write file header and categories before the next event */
+			bool restart;
+		} tgt_binary;
+
+		struct {
+			struct log_rb_file_hdr *hdr;
+			const char *fname;
+			size_t map_len;
+		} tgt_rb_file;
 	};
 
 	/*! call-back function to be called when the logging framework
@@ -313,6 +350,25 @@ struct log_target {
 	bool print_category_hex;
 	/* Should we print the source file and line, and in which way? */
 	enum log_filename_type print_filename2;
+
+	/* Suppression of repeated lines, see log_set_dedup_window() */
+	struct {
+		/* window in milliseconds, 0 if disabled */
+		unsigned int window_ms;
+		/* hash of the last line written, without its timestamp */
+		uint64_t hash;
+		/* CLOCK_MONOTONIC time in milliseconds it was written */
+		uint64_t since_ms;
+		/* its source, to report the suppressed lines */
+		unsigned int subsys;
+		unsigned int level;
+		const char *file;
+		int line;
+		/* number of identical lines suppressed since */
+		unsigned int count;
+		/* the last line was suppressed, and so are its continuations */
+		bool dropping;
+	} dedup;
 };
 
 /* use the above macros */
@@ -322,6 +378,40 @@ void logp2(int subsys, unsigned int level, const char *file,
 int log_init(const struct log_info *inf, void *talloc_ctx);
 void log_fini(void);
 int log_check_level(int subsys, unsigned int level);
+void log_cache_update(void);
+
+/*! State of a rate-limited log statement, see LOGP_RATELIMIT() */
+struct log_ratelimit {
+	/*! CLOCK_MONOTONIC time in microseconds at which the bucket is full */
+	uint64_t full_us;
+	/*! number of messages suppressed since the last one logged */
+	unsigned int suppressed;
+};
+
+bool log_ratelimit_check(struct log_ratelimit *rl, unsigned int rate, unsigned int burst,
+			 int subsys, unsigned int level, const char *file, int line);
+
+/*! Lowest level logged by any target, indexed by sub-system + \ref OSMO_NUM_DLIB */
+extern const uint8_t *osmo_log_level_cache;
+/*! Number of entries in \ref osmo_log_level_cache */
+extern unsigned int osmo_log_level_cache_len;
+
+/*! Check whether no log target wants a log entry, without a function call
+ *  \param[in] subsys logging sub-system
+ *  \param[in] level log level
+ *  \returns true if the entry is certainly dropped; false if it might get
+ *  logged, in which case log_check_level() has the final word
+ *
+ *  Used by the LOGP macros so that disabled log statements cost one array
+ *  load.  Out-of-range sub-systems are left to log_check_level(). */
+static inline bool log_cache_drops(int subsys, unsigned int level)
+{
+	unsigned int idx = subsys + OSMO_NUM_DLIB;
+
+	if (!osmo_log_level_cache || idx >= osmo_log_level_cache_len)
+		return false;
+	return level < osmo_log_level_cache[idx];
+}
 
 /* context management */
 void log_reset_context(void);
@@ -338,6 +428,7 @@ void log_set_print_filename2(struct log_target *target, enum log_filename_type l
 void log_set_print_category(struct log_target *target, int);
 void log_set_print_category_hex(struct log_target *target, int);
 void log_set_print_level(struct log_target *target, int);
+void log_set_dedup_window(struct log_target *target, unsigned int window_ms);
 void log_set_log_level(struct log_target *target, int log_level);
 void log_parse_category_mask(struct log_target *target, const char* mask);
 const char* log_category_name(int subsys);
@@ -364,6 +455,11 @@ int log_targets_reopen(void);
 void log_add_target(struct log_target *target);
 void log_del_target(struct log_target *target);
 
+int log_async_start(unsigned int num_lines);
+void log_async_stop(void);
+void log_async_flush(void);
+unsigned long log_async_dropped(void);
+
 /* Generate command string for VTY use */
 const char *log_vty_command_string() OSMO_DEPRECATED_OUTSIDE_LIBOSMOCORE;
 const char *log_vty_command_description() OSMO_DEPRECATED_OUTSIDE_LIBOSMOCORE;
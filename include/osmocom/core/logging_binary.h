@@ -0,0 +1,128 @@
+/*! \file logging_binary.h
+ * Binary log file format, see log_target_create_binary() */
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#pragma once
+
+/*! \addtogroup logging
+ *  @{
+ * \file logging_binary.h */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <osmocom/core/logging.h>
+
+/*! A binary log file starts with struct log_bin_file_hdr, followed by any
+ *  number of records, each consisting of struct log_bin_rec_hdr and a
+ *  payload of type \ref log_bin_rec_type.  All values are in the byte
+ *  order of the writer, see log_bin_file_hdr.byte_order.
+ *
+ *  Instead of a formatted string, each logged event references the log
+ *  statement (source file, line and format string) by an id defined by a
+ *  preceding LOG_BIN_REC_SITE record, and carries the raw arguments of the
+ *  format string.  For each conversion of the format string, in order:
+ *  - a '*' field width or precision: int32_t
+ *  - d, i, o, u, x, X, c: int64_t (sign-extended for d and i)
+ *  - e, E, f, F, g, G, a, A: double
+ *  - p: uint64_t
+ *  - s, m: uint16_t length and as many characters, without terminating NUL
+ *  - n, %: nothing
+ *  Format strings with other conversions are logged as formatted text,
+ *  referencing a site with format string "%s".
+ */
+
+#define LOG_BIN_MAGIC		"OSMOLOGB"
+#define LOG_BIN_VERSION		1
+#define LOG_BIN_BYTE_ORDER	0x0102
+
+/*! Header at the start of a binary log file */
+struct log_bin_file_hdr {
+	char magic[8];		/*!< \ref LOG_BIN_MAGIC, not NUL-terminated */
+	uint16_t version;	/*!< \ref LOG_BIN_VERSION */
+	uint16_t byte_order;	/*!< \ref LOG_BIN_BYTE_ORDER in the writer's byte order */
+} __attribute__((packed));
+
+/*! Type of a binary log record */
+enum log_bin_rec_type {
+	LOG_BIN_REC_CAT = 1,	/*!< struct log_bin_cat */
+	LOG_BIN_REC_SITE = 2,	/*!< struct log_bin_site */
+	LOG_BIN_REC_LOG = 3,	/*!< struct log_bin_log */
+};
+
+/*! Header of each binary log record */
+struct log_bin_rec_hdr {
+	uint8_t type;		/*!< \ref log_bin_rec_type */
+	uint16_t len;		/*!< length of the payload following this header */
+} __attribute__((packed));
+
+/*! Name of a logging category; written after the file header */
+struct log_bin_cat {
+	uint16_t subsys;	/*!< category index as in \ref log_bin_log */
+	char name[0];		/*!< NUL-terminated category name */
+} __attribute__((packed));
+
+/*! Log statement; written before the first event referencing it */
+struct log_bin_site {
+	uint32_t id;		/*!< id referenced by \ref log_bin_log */
+	uint32_t line;		/*!< source file line */
+	char strings[0];	/*!< NUL-terminated source file name and format string */
+} __attribute__((packed));
+
+/*! the event continues the previous one, see LOGPC() */
+#define LOG_BIN_F_CONT		0x01
+/*! the arguments did not fit into the record and are incomplete */
+#define LOG_BIN_F_TRUNC		0x02
+
+/*! Logged event */
+struct log_bin_log {
+	uint64_t time_us;	/*!< time of the event, microseconds since the epoch */
+	uint32_t site;		/*!< id of the \ref log_bin_site */
+	uint16_t subsys;	/*!< category index */
+	uint8_t level;		/*!< log level */
+	uint8_t flags;		/*!< LOG_BIN_F_* */
+	uint8_t args[0];	/*!< arguments, see above */
+} __attribute__((packed));
+
+/*! Length modifier of a printf conversion */
+enum log_bin_len {
+	LOG_BIN_LEN_NONE,
+	LOG_BIN_LEN_HH,
+	LOG_BIN_LEN_H,
+	LOG_BIN_LEN_L,
+	LOG_BIN_LEN_LL,
+	LOG_BIN_LEN_BIG_L,
+	LOG_BIN_LEN_J,
+	LOG_BIN_LEN_Z,
+	LOG_BIN_LEN_T,
+};
+
+/*! A printf conversion specification, as parsed by log_bin_parse_conv() */
+struct log_bin_conv {
+	const char *flags;	/*!< flags, following the '%' */
+	const char *width;	/*!< field width, following the flags */
+	const char *prec;	/*!< '.' and precision, following the field width */
+	const char *len_mod;	/*!< length modifier, following the precision */
+	bool width_star;	/*!< field width is an int argument */
+	bool prec_star;		/*!< precision is an int argument */
+	enum log_bin_len len;	/*!< length modifier */
+	char conv;		/*!< conversion character */
+};
+
+const char *log_bin_parse_conv(const char *fmt, struct log_bin_conv *conv);
+
+struct log_target *log_target_create_binary(const char *fname);
+
+/*! @} */
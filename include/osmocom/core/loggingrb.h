@@ -23,6 +23,8 @@
  *  @{
  * \file loggingrb.h */
 
+#include <stdint.h>
+
 struct log_info;
 
 size_t log_target_rb_used_size(struct log_target const *target);
@@ -30,4 +32,36 @@ size_t log_target_rb_avail_size(struct log_target const *target);
 const char *log_target_rb_get(struct log_target const *target, size_t logindex);
 struct log_target *log_target_create_rb(size_t size);
 
+#define LOG_RB_FILE_MAGIC	"OSMOLRBF"
+#define LOG_RB_FILE_VERSION	1
+/*! default size of a slot of a ring buffer file, including its header */
+#define LOG_RB_FILE_SLOT_SIZE	256
+
+/*! Header at the start of a ring buffer file, see log_target_create_rb_file().
+ *  The slots follow at offset hdr_len.  All values are in host byte order. */
+struct log_rb_file_hdr {
+	char magic[8];		/*!< \ref LOG_RB_FILE_MAGIC, not NUL-terminated */
+	uint32_t version;	/*!< \ref LOG_RB_FILE_VERSION */
+	uint32_t hdr_len;	/*!< offset of the first slot */
+	uint32_t slot_size;	/*!< size of each slot, including struct log_rb_file_slot */
+	uint32_t num_slots;	/*!< number of slots, a power of two */
+	uint64_t head;		/*!< number of slots ever written; the next one goes
+				     to slot head % num_slots */
+};
+
+/*! Header of each slot of a ring buffer file */
+struct log_rb_file_slot {
+	/*! 1 + the value of head the slot was written for, once the slot is
+	 *  complete; 0 while it is being written */
+	uint64_t seq;
+	uint64_t time_us;	/*!< time of the log line, microseconds since the epoch */
+	uint16_t len;		/*!< length of text, without terminating NUL */
+	uint8_t level;		/*!< log level */
+	uint8_t pad[5];
+	char text[0];		/*!< formatted log line, NUL-terminated */
+};
+
+struct log_target *log_target_create_rb_file(const char *fname, unsigned int num_slots,
+					     unsigned int slot_size);
+
 /*! @} */
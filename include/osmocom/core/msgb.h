@@ -54,6 +54,13 @@ struct msgb {
 	uint16_t data_len;   /*!< length of underlying data array */
 	uint16_t len;	     /*!< length of bytes used in msgb */
 
+	struct msgb *data_owner; /*!< msgb holding the data area, if not this one (see msgb_clone()) */
+	unsigned int dataref;	 /*!< number of references to the data area of this msgb; 0 if never shared */
+	struct msgb *hdr_claim;	 /*!< clone that claimed the shared headroom */
+	unsigned char *hdr_end;	 /*!< end of the headroom that may be claimed */
+
+	struct msgb *frag_next;	 /*!< next fragment of a chained msgb */
+
 	unsigned char *head;	/*!< start of underlying memory buffer */
 	unsigned char *tail;	/*!< end of message in buffer */
 	unsigned char *data;	/*!< start of message in buffer */
@@ -70,6 +77,14 @@ extern const char *msgb_hexdump(const struct msgb *msg);
 extern int msgb_resize_area(struct msgb *msg, uint8_t *area,
 	int old_size, int new_size);
 extern struct msgb *msgb_copy(const struct msgb *msg, const char *name);
+extern struct msgb *msgb_clone(struct msgb *msg, const char *name);
+extern int msgb_unshare(struct msgb *msg);
+extern int msgb_cow_head(struct msgb *msg);
+extern void msgb_frag_append(struct msgb *msg, struct msgb *frag);
+extern struct msgb *msgb_frag_prepend(struct msgb *msg, struct msgb *hdr);
+extern unsigned int msgb_frag_count(const struct msgb *msg);
+extern unsigned int msgb_chain_len(const struct msgb *msg);
+extern int msgb_linearize(struct msgb *msg);
 static int msgb_test_invariant(const struct msgb *msg) __attribute__((pure));
 
 /*! Free all msgbs from a queue built with msgb_enqueue().
@@ -171,6 +186,19 @@ static inline int msgb_headroom(const struct msgb *msgb)
 	return (msgb->data - msgb->head);
 }
 
+/*! determine whether the data area of a msgb is shared with other msgbs
+ *  \param[in] msg message buffer
+ *  \returns true if \a msg refers to a data area used by a clone as well
+ *
+ * Shared data must not be modified in place; msgb_push() and msgb_put()
+ * take care of that, other writers need to call msgb_unshare() first.
+ */
+static inline bool msgb_shared(const struct msgb *msg)
+{
+	const struct msgb *owner = msg->data_owner ? msg->data_owner : msg;
+	return __atomic_load_n(&owner->dataref, __ATOMIC_RELAXED) > 1;
+}
+
 /*! append data to end of message buffer
  *  \param[in] msgb message buffer
  *  \param[in] len number of bytes to append to message
@@ -189,6 +217,11 @@ static inline unsigned char *msgb_put(struct msgb *msgb, unsigned int len)
 	if (msgb_tailroom(msgb) < (int) len)
 		MSGB_ABORT(msgb, "Not enough tailroom msgb_put (%u < %u)\n",
 			   msgb_tailroom(msgb), len);
+	if (msgb_shared(msgb)) {
+		if (msgb_unshare(msgb) < 0)
+			MSGB_ABORT(msgb, "Unable to unshare msgb_put\n");
+		tmp = msgb->tail;
+	}
 	msgb->tail += len;
 	msgb->len += len;
 	return tmp;
@@ -285,6 +318,8 @@ static inline unsigned char *msgb_push(struct msgb *msgb, unsigned int len)
 	if (msgb_headroom(msgb) < (int) len)
 		MSGB_ABORT(msgb, "Not enough headroom msgb_push (%u < %u)\n",
 			   msgb_headroom(msgb), len);
+	if (msgb_shared(msgb) && msgb_cow_head(msgb) < 0)
+		MSGB_ABORT(msgb, "Unable to unshare msgb_push\n");
 	msgb->data -= len;
 	msgb->len += len;
 	return msgb->data;
@@ -508,6 +543,18 @@ static inline int msgb_test_invariant(const struct msgb *msg)
 uint8_t *msgb_data(const struct msgb *msg);
 
 void *msgb_talloc_ctx_init(void *root_ctx, unsigned int pool_size);
+
+/*! Statistics of the per-thread msgb pool */
+struct msgb_pool_stats {
+	uint64_t hits;		/*!< allocations served from the pool */
+	uint64_t misses;	/*!< allocations that went to talloc */
+	unsigned int cached;	/*!< msgbs currently on the free-lists */
+	unsigned int cached_high; /*!< high-water mark of \a cached */
+};
+
+int msgb_pool_enable(unsigned int max_cached);
+void msgb_pool_disable(void);
+int msgb_pool_get_stats(struct msgb_pool_stats *stats);
 void msgb_set_talloc_ctx(void *ctx) OSMO_DEPRECATED("Use msgb_talloc_ctx_init() instead");
 int msgb_printf(struct msgb *msgb, const char *format, ...);
 
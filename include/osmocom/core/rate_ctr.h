@@ -25,12 +25,18 @@ struct rate_ctr_per_intv {
 	uint64_t rate;		/*!< counter rate */
 };
 
+struct rate_ctr_shards;
+
 /*! data we keep for each actual value */
 struct rate_ctr {
 	uint64_t current;	/*!< current value */
 	uint64_t previous;	/*!< previous value, used for delta */
 	/*! per-interval data */
 	struct rate_ctr_per_intv intv[RATE_CTR_INTV_NUM];
+	/*! per-thread counts, see rate_ctr_group_alloc_sharded(); NULL if not sharded */
+	struct rate_ctr_shards *shards;
+	/*! index of this counter in each per-thread row of \a shards */
+	unsigned int shard_idx;
 };
 
 /*! rate counter description */
@@ -68,6 +74,9 @@ struct rate_ctr_group {
 struct rate_ctr_group *rate_ctr_group_alloc(void *ctx,
 					    const struct rate_ctr_group_desc *desc,
 					    unsigned int idx);
+struct rate_ctr_group *rate_ctr_group_alloc_sharded(void *ctx,
+						    const struct rate_ctr_group_desc *desc,
+						    unsigned int idx, unsigned int num_shards);
 
 static inline void rate_ctr_group_upd_idx(struct rate_ctr_group *grp, unsigned int idx)
 {
@@ -96,6 +105,16 @@ static inline void rate_ctr_inc2(struct rate_ctr_group *ctrg, unsigned int idx)
 	rate_ctr_inc(&ctrg->ctr[idx]);
 }
 
+void rate_ctr_add_sharded(struct rate_ctr *ctr, int inc);
+
+/*! Increment the counter by 1 from any thread
+ *  \param ctr \ref rate_ctr to increment, of a sharded group */
+static inline void rate_ctr_inc_sharded(struct rate_ctr *ctr)
+{
+	rate_ctr_add_sharded(ctr, 1);
+}
+
+uint64_t rate_ctr_get(struct rate_ctr *ctr);
 
 /*! Return the counter difference since the last call to this function */
 int64_t rate_ctr_difference(struct rate_ctr *ctr);
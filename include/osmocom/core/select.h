@@ -35,12 +35,67 @@ struct osmo_fd {
 	void *data;
 	/*! private number, extending \a data */
 	unsigned int priv_nr;
+	/*! fd number registered under, for internal use; only valid
+	 *  while osmo_fd_is_registered() */
+	int reg_fd;
 };
 
+/*! Back-ends available to osmo_select_main() */
+enum osmo_select_backend {
+	/*! classic select(), limited to FD_SETSIZE file descriptors */
+	OSMO_SELECT_BACKEND_SELECT,
+	/*! Linux epoll(), dispatching only file descriptors that are ready.
+	 *  Regular files cannot be used with this back-end. */
+	OSMO_SELECT_BACKEND_EPOLL,
+};
+
+int osmo_select_set_backend(enum osmo_select_backend backend);
+enum osmo_select_backend osmo_select_get_backend(void);
+
+/*! Opaque event loop context, owning a set of osmo_fds and timers.
+ *  Each thread operates on the process-wide default context unless it
+ *  switched to one of its own with osmo_select_ctx_switch(). */
+struct osmo_select_ctx;
+
+struct osmo_select_ctx *osmo_select_ctx_alloc(void *talloc_ctx);
+void osmo_select_ctx_free(struct osmo_select_ctx *ctx);
+struct osmo_select_ctx *osmo_select_ctx_switch(struct osmo_select_ctx *ctx);
+struct osmo_select_ctx *osmo_select_ctx_get(void);
+int osmo_select_main_ctx(struct osmo_select_ctx *ctx, int polling);
+
+int osmo_select_stats_enable(unsigned int slow_us);
+void osmo_select_stats_disable(void);
+
 void osmo_fd_setup(struct osmo_fd *ofd, int fd, unsigned int when,
 		   int (*cb)(struct osmo_fd *fd, unsigned int what),
 		   void *data, unsigned int priv_nr);
 
+void osmo_fd_update_when(struct osmo_fd *ofd, unsigned int when_mask, unsigned int when_set);
+
+/*! Start waiting for an osmo_fd to become readable */
+static inline void osmo_fd_read_enable(struct osmo_fd *ofd)
+{
+	osmo_fd_update_when(ofd, ~0, BSC_FD_READ);
+}
+
+/*! Stop waiting for an osmo_fd to become readable */
+static inline void osmo_fd_read_disable(struct osmo_fd *ofd)
+{
+	osmo_fd_update_when(ofd, ~BSC_FD_READ, 0);
+}
+
+/*! Start waiting for an osmo_fd to become writable */
+static inline void osmo_fd_write_enable(struct osmo_fd *ofd)
+{
+	osmo_fd_update_when(ofd, ~0, BSC_FD_WRITE);
+}
+
+/*! Stop waiting for an osmo_fd to become writable */
+static inline void osmo_fd_write_disable(struct osmo_fd *ofd)
+{
+	osmo_fd_update_when(ofd, ~BSC_FD_WRITE, 0);
+}
+
 bool osmo_fd_is_registered(struct osmo_fd *fd);
 int osmo_fd_register(struct osmo_fd *fd);
 void osmo_fd_unregister(struct osmo_fd *fd);
@@ -12,6 +12,8 @@
 
 struct sockaddr;
 struct osmo_fd;
+struct msgb;
+struct iovec;
 
 /* flags for osmo_sock_init. */
 /*! connect the socket to a remote peer */
@@ -59,4 +61,12 @@ int osmo_sock_mcast_subscribe(int fd, const char *grp_addr);
 
 int osmo_sock_local_ip(char *local_ip, const char *remote_ip);
 
+/*! maximum number of fragments of a msgb sent with one system call */
+#define OSMO_SOCK_MSGB_IOV_MAX	16
+
+int osmo_sock_msgb_iov(const struct msgb *msg, struct iovec *iov, unsigned int iov_len);
+int osmo_sock_writev_msgb(int fd, const struct msgb *msg);
+int osmo_sock_sendto_msgb(int fd, const struct msgb *msg, int flags,
+			  const struct sockaddr *dst, unsigned int dst_len);
+
 /*! @} */
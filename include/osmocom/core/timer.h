@@ -23,9 +23,9 @@
 /*! \defgroup timer Osmocom timers
  * Timer management:
  *      - Create a struct osmo_timer_list
- *      - Fill out timeout and use osmo_timer_add(), or
- *        use osmo_timer_schedule() to schedule a timer in
- *        x seconds and microseconds from now...
+ *      - Fill out timeout (absolute CLOCK_MONOTONIC time) and use
+ *        osmo_timer_add(), or use osmo_timer_schedule() to schedule
+ *        a timer in x seconds and microseconds from now...
  *      - Use osmo_timer_del() to remove the timer
  *
  *  Internally:
@@ -34,6 +34,18 @@
  *        it a 0 to immediately fire after the select
  *      - osmo_timers_update() will call the callbacks and
  *        remove the timers.
+ *      - All timeouts are based on CLOCK_MONOTONIC, so changes of
+ *        the wall-clock time (e.g. by NTP) do not affect timers.
+ *        The timeout is still a struct timeval, but no longer
+ *        comparable to osmo_gettimeofday(); osmo_timer_remaining()
+ *        converts a wall-clock \a now for its callers.
+ *      - For the same reason, osmo_gettimeofday_override no longer
+ *        moves timers; unit tests have to step them with
+ *        osmo_clock_override_enable(CLOCK_MONOTONIC, true) and
+ *        osmo_clock_override_add(CLOCK_MONOTONIC, ...) instead.
+ *      - Timers are kept per \ref osmo_timers_ctx; each thread
+ *        operates on the process-wide default context unless it
+ *        switched to one of its own.
  *  @{
  * \file timer.h */
 
@@ -42,6 +54,7 @@
 #include <sys/time.h>
 #include <time.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <osmocom/core/linuxlist.h>
 #include <osmocom/core/linuxrbtree.h>
@@ -55,13 +68,21 @@
 struct osmo_timer_list {
 	struct rb_node node;	  /*!< rb-tree node header */
 	struct llist_head list;   /*!< internal list header */
-	struct timeval timeout;   /*!< expiration time */
+	struct timeval timeout;   /*!< expiration time (CLOCK_MONOTONIC) */
 	unsigned int active  : 1; /*!< is it active? */
 
 	void (*cb)(void*);	  /*!< call-back called at timeout */
 	void *data;		  /*!< user data for callback */
 };
 
+/*! Data structures available to manage timers */
+enum osmo_timer_backend {
+	/*! red-black tree; O(log n) add/delete, exact expiry */
+	OSMO_TIMER_BACKEND_RBTREE,
+	/*! hierarchical timing wheel; O(1) add/delete, 1ms resolution */
+	OSMO_TIMER_BACKEND_WHEEL,
+};
+
 /*
  * timer management
  */
@@ -86,6 +107,27 @@ struct timeval *osmo_timers_nearest(void);
 void osmo_timers_prepare(void);
 int osmo_timers_update(void);
 int osmo_timers_check(void);
+void osmo_timers_freeze_now(void);
+void osmo_timers_thaw_now(void);
+
+int osmo_timers_set_backend(enum osmo_timer_backend backend);
+enum osmo_timer_backend osmo_timers_get_backend(void);
+void osmo_timers_set_slack(unsigned int permille);
+
+/*! Measurements of osmo_timers_update(), see osmo_timers_set_stats() */
+struct osmo_timers_stats {
+	unsigned int fired;	/*!< number of timers fired */
+	uint64_t late_max_ns;	/*!< largest delay of firing after expiry */
+	uint64_t cb_max_ns;	/*!< longest time spent in a call-back */
+};
+
+void osmo_timers_set_stats(struct osmo_timers_stats *stats);
+
+/*! Opaque state of all timers of one event loop, see osmo_select_ctx */
+struct osmo_timers_ctx;
+struct osmo_timers_ctx *osmo_timers_ctx_alloc(void *talloc_ctx);
+void osmo_timers_ctx_free(struct osmo_timers_ctx *tc);
+struct osmo_timers_ctx *osmo_timers_ctx_switch(struct osmo_timers_ctx *tc);
 
 int osmo_gettimeofday(struct timeval *tv, struct timezone *tz);
 int osmo_clock_gettime(clockid_t clk_id, struct timespec *tp);
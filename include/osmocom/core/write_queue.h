@@ -27,9 +27,14 @@
  *  @{
  * \file write_queue.h */
 
+#include <stdbool.h>
+
 #include <osmocom/core/select.h>
 #include <osmocom/core/msgb.h>
 
+struct osmo_stat_item_group;
+struct rate_ctr_group;
+
 /*! write queue instance */
 struct osmo_wqueue {
 	/*! osmocom file descriptor */
@@ -48,11 +53,42 @@ struct osmo_wqueue {
 	int (*write_cb)(struct osmo_fd *fd, struct msgb *msg);
 	/*! call-back in case qeueue has exceptions. Return -EBADF if fd is freed inside cb. */
 	int (*except_cb)(struct osmo_fd *fd);
+
+	/*! maximum number of msgbs written per writable event, see osmo_wqueue_set_batch() */
+	unsigned int batch_max;
+	/*! whether the fd is a datagram socket (batch mode only) */
+	bool batch_dgram;
+	/*! statistics, see osmo_wqueue_stats_alloc() */
+	struct osmo_stat_item_group *statg;
+
+	/*! maximum number of bytes in the write queue; 0 for no limit */
+	unsigned int max_bytes;
+	/*! current number of bytes in the write queue */
+	unsigned int current_bytes;
+	/*! byte watermarks, see osmo_wqueue_set_watermarks() */
+	unsigned int high_bytes;
+	unsigned int low_bytes;
+	/*! whether the queue is above its high watermark */
+	bool congested;
+	/*! call-back when the queue reaches its high watermark */
+	void (*congested_cb)(struct osmo_wqueue *queue);
+	/*! call-back when the queue drained down to its low watermark */
+	void (*decongested_cb)(struct osmo_wqueue *queue);
+	/*! counters, see osmo_wqueue_stats_alloc() */
+	struct rate_ctr_group *ctrg;
 };
 
+/*! maximum batch size of osmo_wqueue_set_batch() */
+#define OSMO_WQUEUE_BATCH_MAX	64
+
 void osmo_wqueue_init(struct osmo_wqueue *queue, int max_length);
 void osmo_wqueue_clear(struct osmo_wqueue *queue);
 int osmo_wqueue_enqueue(struct osmo_wqueue *queue, struct msgb *data);
 int osmo_wqueue_bfd_cb(struct osmo_fd *fd, unsigned int what);
+int osmo_wqueue_set_watermarks(struct osmo_wqueue *queue, unsigned int high_bytes,
+			       unsigned int low_bytes);
+int osmo_wqueue_set_batch(struct osmo_wqueue *queue, unsigned int batch_max);
+int osmo_wqueue_stats_alloc(struct osmo_wqueue *queue, void *ctx, unsigned int idx);
+void osmo_wqueue_stats_free(struct osmo_wqueue *queue);
 
 /*! @} */
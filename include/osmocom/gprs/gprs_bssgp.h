@@ -3,13 +3,16 @@
 #pragma once
 
 #include <stdint.h>
+#include <osmocom/core/defs.h>
 #include <osmocom/core/timer.h>
 #include <osmocom/core/linuxlist.h>
+#include <osmocom/core/linuxrbtree.h>
 
 #include <osmocom/gsm/gsm48.h>
 #include <osmocom/gsm/prim.h>
 
 #include <osmocom/gprs/protocol/gsm_08_18.h>
+#include <osmocom/gprs/gprs_ns.h>
 
 /* gprs_bssgp_util.c */
 extern struct gprs_ns_inst *bssgp_nsi;
@@ -66,17 +69,25 @@ struct bssgp_flow_control {
 	uint32_t bucket_leak_rate; 	/*!< leak rate of the bucket (octets/sec) */
 
 	uint32_t bucket_counter;	/*!< number of tokens in the bucket */
-	struct timeval time_last_pdu;	/*!< timestamp of last PDU sent */
+	struct timeval time_last_pdu;	/*!< CLOCK_MONOTONIC time of last PDU sent */
 
 	/* the built-in queue */
 	uint32_t max_queue_depth;	/*!< how many packets to queue (mgs) */
 	uint32_t queue_depth;		/*!< current length of queue (msgs) */
 	struct llist_head queue;	/*!< linked list of msgb's */
-	struct osmo_timer_list timer;	/*!< timer-based dequeueing */
+	/*! unused, see sched_node; deleting it does not stop the queue
+	 *  from being served, call bssgp_fc_flush() instead */
+	struct osmo_timer_list timer
+		OSMO_DEPRECATED("unused, call bssgp_fc_flush() before freeing the instance");
 
 	/*! callback to be called at output of flow control */
 	int (*out_cb)(struct bssgp_flow_control *fc, struct msgb *msg,
 			uint32_t llc_pdu_len, void *priv);
+
+	/*! position in the flow control scheduler, which serves the
+	 *  queues of all BVC and MS buckets from a single timer */
+	struct rb_node sched_node;
+	struct timeval sched_time;	/*!< CLOCK_MONOTONIC time the queue is served next */
 };
 
 #define BVC_S_BLOCKED	0x0001
@@ -106,12 +117,19 @@ struct bssgp_bvc_ctx {
 	/* we might want to add this as a shortcut later, avoiding the NSVC
 	 * lookup for every packet, similar to a routing cache */
 	//struct gprs_nsvc *nsvc;
+
+	/* entries in the lookup indexes, see bssgp_bvc_ctx_rehash() */
+	struct hlist_node bvci_nsei_node;
+	struct hlist_node raid_cid_node;
+	/* creation order, newer contexts take precedence on lookup */
+	unsigned int seq;
 };
 extern struct llist_head bssgp_bvc_ctxts;
 /* Find a BTS Context based on parsed RA ID and Cell ID */
 struct bssgp_bvc_ctx *btsctx_by_raid_cid(const struct gprs_ra_id *raid, uint16_t cid);
 /* Find a BTS context based on BVCI+NSEI tuple */
 struct bssgp_bvc_ctx *btsctx_by_bvci_nsei(uint16_t bvci, uint16_t nsei);
+void bssgp_bvc_ctx_rehash(struct bssgp_bvc_ctx *bctx);
 
 #define BVC_F_BLOCKED	0x0001
 
@@ -150,6 +168,18 @@ struct bssgp_dl_ud_par {
 int bssgp_tx_dl_ud(struct msgb *msg, uint16_t pdu_lifetime,
 		   struct bssgp_dl_ud_par *dup);
 
+/*! headroom that bssgp_tx_dl_ud() needs in front of the LLC PDU for the
+ *  BSSGP and NS headers, if \a dup has no MS Radio Access Capability */
+#define BSSGP_DL_UD_HEADROOM	(35 + GPRS_NS_TX_HEADROOM)
+
+/*! headroom that bssgp_tx_dl_ud() needs in front of the LLC PDU
+ *  \param[in] dup parameters the LLC PDU will be sent with
+ *  \returns number of octets */
+static inline unsigned int bssgp_dl_ud_headroom(const struct bssgp_dl_ud_par *dup)
+{
+	return BSSGP_DL_UD_HEADROOM + (dup->ms_ra_cap.len ? dup->ms_ra_cap.len + 3 : 0);
+}
+
 uint16_t bssgp_parse_cell_id(struct gprs_ra_id *raid, const uint8_t *buf);
 int bssgp_create_cell_id(uint8_t *buf, const struct gprs_ra_id *raid,
 			 uint16_t cid);
@@ -190,6 +220,9 @@ struct bssgp_paging_info {
 int bssgp_tx_paging(uint16_t nsei, uint16_t ns_bvci,
 		    struct bssgp_paging_info *pinfo);
 
+/* Initialize a flow control instance.  Its queue is served by a scheduler
+ * shared by all instances, so bssgp_fc_flush() must be called before the
+ * instance is freed. */
 void bssgp_fc_init(struct bssgp_flow_control *fc,
 		   uint32_t bucket_size_max, uint32_t bucket_leak_rate,
 		   uint32_t max_queue_depth,
@@ -202,6 +235,10 @@ void bssgp_fc_init(struct bssgp_flow_control *fc,
 int bssgp_fc_in(struct bssgp_flow_control *fc, struct msgb *msg,
 		uint32_t llc_pdu_len, void *priv);
 
+/* Drop all queued PDUs and remove the instance from the flow control
+ * scheduler; mandatory before freeing a flow control instance */
+void bssgp_fc_flush(struct bssgp_flow_control *fc);
+
 /* Initialize the Flow Control parameters for a new MS according to
  * default values for the BVC specified by BVCI and NSEI */
 int bssgp_fc_ms_init(struct bssgp_flow_control *fc_ms, uint16_t bvci,
@@ -21,6 +21,8 @@ struct libgb_msgb_cb {
 #define LIBGB_MSGB_CB(__msgb)	((struct libgb_msgb_cb *)&((__msgb)->cb[0]))
 #define msgb_tlli(__x)		LIBGB_MSGB_CB(__x)->tlli
 #define msgb_nsei(__x)		LIBGB_MSGB_CB(__x)->nsei
+/* Link Selector Parameter for NS load sharing; for BSSGP this is the TLLI */
+#define msgb_lsp(__x)		msgb_tlli(__x)
 #define msgb_bvci(__x)		LIBGB_MSGB_CB(__x)->bvci
 #define msgb_gmmh(__x)		(__x)->l3h
 #define msgb_bssgph(__x)	LIBGB_MSGB_CB(__x)->bssgph
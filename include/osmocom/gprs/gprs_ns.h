@@ -7,6 +7,7 @@
 /* Our Implementation */
 #include <netinet/in.h>
 #include <osmocom/core/linuxlist.h>
+#include <osmocom/core/hashtable.h>
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/timer.h>
 #include <osmocom/core/select.h>
@@ -29,6 +30,13 @@
 #define NS_ALLOC_SIZE	3072
 #define NS_ALLOC_HEADROOM 20
 
+/*! headroom that gprs_ns_sendmsg() needs in front of the BSSGP PDU for any
+ *  link layer: NS-UNITDATA header (4), FR (2) and GRE (4) encapsulation */
+#define GPRS_NS_TX_HEADROOM	10
+
+/*! maximum number of datagrams received per NS-over-IP read event */
+#define GPRS_NS_RX_BATCH_MAX	64
+
 enum ns_timeout {
 	NS_TOUT_TNS_BLOCK,
 	NS_TOUT_TNS_BLOCK_RETRIES,
@@ -102,6 +110,23 @@ struct gprs_ns_inst {
 		uint32_t local_ip;
 		unsigned int enabled:1;
 	} frgre;
+
+	/*! NS-over-IP batched receive, see gprs_ns_nsip_set_rx_batch() */
+	struct {
+		unsigned int batch_max;
+		/*! msgbs allocated for the next read event */
+		struct msgb *msgs[GPRS_NS_RX_BATCH_MAX];
+		struct osmo_stat_item_group *statg;
+		struct rate_ctr_group *ctrg;
+	} nsip_rx;
+
+	/*! indexes of gprs_nsvcs by NSVCI, NSEI and remote address,
+	 *  see gprs_nsvc_rehash() */
+	DECLARE_HASHTABLE(nsvc_by_nsvci, 10);
+	DECLARE_HASHTABLE(nsvc_by_nsei, 10);
+	DECLARE_HASHTABLE(nsvc_by_addr, 10);
+	/*! creation sequence number of the next NS-VC */
+	unsigned int nsvc_seq;
 };
 
 enum nsvc_timer_mode {
@@ -150,6 +175,13 @@ struct gprs_nsvc {
 			struct sockaddr_in bts_addr;
 		} frgre;
 	};
+
+	/*! entries in the indexes of the NS instance */
+	struct hlist_node nsvci_node;
+	struct hlist_node nsei_node;
+	struct hlist_node addr_node;
+	/*! creation order; lookups prefer the most recently created NS-VC */
+	unsigned int seq;
 };
 
 /* Create a new NS protocol instance */
@@ -163,6 +195,7 @@ void gprs_ns_destroy(struct gprs_ns_inst *nsi);
 
 /* Listen for incoming GPRS packets via NS/UDP */
 int gprs_ns_nsip_listen(struct gprs_ns_inst *nsi);
+int gprs_ns_nsip_set_rx_batch(struct gprs_ns_inst *nsi, unsigned int batch_max);
 
 /* Establish a connection (from the BSS) to the SGSN */
 struct gprs_nsvc *gprs_ns_nsip_connect(struct gprs_ns_inst *nsi,
@@ -174,6 +207,8 @@ struct sockaddr_in;
 
 /* main function for higher layers (BSSGP) to send NS messages */
 int gprs_ns_sendmsg(struct gprs_ns_inst *nsi, struct msgb *msg);
+int gprs_ns_fwd_msgb(struct gprs_ns_inst *nsi, struct msgb *msg,
+		     uint16_t nsei, uint16_t bvci);
 
 int gprs_ns_tx_reset(struct gprs_nsvc *nsvc, uint8_t cause);
 int gprs_ns_tx_block(struct gprs_nsvc *nsvc, uint8_t cause);
@@ -186,6 +221,9 @@ struct gprs_nsvc *gprs_nsvc_create(struct gprs_ns_inst *nsi, uint16_t nsvci);
 void gprs_nsvc_delete(struct gprs_nsvc *nsvc);
 struct gprs_nsvc *gprs_nsvc_by_nsei(struct gprs_ns_inst *nsi, uint16_t nsei);
 struct gprs_nsvc *gprs_nsvc_by_nsvci(struct gprs_ns_inst *nsi, uint16_t nsvci);
+struct gprs_nsvc *gprs_nsvc_by_rem_addr(struct gprs_ns_inst *nsi,
+					const struct sockaddr_in *sin);
+void gprs_nsvc_rehash(struct gprs_nsvc *nsvc);
 
 /* Initiate a RESET procedure (including timer start, ...)*/
 int gprs_nsvc_reset(struct gprs_nsvc *nsvc, uint8_t cause);
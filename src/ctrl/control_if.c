@@ -94,18 +94,48 @@ int ctrl_parse_get_num(vector vline, int i, long *num)
 	return 1;
 }
 
+static struct msgb *ctrl_cmd_make_ipa(struct ctrl_cmd *cmd)
+{
+	struct msgb *msg;
+
+	msg = ctrl_cmd_make(cmd);
+	if (!msg) {
+		LOGP(DLCTRL, LOGL_ERROR, "Could not generate msg\n");
+		return NULL;
+	}
+
+	ipa_prepend_header_ext(msg, IPAC_PROTO_EXT_CTRL);
+	ipa_prepend_header(msg, IPAC_PROTO_OSMO);
+	return msg;
+}
+
 /* Send command to all  */
 int ctrl_cmd_send_to_all(struct ctrl_handle *ctrl, struct ctrl_cmd *cmd)
 {
 	struct ctrl_connection *ccon;
+	struct msgb *msg = NULL, *clone;
 	int ret = 0;
 
 	llist_for_each_entry(ccon, &ctrl->ccon_list, list_entry) {
 		if (ccon == cmd->ccon)
 			continue;
-		if (ctrl_cmd_send(&ccon->write_queue, cmd))
+		/* encode once, every connection gets a clone of the msgb */
+		if (!msg)
+			msg = ctrl_cmd_make_ipa(cmd);
+		clone = msg ? msgb_clone(msg, "CTRL") : NULL;
+		if (!clone) {
 			ret++;
+			continue;
+		}
+		if (osmo_wqueue_enqueue(&ccon->write_queue, clone) != 0) {
+			LOGP(DLCTRL, LOGL_ERROR, "Failed to enqueue the command.\n");
+			msgb_free(clone);
+			ret++;
+		}
 	}
+
+	if (msg)
+		msgb_free(msg);
 	return ret;
 }
 
@@ -114,14 +144,9 @@ int ctrl_cmd_send(struct osmo_wqueue *queue, struct ctrl_cmd *cmd)
 	int ret;
 	struct msgb *msg;
 
-	msg = ctrl_cmd_make(cmd);
-	if (!msg) {
-		LOGP(DLCTRL, LOGL_ERROR, "Could not generate msg\n");
+	msg = ctrl_cmd_make_ipa(cmd);
+	if (!msg)
 		return -1;
-	}
-
-	ipa_prepend_header_ext(msg, IPAC_PROTO_EXT_CTRL);
-	ipa_prepend_header(msg, IPAC_PROTO_OSMO);
 
 	ret = osmo_wqueue_enqueue(queue, msg);
 	if (ret != 0) {
@@ -435,12 +460,12 @@ static int control_write_cb(struct osmo_fd *bfd, struct msgb *msg)
 	queue = container_of(bfd, struct osmo_wqueue, bfd);
 	ccon = container_of(queue, struct ctrl_connection, write_queue);
 
-	rc = write(bfd->fd, msg->data, msg->len);
+	rc = osmo_sock_writev_msgb(bfd->fd, msg);
 	if (rc == 0) {
 		control_close_conn(ccon);
 		return -EBADF;
 	}
-	if (rc != msg->len)
+	if (rc != msgb_chain_len(msg))
 		LOGP(DLCTRL, LOGL_ERROR, "Failed to write message to the CTRL connection.\n");
 
 	return 0;
@@ -523,7 +548,7 @@ static int listen_fd_cb(struct osmo_fd *listen_bfd, unsigned int what)
 	return ret;
 }
 
-static uint64_t get_rate_ctr_value(const struct rate_ctr *ctr, int intv, const char *grp)
+static uint64_t get_rate_ctr_value(struct rate_ctr *ctr, int intv, const char *grp)
 {
 	if (intv >= RATE_CTR_INTV_NUM) {
 		LOGP(DLCTRL, LOGL_ERROR, "Unexpected interval value %d while trying to get rate counter value in %s\n",
@@ -533,13 +558,13 @@ static uint64_t get_rate_ctr_value(const struct rate_ctr *ctr, int intv, const c
 
 	/* Absolute value */
 	if (intv == -1) {
-		return  ctr->current;
+		return rate_ctr_get(ctr);
 	} else {
 		return ctr->intv[intv].rate;
 	}
 }
 
-static int get_rate_ctr_group_idx(const struct rate_ctr_group *ctrg, int intv, struct ctrl_cmd *cmd)
+static int get_rate_ctr_group_idx(struct rate_ctr_group *ctrg, int intv, struct ctrl_cmd *cmd)
 {
 	unsigned int i;
 	for (i = 0; i < ctrg->desc->num_ctr; i++) {
@@ -650,7 +675,9 @@ static int get_rate_ctr(struct ctrl_cmd *cmd, void *data)
 
 	talloc_free(dup);
 
-	cmd->reply = talloc_asprintf(cmd, "%"PRIu64, get_rate_ctr_value(ctr, intv, ctrg->desc->group_name_prefix));
+	/* the counter of the (non-const) group, which may need collecting */
+	cmd->reply = talloc_asprintf(cmd, "%"PRIu64, get_rate_ctr_value(&ctrg->ctr[ctr - ctrg->ctr], intv,
+									 ctrg->desc->group_name_prefix));
 	if (!cmd->reply)
 		goto oom;
 
@@ -27,6 +27,7 @@
 
 #include <errno.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/byteswap.h>
@@ -35,6 +36,8 @@
 #include <osmocom/core/talloc.h>
 #include <osmocom/core/rate_ctr.h>
 #include <osmocom/core/stats.h>
+#include <osmocom/core/stat_item.h>
+#include <osmocom/core/hashtable.h>
 
 #include <osmocom/gprs/gprs_bssgp.h>
 #include <osmocom/gprs/gprs_bssgp_bss.h>
@@ -64,20 +67,88 @@ static const struct rate_ctr_group_desc bssgp_ctrg_desc = {
 
 LLIST_HEAD(bssgp_bvc_ctxts);
 
+/* The BVC contexts are kept in bssgp_bvc_ctxts for iteration, and are
+ * additionally indexed by BVCI+NSEI and by RA ID+Cell ID in hash tables.
+ * Contexts may share a key (e.g. before the first BVC-RESET all cells
+ * have an all-zero RA ID); like the list traversal this replaces,
+ * lookups then return the most recently created one, which takes a walk
+ * of the whole hash chain.  The tables are sized for tens of thousands
+ * of BVCs; as static arrays, only the buckets in use take up memory. */
+static DECLARE_HASHTABLE(bvc_by_bvci_nsei, 16);
+static DECLARE_HASHTABLE(bvc_by_raid_cid, 16);
+static unsigned int bvc_seq;
+
+static inline uint32_t bvc_bvci_nsei_key(uint16_t bvci, uint16_t nsei)
+{
+	return ((uint32_t)nsei << 16) | bvci;
+}
+
+static inline uint64_t bvc_raid_cid_key(const struct gprs_ra_id *raid, uint16_t cid)
+{
+	return ((uint64_t)raid->mcc << 48) ^ ((uint64_t)raid->mnc << 36) ^
+	       ((uint64_t)raid->lac << 24) ^ ((uint64_t)raid->rac << 16) ^ cid;
+}
+
+static void bvc_hash(struct bssgp_bvc_ctx *bctx)
+{
+	hash_add(bvc_by_bvci_nsei, &bctx->bvci_nsei_node,
+		 bvc_bvci_nsei_key(bctx->bvci, bctx->nsei));
+	hash_add(bvc_by_raid_cid, &bctx->raid_cid_node,
+		 bvc_raid_cid_key(&bctx->ra_id, bctx->cell_id));
+}
+
+static void bvc_unhash(struct bssgp_bvc_ctx *bctx)
+{
+	hash_del(&bctx->bvci_nsei_node);
+	hash_del(&bctx->raid_cid_node);
+}
+
+/*! Update the lookup indexes after changing a BVC context's keys
+ *  \param[in] bctx BVC context whose bvci, nsei, ra_id or cell_id was changed
+ *
+ *  The BSSGP code calls this itself; users that modify these fields of a
+ *  BVC context directly have to call it afterwards, otherwise
+ *  btsctx_by_bvci_nsei() and btsctx_by_raid_cid() will not find the
+ *  context under its new keys.
+ */
+void bssgp_bvc_ctx_rehash(struct bssgp_bvc_ctx *bctx)
+{
+	if (!hash_hashed(&bctx->bvci_nsei_node))
+		return;
+
+	bvc_unhash(bctx);
+	bvc_hash(bctx);
+}
+
+/* Contexts freed with talloc_free() must not stay reachable */
+static int btsctx_destructor(struct bssgp_bvc_ctx *bctx)
+{
+	bvc_unhash(bctx);
+	/* users used to unlink contexts themselves before freeing them */
+	if (bctx->list.next != LLIST_POISON1 && !llist_empty(&bctx->list))
+		llist_del_init(&bctx->list);
+	if (bctx->fc)
+		bssgp_fc_flush(bctx->fc);
+	if (bctx->ctrg)
+		rate_ctr_group_free(bctx->ctrg);
+	return 0;
+}
+
 static int _bssgp_tx_dl_ud(struct bssgp_flow_control *fc, struct msgb *msg,
 			   uint32_t llc_pdu_len, void *priv);
 
 /* Find a BTS Context based on parsed RA ID and Cell ID */
 struct bssgp_bvc_ctx *btsctx_by_raid_cid(const struct gprs_ra_id *raid, uint16_t cid)
 {
-	struct bssgp_bvc_ctx *bctx;
+	struct bssgp_bvc_ctx *bctx, *found = NULL;
 
-	llist_for_each_entry(bctx, &bssgp_bvc_ctxts, list) {
+	hash_for_each_possible(bvc_by_raid_cid, bctx, raid_cid_node,
+			       bvc_raid_cid_key(raid, cid)) {
 		if (!memcmp(&bctx->ra_id, raid, sizeof(bctx->ra_id)) &&
-		    bctx->cell_id == cid)
-			return bctx;
+		    bctx->cell_id == cid && (!found || bctx->seq > found->seq))
+			found = bctx;
 	}
-	return NULL;
+	return found;
 }
 
 /*! Initiate reset procedure for all PTP BVC on a given NSEI.
@@ -108,13 +179,15 @@ int bssgp_tx_bvc_ptp_reset(uint16_t nsei, enum gprs_bssgp_cause cause)
 /* Find a BTS context based on BVCI+NSEI tuple */
 struct bssgp_bvc_ctx *btsctx_by_bvci_nsei(uint16_t bvci, uint16_t nsei)
 {
-	struct bssgp_bvc_ctx *bctx;
+	struct bssgp_bvc_ctx *bctx, *found = NULL;
 
-	llist_for_each_entry(bctx, &bssgp_bvc_ctxts, list) {
-		if (bctx->nsei == nsei && bctx->bvci == bvci)
-			return bctx;
+	hash_for_each_possible(bvc_by_bvci_nsei, bctx, bvci_nsei_node,
+			       bvc_bvci_nsei_key(bvci, nsei)) {
+		if (bctx->nsei == nsei && bctx->bvci == bvci &&
+		    (!found || bctx->seq > found->seq))
+			found = bctx;
 	}
-	return NULL;
+	return found;
 }
 
 struct bssgp_bvc_ctx *btsctx_alloc(uint16_t bvci, uint16_t nsei)
@@ -133,6 +206,9 @@ struct bssgp_bvc_ctx *btsctx_alloc(uint16_t bvci, uint16_t nsei)
 	bssgp_fc_init(ctx->fc, 100000, 2*1024*1024/8, 30, &_bssgp_tx_dl_ud);
 
 	llist_add(&ctx->list, &bssgp_bvc_ctxts);
+	ctx->seq = bvc_seq++;
+	bvc_hash(ctx);
+	talloc_set_destructor(ctx, btsctx_destructor);
 
 	return ctx;
 }
@@ -284,6 +360,7 @@ static int bssgp_rx_bvc_reset(struct msgb *msg, struct tlv_parsed *tp,
 		/* actually extract RAC / CID */
 		bctx->cell_id = bssgp_parse_cell_id(&bctx->ra_id,
 						TLVP_VAL(tp, BSSGP_IE_CELL_ID));
+		bssgp_bvc_ctx_rehash(bctx);
 		LOGP(DBSSGP, LOGL_NOTICE, "Cell %s CI %u on BVCI %u\n",
 		     osmo_rai_name(&bctx->ra_id), bctx->cell_id, bvci);
 	}
@@ -582,85 +659,302 @@ struct bssgp_fc_queue_element {
 	uint32_t llc_pdu_len;
 	/* private pointer passed to the flow control out_cb function */
 	void *priv;
+	/* time at which the PDU was enqueued */
+	struct timeval enqueued;
+};
+
+/* The queues of all flow control instances (per-BVC and per-MS buckets)
+ * are served by a single scheduler: each instance with PDUs queued sits
+ * in a tree sorted by the time its first PDU is expected to fit into the
+ * bucket, and one timer fires for the earliest of them.  On expiry, all
+ * instances that became due are served in time order, each one sending
+ * as many PDUs as its bucket admits. */
+
+/* maximum number of PDUs sent per scheduler run, so that a burst of
+ * queued PDUs cannot starve the rest of the main loop */
+#define FC_SCHED_BATCH_MAX	256
+/* the bucket level is computed in centiseconds, an earlier retry of a
+ * PDU that did not fit is pointless */
+#define FC_SCHED_MIN_RETRY_MS	10
+
+enum fc_sched_ctr {
+	FC_SCHED_CTR_DELAY_10MS,
+	FC_SCHED_CTR_DELAY_100MS,
+	FC_SCHED_CTR_DELAY_1S,
+	FC_SCHED_CTR_DELAY_10S,
+	FC_SCHED_CTR_DELAY_MORE,
+	FC_SCHED_CTR_IDLE,
+};
+
+static const struct rate_ctr_desc fc_sched_ctr_description[] = {
+	[FC_SCHED_CTR_DELAY_10MS]  = { "delay:10ms",	"PDUs queued for up to 10ms" },
+	[FC_SCHED_CTR_DELAY_100MS] = { "delay:100ms",	"PDUs queued for 10ms to 100ms" },
+	[FC_SCHED_CTR_DELAY_1S]    = { "delay:1s",	"PDUs queued for 100ms to 1s" },
+	[FC_SCHED_CTR_DELAY_10S]   = { "delay:10s",	"PDUs queued for 1s to 10s" },
+	[FC_SCHED_CTR_DELAY_MORE]  = { "delay:more",	"PDUs queued for more than 10s" },
+	[FC_SCHED_CTR_IDLE]        = { "wakeups:idle",	"Queues served without a PDU fitting the bucket" },
+};
+
+static const struct rate_ctr_group_desc fc_sched_ctrg_desc = {
+	.group_name_prefix = "bssgp:fc",
+	.group_description = "BSSGP Flow Control Queueing Statistics",
+	.num_ctr = ARRAY_SIZE(fc_sched_ctr_description),
+	.ctr_desc = fc_sched_ctr_description,
+	.class_id = OSMO_STATS_CLASS_GLOBAL,
+};
+
+enum fc_sched_stat {
+	FC_SCHED_STAT_DELAY,
+	FC_SCHED_STAT_BATCH,
+	FC_SCHED_STAT_QUEUES,
+};
+
+static const struct osmo_stat_item_desc fc_sched_stat_description[] = {
+	[FC_SCHED_STAT_DELAY] = { "queue.delay", "Time PDUs spent queued", "ms", 16, 0 },
+	[FC_SCHED_STAT_BATCH] = { "batch.size", "PDUs sent per scheduler run", OSMO_STAT_ITEM_NO_UNIT, 16, 0 },
+	[FC_SCHED_STAT_QUEUES] = { "queues", "Flow control queues holding PDUs", OSMO_STAT_ITEM_NO_UNIT, 16, 0 },
+};
+
+static const struct osmo_stat_item_group_desc fc_sched_statg_desc = {
+	.group_name_prefix = "bssgp.fc",
+	.group_description = "BSSGP Flow Control Queueing Statistics",
+	.num_items = ARRAY_SIZE(fc_sched_stat_description),
+	.item_desc = fc_sched_stat_description,
+	.class_id = OSMO_STATS_CLASS_GLOBAL,
+};
+
+static struct {
+	struct rb_root tree;
+	struct osmo_timer_list timer;
+	unsigned int num_queues;
+	struct rate_ctr_group *ctrg;
+	struct osmo_stat_item_group *statg;
+} fc_sched = {
+	.tree = RB_ROOT,
 };
 
-static int fc_queue_timer_cfg(struct bssgp_flow_control *fc);
 static int bssgp_fc_needs_queueing(struct bssgp_flow_control *fc, uint32_t pdu_len);
+static void fc_sched_timer_cb(void *data);
 
-static void fc_timer_cb(void *data)
+/* flow control runs on the monotonic clock, like the timers: stepping the
+ * wall clock must neither stall the queues nor serve them out of order */
+static void fc_gettime(struct timeval *tv)
 {
-	struct bssgp_flow_control *fc = data;
-	struct bssgp_fc_queue_element *fcqe;
-	struct timeval time_now;
+	struct timespec ts;
 
-	/* if the queue is empty, we return without sending something
-	 * and without re-starting the timer */
-	if (llist_empty(&fc->queue))
-		return;
+	osmo_clock_gettime(CLOCK_MONOTONIC, &ts);
+	tv->tv_sec = ts.tv_sec;
+	tv->tv_usec = ts.tv_nsec / 1000;
+}
 
-	/* get the first entry from the queue */
-	fcqe = llist_entry(fc->queue.next, struct bssgp_fc_queue_element,
-			   list);
+static void fc_sched_arm(const struct timeval *now)
+{
+	struct bssgp_flow_control *fc;
+	struct timeval delay;
+	struct rb_node *node;
 
-	if (bssgp_fc_needs_queueing(fc, fcqe->llc_pdu_len)) {
-		LOGP(DBSSGP, LOGL_NOTICE, "BSSGP-FC: fc_timer_cb() but still "
-			"not able to send PDU of %u bytes\n", fcqe->llc_pdu_len);
-		/* make sure we re-start the timer */
-		fc_queue_timer_cfg(fc);
+	node = rb_first(&fc_sched.tree);
+	if (!node) {
+		osmo_timer_del(&fc_sched.timer);
 		return;
 	}
 
-	/* remove from the queue */
-	llist_del(&fcqe->list);
-
-	fc->queue_depth--;
+	fc = rb_entry(node, struct bssgp_flow_control, sched_node);
+	if (timercmp(&fc->sched_time, now, >))
+		timersub(&fc->sched_time, now, &delay);
+	else
+		timerclear(&delay);
 
-	/* record the time we transmitted this PDU */
-	osmo_gettimeofday(&time_now, NULL);
-	fc->time_last_pdu = time_now;
+	osmo_timer_setup(&fc_sched.timer, fc_sched_timer_cb, NULL);
+	osmo_timer_schedule(&fc_sched.timer, delay.tv_sec, delay.tv_usec);
+}
 
-	/* call the output callback for this FC instance */
-	fc->out_cb(fcqe->priv, fcqe->msg, fcqe->llc_pdu_len, NULL);
+static void fc_sched_del(struct bssgp_flow_control *fc)
+{
+	if (RB_EMPTY_NODE(&fc->sched_node))
+		return;
 
-	/* we expect that out_cb will in the end free the msgb once
-	 * it is no longer needed */
+	rb_erase(&fc->sched_node, &fc_sched.tree);
+	RB_CLEAR_NODE(&fc->sched_node);
+	fc_sched.num_queues--;
+}
 
-	/* but we have to free the queue element ourselves */
-	talloc_free(fcqe);
+/* (re-)schedule the queue of a flow control instance to be served in
+ * msecs; instances with the same time are served in insertion order */
+static void fc_sched_add(struct bssgp_flow_control *fc, const struct timeval *now,
+			 uint32_t msecs)
+{
+	struct rb_node **new, *parent = NULL;
+	struct bssgp_flow_control *this;
+	struct timeval delay;
+
+	fc_sched_del(fc);
+
+	delay.tv_sec = msecs / 1000;
+	delay.tv_usec = (msecs % 1000) * 1000;
+	timeradd(now, &delay, &fc->sched_time);
+
+	new = &fc_sched.tree.rb_node;
+	while (*new) {
+		this = rb_entry(*new, struct bssgp_flow_control, sched_node);
+		parent = *new;
+		if (timercmp(&fc->sched_time, &this->sched_time, <))
+			new = &((*new)->rb_left);
+		else
+			new = &((*new)->rb_right);
+	}
+	rb_link_node(&fc->sched_node, parent, new);
+	rb_insert_color(&fc->sched_node, &fc_sched.tree);
+	fc_sched.num_queues++;
 
-	/* re-configure the timer for the next PDU */
-	fc_queue_timer_cfg(fc);
+	if (rb_first(&fc_sched.tree) == &fc->sched_node)
+		fc_sched_arm(now);
 }
 
-/* configure/schedule the flow control timer to expire once the bucket
- * will have leaked a sufficient number of bytes to transmit the next
- * PDU in the queue */
-static int fc_queue_timer_cfg(struct bssgp_flow_control *fc)
+/* schedule the queue to be served once the bucket will have leaked a
+ * sufficient number of bytes to transmit its first PDU */
+static void fc_queue_sched(struct bssgp_flow_control *fc, const struct timeval *now)
 {
 	struct bssgp_fc_queue_element *fcqe;
+	uint32_t leak_per_csec = fc->bucket_leak_rate / 100;
+	struct timeval due, delay;
+	int64_t excess;
+	uint64_t csecs;
 	uint32_t msecs;
 
-	if (llist_empty(&fc->queue))
-		return 0;
+	if (llist_empty(&fc->queue) || fc->bucket_leak_rate == 0) {
+		/* If the PCU is telling us to not send any more data at all,
+		 * there's no point in scheduling the queue. */
+		fc_sched_del(fc);
+		return;
+	}
 
 	fcqe = llist_entry(fc->queue.next, struct bssgp_fc_queue_element,
 			   list);
 
-	if (fc->bucket_leak_rate != 0) {
-		/* Calculate the point in time at which we will have leaked
-		 * a sufficient number of bytes from the bucket to transmit
-		 * the first PDU in the queue */
-		msecs = (fcqe->llc_pdu_len * 1000) / fc->bucket_leak_rate;
-		/* FIXME: add that time to fc->time_last_pdu and subtract it from
-		 * current time */
-		osmo_timer_setup(&fc->timer, fc_timer_cb, fc);
-		osmo_timer_schedule(&fc->timer, msecs / 1000, (msecs % 1000) * 1000);
-	} else {
-		/* If the PCU is telling us to not send any more data at all,
-		* there's no point starting a timer. */
+	/* the PDU fits once the bucket has leaked the excess octets since
+	 * the last PDU was sent, see bssgp_fc_needs_queueing(); below one
+	 * octet per centisecond it does not leak at all there, so just
+	 * retry after the time it takes to leak the PDU itself */
+	excess = (int64_t)fc->bucket_counter + fcqe->llc_pdu_len - fc->bucket_size_max;
+	if (leak_per_csec) {
+		csecs = excess > 0 ? (excess + leak_per_csec - 1) / leak_per_csec : 0;
+		due.tv_sec = csecs / 100;
+		due.tv_usec = (csecs % 100) * 10000;
+		timeradd(&fc->time_last_pdu, &due, &due);
+		if (timercmp(&due, now, >)) {
+			timersub(&due, now, &delay);
+			msecs = OSMO_MIN(delay.tv_sec, UINT32_MAX / 1000) * 1000 + delay.tv_usec / 1000;
+		} else
+			msecs = 0;
+	} else
+		msecs = ((uint64_t)fcqe->llc_pdu_len * 1000) / fc->bucket_leak_rate;
+	if (msecs < FC_SCHED_MIN_RETRY_MS)
+		msecs = FC_SCHED_MIN_RETRY_MS;
+
+	fc_sched_add(fc, now, msecs);
+}
+
+static void fc_count_delay(const struct bssgp_fc_queue_element *fcqe,
+			   const struct timeval *now)
+{
+	struct timeval diff;
+	unsigned long msecs;
+	int idx;
+
+	timersub(now, &fcqe->enqueued, &diff);
+	msecs = diff.tv_sec * 1000 + diff.tv_usec / 1000;
+
+	if (msecs <= 10)
+		idx = FC_SCHED_CTR_DELAY_10MS;
+	else if (msecs <= 100)
+		idx = FC_SCHED_CTR_DELAY_100MS;
+	else if (msecs <= 1000)
+		idx = FC_SCHED_CTR_DELAY_1S;
+	else if (msecs <= 10000)
+		idx = FC_SCHED_CTR_DELAY_10S;
+	else
+		idx = FC_SCHED_CTR_DELAY_MORE;
+
+	rate_ctr_inc(&fc_sched.ctrg->ctr[idx]);
+	osmo_stat_item_set(fc_sched.statg->items[FC_SCHED_STAT_DELAY], msecs);
+}
+
+/* send as many PDUs of the queue as the bucket admits, up to max;
+ * returns the number of PDUs sent */
+static unsigned int fc_queue_serve(struct bssgp_flow_control *fc,
+				   struct timeval *now, unsigned int max)
+{
+	struct bssgp_fc_queue_element *fcqe;
+	unsigned int sent = 0;
+
+	while (sent < max && !llist_empty(&fc->queue)) {
+		/* get the first entry from the queue */
+		fcqe = llist_entry(fc->queue.next, struct bssgp_fc_queue_element,
+				   list);
+
+		if (bssgp_fc_needs_queueing(fc, fcqe->llc_pdu_len))
+			break;
+
+		/* remove from the queue */
+		llist_del(&fcqe->list);
+		fc->queue_depth--;
+
+		/* record the time we transmitted this PDU */
+		fc->time_last_pdu = *now;
+		fc_count_delay(fcqe, now);
+
+		/* call the output callback for this FC instance; we expect
+		 * that out_cb will in the end free the msgb once it is no
+		 * longer needed, but we have to free the queue element
+		 * ourselves */
+		fc->out_cb(fcqe->priv, fcqe->msg, fcqe->llc_pdu_len, NULL);
+		talloc_free(fcqe);
+		sent++;
+
+		/* the call-back may have taken its time */
+		fc_gettime(now);
 	}
 
-	return 0;
+	return sent;
+}
+
+static void fc_sched_timer_cb(void *data)
+{
+	struct bssgp_flow_control *fc;
+	struct timeval now;
+	struct rb_node *node;
+	unsigned int sent, total = 0;
+
+	fc_gettime(&now);
+
+	while ((node = rb_first(&fc_sched.tree))) {
+		fc = rb_entry(node, struct bssgp_flow_control, sched_node);
+		if (timercmp(&fc->sched_time, &now, >))
+			break;
+
+		/* leave the rest for the next main loop iteration */
+		if (total >= FC_SCHED_BATCH_MAX)
+			break;
+
+		fc_sched_del(fc);
+		sent = fc_queue_serve(fc, &now, FC_SCHED_BATCH_MAX - total);
+		if (!sent) {
+			LOGP(DBSSGP, LOGL_DEBUG, "BSSGP-FC: queue due but still "
+			     "not able to send PDU\n");
+			rate_ctr_inc(&fc_sched.ctrg->ctr[FC_SCHED_CTR_IDLE]);
+		}
+		total += sent;
+
+		if (total >= FC_SCHED_BATCH_MAX && !llist_empty(&fc->queue))
+			fc_sched_add(fc, &now, 0);
+		else
+			fc_queue_sched(fc, &now);
+	}
+	fc_sched_arm(&now);
+
+	osmo_stat_item_set(fc_sched.statg->items[FC_SCHED_STAT_BATCH], total);
+	osmo_stat_item_set(fc_sched.statg->items[FC_SCHED_STAT_QUEUES], fc_sched.num_queues);
 }
 
 /* Enqueue a PDU in the flow control queue for delayed transmission */
@@ -672,19 +966,28 @@ static int fc_enqueue(struct bssgp_flow_control *fc, struct msgb *msg,
 	if (fc->queue_depth >= fc->max_queue_depth)
 		return -ENOSPC;
 
+	if (!fc_sched.ctrg)
+		fc_sched.ctrg = rate_ctr_group_alloc(bssgp_tall_ctx, &fc_sched_ctrg_desc, 0);
+	if (!fc_sched.statg)
+		fc_sched.statg = osmo_stat_item_group_alloc(bssgp_tall_ctx, &fc_sched_statg_desc, 0);
+	if (!fc_sched.ctrg || !fc_sched.statg)
+		return -ENOMEM;
+
 	fcqe = talloc_zero(fc, struct bssgp_fc_queue_element);
 	if (!fcqe)
 		return -ENOMEM;
 	fcqe->msg = msg;
 	fcqe->llc_pdu_len = llc_pdu_len;
 	fcqe->priv = priv;
+	fc_gettime(&fcqe->enqueued);
 
 	llist_add_tail(&fcqe->list, &fc->queue);
 
 	fc->queue_depth++;
 
-	/* re-configure the timer for dequeueing the pdu */
-	fc_queue_timer_cfg(fc);
+	/* schedule the queue unless it is waiting for an earlier PDU */
+	if (RB_EMPTY_NODE(&fc->sched_node))
+		fc_queue_sched(fc, &fcqe->enqueued);
 
 	return 0;
 }
@@ -700,7 +1003,7 @@ static int bssgp_fc_needs_queueing(struct bssgp_flow_control *fc, uint32_t pdu_l
 
 	/* compute number of centi-seconds that have elapsed since transmitting
 	 * the last PDU (Tc - Tp) */
-	osmo_gettimeofday(&time_now, NULL);
+	fc_gettime(&time_now);
 	timersub(&time_now, &fc->time_last_pdu, &time_diff);
 	csecs_elapsed = time_diff.tv_sec*100 + time_diff.tv_usec/10000;
 
@@ -756,7 +1059,7 @@ int bssgp_fc_in(struct bssgp_flow_control *fc, struct msgb *msg,
 		return rc;
 	} else {
 		/* record the time we transmitted this PDU */
-		osmo_gettimeofday(&time_now, NULL);
+		fc_gettime(&time_now);
 		fc->time_last_pdu = time_now;
 		return fc->out_cb(priv, msg, llc_pdu_len, NULL);
 	}
@@ -775,7 +1078,29 @@ void bssgp_fc_init(struct bssgp_flow_control *fc,
 	fc->bucket_leak_rate = bucket_leak_rate;
 	fc->max_queue_depth = max_queue_depth;
 	INIT_LLIST_HEAD(&fc->queue);
-	osmo_gettimeofday(&fc->time_last_pdu, NULL);
+	RB_CLEAR_NODE(&fc->sched_node);
+	fc_gettime(&fc->time_last_pdu);
+}
+
+/*! Drop all PDUs queued in a flow control instance
+ *  \param[in] fc flow control instance
+ *
+ *  This removes the instance from the flow control scheduler; it has to
+ *  be called before freeing a flow control instance that may still hold
+ *  queued PDUs.
+ */
+void bssgp_fc_flush(struct bssgp_flow_control *fc)
+{
+	struct bssgp_fc_queue_element *fcqe, *fcqe2;
+
+	fc_sched_del(fc);
+
+	llist_for_each_entry_safe(fcqe, fcqe2, &fc->queue, list) {
+		llist_del(&fcqe->list);
+		msgb_free(fcqe->msg);
+		talloc_free(fcqe);
+	}
+	fc->queue_depth = 0;
 }
 
 /* Initialize the Flow Control parameters for a new MS according to
@@ -801,6 +1126,7 @@ static int bssgp_rx_fc_bvc(struct msgb *msg, struct tlv_parsed *tp,
 {
 	uint32_t old_leak_rate = bctx->fc->bucket_leak_rate;
 	uint32_t old_r_def_ms = bctx->r_default_ms;
+	struct timeval time_now;
 
 	DEBUGP(DBSSGP, "BSSGP BVCI=%u Rx Flow Control BVC\n",
 		bctx->bvci);
@@ -838,8 +1164,9 @@ static int bssgp_rx_fc_bvc(struct msgb *msg, struct tlv_parsed *tp,
 		LOGP(DBSSGP, LOGL_NOTICE, "BSS instructs us to MS default "
 			"bucket leak rate != 0, restarting DL GPRS!\n");
 
-	/* reconfigure the timer for flow control based on new values */
-	fc_queue_timer_cfg(bctx->fc);
+	/* reschedule the queue based on the new values */
+	fc_gettime(&time_now);
+	fc_queue_sched(bctx->fc, &time_now);
 
 	/* Send FLOW_CONTROL_BVC_ACK */
 	return bssgp_tx_fc_bvc_ack(msgb_nsei(msg), *TLVP_VAL(tp, BSSGP_IE_TAG),
@@ -1094,6 +1421,40 @@ int bssgp_rcvmsg(struct msgb *msg)
 	return rc;
 }
 
+/* copy an LLC PDU lacking the headroom bssgp_tx_dl_ud() needs */
+static struct msgb *dl_ud_realloc(struct msgb *msg, unsigned int headroom)
+{
+	struct msgb *new_msg;
+
+	LOGP(DBSSGP, LOGL_INFO, "BSSGP BVCI=%u DL-UD with %d octets headroom "
+	     "instead of %u, copying\n", msgb_bvci(msg), msgb_headroom(msg),
+	     headroom);
+
+	new_msg = msgb_alloc_headroom(headroom + msg->len, headroom, "BSSGP DL-UD");
+	if (!new_msg) {
+		msgb_free(msg);
+		return NULL;
+	}
+	memcpy(msgb_put(new_msg, msg->len), msg->data, msg->len);
+	msgb_nsei(new_msg) = msgb_nsei(msg);
+	msgb_bvci(new_msg) = msgb_bvci(msg);
+	msgb_tlli(new_msg) = msgb_tlli(msg);
+	msgb_free(msg);
+
+	return new_msg;
+}
+
+/*! Transmit a BSSGP DL-UNITDATA PDU
+ *  \param[in] msg LLC PDU, with msgb_nsei(), msgb_bvci() and msgb_tlli() set
+ *  \param[in] pdu_lifetime PDU lifetime in centi-seconds
+ *  \param[in] dup further parameters of the PDU
+ *  \returns 0 on success, negative error code otherwise
+ *
+ *  The BSSGP and NS headers are prepended to the LLC PDU in place.  To
+ *  avoid copying it, \a msg must have bssgp_dl_ud_headroom() octets of
+ *  headroom, e.g. \ref BSSGP_DL_UD_HEADROOM plus the length of the MS
+ *  Radio Access Capability plus 3.  Ownership of \a msg is transferred.
+ */
 int bssgp_tx_dl_ud(struct msgb *msg, uint16_t pdu_lifetime,
 		   struct bssgp_dl_ud_par *dup)
 {
@@ -1125,6 +1486,12 @@ int bssgp_tx_dl_ud(struct msgb *msg, uint16_t pdu_lifetime,
 		return -ENODEV;
 	}
 
+	if (msgb_headroom(msg) < bssgp_dl_ud_headroom(dup)) {
+		msg = dl_ud_realloc(msg, bssgp_dl_ud_headroom(dup));
+		if (!msg)
+			return -ENOMEM;
+	}
+
 	if (msg->len > TVLV_MAX_ONEBYTE)
 		llc_pdu_tlv_hdr_len += 1;
 
@@ -62,10 +62,12 @@
  *
  * \file gprs_ns.c */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -86,6 +88,7 @@
 #include <osmocom/gprs/gprs_ns_frgre.h>
 
 #include "common_vty.h"
+#include "../../config.h"
 
 #define ns_set_state(ns_, st_) ns_set_state_with_log(ns_, st_, false, __BASE_FILE__, __LINE__)
 #define ns_set_remote_state(ns_, st_) ns_set_state_with_log(ns_, st_, true, __BASE_FILE__, __LINE__)
@@ -115,6 +118,8 @@ enum ns_ctr {
 	NS_CTR_INV_NSEI,
 	NS_CTR_LOST_ALIVE,
 	NS_CTR_LOST_RESET,
+	NS_CTR_UD_PKTS_OUT,
+	NS_CTR_UD_BYTES_OUT,
 };
 
 static const struct rate_ctr_desc nsvc_ctr_description[] = {
@@ -130,6 +135,8 @@ static const struct rate_ctr_desc nsvc_ctr_description[] = {
 	{ "inv-nsei",	"NSEI was invalid count    " },
 	{ "lost:alive",	"ALIVE ACK missing count   " },
 	{ "lost:reset",	"RESET ACK missing count   " },
+	{ "unitdata:packets:out", "UNITDATA sent by load sharing" },
+	{ "unitdata:bytes:out", "UNITDATA bytes sent by load sharing" },
 };
 
 static const struct rate_ctr_group_desc nsvc_ctrg_desc = {
@@ -156,6 +163,40 @@ static const struct osmo_stat_item_group_desc nsvc_statg_desc = {
 	.class_id = OSMO_STATS_CLASS_PEER,
 };
 
+enum nsip_rx_ctr {
+	NSIP_RX_CTR_DROP_NOMEM,
+	NSIP_RX_CTR_DROP_TRUNC,
+};
+
+static const struct rate_ctr_desc nsip_rx_ctr_description[] = {
+	[NSIP_RX_CTR_DROP_NOMEM] = { "rx:dropped:nomem", "Datagrams not read, no msgb" },
+	[NSIP_RX_CTR_DROP_TRUNC] = { "rx:dropped:trunc", "Datagrams exceeding a msgb" },
+};
+
+static const struct rate_ctr_group_desc nsip_rx_ctrg_desc = {
+	.group_name_prefix = "ns:nsip",
+	.group_description = "NS-over-IP Receive Statistics",
+	.num_ctr = ARRAY_SIZE(nsip_rx_ctr_description),
+	.ctr_desc = nsip_rx_ctr_description,
+	.class_id = OSMO_STATS_CLASS_GLOBAL,
+};
+
+enum nsip_rx_stat {
+	NSIP_RX_STAT_BATCH,
+};
+
+static const struct osmo_stat_item_desc nsip_rx_stat_description[] = {
+	[NSIP_RX_STAT_BATCH] = { "rx.batch.size", "Datagrams per read event", OSMO_STAT_ITEM_NO_UNIT, 16, 0 },
+};
+
+static const struct osmo_stat_item_group_desc nsip_rx_statg_desc = {
+	.group_name_prefix = "ns.nsip",
+	.group_description = "NS-over-IP Receive Statistics",
+	.num_items = ARRAY_SIZE(nsip_rx_stat_description),
+	.item_desc = nsip_rx_stat_description,
+	.class_id = OSMO_STATS_CLASS_GLOBAL,
+};
+
 const struct value_string gprs_ns_signal_ns_names[] = {
 	{ S_NS_RESET,		"NS-RESET" },
 	{ S_NS_BLOCK,		"NS-BLOCK" },
@@ -199,6 +240,50 @@ static inline void ns_set_state_with_log(struct gprs_nsvc *nsvc, uint32_t state,
 		nsvc->state = state;
 }
 
+/* The NS-VCs of an instance are indexed by NSVCI, NSEI and remote
+ * address in hash tables.  Several NS-VCs may share a key (all NS-VCs of
+ * an NSE, or transiently while one replaces another); like the list
+ * traversal this replaces, lookups then return the most recently
+ * created one. */
+
+static inline uint64_t nsvc_addr_key(const struct sockaddr_in *sin)
+{
+	return ((uint64_t)sin->sin_addr.s_addr << 16) | sin->sin_port;
+}
+
+static void nsvc_hash(struct gprs_nsvc *nsvc)
+{
+	struct gprs_ns_inst *nsi = nsvc->nsi;
+
+	hash_add(nsi->nsvc_by_nsvci, &nsvc->nsvci_node, nsvc->nsvci);
+	hash_add(nsi->nsvc_by_nsei, &nsvc->nsei_node, nsvc->nsei);
+	hash_add(nsi->nsvc_by_addr, &nsvc->addr_node, nsvc_addr_key(&nsvc->ip.bts_addr));
+}
+
+static void nsvc_unhash(struct gprs_nsvc *nsvc)
+{
+	hash_del(&nsvc->nsvci_node);
+	hash_del(&nsvc->nsei_node);
+	hash_del(&nsvc->addr_node);
+}
+
+/*! Update the lookup indexes after changing an NS-VC's keys
+ *  \param[in] nsvc NS-VC whose nsvci, nsei or remote address was changed
+ *
+ *  The NS code calls this itself; users that modify these fields of an
+ *  NS-VC directly have to call it afterwards, otherwise the lookup
+ *  functions will not find the NS-VC under its new keys.
+ */
+void gprs_nsvc_rehash(struct gprs_nsvc *nsvc)
+{
+	/* not part of the instance, like the unknown_nsvc */
+	if (!hash_hashed(&nsvc->nsvci_node))
+		return;
+
+	nsvc_unhash(nsvc);
+	nsvc_hash(nsvc);
+}
+
 /*! Lookup struct gprs_nsvc based on NSVCI
  *  \param[in] nsi NS instance in which to search
  *  \param[in] nsvci NSVCI to be searched
@@ -206,12 +291,12 @@ static inline void ns_set_state_with_log(struct gprs_nsvc *nsvc, uint32_t state,
  */
 struct gprs_nsvc *gprs_nsvc_by_nsvci(struct gprs_ns_inst *nsi, uint16_t nsvci)
 {
-	struct gprs_nsvc *nsvc;
-	llist_for_each_entry(nsvc, &nsi->gprs_nsvcs, list) {
-		if (nsvc->nsvci == nsvci)
-			return nsvc;
+	struct gprs_nsvc *nsvc, *found = NULL;
+	hash_for_each_possible(nsi->nsvc_by_nsvci, nsvc, nsvci_node, nsvci) {
+		if (nsvc->nsvci == nsvci && (!found || nsvc->seq > found->seq))
+			found = nsvc;
 	}
-	return NULL;
+	return found;
 }
 
 /*! Lookup struct gprs_nsvc based on NSEI
@@ -221,40 +306,71 @@ struct gprs_nsvc *gprs_nsvc_by_nsvci(struct gprs_ns_inst *nsi, uint16_t nsvci)
  */
 struct gprs_nsvc *gprs_nsvc_by_nsei(struct gprs_ns_inst *nsi, uint16_t nsei)
 {
-	struct gprs_nsvc *nsvc;
-	llist_for_each_entry(nsvc, &nsi->gprs_nsvcs, list) {
-		if (nsvc->nsei == nsei)
-			return nsvc;
+	struct gprs_nsvc *nsvc, *found = NULL;
+	hash_for_each_possible(nsi->nsvc_by_nsei, nsvc, nsei_node, nsei) {
+		if (nsvc->nsei == nsei && (!found || nsvc->seq > found->seq))
+			found = nsvc;
 	}
-	return NULL;
+	return found;
 }
 
-static struct gprs_nsvc *gprs_active_nsvc_by_nsei(struct gprs_ns_inst *nsi,
-						  uint16_t nsei)
+/* Load sharing function (3GPP TS 48.016 Section 4.2.4): select one of
+ * the unblocked and alive NS-VCs of an NSE for the given Link Selector
+ * Parameter.  Each NS-VC gets a pseudo-random weight derived from the
+ * LSP, the BVCI and its NSVCI, and the highest weight wins (rendezvous
+ * hashing).  This keeps all packets of one LSP on the same NS-VC, and
+ * when an NS-VC becomes (un)available, only the LSPs mapped to it move. */
+static inline uint32_t nsvc_lsp_weight(const struct gprs_nsvc *nsvc, uint16_t bvci, uint32_t lsp)
 {
-	struct gprs_nsvc *nsvc;
-	llist_for_each_entry(nsvc, &nsi->gprs_nsvcs, list) {
-		if (nsvc->nsei == nsei) {
-			if (!(nsvc->state & NSE_S_BLOCKED) &&
-			    nsvc->state & NSE_S_ALIVE)
-				return nsvc;
+	uint64_t x = ((uint64_t)lsp << 32) | ((uint32_t)bvci << 16) | nsvc->nsvci;
+
+	/* MurmurHash3 finalizer: weights of different NS-VCs must not be
+	 * correlated, which a plain multiplicative hash does not ensure */
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+static struct gprs_nsvc *gprs_nsvc_by_lsp(struct gprs_ns_inst *nsi, uint16_t nsei,
+					  uint16_t bvci, uint32_t lsp)
+{
+	struct gprs_nsvc *nsvc, *found = NULL;
+	uint32_t weight, found_weight = 0;
+
+	hash_for_each_possible(nsi->nsvc_by_nsei, nsvc, nsei_node, nsei) {
+		if (nsvc->nsei != nsei || nsvc->state & NSE_S_BLOCKED ||
+		    !(nsvc->state & NSE_S_ALIVE))
+			continue;
+		weight = nsvc_lsp_weight(nsvc, bvci, lsp);
+		if (!found || weight > found_weight ||
+		    (weight == found_weight && nsvc->seq > found->seq)) {
+			found = nsvc;
+			found_weight = weight;
 		}
 	}
-	return NULL;
+	return found;
 }
 
-/* Lookup struct gprs_nsvc based on remote peer socket addr */
-static struct gprs_nsvc *nsvc_by_rem_addr(struct gprs_ns_inst *nsi,
-					  struct sockaddr_in *sin)
+/*! Lookup struct gprs_nsvc based on remote peer socket addr
+ *  \param[in] nsi NS instance in which to search
+ *  \param[in] sin remote IP address and port to be searched
+ *  \returns gprs_nsvc of respective remote address
+ */
+struct gprs_nsvc *gprs_nsvc_by_rem_addr(struct gprs_ns_inst *nsi,
+					const struct sockaddr_in *sin)
 {
-	struct gprs_nsvc *nsvc;
-	llist_for_each_entry(nsvc, &nsi->gprs_nsvcs, list) {
+	struct gprs_nsvc *nsvc, *found = NULL;
+	hash_for_each_possible(nsi->nsvc_by_addr, nsvc, addr_node, nsvc_addr_key(sin)) {
 		if (nsvc->ip.bts_addr.sin_addr.s_addr ==
 					sin->sin_addr.s_addr &&
-		    nsvc->ip.bts_addr.sin_port == sin->sin_port)
-			return nsvc;
+		    nsvc->ip.bts_addr.sin_port == sin->sin_port &&
+		    (!found || nsvc->seq > found->seq))
+			found = nsvc;
 	}
-	return NULL;
+	return found;
 }
 
 static void gprs_ns_timer_cb(void *data);
@@ -276,6 +392,8 @@ struct gprs_nsvc *gprs_nsvc_create(struct gprs_ns_inst *nsi, uint16_t nsvci)
 	nsvc->statg = osmo_stat_item_group_alloc(nsvc, &nsvc_statg_desc, nsvci);
 
 	llist_add(&nsvc->list, &nsi->gprs_nsvcs);
+	nsvc->seq = nsi->nsvc_seq++;
+	nsvc_hash(nsvc);
 
 	return nsvc;
 }
@@ -288,6 +406,7 @@ void gprs_nsvc_delete(struct gprs_nsvc *nsvc)
 	if (osmo_timer_pending(&nsvc->timer))
 		osmo_timer_del(&nsvc->timer);
 	llist_del(&nsvc->list);
+	nsvc_unhash(nsvc);
 	rate_ctr_group_free(nsvc->ctrg);
 	osmo_stat_item_group_free(nsvc->statg);
 	talloc_free(nsvc);
@@ -719,9 +838,10 @@ static int gprs_ns_tx_reset_ack(struct gprs_nsvc *nsvc)
  *  \param[in] nsi NS-instance on which we shall transmit
  *  \param[in] msg struct msgb to be trasnmitted
  *
- * This function obtains the NS-VC by the msgb_nsei(msg) and then checks
- * if the NS-VC is ALIVEV and not BLOCKED.  After that, it adds a NS
- * header for the NS-UNITDATA message type and sends it off.
+ * This function selects one of the ALIVE and not BLOCKED NS-VCs of the
+ * NSE msgb_nsei(msg), based on the Link Selector Parameter msgb_lsp(msg)
+ * and msgb_bvci(msg).  After that, it adds a NS header for the
+ * NS-UNITDATA message type and sends it off.
  *
  * Section 9.2.10: transmit side / NS-UNITDATA-REQUEST primitive 
  */
@@ -731,7 +851,7 @@ int gprs_ns_sendmsg(struct gprs_ns_inst *nsi, struct msgb *msg)
 	struct gprs_ns_hdr *nsh;
 	uint16_t bvci = msgb_bvci(msg);
 
-	nsvc = gprs_active_nsvc_by_nsei(nsi, msgb_nsei(msg));
+	nsvc = gprs_nsvc_by_lsp(nsi, msgb_nsei(msg), bvci, msgb_lsp(msg));
 	if (!nsvc) {
 		int rc;
 		if (gprs_nsvc_by_nsei(nsi, msgb_nsei(msg))) {
@@ -750,22 +870,97 @@ int gprs_ns_sendmsg(struct gprs_ns_inst *nsi, struct msgb *msg)
 	}
 	log_set_context(LOG_CTX_GB_NSVC, nsvc);
 
-	msg->l2h = msgb_push(msg, sizeof(*nsh) + 3);
-	nsh = (struct gprs_ns_hdr *) msg->l2h;
-	if (!nsh) {
+	if (msgb_headroom(msg) < sizeof(*nsh) + 3) {
 		LOGP(DNS, LOGL_ERROR, "Not enough headroom for NS header\n");
 		msgb_free(msg);
 		return -EIO;
 	}
+	msg->l2h = msgb_push(msg, sizeof(*nsh) + 3);
+	nsh = (struct gprs_ns_hdr *) msg->l2h;
 
 	nsh->pdu_type = NS_PDUT_UNITDATA;
 	/* spare octet in data[0] */
 	nsh->data[1] = bvci >> 8;
 	nsh->data[2] = bvci & 0xff;
 
+	rate_ctr_inc(&nsvc->ctrg->ctr[NS_CTR_UD_PKTS_OUT]);
+	rate_ctr_add(&nsvc->ctrg->ctr[NS_CTR_UD_BYTES_OUT], msgb_l2len(msg));
+
 	return gprs_ns_tx(nsvc, msg);
 }
 
+/* copy a PDU lacking headroom, along with the libgb control block */
+static struct msgb *ns_fwd_copy(const struct msgb *msg)
+{
+	struct libgb_msgb_cb *old_cb = LIBGB_MSGB_CB(msg), *new_cb;
+	struct msgb *fwd;
+	ptrdiff_t offs;
+
+	fwd = msgb_alloc_headroom(NS_ALLOC_HEADROOM + msg->len,
+				  NS_ALLOC_HEADROOM, "Gb/NS fwd");
+	if (!fwd)
+		return NULL;
+	memcpy(msgb_put(fwd, msg->len), msg->data, msg->len);
+
+	new_cb = LIBGB_MSGB_CB(fwd);
+	*new_cb = *old_cb;
+	offs = fwd->data - msg->data;
+	new_cb->bssgph = fwd->data;
+	if (old_cb->llch)
+		new_cb->llch = old_cb->llch >= msg->data && old_cb->llch < msg->tail ?
+				old_cb->llch + offs : NULL;
+	if (old_cb->bssgp_cell_id)
+		new_cb->bssgp_cell_id = old_cb->bssgp_cell_id >= msg->data &&
+					old_cb->bssgp_cell_id < msg->tail ?
+					old_cb->bssgp_cell_id + offs : NULL;
+
+	return fwd;
+}
+
+/*! Forward a received BSSGP PDU to another NSE without copying it
+ *  \param[in] nsi NS-instance on which we shall transmit
+ *  \param[in] msg received message, msgb_bssgph() pointing to the BSSGP PDU
+ *  \param[in] nsei NSEI to forward the PDU to
+ *  \param[in] bvci BVCI to forward the PDU to
+ *  \returns see gprs_ns_sendmsg()
+ *
+ * This is meant for a Gb proxy forwarding a PDU from the NS call-back.
+ * Ownership of \a msg stays with the caller, but its data is not copied:
+ * \a msg is pulled up to the BSSGP header and a clone of it is sent, whose
+ * NS header is written in place of the one \a msg was received with.
+ * Afterwards, msg->l2h no longer points to a valid NS header.
+ *
+ * The BSSGP PDU needs \ref GPRS_NS_TX_HEADROOM octets of headroom in front
+ * of it, which every msgb received by the NS code has; otherwise it is
+ * copied after all.  The same holds for forwarding \a msg again while an
+ * earlier clone is still queued for transmission.  The other parts of the
+ * libgb control block (msgb_tlli() etc) are kept.
+ */
+int gprs_ns_fwd_msgb(struct gprs_ns_inst *nsi, struct msgb *msg,
+		     uint16_t nsei, uint16_t bvci)
+{
+	uint8_t *bssgph = msgb_bssgph(msg);
+	struct msgb *fwd;
+
+	if (!bssgph || bssgph < msg->data || bssgph > msg->tail)
+		return -EINVAL;
+
+	/* the NS header becomes headroom, which the clone may claim */
+	msgb_pull(msg, bssgph - msg->data);
+
+	if (msgb_headroom(msg) >= GPRS_NS_TX_HEADROOM)
+		fwd = msgb_clone(msg, "Gb/NS fwd");
+	else
+		fwd = ns_fwd_copy(msg);
+	if (!fwd)
+		return -ENOMEM;
+
+	msgb_nsei(fwd) = nsei;
+	msgb_bvci(fwd) = bvci;
+
+	return gprs_ns_sendmsg(nsi, fwd);
+}
+
 /* Section 9.2.10: receive side */
 static int gprs_ns_rx_unitdata(struct gprs_nsvc *nsvc, struct msgb *msg)
 {
@@ -952,6 +1147,7 @@ static int gprs_ns_rx_reset(struct gprs_nsvc **nsvc, struct msgb *msg)
 		rate_ctr_group_upd_idx((*nsvc)->ctrg, nsvci);
 		osmo_stat_item_group_udp_idx((*nsvc)->statg, nsvci);
 	}
+	gprs_nsvc_rehash(*nsvc);
 
 	/* inform interested parties about the fact that this NSVC
 	 * has received RESET */
@@ -1073,6 +1269,7 @@ static int gprs_ns_rx_reset_ack(struct gprs_nsvc **nsvc, struct msgb *msg)
 		/* NSEI has changed */
 		rate_ctr_inc(&(*nsvc)->ctrg->ctr[NS_CTR_NSEI_CHG]);
 		(*nsvc)->nsei = nsei;
+		gprs_nsvc_rehash(*nsvc);
 	}
 
 	/* Mark NS-VC as blocked and alive */
@@ -1149,7 +1346,7 @@ int gprs_ns_rcvmsg(struct gprs_ns_inst *nsi, struct msgb *msg,
 	int rc = 0;
 
 	/* look up the NSVC based on source address */
-	nsvc = nsvc_by_rem_addr(nsi, saddr);
+	nsvc = gprs_nsvc_by_rem_addr(nsi, saddr);
 
 	if (!nsvc) {
 		struct gprs_nsvc *fallback_nsvc;
@@ -1210,6 +1407,7 @@ void gprs_ns_ll_copy(struct gprs_nsvc *nsvc, struct gprs_nsvc *other)
 	default:
 		break;
 	}
+	gprs_nsvc_rehash(nsvc);
 }
 
 void gprs_ns_ll_clear(struct gprs_nsvc *nsvc)
@@ -1226,6 +1424,7 @@ void gprs_ns_ll_clear(struct gprs_nsvc *nsvc)
 	default:
 		break;
 	}
+	gprs_nsvc_rehash(nsvc);
 }
 
 /*! Create/get NS-VC independently from underlying transport layer
@@ -1340,6 +1539,7 @@ int gprs_ns_vc_create(struct gprs_ns_inst *nsi, struct msgb *msg,
 
 		/* Override old NSEI */
 		existing_nsvc->nsei  = nsei;
+		gprs_nsvc_rehash(existing_nsvc);
 
 		/* Do statistics */
 		rate_ctr_inc(&existing_nsvc->ctrg->ctr[NS_CTR_NSEI_CHG]);
@@ -1464,6 +1664,7 @@ struct gprs_ns_inst *gprs_ns_instantiate(gprs_ns_cb_t *cb, void *ctx)
 	nsi->unknown_nsvc->nsvci_is_valid = 0;
 	llist_del(&nsi->unknown_nsvc->list);
 	INIT_LLIST_HEAD(&nsi->unknown_nsvc->list);
+	nsvc_unhash(nsi->unknown_nsvc);
 
 	return nsi;
 }
@@ -1471,6 +1672,7 @@ struct gprs_ns_inst *gprs_ns_instantiate(gprs_ns_cb_t *cb, void *ctx)
 void gprs_ns_close(struct gprs_ns_inst *nsi)
 {
 	struct gprs_nsvc *nsvc, *nsvc2;
+	unsigned int i;
 
 	gprs_nsvc_delete(nsi->unknown_nsvc);
 
@@ -1484,6 +1686,13 @@ void gprs_ns_close(struct gprs_ns_inst *nsi)
 		osmo_fd_unregister(&nsi->nsip.fd);
 		nsi->nsip.fd.data = NULL;
 	}
+
+	/* keep the configured batch size for a later gprs_ns_nsip_listen(),
+	 * only release the msgbs allocated in advance */
+	for (i = 0; i < GPRS_NS_RX_BATCH_MAX; i++) {
+		msgb_free(nsi->nsip_rx.msgs[i]);
+		nsi->nsip_rx.msgs[i] = NULL;
+	}
 }
 
 /*! Destroy an entire NS instance
@@ -1495,6 +1704,8 @@ void gprs_ns_close(struct gprs_ns_inst *nsi)
 void gprs_ns_destroy(struct gprs_ns_inst *nsi)
 {
 	gprs_ns_close(nsi);
+	/* free the batch receive counters */
+	gprs_ns_nsip_set_rx_batch(nsi, 0);
 	/* free the NSI */
 	talloc_free(nsi);
 }
@@ -1536,12 +1747,97 @@ static struct msgb *read_nsip_msg(struct osmo_fd *bfd, int *error,
 	return msg;
 }
 
+#ifdef HAVE_RECVMMSG
+/* Read up to batch_max NS-over-IP messages with one recvmmsg() and
+ * dispatch them one after the other */
+static int handle_nsip_read_batch(struct gprs_ns_inst *nsi)
+{
+	struct mmsghdr mmsg[GPRS_NS_RX_BATCH_MAX];
+	struct iovec iov[GPRS_NS_RX_BATCH_MAX];
+	struct sockaddr_in saddr[GPRS_NS_RX_BATCH_MAX];
+	struct msgb *msgs[GPRS_NS_RX_BATCH_MAX];
+	struct msgb *msg;
+	unsigned int n;
+	int i, rc;
+
+	/* refill the slots consumed by the previous read event */
+	for (n = 0; n < nsi->nsip_rx.batch_max; n++) {
+		if (!nsi->nsip_rx.msgs[n])
+			nsi->nsip_rx.msgs[n] = gprs_ns_msgb_alloc();
+		if (!nsi->nsip_rx.msgs[n])
+			break;
+		msg = nsi->nsip_rx.msgs[n];
+
+		iov[n].iov_base = msg->data;
+		iov[n].iov_len = msgb_tailroom(msg);
+		memset(&mmsg[n], 0, sizeof(mmsg[n]));
+		mmsg[n].msg_hdr.msg_name = &saddr[n];
+		mmsg[n].msg_hdr.msg_namelen = sizeof(saddr[n]);
+		mmsg[n].msg_hdr.msg_iov = &iov[n];
+		mmsg[n].msg_hdr.msg_iovlen = 1;
+	}
+
+	if (!n) {
+		rate_ctr_inc(&nsi->nsip_rx.ctrg->ctr[NSIP_RX_CTR_DROP_NOMEM]);
+		return -ENOMEM;
+	}
+
+	rc = recvmmsg(nsi->nsip.fd.fd, mmsg, n, MSG_DONTWAIT, NULL);
+	if (rc < 0) {
+		if (errno == EAGAIN)
+			return 0;
+		LOGP(DNS, LOGL_ERROR, "recv error %s during NSIP recv\n",
+			strerror(errno));
+		return -errno;
+	}
+
+	osmo_stat_item_set(nsi->nsip_rx.statg->items[NSIP_RX_STAT_BATCH], rc);
+
+	/* take the received msgbs out of the slots before dispatching, in
+	 * case the user closes the NS instance from a call-back */
+	for (i = 0; i < rc; i++) {
+		msgs[i] = nsi->nsip_rx.msgs[i];
+		nsi->nsip_rx.msgs[i] = NULL;
+	}
+
+	for (i = 0; i < rc; i++) {
+		msg = msgs[i];
+		if (mmsg[i].msg_hdr.msg_flags & MSG_TRUNC) {
+			LOGP(DNS, LOGL_ERROR, "NSIP message from %s:%u exceeds %zu bytes, dropping\n",
+			     inet_ntoa(saddr[i].sin_addr), ntohs(saddr[i].sin_port),
+			     iov[i].iov_len);
+			rate_ctr_inc(&nsi->nsip_rx.ctrg->ctr[NSIP_RX_CTR_DROP_TRUNC]);
+			msgb_free(msg);
+			continue;
+		}
+		if (mmsg[i].msg_len == 0) {
+			msgb_free(msg);
+			continue;
+		}
+
+		msg->l2h = msg->data;
+		msgb_put(msg, mmsg[i].msg_len);
+		gprs_ns_rcvmsg(nsi, msg, &saddr[i], GPRS_NS_LL_UDP);
+		msgb_free(msg);
+	}
+
+	return 0;
+}
+#endif
+
 static int handle_nsip_read(struct osmo_fd *bfd)
 {
 	int error;
 	struct sockaddr_in saddr;
 	struct gprs_ns_inst *nsi = bfd->data;
-	struct msgb *msg = read_nsip_msg(bfd, &error, &saddr);
+	struct msgb *msg;
+
+#ifdef HAVE_RECVMMSG
+	if (nsi->nsip_rx.batch_max > 1)
+		return handle_nsip_read_batch(nsi);
+#endif
+
+	msg = read_nsip_msg(bfd, &error, &saddr);
 
 	if (!msg)
 		return error;
@@ -1565,8 +1861,8 @@ static int nsip_sendmsg(struct gprs_nsvc *nsvc, struct msgb *msg)
 	struct gprs_ns_inst *nsi = nsvc->nsi;
 	struct sockaddr_in *daddr = &nsvc->ip.bts_addr;
 
-	rc = sendto(nsi->nsip.fd.fd, msg->data, msg->len, 0,
-		  (struct sockaddr *)daddr, sizeof(*daddr));
+	rc = osmo_sock_sendto_msgb(nsi->nsip.fd.fd, msg, 0,
+				   (struct sockaddr *)daddr, sizeof(*daddr));
 
 	msgb_free(msg);
 
@@ -1586,6 +1882,73 @@ static int nsip_fd_cb(struct osmo_fd *bfd, unsigned int what)
 	return rc;
 }
 
+/* lowest index of the rx-batch groups not used by another NS instance */
+static unsigned int nsip_rx_unused_idx(void)
+{
+	unsigned int idx = 0;
+
+	while (rate_ctr_get_group_by_name_idx(nsip_rx_ctrg_desc.group_name_prefix, idx) ||
+	       osmo_stat_item_get_group_by_name_idx(nsip_rx_statg_desc.group_name_prefix, idx))
+		idx++;
+	return idx;
+}
+
+/*! Receive several NS/UDP/IP messages per read event
+ *  \param[in] nsi NS protocol instance
+ *  \param[in] batch_max maximum number of datagrams per read event; 0 or 1 to disable
+ *  \returns 0 on success; -EINVAL if \a batch_max is too large; -ENOTSUP; -ENOMEM
+ *
+ *  In batch mode, up to \a batch_max datagrams are read with a single
+ *  recvmmsg() into msgbs allocated in advance, and then passed to
+ *  gprs_ns_rcvmsg() one after the other.  msgbs that were not filled stay
+ *  allocated for the next read event.  The number of datagrams per event
+ *  is reported in the "ns.nsip" stat item group, datagrams that had to be
+ *  dropped are counted in the "ns:nsip" counter group.  Each NS instance
+ *  gets groups of its own, with the lowest index not in use.
+ */
+int gprs_ns_nsip_set_rx_batch(struct gprs_ns_inst *nsi, unsigned int batch_max)
+{
+	unsigned int i;
+
+	if (batch_max > GPRS_NS_RX_BATCH_MAX)
+		return -EINVAL;
+
+	if (batch_max > 1) {
+#ifndef HAVE_RECVMMSG
+		return -ENOTSUP;
+#endif
+		/* both groups are allocated and freed together */
+		if (!nsi->nsip_rx.ctrg) {
+			unsigned int idx = nsip_rx_unused_idx();
+
+			nsi->nsip_rx.statg = osmo_stat_item_group_alloc(nsi, &nsip_rx_statg_desc, idx);
+			nsi->nsip_rx.ctrg = rate_ctr_group_alloc(nsi, &nsip_rx_ctrg_desc, idx);
+		}
+		if (!nsi->nsip_rx.statg || !nsi->nsip_rx.ctrg) {
+			gprs_ns_nsip_set_rx_batch(nsi, 0);
+			return -ENOMEM;
+		}
+	}
+
+	/* release the msgbs of slots no longer in use */
+	for (i = batch_max > 1 ? batch_max : 0; i < GPRS_NS_RX_BATCH_MAX; i++) {
+		msgb_free(nsi->nsip_rx.msgs[i]);
+		nsi->nsip_rx.msgs[i] = NULL;
+	}
+
+	if (batch_max <= 1) {
+		if (nsi->nsip_rx.statg)
+			osmo_stat_item_group_free(nsi->nsip_rx.statg);
+		nsi->nsip_rx.statg = NULL;
+		if (nsi->nsip_rx.ctrg)
+			rate_ctr_group_free(nsi->nsip_rx.ctrg);
+		nsi->nsip_rx.ctrg = NULL;
+	}
+
+	nsi->nsip_rx.batch_max = batch_max;
+	return 0;
+}
+
 /*! Create a listening socket for GPRS NS/UDP/IP
  *  \param[in] nsi NS protocol instance to listen
  *  \returns >=0 (fd) in case of success, negative in case of error
@@ -1689,12 +2052,13 @@ struct gprs_nsvc *gprs_ns_nsip_connect(struct gprs_ns_inst *nsi,
 {
 	struct gprs_nsvc *nsvc;
 
-	nsvc = nsvc_by_rem_addr(nsi, dest);
+	nsvc = gprs_nsvc_by_rem_addr(nsi, dest);
 	if (!nsvc)
 		nsvc = gprs_nsvc_create(nsi, nsvci);
 	nsvc->ip.bts_addr = *dest;
 	nsvc->nsei = nsei;
 	nsvc->remote_end_is_sgsn = 1;
+	gprs_nsvc_rehash(nsvc);
 
 	gprs_nsvc_reset(nsvc, NS_CAUSE_OM_INTERVENTION);
 	return nsvc;
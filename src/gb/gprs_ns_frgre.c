@@ -303,8 +303,8 @@ int gprs_ns_frgre_sendmsg(struct gprs_nsvc *nsvc, struct msgb *msg)
 	greh->flags = 0;
 	greh->ptype = osmo_htons(GRE_PTYPE_FR);
 
-	rc = sendto(nsi->frgre.fd.fd, msg->data, msg->len, 0,
-		  (struct sockaddr *)&daddr, sizeof(daddr));
+	rc = osmo_sock_sendto_msgb(nsi->frgre.fd.fd, msg, 0,
+				   (struct sockaddr *)&daddr, sizeof(daddr));
 
 	msgb_free(msg);
 
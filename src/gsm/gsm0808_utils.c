@@ -921,6 +921,8 @@ static bool same_cell_id_list_entries(const struct gsm0808_cell_id_list2 *a, int
 	struct msgb *msg_a = (void*)buf_a;
 	struct msgb *msg_b = (void*)buf_b;
 
+	memset(msg_a, 0, sizeof(*msg_a));
+	memset(msg_b, 0, sizeof(*msg_b));
 	msg_a->data_len = 32;
 	msg_b->data_len = 32;
 	msgb_reset(msg_a);
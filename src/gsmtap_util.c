@@ -281,10 +281,10 @@ int gsmtap_sendmsg(struct gsmtap_inst *gti, struct msgb *msg)
 		/* try immediate send and return error if any */
 		int rc;
 
-		rc = write(gsmtap_inst_fd(gti), msg->data, msg->len);
+		rc = osmo_sock_writev_msgb(gsmtap_inst_fd(gti), msg);
 		if (rc < 0) {
 			return rc;
-		} else if (rc >= msg->len) {
+		} else if (rc >= msgb_chain_len(msg)) {
 			msgb_free(msg);
 			return 0;
 		} else {
@@ -336,11 +336,11 @@ static int gsmtap_wq_w_cb(struct osmo_fd *ofd, struct msgb *msg)
 {
 	int rc;
 
-	rc = write(ofd->fd, msg->data, msg->len);
+	rc = osmo_sock_writev_msgb(ofd->fd, msg);
 	if (rc < 0) {
 		return rc;
 	}
-	if (rc != msg->len) {
+	if (rc != msgb_chain_len(msg)) {
 		return -EIO;
 	}
 
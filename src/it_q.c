@@ -0,0 +1,305 @@
+/*! \file it_q.c
+ * Lock-free inter-thread queue into an osmo_select_main() loop.
+ *
+ * Any number of threads may post msgbs or closures to an osmo_it_q;
+ * they are processed by the select loop (osmo_select_ctx) the queue was
+ * allocated from.  The queue is a bounded ring of slots, each carrying a
+ * sequence number (the algorithm by Dmitry Vyukov): producers reserve a
+ * slot by advancing 'head' with a compare-and-swap and publish it by
+ * updating the slot's sequence number, so posting never takes a lock.
+ * The consumer is woken up via an eventfd, which is only written to if
+ * no wake-up is pending already.
+ */
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <osmocom/core/it_q.h>
+#include <osmocom/core/select.h>
+#include <osmocom/core/talloc.h>
+
+#include "../config.h"
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+
+/*! \addtogroup it_q
+ *  @{
+ *  Post \ref msgb or call-backs from any thread into a select loop.
+ *
+ * \file it_q.c */
+
+struct it_q_slot {
+	/* equals the ring position if free, position + 1 if filled */
+	size_t seq;
+	/* closure to call; NULL if arg is a msgb */
+	void (*cb)(void *arg);
+	void *arg;
+};
+
+struct osmo_it_q {
+	/* next position to be reserved by a producer */
+	size_t head __attribute__((aligned(64)));
+	/* next position to be consumed; only used by the consumer */
+	size_t tail __attribute__((aligned(64)));
+	/* non-zero while a wake-up is pending in the eventfd */
+	int signalled __attribute__((aligned(64)));
+
+	struct osmo_fd ofd;
+	osmo_it_q_msg_cb_t msg_cb;
+	const char *name;
+	void *data;
+	/* number of slots, a power of two */
+	size_t size;
+	struct it_q_slot *slots;
+};
+
+static void it_q_wakeup(struct osmo_it_q *q)
+{
+	uint64_t one = 1;
+
+	if (__atomic_exchange_n(&q->signalled, 1, __ATOMIC_ACQ_REL))
+		return;
+	/* can only fail if the counter overflows, which means it is
+	 * readable already */
+	if (write(q->ofd.fd, &one, sizeof(one)) < 0)
+		return;
+}
+
+static int it_q_post(struct osmo_it_q *q, void (*cb)(void *arg), void *arg)
+{
+	struct it_q_slot *slot;
+	size_t pos, seq;
+	intptr_t diff;
+
+	pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &q->slots[pos & (q->size - 1)];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0) {
+			/* slot is free, try to reserve it */
+			if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, true,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+			/* pos was updated by the failed exchange */
+		} else if (diff < 0) {
+			/* slot not yet consumed since the last lap */
+			return -ENOSPC;
+		} else
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	}
+
+	slot->cb = cb;
+	slot->arg = arg;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	it_q_wakeup(q);
+	return 0;
+}
+
+/* take the oldest entry out of the ring; consumer only */
+static bool it_q_get(struct osmo_it_q *q, void (**cb)(void *arg), void **arg)
+{
+	struct it_q_slot *slot = &q->slots[q->tail & (q->size - 1)];
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != q->tail + 1)
+		return false;
+
+	*cb = slot->cb;
+	*arg = slot->arg;
+	/* hand the slot back to the producers for the next lap */
+	__atomic_store_n(&slot->seq, q->tail + q->size, __ATOMIC_RELEASE);
+	q->tail++;
+
+	return true;
+}
+
+static int it_q_fd_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	struct osmo_it_q *q = ofd->data;
+	uint64_t val;
+	int rc = 0;
+
+	/* we were woken up either way, so re-arm and drain even if this
+	 * fails; bailing out would leave signalled set for good */
+	if (read(ofd->fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		rc = -errno;
+
+	/* re-arm before draining, so that entries posted from now on
+	 * cause another wake-up; this also makes the entries published
+	 * before the last wake-up visible to us */
+	__atomic_exchange_n(&q->signalled, 0, __ATOMIC_ACQ_REL);
+
+	/* process at most one ring worth per iteration, so that producers
+	 * posting at a high rate cannot starve all other fds and timers */
+	if (osmo_it_q_drain(q, q->size) == q->size)
+		it_q_wakeup(q);
+
+	return rc;
+}
+
+/*! Allocate an inter-thread queue and register it with the select loop
+ *  \param[in] ctx talloc context to allocate from
+ *  \param[in] name human-readable name of the queue
+ *  \param[in] size number of entries the queue can hold; rounded up to a power of two
+ *  \param[in] msg_cb call-back for msgbs posted with osmo_it_q_enqueue()
+ *  \param[in] data opaque user data, see osmo_it_q_data()
+ *  \returns newly allocated queue; NULL on error
+ *
+ *  The queue is registered with the \ref osmo_select_ctx of the calling
+ *  thread, which is the only one that processes entries of this queue.
+ */
+struct osmo_it_q *osmo_it_q_alloc(void *ctx, const char *name,
+				  unsigned int size, osmo_it_q_msg_cb_t msg_cb,
+				  void *data)
+{
+	struct osmo_it_q *q;
+	size_t i;
+	int fd;
+
+	if (!size)
+		return NULL;
+
+	q = talloc_zero(ctx, struct osmo_it_q);
+	if (!q)
+		return NULL;
+
+	q->size = 1;
+	while (q->size < size)
+		q->size <<= 1;
+	q->slots = talloc_zero_array(q, struct it_q_slot, q->size);
+	if (!q->slots)
+		goto out_free;
+	for (i = 0; i < q->size; i++)
+		q->slots[i].seq = i;
+
+	q->name = talloc_strdup(q, name);
+	q->msg_cb = msg_cb;
+	q->data = data;
+
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd < 0)
+		goto out_free;
+	osmo_fd_setup(&q->ofd, fd, BSC_FD_READ, it_q_fd_cb, q, 0);
+	if (osmo_fd_register(&q->ofd) < 0) {
+		close(fd);
+		goto out_free;
+	}
+
+	return q;
+
+out_free:
+	talloc_free(q);
+	return NULL;
+}
+
+/*! Unregister and free an inter-thread queue
+ *  \param[in] q queue to be freed
+ *
+ *  Must be called from the thread running the queue's select loop, and
+ *  only after all producers stopped posting.  msgbs still queued are
+ *  freed; pending call-backs are discarded without being called.
+ */
+void osmo_it_q_free(struct osmo_it_q *q)
+{
+	void (*cb)(void *arg);
+	void *arg;
+
+	osmo_fd_close(&q->ofd);
+	while (it_q_get(q, &cb, &arg)) {
+		if (!cb)
+			msgb_free(arg);
+	}
+	talloc_free(q);
+}
+
+/*! Post a msgb to the queue; may be called from any thread
+ *  \param[in] q queue to post to
+ *  \param[in] msg message buffer, handed to the queue's msg_cb
+ *  \returns 0 on success; -ENOSPC if the queue is full
+ *
+ *  Ownership of \a msg passes to the queue on success only.
+ */
+int osmo_it_q_enqueue(struct osmo_it_q *q, struct msgb *msg)
+{
+	return it_q_post(q, NULL, msg);
+}
+
+/*! Post a call-back to the queue; may be called from any thread
+ *  \param[in] q queue to post to
+ *  \param[in] cb function to be called from the queue's select loop
+ *  \param[in] arg argument passed to \a cb
+ *  \returns 0 on success; -ENOSPC if the queue is full; -EINVAL without \a cb
+ */
+int osmo_it_q_call(struct osmo_it_q *q, void (*cb)(void *arg), void *arg)
+{
+	if (!cb)
+		return -EINVAL;
+	return it_q_post(q, cb, arg);
+}
+
+/*! Process entries posted to the queue
+ *  \param[in] q queue to process
+ *  \param[in] max maximum number of entries to process; 0 for all
+ *  \returns number of entries processed
+ *
+ *  This is called by the select loop whenever entries were posted, but
+ *  may also be used by the consuming thread to flush the queue, e.g. on
+ *  shutdown.  Must not be called from any other thread.
+ */
+unsigned int osmo_it_q_drain(struct osmo_it_q *q, unsigned int max)
+{
+	void (*cb)(void *arg);
+	void *arg;
+	unsigned int n = 0;
+
+	while ((!max || n < max) && it_q_get(q, &cb, &arg)) {
+		if (cb)
+			cb(arg);
+		else if (q->msg_cb)
+			q->msg_cb(q, arg);
+		else
+			msgb_free(arg);
+		n++;
+	}
+
+	return n;
+}
+
+/*! Get the name of an inter-thread queue */
+const char *osmo_it_q_name(const struct osmo_it_q *q)
+{
+	return q->name;
+}
+
+/*! Get the user data passed to osmo_it_q_alloc() */
+void *osmo_it_q_data(const struct osmo_it_q *q)
+{
+	return q->data;
+}
+
+/*! @} */
+
+#endif /* HAVE_SYS_EVENTFD_H */
@@ -44,6 +44,12 @@
 #include <sys/time.h>
 #include <errno.h>
 
+#if !EMBEDDED
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#endif
+
 #include <osmocom/core/talloc.h>
 #include <osmocom/core/utils.h>
 #include <osmocom/core/logging.h>
@@ -64,6 +70,11 @@ static struct log_context log_context;
 static void *tall_log_ctx = NULL;
 LLIST_HEAD(osmo_log_target_list);
 
+/* lowest level any target logs, per sub-system; see log_cache_update() */
+static uint8_t *log_level_cache;
+const uint8_t *osmo_log_level_cache;
+unsigned int osmo_log_level_cache_len;
+
 #define LOGLEVEL_DEFS	6	/* Number of loglevels.*/
 
 static const struct value_string loglevel_strs[LOGLEVEL_DEFS+1] = {
@@ -293,6 +304,7 @@ void log_parse_category_mask(struct log_target* target, const char *_mask)
 	} while ((category_token = strtok(NULL, ":")));
 
 	free(mask);
+	log_cache_update();
 }
 
 static const char* color(int subsys)
@@ -336,12 +348,320 @@ static const char *const_basename(const char *path)
 	return bn + 1;
 }
 
-static void _output(struct log_target *target, unsigned int subsys,
-		    unsigned int level, const char *file, int line, int cont,
-		    const char *format, va_list ap)
+/* maximum length of a formatted log line, including the terminating NUL */
+#define LOG_LINE_MAX	4096
+
+#if !EMBEDDED
+/* Asynchronous log writer: log lines for targets doing blocking I/O are
+ * formatted into a slot of a ring by the logging thread and written by a
+ * separate writer thread.  The ring is the same as in it_q.c: each slot
+ * carries a sequence number, producers reserve a slot by advancing 'head'
+ * with a compare-and-swap, and publish it by updating its sequence number,
+ * so logging never takes a lock. */
+
+struct log_async_rec {
+	/* equals the ring position if free, position + 1 if filled */
+	size_t seq;
+	struct log_target *target;
+	unsigned int level;
+	/* number of log lines dropped before this one as the ring was full */
+	unsigned int dropped;
+	char buf[LOG_LINE_MAX];
+};
+
+static struct {
+	/* next position to be reserved by a producer */
+	size_t head __attribute__((aligned(64)));
+	/* number of log lines written so far; only written by the writer */
+	size_t done __attribute__((aligned(64)));
+	/* log lines dropped and not yet reported */
+	unsigned int dropped __attribute__((aligned(64)));
+	/* log lines dropped in total */
+	unsigned long dropped_total;
+	/* non-zero while the writer waits for the semaphore */
+	int idle __attribute__((aligned(64)));
+
+	bool running;
+	bool stop;
+	sem_t wakeup;
+	pthread_t thread;
+	/* number of slots, a power of two */
+	size_t size;
+	struct log_async_rec *recs;
+} log_async;
+
+/* does the target perform (possibly) blocking I/O from its output call-back? */
+static bool log_async_target(const struct log_target *target)
+{
+	if (!log_async.running || !target->output)
+		return false;
+
+	switch (target->type) {
+	case LOG_TGT_TYPE_FILE:
+	case LOG_TGT_TYPE_STDERR:
+	case LOG_TGT_TYPE_SYSLOG:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void log_async_wakeup(void)
+{
+	/* pairs with the fence in log_async_thread(): either the writer sees
+	 * the record we published, or we see it is idle */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&log_async.idle, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n(&log_async.idle, 0, __ATOMIC_ACQ_REL))
+		sem_post(&log_async.wakeup);
+}
+
+/* reserve a slot to format a log line into; NULL if the ring is full */
+static struct log_async_rec *log_async_reserve(size_t *pos_out)
+{
+	struct log_async_rec *rec;
+	size_t pos, seq;
+	intptr_t diff;
+
+	pos = __atomic_load_n(&log_async.head, __ATOMIC_RELAXED);
+	for (;;) {
+		rec = &log_async.recs[pos & (log_async.size - 1)];
+		seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+		diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&log_async.head, &pos, pos + 1, true,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			__atomic_add_fetch(&log_async.dropped, 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&log_async.dropped_total, 1, __ATOMIC_RELAXED);
+			return NULL;
+		} else
+			pos = __atomic_load_n(&log_async.head, __ATOMIC_RELAXED);
+	}
+
+	*pos_out = pos;
+	return rec;
+}
+
+static void log_async_publish(struct log_async_rec *rec, size_t pos,
+			      struct log_target *target, unsigned int level)
+{
+	rec->target = target;
+	rec->level = level;
+	rec->dropped = __atomic_exchange_n(&log_async.dropped, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+
+	log_async_wakeup();
+}
+
+static void *log_async_thread(void *arg)
+{
+	size_t tail = 0;
+
+	for (;;) {
+		struct log_async_rec *rec = &log_async.recs[tail & (log_async.size - 1)];
+
+		if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) == tail + 1) {
+			if (rec->dropped) {
+				char msg[64];
+				snprintf(msg, sizeof(msg), "%u log messages dropped\n", rec->dropped);
+				rec->target->output(rec->target, LOGL_ERROR, msg);
+			}
+			rec->target->output(rec->target, rec->level, rec->buf);
+
+			/* hand the slot back to the producers for the next lap */
+			__atomic_store_n(&rec->seq, tail + log_async.size, __ATOMIC_RELEASE);
+			tail++;
+			__atomic_store_n(&log_async.done, tail, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		if (__atomic_load_n(&log_async.stop, __ATOMIC_ACQUIRE))
+			break;
+
+		__atomic_store_n(&log_async.idle, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) == tail + 1 ||
+		    __atomic_load_n(&log_async.stop, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&log_async.idle, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		while (sem_wait(&log_async.wakeup) < 0 && errno == EINTR);
+	}
+
+	return NULL;
+}
+
+/*! Write log lines for file, stderr and syslog targets from a separate thread
+ *  \param[in] num_lines number of log lines that can be queued; rounded up to a power of two
+ *  \returns 0 on success; negative errno on error
+ *
+ *  From now on, the thread logging only formats log lines for these
+ *  targets; the (possibly blocking) I/O is done by a writer thread.  If
+ *  more than \a num_lines lines are pending, further lines are dropped and
+ *  counted; the number of lines dropped is logged in front of the next
+ *  line that is written.  Other targets are still written to directly.
+ *
+ *  Lines queued are written before a target is removed or re-opened, by
+ *  log_async_flush(), log_fini() and osmo_panic(), as well as after each
+ *  line logged at \ref LOGL_FATAL.
+ */
+int log_async_start(unsigned int num_lines)
+{
+	sigset_t all, old;
+	size_t i;
+	int rc;
+
+	assert_loginfo(__func__);
+
+	if (log_async.running)
+		return -EALREADY;
+	if (!num_lines)
+		return -EINVAL;
+
+	log_async.size = 1;
+	while (log_async.size < num_lines)
+		log_async.size <<= 1;
+	log_async.recs = talloc_array(tall_log_ctx, struct log_async_rec, log_async.size);
+	if (!log_async.recs)
+		return -ENOMEM;
+	for (i = 0; i < log_async.size; i++)
+		log_async.recs[i].seq = i;
+	log_async.head = 0;
+	log_async.done = 0;
+	log_async.dropped = 0;
+	log_async.idle = 0;
+	log_async.stop = false;
+
+	if (sem_init(&log_async.wakeup, 0, 0) < 0) {
+		rc = -errno;
+		goto out_free;
+	}
+
+	/* signals are to be handled by the application's threads */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	rc = -pthread_create(&log_async.thread, NULL, log_async_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (rc < 0) {
+		sem_destroy(&log_async.wakeup);
+		goto out_free;
+	}
+
+	log_async.running = true;
+	return 0;
+
+out_free:
+	talloc_free(log_async.recs);
+	log_async.recs = NULL;
+	return rc;
+}
+
+/*! Wait until all log lines queued for the writer thread are written
+ *
+ *  Does nothing if log_async_start() was not called, or if called from
+ *  within an output call-back of the writer thread. */
+void log_async_flush(void)
+{
+	size_t head;
+
+	if (!log_async.running || pthread_equal(pthread_self(), log_async.thread))
+		return;
+
+	head = __atomic_load_n(&log_async.head, __ATOMIC_ACQUIRE);
+	while ((intptr_t)(__atomic_load_n(&log_async.done, __ATOMIC_ACQUIRE) - head) < 0) {
+		struct timespec ts = { .tv_sec = 0, .tv_nsec = 100000 };
+		log_async_wakeup();
+		nanosleep(&ts, NULL);
+	}
+}
+
+/*! Write all queued log lines and stop the writer thread
+ *
+ *  All targets are written to directly again afterwards. */
+void log_async_stop(void)
+{
+	if (!log_async.running || pthread_equal(pthread_self(), log_async.thread))
+		return;
+
+	log_async_flush();
+	__atomic_store_n(&log_async.stop, true, __ATOMIC_RELEASE);
+	__atomic_store_n(&log_async.idle, 0, __ATOMIC_RELAXED);
+	sem_post(&log_async.wakeup);
+	pthread_join(log_async.thread, NULL);
+	log_async.running = false;
+
+	sem_destroy(&log_async.wakeup);
+	talloc_free(log_async.recs);
+	log_async.recs = NULL;
+}
+
+/*! Get the number of log lines dropped as the writer thread's queue was full */
+unsigned long log_async_dropped(void)
+{
+	return __atomic_load_n(&log_async.dropped_total, __ATOMIC_RELAXED);
+}
+#else
+int log_async_start(unsigned int num_lines)
+{
+	return -ENOTSUP;
+}
+
+void log_async_flush(void)
+{
+}
+
+void log_async_stop(void)
+{
+}
+
+unsigned long log_async_dropped(void)
 {
-	char buf[4096];
-	int ret, len = 0, offset = 0, rem = sizeof(buf);
+	return 0;
+}
+#endif /* !EMBEDDED */
+
+/* timestamps of the current second, formatted once per second and thread
+ * instead of calling localtime_r() for each line and target */
+static __thread struct {
+	bool valid;
+	time_t sec;
+	/* YYYYMMDDhhmmss, the milliseconds are appended per line */
+	char ext[32];
+	/* ctime() without the trailing newline */
+	char ctime[32];
+} log_time_cache;
+
+static void log_time_cache_update(time_t sec)
+{
+	struct tm tm;
+
+	if (log_time_cache.valid && log_time_cache.sec == sec)
+		return;
+
+	localtime_r(&sec, &tm);
+	snprintf(log_time_cache.ext, sizeof(log_time_cache.ext), "%04d%02d%02d%02d%02d%02d",
+		 tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+		 tm.tm_hour, tm.tm_min, tm.tm_sec);
+	if (asctime_r(&tm, log_time_cache.ctime))
+		log_time_cache.ctime[strlen(log_time_cache.ctime)-1] = '\0';
+	else
+		log_time_cache.ctime[0] = '\0';
+	log_time_cache.sec = sec;
+	log_time_cache.valid = true;
+}
+
+/* format a log line into buf; tv is the time of the log call, only valid
+ * if a timestamp is printed.  Returns the offset of the line following the
+ * timestamp. */
+static int _output_buf(char *buf, int buf_len, struct log_target *target,
+		       unsigned int subsys, unsigned int level,
+		       const char *file, int line, int cont,
+		       const char *format, const struct timeval *tv, va_list ap)
+{
+	int ret, len = 0, offset = 0, rem = buf_len;
+	int text = 0;
 	const char *c_subsys = NULL;
 
 	/* are we using color */
@@ -356,28 +676,20 @@ static void _output(struct log_target *target, unsigned int subsys,
 	}
 	if (!cont) {
 		if (target->print_ext_timestamp) {
-			struct tm tm;
-			struct timeval tv;
-			osmo_gettimeofday(&tv, NULL);
-			localtime_r(&tv.tv_sec, &tm);
-			ret = snprintf(buf + offset, rem, "%04d%02d%02d%02d%02d%02d%03d ",
-					tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
-					tm.tm_hour, tm.tm_min, tm.tm_sec,
-					(int)(tv.tv_usec / 1000));
+			log_time_cache_update(tv->tv_sec);
+			ret = snprintf(buf + offset, rem, "%s%03d ", log_time_cache.ext,
+				       (int)(tv->tv_usec / 1000));
 			if (ret < 0)
 				goto err;
 			OSMO_SNPRINTF_RET(ret, rem, offset, len);
 		} else if (target->print_timestamp) {
-			char *timestr;
-			time_t tm;
-			tm = time(NULL);
-			timestr = ctime(&tm);
-			timestr[strlen(timestr)-1] = '\0';
-			ret = snprintf(buf + offset, rem, "%s ", timestr);
+			log_time_cache_update(tv->tv_sec);
+			ret = snprintf(buf + offset, rem, "%s ", log_time_cache.ctime);
 			if (ret < 0)
 				goto err;
 			OSMO_SNPRINTF_RET(ret, rem, offset, len);
 		}
+		text = offset;
 		if (target->print_category) {
 			ret = snprintf(buf + offset, rem, "%s%s%s%s ",
 				       target->use_color ? level_color(level) : "",
@@ -433,7 +745,151 @@ static void _output(struct log_target *target, unsigned int subsys,
 		OSMO_SNPRINTF_RET(ret, rem, offset, len);
 	}
 err:
-	buf[sizeof(buf)-1] = '\0';
+	buf[buf_len-1] = '\0';
+	return text;
+}
+
+static void _output_fmt(char *buf, int buf_len, struct log_target *target,
+			unsigned int subsys, unsigned int level,
+			const char *file, int line, const struct timeval *tv,
+			const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	_output_buf(buf, buf_len, target, subsys, level, file, line, 0, format, tv, ap);
+	va_end(ap);
+}
+
+/* pass a formatted line to the target, or to the writer thread */
+static void _output_str(struct log_target *target, unsigned int level, const char *str)
+{
+#if !EMBEDDED
+	if (log_async_target(target)) {
+		struct log_async_rec *rec;
+		size_t pos;
+
+		rec = log_async_reserve(&pos);
+		if (!rec)
+			return;
+		osmo_strlcpy(rec->buf, str, sizeof(rec->buf));
+		log_async_publish(rec, pos, target, level);
+		if (level >= LOGL_FATAL)
+			log_async_flush();
+		return;
+	}
+#endif
+	target->output(target, level, str);
+}
+
+static uint64_t log_monotonic_ms(void)
+{
+	struct timespec ts;
+
+	osmo_clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* FNV-1a */
+static uint64_t log_hash(const char *str)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (; *str; str++) {
+		hash ^= (uint8_t)*str;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/* _output() for targets that suppress repeated lines */
+static void _output_dedup(struct log_target *target, unsigned int subsys,
+			  unsigned int level, const char *file, int line, int cont,
+			  const char *format, const struct timeval *tv, va_list ap)
+{
+	char buf[LOG_LINE_MAX];
+	uint64_t hash, now;
+	unsigned int count;
+	bool partial;
+	int text, len;
+
+	if (cont && target->dedup.dropping)
+		return;
+
+	text = _output_buf(buf, sizeof(buf), target, subsys, level, file, line, cont,
+			   format, tv, ap);
+	if (cont) {
+		_output_str(target, level, buf);
+		return;
+	}
+
+	/* the hash can't cover the LOGPC() continuations of a line that
+	 * doesn't end yet, so never suppress those */
+	len = strlen(buf);
+	partial = len > text && buf[len - 1] != '\n';
+
+	hash = log_hash(buf + text);
+	now = log_monotonic_ms();
+	if (!partial && hash == target->dedup.hash &&
+	    now - target->dedup.since_ms < target->dedup.window_ms) {
+		target->dedup.count++;
+		target->dedup.dropping = true;
+		return;
+	}
+
+	count = target->dedup.count;
+	if (count) {
+		char msg[LOG_LINE_MAX];
+
+		_output_fmt(msg, sizeof(msg), target, target->dedup.subsys,
+			    target->dedup.level, target->dedup.file, target->dedup.line,
+			    tv, "last message repeated %u times\n", count);
+		_output_str(target, target->dedup.level, msg);
+	}
+
+	target->dedup.hash = partial ? 0 : hash;
+	target->dedup.since_ms = now;
+	target->dedup.subsys = subsys;
+	target->dedup.level = level;
+	target->dedup.file = file;
+	target->dedup.line = line;
+	target->dedup.count = 0;
+	target->dedup.dropping = false;
+
+	_output_str(target, level, buf);
+}
+
+static void _output(struct log_target *target, unsigned int subsys,
+		    unsigned int level, const char *file, int line, int cont,
+		    const char *format, const struct timeval *tv, va_list ap)
+{
+	char buf[LOG_LINE_MAX];
+
+	if (target->dedup.window_ms) {
+		_output_dedup(target, subsys, level, file, line, cont, format, tv, ap);
+		return;
+	}
+
+#if !EMBEDDED
+	if (log_async_target(target)) {
+		struct log_async_rec *rec;
+		size_t pos;
+
+		rec = log_async_reserve(&pos);
+		if (!rec)
+			return;
+		_output_buf(rec->buf, sizeof(rec->buf), target, subsys, level,
+			    file, line, cont, format, tv, ap);
+		log_async_publish(rec, pos, target, level);
+		/* the program is likely about to terminate */
+		if (level >= LOGL_FATAL)
+			log_async_flush();
+		return;
+	}
+#endif
+
+	_output_buf(buf, sizeof(buf), target, subsys, level, file, line, cont,
+		    format, tv, ap);
 	target->output(target, level, buf);
 }
 
@@ -506,6 +962,8 @@ void osmo_vlogp(int subsys, int level, const char *file, int line,
 		int cont, const char *format, va_list ap)
 {
 	struct log_target *tar;
+	struct timeval tv;
+	bool have_tv = false;
 
 	subsys = map_subsys(subsys);
 
@@ -515,6 +973,13 @@ void osmo_vlogp(int subsys, int level, const char *file, int line,
 		if (!should_log_to_target(tar, subsys, level))
 			continue;
 
+		/* all targets print the same timestamp */
+		if (!have_tv && !cont &&
+		    (tar->print_ext_timestamp || tar->print_timestamp)) {
+			osmo_gettimeofday(&tv, NULL);
+			have_tv = true;
+		}
+
 		/* According to the manpage, vsnprintf leaves the value of ap
 		 * in undefined state. Since _output uses vsnprintf and it may
 		 * be called several times, we have to pass a copy of ap. */
@@ -522,7 +987,7 @@ void osmo_vlogp(int subsys, int level, const char *file, int line,
 		if (tar->raw_output)
 			tar->raw_output(tar, subsys, level, file, line, cont, format, bp);
 		else
-			_output(tar, subsys, level, file, line, cont, format, bp);
+			_output(tar, subsys, level, file, line, cont, format, &tv, bp);
 		va_end(bp);
 	}
 }
@@ -559,12 +1024,55 @@ void logp2(int subsys, unsigned int level, const char *file, int line, int cont,
 	va_end(ap);
 }
 
+/*! Check whether a rate-limited log statement may log, see LOGP_RATELIMIT()
+ *  \param[inout] rl state of the log statement
+ *  \param[in] rate messages per second, larger than 0
+ *  \param[in] burst messages logged in a row before the rate applies
+ *  \param[in] subsys Logging sub-system
+ *  \param[in] level Log level
+ *  \param[in] file name of source code file
+ *  \param[in] line line number in the source code file
+ *  \returns true if the message is to be logged, false if it is suppressed
+ *
+ *  Before returning true after messages were suppressed, their number is
+ *  logged.  The check is not atomic; with several threads logging from the
+ *  same statement the rate is only approximate.
+ */
+bool log_ratelimit_check(struct log_ratelimit *rl, unsigned int rate, unsigned int burst,
+			 int subsys, unsigned int level, const char *file, int line)
+{
+	struct timespec ts;
+	uint64_t now, interval;
+
+	osmo_clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	interval = 1000000 / (rate ? rate : 1);
+
+	/* each message takes one token, i.e. moves the time at which the
+	 * bucket is full again by one interval */
+	if (rl->full_us < now)
+		rl->full_us = now;
+	if (rl->full_us - now > (uint64_t)(burst ? burst - 1 : 0) * interval) {
+		rl->suppressed++;
+		return false;
+	}
+	rl->full_us += interval;
+
+	if (rl->suppressed) {
+		logp2(subsys, level, file, line, 0, "%u similar log messages suppressed\n",
+		      rl->suppressed);
+		rl->suppressed = 0;
+	}
+	return true;
+}
+
 /*! Register a new log target with the logging core
  *  \param[in] target Log target to be registered
  */
 void log_add_target(struct log_target *target)
 {
 	llist_add_tail(&target->entry, &osmo_log_target_list);
+	log_cache_update();
 }
 
 /*! Unregister a log target from the logging core
@@ -572,7 +1080,10 @@ void log_add_target(struct log_target *target)
  */
 void log_del_target(struct log_target *target)
 {
+	/* the writer thread may still hold log lines for it */
+	log_async_flush();
 	llist_del(&target->entry);
+	log_cache_update();
 }
 
 /*! Reset (clear) the logging context */
@@ -706,6 +1217,24 @@ void log_set_print_level(struct log_target *target, int print_level)
 	target->print_level = (bool)print_level;
 }
 
+/*! Suppress repeated identical log lines
+ *  \param[in] target Log target to be affected
+ *  \param[in] window_ms time window in milliseconds, 0 to disable
+ *
+ *  A line that is identical to the previous line of the target, apart from
+ *  the timestamp, is not written if the previous line was written less than
+ *  window_ms ago.  The number of suppressed lines is reported before the
+ *  next line that is written.  Lines continued with LOGPC() are never
+ *  suppressed.
+ */
+void log_set_dedup_window(struct log_target *target, unsigned int window_ms)
+{
+	target->dedup.window_ms = window_ms;
+	target->dedup.count = 0;
+	target->dedup.dropping = false;
+	target->dedup.hash = 0;
+}
+
 /*! Set the global log level for a given log target
  *  \param[in] target Log target to be affected
  *  \param[in] log_level New global log level
@@ -713,6 +1242,7 @@ void log_set_print_level(struct log_target *target, int print_level)
 void log_set_log_level(struct log_target *target, int log_level)
 {
 	target->loglevel = log_level;
+	log_cache_update();
 }
 
 /*! Set a category filter on a given log target
@@ -729,6 +1259,7 @@ void log_set_category_filter(struct log_target *target, int category,
 	category = map_subsys(category);
 	target->categories[category].enabled = !!enable;
 	target->categories[category].loglevel = level;
+	log_cache_update();
 }
 
 #if (!EMBEDDED)
@@ -849,6 +1380,14 @@ struct log_target *log_target_find(int type, const char *fname)
 			if (!strcmp(fname, tgt->tgt_file.fname))
 				return tgt;
 			break;
+		case LOG_TGT_TYPE_BINARY:
+			if (!strcmp(fname, tgt->tgt_binary.fname))
+				return tgt;
+			break;
+		case LOG_TGT_TYPE_RB_FILE:
+			if (!strcmp(fname, tgt->tgt_rb_file.fname))
+				return tgt;
+			break;
 		case LOG_TGT_TYPE_GSMTAP:
 			if (!strcmp(fname, tgt->tgt_gsmtap.hostname))
 				return tgt;
@@ -890,11 +1429,14 @@ void log_target_destroy(struct log_target *target)
  *  \returns 0 in case of success; negative otherwise */
 int log_target_file_reopen(struct log_target *target)
 {
+	log_async_flush();
 	fclose(target->tgt_file.out);
 
 	target->tgt_file.out = fopen(target->tgt_file.fname, "a");
 	if (!target->tgt_file.out)
 		return -errno;
+	if (target->type == LOG_TGT_TYPE_BINARY)
+		target->tgt_binary.restart = true;
 
 	/* we assume target->output already to be set */
 
@@ -911,6 +1453,7 @@ int log_targets_reopen(void)
 	llist_for_each_entry(tar, &osmo_log_target_list, entry) {
 		switch (tar->type) {
 		case LOG_TGT_TYPE_FILE:
+		case LOG_TGT_TYPE_BINARY:
 			if (log_target_file_reopen(tar) < 0)
 				rc = -1;
 			break;
@@ -1110,6 +1653,16 @@ int log_init(const struct log_info *inf, void *ctx)
 			&internal_cat[i], sizeof(struct log_info_cat));
 	}
 
+	log_level_cache = talloc_array(osmo_log_info, uint8_t,
+				       inf->num_cat + OSMO_NUM_DLIB);
+	if (!log_level_cache) {
+		talloc_free(osmo_log_info);
+		osmo_log_info = NULL;
+		return -ENOMEM;
+	}
+	osmo_log_level_cache_len = inf->num_cat + OSMO_NUM_DLIB;
+	log_cache_update();
+
 	return 0;
 }
 
@@ -1119,9 +1672,14 @@ void log_fini(void)
 {
 	struct log_target *tar, *tar2;
 
+	log_async_stop();
+
 	llist_for_each_entry_safe(tar, tar2, &osmo_log_target_list, entry)
 		log_target_destroy(tar);
 
+	osmo_log_level_cache = NULL;
+	osmo_log_level_cache_len = 0;
+	log_level_cache = NULL;
 	talloc_free(osmo_log_info);
 	osmo_log_info = NULL;
 	talloc_free(tall_log_ctx);
@@ -1136,9 +1694,10 @@ int log_check_level(int subsys, unsigned int level)
 
 	assert_loginfo(__func__);
 
-	subsys = map_subsys(subsys);
+	if (log_cache_drops(subsys, level))
+		return 0;
 
-	/* TODO: The following could/should be cached (update on config) */
+	subsys = map_subsys(subsys);
 
 	llist_for_each_entry(tar, &osmo_log_target_list, entry) {
 		if (!should_log_to_target(tar, subsys, level))
@@ -1152,4 +1711,46 @@ int log_check_level(int subsys, unsigned int level)
 	return 0;
 }
 
+/* lowest level a target logs for a (mapped) sub-system; UINT8_MAX if none */
+static uint8_t target_min_level(const struct log_target *tar, int subsys)
+{
+	const struct log_category *category = &tar->categories[subsys];
+
+	if (!category->enabled)
+		return UINT8_MAX;
+	if (tar->loglevel != 0)
+		return tar->loglevel;
+	return category->loglevel;
+}
+
+/*! Recompute the per sub-system log levels used by log_cache_drops()
+ *
+ *  The cache covers the enabled flag and log levels of all registered
+ *  targets, but not the filters, which depend on the logging context.  It
+ *  is updated by all functions of this API that change those settings;
+ *  code modifying \ref log_target members directly must call this
+ *  afterwards. */
+void log_cache_update(void)
+{
+	struct log_target *tar;
+	unsigned int i;
+
+	if (!log_level_cache)
+		return;
+
+	for (i = 0; i < osmo_log_level_cache_len; i++) {
+		int subsys = map_subsys((int)i - OSMO_NUM_DLIB);
+		uint8_t min = UINT8_MAX;
+
+		llist_for_each_entry(tar, &osmo_log_target_list, entry) {
+			uint8_t level = target_min_level(tar, subsys);
+			if (level < min)
+				min = level;
+		}
+		log_level_cache[i] = min;
+	}
+
+	osmo_log_level_cache = log_level_cache;
+}
+
 /*! @} */
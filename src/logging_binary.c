@@ -0,0 +1,524 @@
+/*! \file logging_binary.c
+ * Binary log target: write compact records instead of formatted text. */
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*! \addtogroup logging
+ *  @{
+ *  The binary log target stores each log event as the time, category,
+ *  level, an id of the log statement and the raw format string arguments,
+ *  which is much cheaper than formatting it as text.  osmo-log-decode
+ *  turns such a file into text offline.
+ *
+ * \file logging_binary.c */
+
+#include "../config.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/core/hashtable.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/core/logging_binary.h>
+
+extern struct log_info *osmo_log_info;
+
+/* maximum payload of a record */
+#define LOG_BIN_REC_MAX		4096
+
+struct log_bin_site_ent {
+	struct hlist_node node;
+	const char *file;
+	int line;
+	const char *format;
+	char *format_copy;
+	uint32_t id;
+};
+
+struct log_bin_state {
+	uint32_t next_id;
+	/* talloc context of the site entries */
+	void *sites_ctx;
+	DECLARE_HASHTABLE(sites, 10);
+};
+
+/* used for format strings that can't be encoded */
+static const char fallback_format[] = "%s";
+
+/*! Parse a printf conversion specification
+ *  \param[in] fmt format string, pointing to the '%'
+ *  \param[out] conv parsed conversion specification
+ *  \returns pointer behind the conversion character; NULL if the
+ *  conversion cannot be encoded in a binary log record
+ */
+const char *log_bin_parse_conv(const char *fmt, struct log_bin_conv *conv)
+{
+	const char *p = fmt + 1;
+
+	memset(conv, 0, sizeof(*conv));
+
+	conv->flags = p;
+	while (*p && strchr("-+ #0'I", *p))
+		p++;
+
+	conv->width = p;
+	if (*p == '*') {
+		conv->width_star = true;
+		p++;
+	} else {
+		while (isdigit((unsigned char)*p))
+			p++;
+	}
+	/* positional arguments */
+	if (*p == '$')
+		return NULL;
+
+	conv->prec = p;
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			conv->prec_star = true;
+			p++;
+		} else {
+			while (isdigit((unsigned char)*p))
+				p++;
+		}
+	}
+
+	conv->len_mod = p;
+	switch (*p) {
+	case 'h':
+		p++;
+		if (*p == 'h') {
+			conv->len = LOG_BIN_LEN_HH;
+			p++;
+		} else
+			conv->len = LOG_BIN_LEN_H;
+		break;
+	case 'l':
+		p++;
+		if (*p == 'l') {
+			conv->len = LOG_BIN_LEN_LL;
+			p++;
+		} else
+			conv->len = LOG_BIN_LEN_L;
+		break;
+	case 'q':
+		conv->len = LOG_BIN_LEN_LL;
+		p++;
+		break;
+	case 'L':
+		conv->len = LOG_BIN_LEN_BIG_L;
+		p++;
+		break;
+	case 'j':
+		conv->len = LOG_BIN_LEN_J;
+		p++;
+		break;
+	case 'z':
+	case 'Z':
+		conv->len = LOG_BIN_LEN_Z;
+		p++;
+		break;
+	case 't':
+		conv->len = LOG_BIN_LEN_T;
+		p++;
+		break;
+	}
+
+	conv->conv = *p;
+	switch (*p) {
+	case 'd':
+	case 'i':
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+		if (conv->len == LOG_BIN_LEN_BIG_L)
+			return NULL;
+		break;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		if (conv->len != LOG_BIN_LEN_NONE && conv->len != LOG_BIN_LEN_L &&
+		    conv->len != LOG_BIN_LEN_BIG_L)
+			return NULL;
+		break;
+	case 'n':
+		break;
+	case 'c':
+	case 's':
+	case 'p':
+	case 'm':
+	case '%':
+		/* no wide characters */
+		if (conv->len != LOG_BIN_LEN_NONE)
+			return NULL;
+		break;
+	default:
+		return NULL;
+	}
+
+	return p + 1;
+}
+
+struct log_bin_buf {
+	uint8_t data[LOG_BIN_REC_MAX];
+	size_t len;
+	bool trunc;
+};
+
+static bool buf_put(struct log_bin_buf *buf, const void *data, size_t len)
+{
+	if (buf->trunc || len > sizeof(buf->data) - buf->len) {
+		buf->trunc = true;
+		return false;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	return true;
+}
+
+static void buf_put_str(struct log_bin_buf *buf, const char *str, size_t max)
+{
+	size_t n, room = sizeof(buf->data) - buf->len;
+	bool trunc = false;
+	uint16_t len;
+
+	if (!str)
+		str = "(null)";
+	n = strnlen(str, max);
+
+	/* truncate the string rather than dropping it */
+	if (room >= sizeof(len) && n > room - sizeof(len)) {
+		n = room - sizeof(len);
+		trunc = true;
+	}
+
+	len = n;
+	if (buf_put(buf, &len, sizeof(len)))
+		buf_put(buf, str, len);
+	if (trunc)
+		buf->trunc = true;
+}
+
+static int64_t get_int(enum log_bin_len len, bool is_signed, va_list *ap)
+{
+	switch (len) {
+	case LOG_BIN_LEN_L:
+		return is_signed ? va_arg(*ap, long) : (int64_t)va_arg(*ap, unsigned long);
+	case LOG_BIN_LEN_LL:
+		return is_signed ? va_arg(*ap, long long) : (int64_t)va_arg(*ap, unsigned long long);
+	case LOG_BIN_LEN_J:
+		return is_signed ? va_arg(*ap, intmax_t) : (int64_t)va_arg(*ap, uintmax_t);
+	case LOG_BIN_LEN_Z:
+		return is_signed ? va_arg(*ap, ssize_t) : (int64_t)va_arg(*ap, size_t);
+	case LOG_BIN_LEN_T:
+		return va_arg(*ap, ptrdiff_t);
+	default:
+		/* char and short are promoted to int */
+		return is_signed ? va_arg(*ap, int) : (int64_t)va_arg(*ap, unsigned int);
+	}
+}
+
+/* encode the arguments of format; false if the format can't be encoded */
+static bool encode_args(struct log_bin_buf *buf, const char *format, int err,
+			va_list *ap)
+{
+	const char *p = format;
+	struct log_bin_conv conv;
+
+	while ((p = strchr(p, '%'))) {
+		int32_t star;
+		size_t prec = SIZE_MAX;
+		int64_t i64;
+		uint64_t u64;
+		double d;
+
+		p = log_bin_parse_conv(p, &conv);
+		if (!p)
+			return false;
+
+		if (conv.width_star) {
+			star = va_arg(*ap, int);
+			buf_put(buf, &star, sizeof(star));
+		}
+		if (conv.prec_star) {
+			star = va_arg(*ap, int);
+			buf_put(buf, &star, sizeof(star));
+			if (star >= 0)
+				prec = star;
+		} else if (*conv.prec == '.')
+			prec = atoi(conv.prec + 1);
+
+		switch (conv.conv) {
+		case 'd':
+		case 'i':
+			i64 = get_int(conv.len, true, ap);
+			buf_put(buf, &i64, sizeof(i64));
+			break;
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			i64 = get_int(conv.len, false, ap);
+			buf_put(buf, &i64, sizeof(i64));
+			break;
+		case 'c':
+			i64 = va_arg(*ap, int);
+			buf_put(buf, &i64, sizeof(i64));
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (conv.len == LOG_BIN_LEN_BIG_L)
+				d = va_arg(*ap, long double);
+			else
+				d = va_arg(*ap, double);
+			buf_put(buf, &d, sizeof(d));
+			break;
+		case 'p':
+			u64 = (uintptr_t)va_arg(*ap, void *);
+			buf_put(buf, &u64, sizeof(u64));
+			break;
+		case 's':
+			buf_put_str(buf, va_arg(*ap, const char *), prec);
+			break;
+		case 'm':
+			buf_put_str(buf, strerror(err), prec);
+			break;
+		case 'n':
+			(void)va_arg(*ap, void *);
+			break;
+		}
+	}
+
+	return true;
+}
+
+static void write_rec(FILE *out, uint8_t type, const void *payload, size_t len)
+{
+	struct log_bin_rec_hdr rh = {
+		.type = type,
+		.len = len,
+	};
+
+	fwrite(&rh, sizeof(rh), 1, out);
+	fwrite(payload, len, 1, out);
+}
+
+/* write the file header and category names, forget all sites written */
+static void start_file(struct log_target *target)
+{
+	struct log_bin_state *state = target->tgt_binary.state;
+	FILE *out = target->tgt_binary.out;
+	struct log_bin_file_hdr fh = {
+		.version = LOG_BIN_VERSION,
+		.byte_order = LOG_BIN_BYTE_ORDER,
+	};
+	struct log_bin_buf buf;
+	unsigned int i;
+
+	memcpy(fh.magic, LOG_BIN_MAGIC, sizeof(fh.magic));
+	fwrite(&fh, sizeof(fh), 1, out);
+
+	for (i = 0; i < osmo_log_info->num_cat; i++) {
+		const char *name = osmo_log_info->cat[i].name;
+		uint16_t subsys = i;
+
+		if (!name)
+			continue;
+		buf.len = 0;
+		buf.trunc = false;
+		buf_put(&buf, &subsys, sizeof(subsys));
+		buf_put(&buf, name, strlen(name) + 1);
+		write_rec(out, LOG_BIN_REC_CAT, buf.data, buf.len);
+	}
+
+	talloc_free(state->sites_ctx);
+	state->sites_ctx = talloc_named_const(state, 0, "log_bin_sites");
+	hash_init(state->sites);
+	state->next_id = 0;
+	target->tgt_binary.restart = false;
+}
+
+/* look up the id of a log statement, writing its site record if new */
+static uint32_t get_site(struct log_target *target, const char *file, int line,
+			 const char *format)
+{
+	struct log_bin_state *state = target->tgt_binary.state;
+	struct log_bin_site_ent *ent;
+	uintptr_t key = (uintptr_t)format ^ line;
+	struct log_bin_buf buf;
+	uint32_t line32 = line;
+	size_t file_len, fmt_len;
+
+	/* format strings are usually literals; compare the contents for the
+	 * rare case of a buffer being re-used */
+	hash_for_each_possible(state->sites, ent, node, key) {
+		if (ent->format == format && ent->file == file && ent->line == line &&
+		    !strcmp(ent->format_copy, format))
+			return ent->id;
+	}
+
+	ent = talloc_zero(state->sites_ctx, struct log_bin_site_ent);
+	if (!ent)
+		return UINT32_MAX;
+	ent->format_copy = talloc_strdup(ent, format);
+	if (!ent->format_copy) {
+		talloc_free(ent);
+		return UINT32_MAX;
+	}
+	ent->file = file;
+	ent->line = line;
+	ent->format = format;
+	ent->id = state->next_id++;
+	hash_add(state->sites, &ent->node, key);
+
+	file_len = strlen(file) + 1;
+	fmt_len = strlen(format) + 1;
+	buf.len = 0;
+	buf.trunc = false;
+	buf_put(&buf, &ent->id, sizeof(ent->id));
+	buf_put(&buf, &line32, sizeof(line32));
+	buf_put(&buf, file, file_len);
+	buf_put(&buf, format, fmt_len);
+	if (buf.trunc) {
+		/* no sane format string is that long */
+		hash_del(&ent->node);
+		talloc_free(ent);
+		return UINT32_MAX;
+	}
+	write_rec(target->tgt_binary.out, LOG_BIN_REC_SITE, buf.data, buf.len);
+
+	return ent->id;
+}
+
+static void _binary_raw_output(struct log_target *target, int subsys,
+			       unsigned int level, const char *file, int line,
+			       int cont, const char *format, va_list ap)
+{
+	struct log_bin_buf buf;
+	struct log_bin_log *ev;
+	struct timeval tv;
+	int err = errno;
+	va_list bp;
+	bool ok;
+
+	/* get timestamp ASAP */
+	osmo_gettimeofday(&tv, NULL);
+
+	if (target->tgt_binary.restart)
+		start_file(target);
+
+	buf.len = sizeof(*ev);
+	buf.trunc = false;
+	va_copy(bp, ap);
+	ok = encode_args(&buf, format, err, &bp);
+	va_end(bp);
+	if (!ok) {
+		/* log the formatted text instead */
+		char text[LOG_BIN_REC_MAX];
+
+		vsnprintf(text, sizeof(text), format, ap);
+		buf.len = sizeof(*ev);
+		buf.trunc = false;
+		buf_put_str(&buf, text, SIZE_MAX);
+		format = fallback_format;
+	}
+
+	ev = (struct log_bin_log *) buf.data;
+	ev->time_us = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	ev->site = get_site(target, file, line, format);
+	if (ev->site == UINT32_MAX)
+		return;
+	ev->subsys = subsys;
+	ev->level = level;
+	ev->flags = (cont ? LOG_BIN_F_CONT : 0) | (buf.trunc ? LOG_BIN_F_TRUNC : 0);
+	write_rec(target->tgt_binary.out, LOG_BIN_REC_LOG, buf.data, buf.len);
+
+	/* the program might be about to terminate */
+	if (level >= LOGL_ERROR)
+		fflush(target->tgt_binary.out);
+}
+
+static int binary_target_destructor(struct log_target *target)
+{
+	if (target->tgt_binary.out) {
+		fclose(target->tgt_binary.out);
+		target->tgt_binary.out = NULL;
+	}
+	return 0;
+}
+
+/*! Create a new logging target for binary logging to a file
+ *  \param[in] fname file name of the new binary log file
+ *  \returns Log target in case of success, NULL in case of error
+ *
+ *  Log events are written as binary records, see logging_binary.h, and
+ *  can be turned into text with osmo-log-decode.  The file is written
+ *  through a stdio buffer that is only flushed for events of level \ref
+ *  LOGL_ERROR and above, on log_target_file_reopen() and when the target
+ *  is destroyed.
+ */
+struct log_target *log_target_create_binary(const char *fname)
+{
+	struct log_target *target;
+
+	target = log_target_create();
+	if (!target)
+		return NULL;
+
+	target->type = LOG_TGT_TYPE_BINARY;
+	target->tgt_binary.state = talloc_zero(target, struct log_bin_state);
+	if (!target->tgt_binary.state)
+		goto out_free;
+	target->tgt_binary.fname = talloc_strdup(target, fname);
+	target->tgt_binary.out = fopen(fname, "a");
+	if (!target->tgt_binary.out)
+		goto out_free;
+	target->tgt_binary.restart = true;
+	talloc_set_destructor(target, binary_target_destructor);
+
+	target->raw_output = _binary_raw_output;
+
+	return target;
+
+out_free:
+	talloc_free(target);
+	return NULL;
+}
+
+/*! @} */
@@ -0,0 +1,195 @@
+/*! \file loggingrb_file.c
+ * Memory-mapped ring buffer file logging support code. */
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*! \addtogroup loggingrb
+ *  @{
+ *  The ring buffer file target writes log lines into the fixed-size slots
+ *  of a file that is mapped into memory.  Written lines end up in the page
+ *  cache immediately, so they survive a crash of the process without any
+ *  write system call per line, and can be read with osmo-log-ring.  This
+ *  allows to keep the last lines of verbose logging around for post-mortem
+ *  analysis without writing them to a log file.
+ *
+ * \file loggingrb_file.c */
+
+#include "../config.h"
+
+#ifdef HAVE_SYS_MMAN_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/core/loggingrb.h>
+
+/* offset of the first slot; keeps the slots cache line aligned */
+#define LOG_RB_FILE_HDR_LEN	64
+
+osmo_static_assert(sizeof(struct log_rb_file_hdr) <= LOG_RB_FILE_HDR_LEN, log_rb_file_hdr_fits);
+
+static void _rb_file_output(struct log_target *target, unsigned int level,
+			    const char *log)
+{
+	struct log_rb_file_hdr *hdr = target->tgt_rb_file.hdr;
+	struct log_rb_file_slot *slot;
+	size_t len = strlen(log);
+	size_t max = hdr->slot_size - sizeof(*slot) - 1;
+	struct timeval tv;
+	uint64_t pos;
+
+	osmo_gettimeofday(&tv, NULL);
+
+	/* threads logging at the same time get different slots */
+	pos = __atomic_fetch_add(&hdr->head, 1, __ATOMIC_RELAXED);
+	slot = (struct log_rb_file_slot *)((uint8_t *)hdr + hdr->hdr_len +
+					   (pos & (hdr->num_slots - 1)) * hdr->slot_size);
+
+	/* a crash while the slot is written leaves it marked incomplete */
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	if (len > max)
+		len = max;
+	slot->time_us = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	slot->len = len;
+	slot->level = level;
+	memcpy(slot->text, log, len);
+	slot->text[len] = '\0';
+
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+static int rb_file_target_destructor(struct log_target *target)
+{
+	if (target->tgt_rb_file.hdr) {
+		munmap(target->tgt_rb_file.hdr, target->tgt_rb_file.map_len);
+		target->tgt_rb_file.hdr = NULL;
+	}
+	return 0;
+}
+
+/* map the file; keep its slots if it was written with the same layout */
+static struct log_rb_file_hdr *rb_file_map(int fd, size_t map_len, unsigned int num_slots,
+					   unsigned int slot_size)
+{
+	struct log_rb_file_hdr *hdr;
+	struct stat st;
+	bool keep = false;
+
+	if (fstat(fd, &st) < 0)
+		return NULL;
+
+	if (st.st_size == map_len) {
+		hdr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (hdr == MAP_FAILED)
+			return NULL;
+		keep = !memcmp(hdr->magic, LOG_RB_FILE_MAGIC, sizeof(hdr->magic)) &&
+		       hdr->version == LOG_RB_FILE_VERSION &&
+		       hdr->hdr_len == LOG_RB_FILE_HDR_LEN &&
+		       hdr->slot_size == slot_size &&
+		       hdr->num_slots == num_slots;
+		if (keep)
+			return hdr;
+		munmap(hdr, map_len);
+	}
+
+	/* allocate all blocks now, rather than getting SIGBUS when writing
+	 * to a sparse file on a full file system */
+	if (ftruncate(fd, 0) < 0 || posix_fallocate(fd, 0, map_len) != 0)
+		return NULL;
+	hdr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED)
+		return NULL;
+
+	hdr->version = LOG_RB_FILE_VERSION;
+	hdr->hdr_len = LOG_RB_FILE_HDR_LEN;
+	hdr->slot_size = slot_size;
+	hdr->num_slots = num_slots;
+	hdr->head = 0;
+	memcpy(hdr->magic, LOG_RB_FILE_MAGIC, sizeof(hdr->magic));
+
+	return hdr;
+}
+
+/*! Create a new logging target for a memory-mapped ring buffer file
+ *  \param[in] fname file name of the ring buffer file
+ *  \param[in] num_slots number of log lines kept, rounded up to a power of two
+ *  \param[in] slot_size size of each slot, e.g. \ref LOG_RB_FILE_SLOT_SIZE;
+ *	longer lines are truncated
+ *  \returns Log target in case of success, NULL in case of error
+ *
+ *  The file keeps the last num_slots log lines, see osmo-log-ring.  If the
+ *  file was written before with the same number and size of slots, its
+ *  lines are kept, so that restarting a crashed process does not overwrite
+ *  them at once.  Writing a log line does not allocate memory or call into
+ *  the kernel.
+ */
+struct log_target *log_target_create_rb_file(const char *fname, unsigned int num_slots,
+					     unsigned int slot_size)
+{
+	struct log_target *target;
+	size_t map_len;
+	int fd;
+
+	if (!num_slots || num_slots > (1 << 24) ||
+	    slot_size < sizeof(struct log_rb_file_slot) + 16 || slot_size > UINT16_MAX)
+		return NULL;
+	while (num_slots & (num_slots - 1))
+		num_slots += num_slots & -num_slots;
+	slot_size = (slot_size + 7) & ~7;
+	map_len = LOG_RB_FILE_HDR_LEN + (size_t)num_slots * slot_size;
+
+	target = log_target_create();
+	if (!target)
+		return NULL;
+
+	target->type = LOG_TGT_TYPE_RB_FILE;
+	target->tgt_rb_file.fname = talloc_strdup(target, fname);
+	if (!target->tgt_rb_file.fname)
+		goto out_free;
+
+	fd = open(fname, O_RDWR | O_CREAT, 0666);
+	if (fd < 0)
+		goto out_free;
+	target->tgt_rb_file.hdr = rb_file_map(fd, map_len, num_slots, slot_size);
+	close(fd);
+	if (!target->tgt_rb_file.hdr)
+		goto out_free;
+	target->tgt_rb_file.map_len = map_len;
+	talloc_set_destructor(target, rb_file_target_destructor);
+
+	target->output = _rb_file_output;
+
+	return target;
+
+out_free:
+	talloc_free(target);
+	return NULL;
+}
+
+#endif /* HAVE_SYS_MMAN_H */
+
+/* @} */
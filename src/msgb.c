@@ -59,13 +59,172 @@
 #include <inttypes.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <stdbool.h>
 
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/talloc.h>
 #include <osmocom/core/logging.h>
+#include <osmocom/core/stats.h>
+#include <osmocom/core/stat_item.h>
 
 void *tall_msgb_ctx = NULL;
 
+/* Size classes of the msgb pool (payload octets).  Beside the powers of
+ * two, there is one for the common msgb_alloc_headroom(4096, 128/256). */
+static const uint16_t msgb_pool_class_size[] = {
+	128, 256, 512, 1024, 2048, 4096, 4096 + 256, 8192,
+};
+#define MSGB_POOL_NUM_CLASSES	ARRAY_SIZE(msgb_pool_class_size)
+
+/* number of pool operations between updates of the stat items */
+#define MSGB_POOL_STAT_INTERVAL	64
+
+enum msgb_pool_stat_item_id {
+	MSGB_POOL_STAT_HITS,
+	MSGB_POOL_STAT_MISSES,
+	MSGB_POOL_STAT_CACHED,
+	MSGB_POOL_STAT_CACHED_HIGH,
+};
+
+static const struct osmo_stat_item_desc msgb_pool_stat_description[] = {
+	[MSGB_POOL_STAT_HITS]		= { "hits", "Allocations served from the pool", OSMO_STAT_ITEM_NO_UNIT, 16, 0 },
+	[MSGB_POOL_STAT_MISSES]		= { "misses", "Allocations that went to talloc", OSMO_STAT_ITEM_NO_UNIT, 16, 0 },
+	[MSGB_POOL_STAT_CACHED]		= { "cached", "Buffers on the free-lists", OSMO_STAT_ITEM_NO_UNIT, 16, 0 },
+	[MSGB_POOL_STAT_CACHED_HIGH]	= { "cached.high", "High-water mark of buffers on the free-lists", OSMO_STAT_ITEM_NO_UNIT, 16, 0 },
+};
+
+static const struct osmo_stat_item_group_desc msgb_pool_statg_desc = {
+	.group_name_prefix = "msgb.pool",
+	.group_description = "Message Buffer Pool Statistics",
+	.num_items = ARRAY_SIZE(msgb_pool_stat_description),
+	.item_desc = msgb_pool_stat_description,
+	.class_id = OSMO_STATS_CLASS_GLOBAL,
+};
+
+/* per-thread cache of released msgbs, one LIFO free-list per size class */
+struct msgb_pool {
+	struct llist_head free[MSGB_POOL_NUM_CLASSES];
+	unsigned int count[MSGB_POOL_NUM_CLASSES];
+	unsigned int max_cached;
+	struct msgb_pool_stats stats;
+	unsigned int ops;
+	struct osmo_stat_item_group *statg;
+};
+
+static __thread struct msgb_pool *msgb_pool_cur;
+static unsigned int msgb_pool_count;
+
+static void msgb_pool_publish(struct msgb_pool *pool)
+{
+	struct osmo_stat_item_group *statg = pool->statg;
+
+	pool->ops = 0;
+	osmo_stat_item_set(statg->items[MSGB_POOL_STAT_HITS], pool->stats.hits);
+	osmo_stat_item_set(statg->items[MSGB_POOL_STAT_MISSES], pool->stats.misses);
+	osmo_stat_item_set(statg->items[MSGB_POOL_STAT_CACHED], pool->stats.cached);
+	osmo_stat_item_set(statg->items[MSGB_POOL_STAT_CACHED_HIGH], pool->stats.cached_high);
+}
+
+static int msgb_pool_class(uint16_t size)
+{
+	int i;
+
+	for (i = 0; i < MSGB_POOL_NUM_CLASSES; i++) {
+		if (size <= msgb_pool_class_size[i])
+			return i;
+	}
+	return -1;
+}
+
+/* take a buffer of the size class of 'size' from the pool, or allocate a
+ * new one of the class size; NULL if 'size' exceeds all size classes */
+static struct msgb *msgb_pool_get(struct msgb_pool *pool, uint16_t size, const char *name)
+{
+	struct msgb *msg;
+	int cls;
+
+	cls = msgb_pool_class(size);
+	if (cls < 0)
+		return NULL;
+
+	if (!llist_empty(&pool->free[cls])) {
+		msg = llist_entry(pool->free[cls].next, struct msgb, list);
+		llist_del(&msg->list);
+		pool->count[cls]--;
+		pool->stats.cached--;
+		pool->stats.hits++;
+		talloc_steal(tall_msgb_ctx, msg);
+		talloc_set_name_const(msg, name);
+	} else {
+		msg = talloc_named_const(tall_msgb_ctx, sizeof(*msg) + msgb_pool_class_size[cls], name);
+		if (!msg)
+			return NULL;
+		pool->stats.misses++;
+	}
+
+	if (++pool->ops >= MSGB_POOL_STAT_INTERVAL)
+		msgb_pool_publish(pool);
+	return msg;
+}
+
+/* put a released buffer on the free-list of its size class; returns false
+ * if it is not suitable for the pool or the free-list is full */
+static bool msgb_pool_put(struct msgb_pool *pool, struct msgb *msg)
+{
+	size_t size = talloc_get_size(msg) - sizeof(*msg);
+	int cls;
+
+	cls = msgb_pool_class(size);
+	if (cls < 0 || msgb_pool_class_size[cls] != size)
+		return false;
+	if (pool->count[cls] >= pool->max_cached)
+		return false;
+	/* talloc children would be leaked by re-using the buffer */
+	if (talloc_total_blocks(msg) != 1)
+		return false;
+
+	talloc_steal(pool, msg);
+	llist_add(&msg->list, &pool->free[cls]);
+	pool->count[cls]++;
+	if (++pool->stats.cached > pool->stats.cached_high)
+		pool->stats.cached_high = pool->stats.cached;
+
+	if (++pool->ops >= MSGB_POOL_STAT_INTERVAL)
+		msgb_pool_publish(pool);
+	return true;
+}
+
+static struct msgb *_msgb_alloc(uint16_t size, const char *name, bool zero)
+{
+	struct msgb *msg = NULL;
+
+	if (msgb_pool_cur)
+		msg = msgb_pool_get(msgb_pool_cur, size, name);
+
+	if (msg) {
+		/* only the header of pooled buffers is initialized */
+		memset(msg, 0x00, sizeof(*msg));
+	} else {
+		msg = talloc_named_const(tall_msgb_ctx, sizeof(*msg) + size, name);
+		if (!msg) {
+			LOGP(DLGLOBAL, LOGL_FATAL, "Unable to allocate a msgb: "
+				"name='%s', size=%u\n", name, size);
+			return NULL;
+		}
+
+		/* Manually zero-initialize allocated memory */
+		memset(msg, 0x00, zero ? sizeof(*msg) + size : sizeof(*msg));
+	}
+
+	msg->data_len = size;
+	msg->len = 0;
+	msg->data = msg->_data;
+	msg->head = msg->_data;
+	msg->tail = msg->_data;
+
+	return msg;
+}
+
 /*! Allocate a new message buffer
  * \param[in] size Length in octets, including headroom
  * \param[in] name Human-readable name to be associated with msgb
@@ -74,36 +233,134 @@ void *tall_msgb_ctx = NULL;
  * This function allocates a 'struct msgb' as well as the underlying
  * memory buffer for the actual message data (size specified by \a size)
  * using the talloc memory context previously set by \ref msgb_set_talloc_ctx
+ *
+ * If the calling thread enabled the msgb pool (see msgb_pool_enable()),
+ * the buffer is taken from the pool and its data section is not zeroed.
  */
 struct msgb *msgb_alloc(uint16_t size, const char *name)
 {
-	struct msgb *msg;
+	return _msgb_alloc(size, name, true);
+}
 
-	msg = talloc_named_const(tall_msgb_ctx, sizeof(*msg) + size, name);
-	if (!msg) {
-		LOGP(DLGLOBAL, LOGL_FATAL, "Unable to allocate a msgb: "
-			"name='%s', size=%u\n", name, size);
-		return NULL;
-	}
+static void msgb_release(struct msgb *m)
+{
+	if (msgb_pool_cur && msgb_pool_put(msgb_pool_cur, m))
+		return;
+	talloc_free(m);
+}
 
-	/* Manually zero-initialize allocated memory */
-	memset(msg, 0x00, sizeof(*msg) + size);
+/* drop a reference to the data area of 'm', release it with the last one */
+static void msgb_dataref_put(struct msgb *m)
+{
+	if (__atomic_load_n(&m->dataref, __ATOMIC_ACQUIRE) > 1 &&
+	    __atomic_sub_fetch(&m->dataref, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	msgb_release(m);
+}
 
-	msg->data_len = size;
-	msg->len = 0;
-	msg->data = msg->_data;
-	msg->head = msg->_data;
-	msg->tail = msg->_data;
+static void msgb_free_one(struct msgb *m)
+{
+	struct msgb *owner = m->data_owner;
 
-	return msg;
+	if (owner) {
+		if (owner->hdr_claim == m)
+			owner->hdr_claim = NULL;
+		msgb_dataref_put(owner);
+	} else if (m->hdr_claim == m)
+		m->hdr_claim = NULL;
+
+	msgb_dataref_put(m);
 }
 
 /*! Release given message buffer
  * \param[in] m Message buffer to be freed
+ *
+ * If the data area of \a m is still used by clones (see msgb_clone()), it
+ * is only released together with the last one of them.  All fragments of
+ * a chained msgb are released as well.
  */
 void msgb_free(struct msgb *m)
 {
-	talloc_free(m);
+	struct msgb *next;
+
+	while (m) {
+		next = m->frag_next;
+		msgb_free_one(m);
+		m = next;
+	}
+}
+
+/*! Enable the msgb pool for the calling thread
+ *  \param[in] max_cached maximum number of released msgbs kept per size class
+ *  \returns 0 on success; -EALREADY if already enabled; -ENOMEM on error
+ *
+ *  From now on, msgb_alloc() calls of this thread round the buffer up to
+ *  one of a few size classes and take it from a LIFO free-list of released
+ *  msgbs of that class, if any.  msgb_free() puts buffers of a size class
+ *  back onto its free-list instead of releasing them.  Only the \ref msgb
+ *  header of a pooled buffer is initialized, the data section is not zeroed.
+ *
+ *  Pooled msgbs remain regular talloc chunks below the msgb talloc context
+ *  while in use; msgbs released with talloc_free() rather than msgb_free()
+ *  just bypass the pool.  A msgb carrying talloc children is never cached.
+ *  Statistics are reported in the "msgb.pool" stat item group.
+ */
+int msgb_pool_enable(unsigned int max_cached)
+{
+	struct msgb_pool *pool;
+	int i;
+
+	if (msgb_pool_cur)
+		return -EALREADY;
+
+	pool = talloc_zero(NULL, struct msgb_pool);
+	if (!pool)
+		return -ENOMEM;
+	talloc_set_name_const(pool, "msgb_pool");
+
+	for (i = 0; i < MSGB_POOL_NUM_CLASSES; i++)
+		INIT_LLIST_HEAD(&pool->free[i]);
+	pool->max_cached = max_cached;
+
+	pool->statg = osmo_stat_item_group_alloc(pool, &msgb_pool_statg_desc,
+						 __atomic_fetch_add(&msgb_pool_count, 1, __ATOMIC_RELAXED));
+	if (!pool->statg) {
+		talloc_free(pool);
+		return -ENOMEM;
+	}
+
+	msgb_pool_cur = pool;
+	return 0;
+}
+
+/*! Disable the msgb pool of the calling thread and release all cached msgbs
+ *
+ *  Must be called before a thread that enabled the pool terminates.
+ */
+void msgb_pool_disable(void)
+{
+	struct msgb_pool *pool = msgb_pool_cur;
+
+	if (!pool)
+		return;
+
+	msgb_pool_cur = NULL;
+	osmo_stat_item_group_free(pool->statg);
+	talloc_free(pool);
+}
+
+/*! Get the statistics of the msgb pool of the calling thread
+ *  \param[out] stats caller-allocated structure to fill
+ *  \returns 0 on success; -ENODEV if the pool is not enabled
+ */
+int msgb_pool_get_stats(struct msgb_pool_stats *stats)
+{
+	if (!msgb_pool_cur)
+		return -ENODEV;
+
+	msgb_pool_publish(msgb_pool_cur);
+	*stats = msgb_pool_cur->stats;
+	return 0;
 }
 
 /*! Enqueue message buffer to tail of a queue
@@ -150,10 +407,12 @@ struct msgb *msgb_dequeue(struct llist_head *queue)
  */
 void msgb_reset(struct msgb *msg)
 {
+	/* a msgb using another data area keeps referring to it */
+	if (!msg->data_owner)
+		msg->head = msg->_data;
 	msg->len = 0;
-	msg->data = msg->_data;
-	msg->head = msg->_data;
-	msg->tail = msg->_data;
+	msg->data = msg->head;
+	msg->tail = msg->head;
 
 	msg->trx = NULL;
 	msg->lchan = NULL;
@@ -213,7 +472,7 @@ void *msgb_talloc_ctx_init(void *root_ctx, unsigned int pool_size)
  *
  *  This function allocates a new msgb, copies the data buffer of msg,
  *  and adjusts the pointers (incl l1h-l4h) accordingly. The cb part
- *  is not copied.
+ *  is not copied.  All fragments of a chained msgb are copied.
  *  \param[in] msg  The old msgb object
  *  \param[in] name Human-readable name to be associated with msgb
  */
@@ -226,26 +485,250 @@ struct msgb *msgb_copy(const struct msgb *msg, const char *name)
 		return NULL;
 
 	/* copy data */
-	memcpy(new_msg->_data, msg->_data, new_msg->data_len);
+	memcpy(new_msg->_data, msg->head, new_msg->data_len);
 
 	/* copy header */
 	new_msg->len = msg->len;
-	new_msg->data += msg->data - msg->_data;
-	new_msg->head += msg->head - msg->_data;
-	new_msg->tail += msg->tail - msg->_data;
+	new_msg->data += msg->data - msg->head;
+	new_msg->tail += msg->tail - msg->head;
 
 	if (msg->l1h)
-		new_msg->l1h = new_msg->_data + (msg->l1h - msg->_data);
+		new_msg->l1h = new_msg->_data + (msg->l1h - msg->head);
 	if (msg->l2h)
-		new_msg->l2h = new_msg->_data + (msg->l2h - msg->_data);
+		new_msg->l2h = new_msg->_data + (msg->l2h - msg->head);
 	if (msg->l3h)
-		new_msg->l3h = new_msg->_data + (msg->l3h - msg->_data);
+		new_msg->l3h = new_msg->_data + (msg->l3h - msg->head);
 	if (msg->l4h)
-		new_msg->l4h = new_msg->_data + (msg->l4h - msg->_data);
+		new_msg->l4h = new_msg->_data + (msg->l4h - msg->head);
+
+	if (msg->frag_next) {
+		new_msg->frag_next = msgb_copy(msg->frag_next, name);
+		if (!new_msg->frag_next) {
+			msgb_free(new_msg);
+			return NULL;
+		}
+	}
 
 	return new_msg;
 }
 
+/*! Append a fragment to a chained msgb.
+ *
+ *  A chained msgb consists of a head fragment, which carries the metadata
+ *  like the layer pointers and the cb part, followed by further fragments
+ *  whose data is transmitted after the one of the head fragment (see
+ *  osmo_sock_writev_msgb()).  This allows a protocol layer to append to or
+ *  prepend to a message without copying it.  msgb_length() and all other
+ *  msgb functions only refer to a single fragment.
+ *  \param[in] msg  head of the chain
+ *  \param[in] frag msgb (or chain) to be appended; owned by \a msg afterwards
+ */
+void msgb_frag_append(struct msgb *msg, struct msgb *frag)
+{
+	while (msg->frag_next)
+		msg = msg->frag_next;
+	msg->frag_next = frag;
+}
+
+/*! Prepend a header fragment to a chained msgb.
+ *  \param[in] msg head of the chain, owned by \a hdr afterwards
+ *  \param[in] hdr msgb holding the header(s) to be prepended
+ *  \returns \a hdr, the new head of the chain
+ *
+ *  The layer pointers and the cb part of \a msg are not transferred to
+ *  \a hdr.
+ */
+struct msgb *msgb_frag_prepend(struct msgb *msg, struct msgb *hdr)
+{
+	msgb_frag_append(hdr, msg);
+	return hdr;
+}
+
+/*! Get the number of fragments of a chained msgb.
+ *  \param[in] msg head of the chain
+ *  \returns number of fragments, including the head
+ */
+unsigned int msgb_frag_count(const struct msgb *msg)
+{
+	unsigned int count = 0;
+
+	for (; msg; msg = msg->frag_next)
+		count++;
+	return count;
+}
+
+/*! Get the length of all fragments of a chained msgb.
+ *  \param[in] msg head of the chain
+ *  \returns sum of msgb_length() of all fragments
+ */
+unsigned int msgb_chain_len(const struct msgb *msg)
+{
+	unsigned int len = 0;
+
+	for (; msg; msg = msg->frag_next)
+		len += msg->len;
+	return len;
+}
+
+/*! Copy all fragments of a chained msgb into the head fragment.
+ *
+ *  This is for consumers that need the message in one piece.  The
+ *  fragments are released afterwards.
+ *  \param[in] msg head of the chain
+ *  \returns 0 on success, -ENOSPC if the tailroom of \a msg is too small
+ */
+int msgb_linearize(struct msgb *msg)
+{
+	struct msgb *frag;
+
+	if (!msg->frag_next)
+		return 0;
+	if (msgb_tailroom(msg) < (int) (msgb_chain_len(msg) - msg->len))
+		return -ENOSPC;
+
+	for (frag = msg->frag_next; frag; frag = frag->frag_next)
+		memcpy(msgb_put(msg, frag->len), frag->data, frag->len);
+
+	frag = msg->frag_next;
+	msg->frag_next = NULL;
+	msgb_free(frag);
+
+	return 0;
+}
+
+/*! Clone an msgb without copying its data.
+ *
+ *  This function allocates a new msgb header referring to the data area
+ *  of \a msg, which is reference counted and only released with the last
+ *  msgb using it.  The pointers (incl l1h-l4h) and the cb part are the
+ *  same as in \a msg.  All fragments of a chained msgb are cloned.
+ *
+ *  Both \a msg and the clone must treat the data as read-only: msgb_put()
+ *  and msgb_resize_area() copy it first (see msgb_unshare()).  msgb_push()
+ *  writes into the headroom in place, as long as no other msgb sharing the
+ *  data did so yet; this allows one of the clones to prepend its headers
+ *  without copying.  Code modifying the data through other means must call
+ *  msgb_unshare() before.
+ *  \param[in] msg  The msgb object to be cloned
+ *  \param[in] name Human-readable name to be associated with msgb
+ *  \returns newly allocated msgb; NULL on error
+ */
+struct msgb *msgb_clone(struct msgb *msg, const char *name)
+{
+	struct msgb *owner = msg->data_owner ? msg->data_owner : msg;
+	struct msgb *new_msg;
+
+	new_msg = talloc_named_const(tall_msgb_ctx, sizeof(*new_msg), name);
+	if (!new_msg) {
+		LOGP(DLGLOBAL, LOGL_FATAL, "Unable to clone a msgb: "
+			"name='%s'\n", name);
+		return NULL;
+	}
+
+	memcpy(new_msg, msg, sizeof(*new_msg));
+	INIT_LLIST_HEAD(&new_msg->list);
+	new_msg->data_owner = owner;
+	new_msg->dataref = 0;
+	new_msg->hdr_claim = NULL;
+	new_msg->hdr_end = NULL;
+	new_msg->frag_next = NULL;
+
+	if (!owner->hdr_end || msg->data < owner->hdr_end)
+		owner->hdr_end = msg->data;
+	if (!owner->dataref)
+		owner->dataref = 1;
+	__atomic_add_fetch(&owner->dataref, 1, __ATOMIC_RELAXED);
+
+	if (msg->frag_next) {
+		new_msg->frag_next = msgb_clone(msg->frag_next, name);
+		if (!new_msg->frag_next) {
+			msgb_free(new_msg);
+			return NULL;
+		}
+	}
+
+	return new_msg;
+}
+
+/*! Give an msgb a private copy of a shared data area.
+ *
+ *  If the data area of \a msg is shared with clones (see msgb_clone()), copy
+ *  it and adjust the pointers (incl l1h-l4h and pointers into the data kept
+ *  in the cb part) accordingly.  Does nothing otherwise.
+ *  \param[in] msg The msgb object
+ *  \returns 0 on success, -ENOMEM if the data area could not be copied
+ */
+int msgb_unshare(struct msgb *msg)
+{
+	struct msgb *owner = msg->data_owner;
+	struct msgb *area;
+	unsigned char *old = msg->head;
+	unsigned char *old_end = old + msg->data_len;
+	ptrdiff_t offs;
+	int i;
+
+	if (!msgb_shared(msg))
+		return 0;
+
+	/* the new data area is referred to by msg only; its own header is
+	 * never used as msgb */
+	area = _msgb_alloc(msg->data_len, talloc_get_name(msg), false);
+	if (!area)
+		return -ENOMEM;
+	area->dataref = 1;
+	memcpy(area->_data, old, msg->data_len);
+
+	offs = area->_data - old;
+	msg->head += offs;
+	msg->data += offs;
+	msg->tail += offs;
+	if (msg->l1h)
+		msg->l1h += offs;
+	if (msg->l2h)
+		msg->l2h += offs;
+	if (msg->l3h)
+		msg->l3h += offs;
+	if (msg->l4h)
+		msg->l4h += offs;
+	/* like the libgb header pointers */
+	for (i = 0; i < ARRAY_SIZE(msg->cb); i++) {
+		unsigned char *p = (unsigned char *)msg->cb[i];
+		if (p >= old && p <= old_end)
+			msg->cb[i] += offs;
+	}
+
+	if (owner) {
+		if (owner->hdr_claim == msg)
+			owner->hdr_claim = NULL;
+		msgb_dataref_put(owner);
+	} else if (msg->hdr_claim == msg)
+		msg->hdr_claim = NULL;
+	msg->data_owner = area;
+
+	return 0;
+}
+
+/*! Prepare a shared msgb for writing into its headroom.
+ *
+ *  Called by msgb_push() for msgbs sharing their data area.  The headroom
+ *  in front of the data the clones were made of can be used in place by
+ *  one of the msgbs sharing it; everyone else gets a private copy.
+ *  \param[in] msg The msgb object
+ *  \returns 0 on success, -ENOMEM if the data area could not be copied
+ */
+int msgb_cow_head(struct msgb *msg)
+{
+	struct msgb *owner = msg->data_owner ? msg->data_owner : msg;
+
+	if (msg->data <= owner->hdr_end &&
+	    (!owner->hdr_claim || owner->hdr_claim == msg)) {
+		owner->hdr_claim = msg;
+		return 0;
+	}
+
+	return msgb_unshare(msg);
+}
+
 /*! Resize an area within an msgb
  *
  *  This resizes a sub area of the msgb data and adjusts the pointers (incl
@@ -276,6 +759,14 @@ int msgb_resize_area(struct msgb *msg, uint8_t *area,
 	if (delta_size == 0)
 		return 0;
 
+	if (msgb_shared(msg)) {
+		ptrdiff_t offs = area - msg->head;
+		if (msgb_unshare(msg) < 0)
+			return -1;
+		area = msg->head + offs;
+		post_start = area + old_size;
+	}
+
 	if (delta_size > 0) {
 		rc = msgb_trim(msg, msg->len + delta_size);
 		if (rc < 0)
@@ -412,6 +903,8 @@ int msgb_printf(struct msgb *msgb, const char *format, ...)
 	 * be able to store a string terminator (nullstring) */
 	if (msgb_tailroom(msgb) < 1)
 		return -EINVAL;
+	if (msgb_unshare(msgb) < 0)
+		return -ENOMEM;
 
 	va_start(args, format);
 
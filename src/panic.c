@@ -29,6 +29,7 @@
 
 #include <osmocom/core/panic.h>
 #include <osmocom/core/backtrace.h>
+#include <osmocom/core/logging.h>
 
 #include "../config.h"
 
@@ -75,6 +76,9 @@ void osmo_panic(const char *fmt, ...)
 {
 	va_list args;
 
+	/* don't lose the log lines leading up to the panic */
+	log_async_flush();
+
 	va_start(args, fmt);
 
 	if (osmo_panic_handler)
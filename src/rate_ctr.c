@@ -57,8 +57,12 @@
  *
  * \file rate_ctr.c */
 
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <osmocom/core/utils.h>
@@ -72,6 +76,40 @@ static LLIST_HEAD(rate_ctr_groups);
 
 static void *tall_rate_ctr_ctx;
 
+/* size of a cache line; per-thread rows of counters never share one */
+#define RATE_CTR_CACHE_LINE	64
+#define RATE_CTR_PER_LINE	(RATE_CTR_CACHE_LINE / sizeof(uint64_t))
+
+/* per-thread counts of the counters of a sharded group */
+struct rate_ctr_shards {
+	/* number of per-thread rows; one more row is shared by all other
+	 * threads and updated atomically */
+	unsigned int num;
+	/* counters per row, rounded up to full cache lines */
+	unsigned int stride;
+	/* (num + 1) * stride counts already added to rate_ctr.current; only
+	 * used by the thread owning the group */
+	uint64_t *folded;
+	/* (num + 1) * stride counts, cache line aligned */
+	uint64_t *rows;
+};
+
+/* Shard numbers are process-wide: a thread keeps the number it got on
+ * its first rate_ctr_add_sharded() for all sharded groups, and gives it
+ * back when it exits.  Threads always get the lowest free number, so the
+ * threads alive at the same time use the first rows of each group. */
+#define RATE_CTR_SHARD_BITS	(sizeof(unsigned long) * CHAR_BIT)
+
+/* shard of the calling thread plus 1; 0 if not assigned yet */
+static __thread unsigned int rate_ctr_thread_shard;
+static pthread_once_t rate_ctr_shard_once = PTHREAD_ONCE_INIT;
+/* holds the shard number of each thread, to release it on thread exit */
+static pthread_key_t rate_ctr_shard_key;
+static pthread_mutex_t rate_ctr_shard_lock = PTHREAD_MUTEX_INITIALIZER;
+/* bit n - 1 is set while shard number n is in use */
+static unsigned long *rate_ctr_shards_used;
+static unsigned int rate_ctr_shards_used_words;
+
 
 static bool rate_ctrl_group_desc_validate(const struct rate_ctr_group_desc *desc, bool quiet)
 {
@@ -200,14 +238,43 @@ static unsigned int rate_ctr_get_unused_name_idx(const char *name)
 	return idx;
 }
 
-/*! Allocate a new group of counters according to description
- *  \param[in] ctx \ref talloc context
- *  \param[in] desc Rate counter group description
- *  \param[in] idx Index of new counter group
- */
-struct rate_ctr_group *rate_ctr_group_alloc(void *ctx,
-					    const struct rate_ctr_group_desc *desc,
-					    unsigned int idx)
+static int rate_ctr_group_shards_alloc(struct rate_ctr_group *group, unsigned int num_shards)
+{
+	struct rate_ctr_shards *shards;
+	unsigned int stride, i;
+	size_t len;
+	void *mem;
+
+	shards = talloc_zero(group, struct rate_ctr_shards);
+	if (!shards)
+		return -ENOMEM;
+
+	stride = (group->desc->num_ctr + RATE_CTR_PER_LINE - 1) / RATE_CTR_PER_LINE * RATE_CTR_PER_LINE;
+	len = (size_t)(num_shards + 1) * stride * sizeof(uint64_t);
+
+	shards->num = num_shards;
+	shards->stride = stride;
+	shards->folded = talloc_zero_size(shards, len);
+	/* talloc does not align to cache lines */
+	mem = talloc_zero_size(shards, len + RATE_CTR_CACHE_LINE - 1);
+	if (!shards->folded || !mem) {
+		talloc_free(shards);
+		return -ENOMEM;
+	}
+	shards->rows = (uint64_t *)(((uintptr_t)mem + RATE_CTR_CACHE_LINE - 1) &
+				    ~(uintptr_t)(RATE_CTR_CACHE_LINE - 1));
+
+	for (i = 0; i < group->desc->num_ctr; i++) {
+		group->ctr[i].shards = shards;
+		group->ctr[i].shard_idx = i;
+	}
+
+	return 0;
+}
+
+static struct rate_ctr_group *_rate_ctr_group_alloc(void *ctx,
+						    const struct rate_ctr_group_desc *desc,
+						    unsigned int idx, unsigned int num_shards)
 {
 	unsigned int size;
 	struct rate_ctr_group *group;
@@ -242,11 +309,59 @@ struct rate_ctr_group *rate_ctr_group_alloc(void *ctx,
 	group->desc = desc;
 	group->idx = idx;
 
+	if (num_shards && rate_ctr_group_shards_alloc(group, num_shards) < 0) {
+		talloc_free(group);
+		return NULL;
+	}
+
 	llist_add(&group->list, &rate_ctr_groups);
 
 	return group;
 }
 
+/*! Allocate a new group of counters according to description
+ *  \param[in] ctx \ref talloc context
+ *  \param[in] desc Rate counter group description
+ *  \param[in] idx Index of new counter group
+ */
+struct rate_ctr_group *rate_ctr_group_alloc(void *ctx,
+					    const struct rate_ctr_group_desc *desc,
+					    unsigned int idx)
+{
+	return _rate_ctr_group_alloc(ctx, desc, idx, 0);
+}
+
+/*! Allocate a new group of counters that other threads may increment
+ *  \param[in] ctx \ref talloc context
+ *  \param[in] desc Rate counter group description
+ *  \param[in] idx Index of new counter group
+ *  \param[in] num_shards Number of threads with a row of counts of their own
+ *
+ *  Other threads increment the counters with rate_ctr_add_sharded(), which
+ *  adds to a row of counts of the calling thread.  The rows are aligned to
+ *  and padded to cache lines, so threads don't contend for them.  The
+ *  thread owning the group, i.e. running the main loop, may still use
+ *  rate_ctr_add().
+ *
+ *  Each thread calling rate_ctr_add_sharded() gets a shard number, which
+ *  is the same for all sharded groups and is given back when the thread
+ *  exits.  Threads get the lowest number not in use, so as long as at
+ *  most num_shards threads use sharded counters at the same time, each of
+ *  them has a row of its own.  Threads with higher numbers share one row,
+ *  which they update with atomic operations.
+ *
+ *  The per-thread counts are added to rate_ctr.current by the thread
+ *  owning the group: once a second, by rate_ctr_difference(),
+ *  rate_ctr_get() and rate_ctr_for_each_counter().  Reading
+ *  rate_ctr.current directly may miss the counts of the last second.
+ */
+struct rate_ctr_group *rate_ctr_group_alloc_sharded(void *ctx,
+						    const struct rate_ctr_group_desc *desc,
+						    unsigned int idx, unsigned int num_shards)
+{
+	return _rate_ctr_group_alloc(ctx, desc, idx, num_shards ? num_shards : 1);
+}
+
 /*! Free the memory for the specified group of counters */
 void rate_ctr_group_free(struct rate_ctr_group *grp)
 {
@@ -260,10 +375,124 @@ void rate_ctr_add(struct rate_ctr *ctr, int inc)
 	ctr->current += inc;
 }
 
+static void rate_ctr_shard_release(void *arg)
+{
+	unsigned int bit = (uintptr_t)arg - 1;
+
+	pthread_mutex_lock(&rate_ctr_shard_lock);
+	rate_ctr_shards_used[bit / RATE_CTR_SHARD_BITS] &= ~(1UL << (bit % RATE_CTR_SHARD_BITS));
+	pthread_mutex_unlock(&rate_ctr_shard_lock);
+}
+
+static void rate_ctr_shard_key_init(void)
+{
+	pthread_key_create(&rate_ctr_shard_key, rate_ctr_shard_release);
+}
+
+/* assign the lowest free shard number to the calling thread; UINT_MAX
+ * makes it use the shared row if that fails */
+static unsigned int rate_ctr_shard_acquire(void)
+{
+	unsigned long *used;
+	unsigned int word, bit;
+
+	pthread_once(&rate_ctr_shard_once, rate_ctr_shard_key_init);
+
+	pthread_mutex_lock(&rate_ctr_shard_lock);
+	for (word = 0; word < rate_ctr_shards_used_words; word++) {
+		if (~rate_ctr_shards_used[word])
+			break;
+	}
+	if (word == rate_ctr_shards_used_words) {
+		/* not talloc, the shard numbers outlive any context */
+		used = realloc(rate_ctr_shards_used, (word + 1) * sizeof(*used));
+		if (!used) {
+			pthread_mutex_unlock(&rate_ctr_shard_lock);
+			return UINT_MAX;
+		}
+		used[word] = 0;
+		rate_ctr_shards_used = used;
+		rate_ctr_shards_used_words++;
+	}
+	bit = __builtin_ctzl(~rate_ctr_shards_used[word]);
+	rate_ctr_shards_used[word] |= 1UL << bit;
+	pthread_mutex_unlock(&rate_ctr_shard_lock);
+
+	bit += word * RATE_CTR_SHARD_BITS;
+	/* released by rate_ctr_shard_release() when the thread exits */
+	pthread_setspecific(rate_ctr_shard_key, (void *)(uintptr_t)(bit + 1));
+	return bit + 1;
+}
+
+/*! Add a number to the counter of a sharded group, from any thread
+ *  \param ctr \ref rate_ctr of a group allocated by rate_ctr_group_alloc_sharded()
+ *  \param inc quantity to increment \a ctr by
+ *
+ *  For counters of other groups, this falls back to an atomic add, which
+ *  is only safe as long as no thread uses rate_ctr_add() on the counter. */
+void rate_ctr_add_sharded(struct rate_ctr *ctr, int inc)
+{
+	struct rate_ctr_shards *shards = ctr->shards;
+	unsigned int shard = rate_ctr_thread_shard;
+	uint64_t *count;
+
+	if (!shards) {
+		__atomic_add_fetch(&ctr->current, inc, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (!shard) {
+		shard = rate_ctr_shard_acquire();
+		rate_ctr_thread_shard = shard;
+	}
+
+	if (shard <= shards->num) {
+		/* only this thread writes to its row */
+		count = &shards->rows[(shard - 1) * shards->stride + ctr->shard_idx];
+		__atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + inc,
+				 __ATOMIC_RELAXED);
+	} else {
+		count = &shards->rows[shards->num * shards->stride + ctr->shard_idx];
+		__atomic_add_fetch(count, inc, __ATOMIC_RELAXED);
+	}
+}
+
+/* add the per-thread counts of a sharded counter to ctr->current */
+static void rate_ctr_collect(struct rate_ctr *ctr)
+{
+	struct rate_ctr_shards *shards = ctr->shards;
+	unsigned int i;
+
+	if (!shards)
+		return;
+
+	for (i = ctr->shard_idx; i < (shards->num + 1) * shards->stride; i += shards->stride) {
+		uint64_t count = __atomic_load_n(&shards->rows[i], __ATOMIC_RELAXED);
+
+		ctr->current += count - shards->folded[i];
+		shards->folded[i] = count;
+	}
+}
+
+/*! Return the current value of a counter
+ *  \param ctr \ref rate_ctr to read
+ *  \returns rate_ctr.current, including the per-thread counts of sharded
+ *	counters, which rate_ctr.current only contains after collecting them
+ *
+ *  Must be called by the thread owning the group of \a ctr. */
+uint64_t rate_ctr_get(struct rate_ctr *ctr)
+{
+	rate_ctr_collect(ctr);
+	return ctr->current;
+}
+
 /*! Return the counter difference since the last call to this function */
 int64_t rate_ctr_difference(struct rate_ctr *ctr)
 {
-	int64_t result = ctr->current - ctr->previous;
+	int64_t result;
+
+	rate_ctr_collect(ctr);
+	result = ctr->current - ctr->previous;
 	ctr->previous = ctr->current;
 
 	return result;
@@ -296,6 +525,7 @@ static void rate_ctr_group_intv(struct rate_ctr_group *grp)
 	for (i = 0; i < grp->desc->num_ctr; i++) {
 		struct rate_ctr *ctr = &grp->ctr[i];
 
+		rate_ctr_collect(ctr);
 		interval_expired(ctr, RATE_CTR_INTV_SEC);
 		if ((timer_ticks % 60) == 0)
 			interval_expired(ctr, RATE_CTR_INTV_MIN);
@@ -389,6 +619,7 @@ int rate_ctr_for_each_counter(struct rate_ctr_group *ctrg,
 
 	for (i = 0; i < ctrg->desc->num_ctr; i++) {
 		struct rate_ctr *ctr = &ctrg->ctr[i];
+		rate_ctr_collect(ctr);
 		rc = handle_counter(ctrg,
 			ctr, &ctrg->desc->ctr_desc[i], data);
 		if (rc < 0)
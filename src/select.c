@@ -31,25 +31,523 @@
 #include <string.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <limits.h>
 
 #include <osmocom/core/select.h>
+#include <osmocom/core/talloc.h>
 #include <osmocom/core/linuxlist.h>
 #include <osmocom/core/timer.h>
+#include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/stat_item.h>
+#include <osmocom/core/stats.h>
+#include <osmocom/core/utils.h>
 
 #include "../config.h"
 
 #ifdef HAVE_SYS_SELECT_H
 #include <sys/select.h>
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 /*! \addtogroup select
  *  @{
  *  select() loop abstraction
  *
  * \file select.c */
 
-static int maxfd = 0;
-static LLIST_HEAD(osmo_fds);
-static int unregistered_count;
+#ifdef OSMO_SELECT_DEFAULT_EPOLL
+#define SELECT_DEFAULT_BACKEND	OSMO_SELECT_BACKEND_EPOLL
+#else
+#define SELECT_DEFAULT_BACKEND	OSMO_SELECT_BACKEND_SELECT
+#endif
+
+/*! maximum number of events fetched by one epoll_wait() call */
+#define EPOLL_MAX_EVENTS	256
+
+enum select_ctr {
+	SELECT_CTR_ITERATIONS,
+	SELECT_CTR_SLOW_ITERATIONS,
+	SELECT_CTR_FD_CALLBACKS,
+	SELECT_CTR_FD_SLOW,
+	SELECT_CTR_TIMER_FIRED,
+};
+
+static const struct rate_ctr_desc select_ctr_description[] = {
+	[SELECT_CTR_ITERATIONS]		= { "loop:iterations",	"Loop iterations           " },
+	[SELECT_CTR_SLOW_ITERATIONS]	= { "loop:slow",	"Iterations above threshold" },
+	[SELECT_CTR_FD_CALLBACKS]	= { "fd:callbacks",	"fd call-backs             " },
+	[SELECT_CTR_FD_SLOW]		= { "fd:slow",		"fd call-backs above thresh" },
+	[SELECT_CTR_TIMER_FIRED]	= { "timer:fired",	"Timers fired              " },
+};
+
+static const struct rate_ctr_group_desc select_ctrg_desc = {
+	.group_name_prefix = "select",
+	.group_description = "Event Loop Counters",
+	.num_ctr = ARRAY_SIZE(select_ctr_description),
+	.ctr_desc = select_ctr_description,
+	.class_id = OSMO_STATS_CLASS_GLOBAL,
+};
+
+enum select_stat {
+	SELECT_STAT_BUSY,
+	SELECT_STAT_FD_CB_MAX,
+	SELECT_STAT_FD_CB_MAX_FD,
+	SELECT_STAT_FD_CB_MAX_PRIV,
+	SELECT_STAT_TIMER_FIRED,
+	SELECT_STAT_TIMER_LATE_MAX,
+	SELECT_STAT_TIMER_CB_MAX,
+};
+
+static const struct osmo_stat_item_desc select_stat_description[] = {
+	[SELECT_STAT_BUSY]		= { "loop.busy", "Time spent handling one iteration", "us", 16, 0 },
+	[SELECT_STAT_FD_CB_MAX]		= { "fd.cb_max", "Longest fd call-back of an iteration", "us", 16, 0 },
+	[SELECT_STAT_FD_CB_MAX_FD]	= { "fd.cb_max_fd", "fd of the longest call-back", OSMO_STAT_ITEM_NO_UNIT, 16, -1 },
+	[SELECT_STAT_FD_CB_MAX_PRIV]	= { "fd.cb_max_priv", "priv_nr of the longest call-back", OSMO_STAT_ITEM_NO_UNIT, 16, 0 },
+	[SELECT_STAT_TIMER_FIRED]	= { "timer.fired", "Timers fired in one iteration", OSMO_STAT_ITEM_NO_UNIT, 16, 0 },
+	[SELECT_STAT_TIMER_LATE_MAX]	= { "timer.late_max", "Largest timer lateness of an iteration", "us", 16, 0 },
+	[SELECT_STAT_TIMER_CB_MAX]	= { "timer.cb_max", "Longest timer call-back of an iteration", "us", 16, 0 },
+};
+
+static const struct osmo_stat_item_group_desc select_statg_desc = {
+	.group_name_prefix = "select",
+	.group_description = "Event Loop Statistics",
+	.num_items = ARRAY_SIZE(select_stat_description),
+	.item_desc = select_stat_description,
+	.class_id = OSMO_STATS_CLASS_GLOBAL,
+};
+
+/* instrumentation of one event loop, only allocated if enabled */
+struct select_stats {
+	struct rate_ctr_group *ctrg;
+	struct osmo_stat_item_group *statg;
+	/* call-backs / iterations taking longer are counted as slow */
+	uint64_t slow_ns;
+
+	/* current iteration */
+	struct timespec start;
+	unsigned int callbacks;
+	uint64_t cb_max_ns;
+	int cb_max_fd;
+	unsigned int cb_max_priv;
+	struct osmo_timers_stats timers;
+};
+
+/* registration of one fd number, see osmo_select_ctx.fd_table */
+struct fd_slot {
+	/* registered osmo_fd; NULL if none */
+	struct osmo_fd *ofd;
+	/* value of osmo_select_ctx.generation when ofd was registered */
+	unsigned long generation;
+	/* 'when' flags as currently installed in the epoll set */
+	unsigned int epoll_when;
+};
+
+/*! state of one event loop: its file descriptors and timers */
+struct osmo_select_ctx {
+	/* index of the stats groups of this context */
+	unsigned int idx;
+	/* NULL unless instrumentation is enabled */
+	struct select_stats *stats;
+
+	int maxfd;
+	struct llist_head fds;
+	/* all registered osmo_fds, indexed by fd number for O(1) lookup */
+	struct fd_slot *fd_table;
+	unsigned int fd_table_size;
+	/* incremented on every registration; call-backs are only
+	 * dispatched for fds registered before the dispatch started, so
+	 * that an fd number closed and re-used by a call-back is not
+	 * dispatched with stale events */
+	unsigned long generation;
+	enum osmo_select_backend backend;
+	/* NULL for the default timer context */
+	struct osmo_timers_ctx *timers;
+#ifdef HAVE_SYS_EPOLL_H
+	int epoll_fd;
+	/* events returned by the last epoll_wait() */
+	struct epoll_event epoll_events[EPOLL_MAX_EVENTS];
+#endif
+};
+
+/* used by all threads that did not switch to a context of their own */
+static struct osmo_select_ctx select_default = {
+	.fds = LLIST_HEAD_INIT(select_default.fds),
+	.backend = SELECT_DEFAULT_BACKEND,
+#ifdef HAVE_SYS_EPOLL_H
+	.epoll_fd = -1,
+#endif
+};
+
+static __thread struct osmo_select_ctx *select_cur;
+
+static unsigned int select_ctx_count = 1;
+
+static inline struct osmo_select_ctx *select_ctx(void)
+{
+	return select_cur ? select_cur : &select_default;
+}
+
+static inline uint64_t ts_ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static void stats_iter_begin(struct select_stats *st)
+{
+	osmo_clock_gettime(CLOCK_MONOTONIC, &st->start);
+	st->callbacks = 0;
+	st->cb_max_ns = 0;
+	st->cb_max_fd = -1;
+	st->cb_max_priv = 0;
+	memset(&st->timers, 0, sizeof(st->timers));
+}
+
+static void stats_iter_end(struct select_stats *st)
+{
+	struct osmo_stat_item **items = st->statg->items;
+	struct timespec end;
+	uint64_t busy;
+
+	rate_ctr_inc(&st->ctrg->ctr[SELECT_CTR_ITERATIONS]);
+	/* only record iterations that actually did something, so the
+	 * values are not drowned in idle wake-ups */
+	if (!st->callbacks && !st->timers.fired)
+		return;
+
+	osmo_clock_gettime(CLOCK_MONOTONIC, &end);
+	busy = ts_ns(&end) - ts_ns(&st->start);
+	if (busy > st->slow_ns)
+		rate_ctr_inc(&st->ctrg->ctr[SELECT_CTR_SLOW_ITERATIONS]);
+	rate_ctr_add(&st->ctrg->ctr[SELECT_CTR_FD_CALLBACKS], st->callbacks);
+	rate_ctr_add(&st->ctrg->ctr[SELECT_CTR_TIMER_FIRED], st->timers.fired);
+
+	osmo_stat_item_set(items[SELECT_STAT_BUSY], busy / 1000);
+	if (st->callbacks) {
+		osmo_stat_item_set(items[SELECT_STAT_FD_CB_MAX], st->cb_max_ns / 1000);
+		osmo_stat_item_set(items[SELECT_STAT_FD_CB_MAX_FD], st->cb_max_fd);
+		osmo_stat_item_set(items[SELECT_STAT_FD_CB_MAX_PRIV], st->cb_max_priv);
+	}
+	if (st->timers.fired) {
+		osmo_stat_item_set(items[SELECT_STAT_TIMER_FIRED], st->timers.fired);
+		osmo_stat_item_set(items[SELECT_STAT_TIMER_LATE_MAX], st->timers.late_max_ns / 1000);
+		osmo_stat_item_set(items[SELECT_STAT_TIMER_CB_MAX], st->timers.cb_max_ns / 1000);
+	}
+}
+
+static int fd_dispatch_measured(struct select_stats *st, struct osmo_fd *ofd,
+				unsigned int what)
+{
+	struct timespec before, after;
+	uint64_t duration;
+	int fd = ofd->fd;
+	unsigned int priv_nr = ofd->priv_nr;
+	int rc;
+
+	osmo_clock_gettime(CLOCK_MONOTONIC, &before);
+	/* ofd may be freed by the call-back */
+	rc = ofd->cb(ofd, what);
+	osmo_clock_gettime(CLOCK_MONOTONIC, &after);
+
+	duration = ts_ns(&after) - ts_ns(&before);
+	st->callbacks++;
+	if (duration > st->slow_ns)
+		rate_ctr_inc(&st->ctrg->ctr[SELECT_CTR_FD_SLOW]);
+	if (duration >= st->cb_max_ns) {
+		st->cb_max_ns = duration;
+		st->cb_max_fd = fd;
+		st->cb_max_priv = priv_nr;
+	}
+
+	return rc;
+}
+
+/* call the call-back of an osmo_fd; kept tiny for the common case of
+ * disabled instrumentation */
+static inline int fd_dispatch(struct osmo_select_ctx *ctx, struct osmo_fd *ofd,
+			      unsigned int what)
+{
+	if (ctx->stats)
+		return fd_dispatch_measured(ctx->stats, ofd, what);
+	return ofd->cb(ofd, what);
+}
+
+/* make sure fd_table[] can be indexed by \a fd */
+static int fd_table_grow(struct osmo_select_ctx *ctx, int fd)
+{
+	unsigned int new_size;
+	struct fd_slot *new_table;
+
+	if (fd < 0)
+		return -EBADF;
+	if (fd < ctx->fd_table_size)
+		return 0;
+
+	new_size = ctx->fd_table_size ? ctx->fd_table_size : 64;
+	while (new_size <= fd)
+		new_size *= 2;
+
+	new_table = talloc_realloc(NULL, ctx->fd_table, struct fd_slot, new_size);
+	if (!new_table)
+		return -ENOMEM;
+	memset(new_table + ctx->fd_table_size, 0,
+	       (new_size - ctx->fd_table_size) * sizeof(*new_table));
+	ctx->fd_table = new_table;
+	ctx->fd_table_size = new_size;
+
+	return 0;
+}
+
+/* fd number \a ofd is registered under; -1 if not registered.  That is
+ * ofd->reg_fd, as callers may have changed or reset ofd->fd since.  It
+ * is only trusted if the slot points back to \a ofd, as it is garbage
+ * in osmo_fds that were never registered. */
+static int fd_table_find(struct osmo_select_ctx *ctx, const struct osmo_fd *ofd)
+{
+	int fd = ofd->reg_fd;
+
+	if (fd >= 0 && fd < ctx->fd_table_size && ctx->fd_table[fd].ofd == ofd)
+		return fd;
+	return -1;
+}
+
+/* osmo_fd registered for fd number \a fd before dispatching started at
+ * \a generation; NULL if none */
+static inline struct osmo_fd *fd_lookup_dispatch(struct osmo_select_ctx *ctx, int fd,
+						 unsigned long generation)
+{
+	struct fd_slot *slot;
+
+	if (fd < 0 || fd >= ctx->fd_table_size)
+		return NULL;
+	slot = &ctx->fd_table[fd];
+	if (!slot->ofd || slot->generation > generation)
+		return NULL;
+	return slot->ofd;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+
+static uint32_t when2epoll(unsigned int when)
+{
+	uint32_t events = 0;
+
+	if (when & BSC_FD_READ)
+		events |= EPOLLIN;
+	if (when & BSC_FD_WRITE)
+		events |= EPOLLOUT;
+	if (when & BSC_FD_EXCEPT)
+		events |= EPOLLPRI;
+
+	return events;
+}
+
+static unsigned int epoll2what(uint32_t events)
+{
+	unsigned int what = 0;
+
+	if (events & EPOLLIN)
+		what |= BSC_FD_READ;
+	if (events & EPOLLOUT)
+		what |= BSC_FD_WRITE;
+	if (events & EPOLLPRI)
+		what |= BSC_FD_EXCEPT;
+	/* select() reports errors and hang-ups as readable + writable */
+	if (events & (EPOLLERR | EPOLLHUP))
+		what |= BSC_FD_READ | BSC_FD_WRITE;
+
+	return what;
+}
+
+/* bring the epoll set in line with the current 'when' flags of \a ofd.
+ * Fds without any 'when' flags are kept out of the epoll set, as the
+ * kernel would otherwise keep reporting EPOLLHUP/EPOLLERR for them. */
+static int epoll_sync_fd(struct osmo_select_ctx *ctx, struct osmo_fd *ofd)
+{
+	struct epoll_event ev = {
+		.events = when2epoll(ofd->when),
+		.data.fd = ofd->fd,
+	};
+	unsigned int old;
+	int rc;
+
+	/* the fd table was grown on registration */
+	if (ofd->fd < 0 || ofd->fd >= ctx->fd_table_size)
+		return -EBADF;
+
+	old = ctx->fd_table[ofd->fd].epoll_when;
+	if (old == ofd->when)
+		return 0;
+
+	if (!old)
+		rc = epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ofd->fd, &ev);
+	else if (!ofd->when)
+		rc = epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, ofd->fd, &ev);
+	else
+		rc = epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, ofd->fd, &ev);
+	if (rc < 0)
+		return -errno;
+
+	ctx->fd_table[ofd->fd].epoll_when = ofd->when;
+	return 0;
+}
+
+static void epoll_unregister(struct osmo_select_ctx *ctx, int fd)
+{
+	struct fd_slot *slot = &ctx->fd_table[fd];
+
+	if (slot->epoll_when) {
+		/* may fail with EBADF if the fd was closed before being
+		 * unregistered; the kernel has dropped it then anyway */
+		epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+		slot->epoll_when = 0;
+	}
+}
+
+static int epoll_init(struct osmo_select_ctx *ctx)
+{
+	struct osmo_fd *ufd;
+	unsigned int i;
+
+	if (ctx->epoll_fd >= 0)
+		return 0;
+
+	ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (ctx->epoll_fd < 0)
+		return -errno;
+
+	for (i = 0; i < ctx->fd_table_size; i++)
+		ctx->fd_table[i].epoll_when = 0;
+
+	/* adopt all osmo_fds that were registered before */
+	llist_for_each_entry(ufd, &ctx->fds, list)
+		epoll_sync_fd(ctx, ufd);
+
+	return 0;
+}
+
+static void epoll_exit(struct osmo_select_ctx *ctx)
+{
+	if (ctx->epoll_fd < 0)
+		return;
+	close(ctx->epoll_fd);
+	ctx->epoll_fd = -1;
+}
+
+static int epoll_main(struct osmo_select_ctx *ctx, int polling)
+{
+	struct timeval *tv;
+	struct osmo_fd *ufd;
+	unsigned long generation;
+	int64_t timeout_ms;
+	int timeout = 0;
+	int i, rc, work = 0;
+
+	/* Users are allowed to modify ofd->when at any time without
+	 * notifying us, so pick up any changes before waiting.  This is a
+	 * plain memory compare for all fds; only fds whose flags actually
+	 * changed cost an epoll_ctl() syscall. */
+	llist_for_each_entry(ufd, &ctx->fds, list)
+		epoll_sync_fd(ctx, ufd);
+
+	if (!polling) {
+		osmo_timers_prepare();
+		tv = osmo_timers_nearest();
+		if (!tv)
+			timeout = -1;
+		else {
+			timeout_ms = (int64_t)tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
+			/* timers further away than ~24 days wake us up early */
+			timeout = timeout_ms > INT_MAX ? INT_MAX : timeout_ms;
+		}
+	}
+
+	rc = epoll_wait(ctx->epoll_fd, ctx->epoll_events, EPOLL_MAX_EVENTS, timeout);
+	if (rc < 0)
+		return 0;
+	generation = ctx->generation;
+
+	if (ctx->stats)
+		stats_iter_begin(ctx->stats);
+
+	/* read the clock once for timers and all call-backs */
+	osmo_timers_freeze_now();
+
+	/* fire timers */
+	osmo_timers_update();
+
+	/* call registered callback functions, only for fds that are ready */
+	for (i = 0; i < rc; i++) {
+		unsigned int flags;
+
+		/* skips fds unregistered (and maybe re-used) by a previous
+		 * call-back */
+		ufd = fd_lookup_dispatch(ctx, ctx->epoll_events[i].data.fd, generation);
+		if (!ufd)
+			continue;
+
+		flags = epoll2what(ctx->epoll_events[i].events) & ufd->when;
+		if (flags) {
+			work = 1;
+			fd_dispatch(ctx, ufd, flags);
+		}
+	}
+
+	osmo_timers_thaw_now();
+
+	if (ctx->stats)
+		stats_iter_end(ctx->stats);
+
+	return work;
+}
+#endif /* HAVE_SYS_EPOLL_H */
+
+/*! Select the back-end to be used by osmo_select_main()
+ *  \param[in] backend back-end to use from now on
+ *  \returns 0 on success; negative in case of error
+ *
+ *  All osmo_fds already registered are transferred to the new back-end.
+ *  Must not be called from within an osmo_fd call-back.  This applies
+ *  to the \ref osmo_select_ctx of the calling thread only.
+ */
+int osmo_select_set_backend(enum osmo_select_backend backend)
+{
+	struct osmo_select_ctx *ctx = select_ctx();
+
+	switch (backend) {
+	case OSMO_SELECT_BACKEND_SELECT:
+#ifdef HAVE_SYS_EPOLL_H
+		epoll_exit(ctx);
+#endif
+		break;
+	case OSMO_SELECT_BACKEND_EPOLL:
+#ifdef HAVE_SYS_EPOLL_H
+	{
+		int rc = epoll_init(ctx);
+		if (rc < 0) {
+			epoll_exit(ctx);
+			return rc;
+		}
+		break;
+	}
+#else
+		return -ENOTSUP;
+#endif
+	default:
+		return -EINVAL;
+	}
+
+	ctx->backend = backend;
+	return 0;
+}
+
+/*! Get the back-end currently used by osmo_select_main()
+ *  \returns currently active back-end */
+enum osmo_select_backend osmo_select_get_backend(void)
+{
+	return select_ctx()->backend;
+}
 
 /*! Set up an osmo-fd. Will not register it.
  *  \param[inout] ofd Osmo FD to be set-up
@@ -70,29 +568,40 @@ void osmo_fd_setup(struct osmo_fd *ofd, int fd, unsigned int when,
 	ofd->priv_nr = priv_nr;
 }
 
+/*! Change the 'when' flags of an osmo_fd
+ *  \param[inout] ofd Osmo FD whose flags to change
+ *  \param[in] when_mask bit-mask of BSC_FD_{READ,WRITE,EXCEPT} to keep
+ *  \param[in] when_set bit-mask of BSC_FD_{READ,WRITE,EXCEPT} to set
+ *
+ *  Equivalent to assigning ofd->when; the new flags take effect with
+ *  the next iteration of osmo_select_main() with either back-end.
+ */
+void osmo_fd_update_when(struct osmo_fd *ofd, unsigned int when_mask, unsigned int when_set)
+{
+	ofd->when = (ofd->when & when_mask) | when_set;
+}
+
 /*! Check if a file descriptor is already registered
  *  \param[in] fd osmocom file descriptor to be checked
  *  \returns true if registered; otherwise false
  */
 bool osmo_fd_is_registered(struct osmo_fd *fd)
 {
-	struct osmo_fd *entry;
-	llist_for_each_entry(entry, &osmo_fds, list) {
-		if (entry == fd) {
-			return true;
-		}
-	}
-
-	return false;
+	return fd_table_find(select_ctx(), fd) >= 0;
 }
 
 /*! Register a new file descriptor with select loop abstraction
  *  \param[in] fd osmocom file descriptor to be registered
  *  \returns 0 on success; negative in case of error
+ *
+ *  Only one osmo_fd can be registered per file descriptor number;
+ *  -EEXIST is returned if another one is registered already.
  */
 int osmo_fd_register(struct osmo_fd *fd)
 {
-	int flags;
+	struct osmo_select_ctx *ctx = select_ctx();
+	struct fd_slot *slot;
+	int flags, rc;
 
 	/* make FD nonblocking */
 	flags = fcntl(fd->fd, F_GETFL);
@@ -113,17 +622,39 @@ int osmo_fd_register(struct osmo_fd *fd)
 		return flags;
 
 	/* Register FD */
-	if (fd->fd > maxfd)
-		maxfd = fd->fd;
-
+	rc = fd_table_grow(ctx, fd->fd);
+	if (rc < 0)
+		return rc;
+	slot = &ctx->fd_table[fd->fd];
+	if (slot->ofd == fd) {
 #ifdef BSC_FD_CHECK
-	if (osmo_fd_is_registered(fd)) {
 		fprintf(stderr, "Adding a osmo_fd that is already in the list.\n");
+#endif
 		return 0;
 	}
+	if (slot->ofd)
+		return -EEXIST;
+
+	if (fd->fd > ctx->maxfd)
+		ctx->maxfd = fd->fd;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (ctx->backend == OSMO_SELECT_BACKEND_EPOLL) {
+		if (ctx->epoll_fd < 0) {
+			rc = epoll_init(ctx);
+			if (rc < 0)
+				return rc;
+		}
+		rc = epoll_sync_fd(ctx, fd);
+		if (rc < 0)
+			return rc;
+	}
 #endif
 
-	llist_add_tail(&fd->list, &osmo_fds);
+	llist_add_tail(&fd->list, &ctx->fds);
+	fd->reg_fd = fd->fd;
+	slot->ofd = fd;
+	slot->generation = ++ctx->generation;
 
 	return 0;
 }
@@ -133,11 +664,25 @@ int osmo_fd_register(struct osmo_fd *fd)
  */
 void osmo_fd_unregister(struct osmo_fd *fd)
 {
+	struct osmo_select_ctx *ctx = select_ctx();
+	int idx;
+
 	/* Note: when fd is inside the osmo_fds list (not registered before)
 	 * this function will crash! If in doubt, check file descriptor with
 	 * osmo_fd_is_registered() */
-	unregistered_count++;
 	llist_del(&fd->list);
+
+	/* clear the slot it was registered under, even if fd->fd was
+	 * modified since */
+	idx = fd_table_find(ctx, fd);
+	if (idx < 0)
+		return;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (ctx->epoll_fd >= 0)
+		epoll_unregister(ctx, idx);
+#endif
+	ctx->fd_table[idx].ofd = NULL;
 }
 
 /*! Close a file descriptor, mark it as closed + unregister from select loop abstraction
@@ -169,7 +714,7 @@ inline int osmo_fd_fill_fds(void *_rset, void *_wset, void *_eset)
 	struct osmo_fd *ufd;
 	int highfd = 0;
 
-	llist_for_each_entry(ufd, &osmo_fds, list) {
+	llist_for_each_entry(ufd, &select_ctx()->fds, list) {
 		if (ufd->when & BSC_FD_READ)
 			FD_SET(ufd->fd, readset);
 
@@ -186,57 +731,76 @@ inline int osmo_fd_fill_fds(void *_rset, void *_wset, void *_eset)
 	return highfd;
 }
 
-inline int osmo_fd_disp_fds(void *_rset, void *_wset, void *_eset)
+/* dispatch all fds set in the fd_sets and registered before \a generation */
+static int fd_disp_fds(struct osmo_select_ctx *ctx, fd_set *readset, fd_set *writeset,
+		       fd_set *exceptset, unsigned long generation)
 {
-	struct osmo_fd *ufd, *tmp;
-	int work = 0;
-	fd_set *readset = _rset, *writeset = _wset, *exceptset = _eset;
+	struct osmo_fd *ufd;
+	int fd, work = 0;
 
-restart:
-	unregistered_count = 0;
-	llist_for_each_entry_safe(ufd, tmp, &osmo_fds, list) {
-		int flags = 0;
+	/* Walk the fd table rather than the list, so that call-backs may
+	 * unregister any other osmo_fd: it is simply not found anymore.
+	 * The generation check skips fd numbers that were closed and
+	 * registered again by a call-back after the fd_sets were filled. */
+	for (fd = 0; fd <= ctx->maxfd; fd++) {
+		unsigned int flags = 0;
 
-		if (FD_ISSET(ufd->fd, readset)) {
+		ufd = fd_lookup_dispatch(ctx, fd, generation);
+		if (!ufd)
+			continue;
+
+		if (FD_ISSET(fd, readset)) {
 			flags |= BSC_FD_READ;
-			FD_CLR(ufd->fd, readset);
+			FD_CLR(fd, readset);
 		}
 
-		if (FD_ISSET(ufd->fd, writeset)) {
+		if (FD_ISSET(fd, writeset)) {
 			flags |= BSC_FD_WRITE;
-			FD_CLR(ufd->fd, writeset);
+			FD_CLR(fd, writeset);
 		}
 
-		if (FD_ISSET(ufd->fd, exceptset)) {
+		if (FD_ISSET(fd, exceptset)) {
 			flags |= BSC_FD_EXCEPT;
-			FD_CLR(ufd->fd, exceptset);
+			FD_CLR(fd, exceptset);
 		}
 
 		if (flags) {
 			work = 1;
-			ufd->cb(ufd, flags);
+			fd_dispatch(ctx, ufd, flags);
 		}
-		/* ugly, ugly hack. If more than one filedescriptor was
-		 * unregistered, they might have been consecutive and
-		 * llist_for_each_entry_safe() is no longer safe */
-		/* this seems to happen with the last element of the list as well */
-		if (unregistered_count >= 1)
-			goto restart;
 	}
 
 	return work;
 }
 
-/*! select main loop integration
- *  \param[in] polling should we pollonly (1) or block on select (0)
- *  \returns 0 if no fd handled; 1 if fd handled; negative in case of error
+/*! Call the call-backs of all osmo_fds set in the given fd_sets
+ *  \param[in] _rset The readfds as returned by select()
+ *  \param[in] _wset The writefds as returned by select()
+ *  \param[in] _eset The errorfds as returned by select()
+ *  \returns 1 if any call-back was called; 0 otherwise
  */
-int osmo_select_main(int polling)
+inline int osmo_fd_disp_fds(void *_rset, void *_wset, void *_eset)
+{
+	struct osmo_select_ctx *ctx = select_ctx();
+
+	return fd_disp_fds(ctx, _rset, _wset, _eset, ctx->generation);
+}
+
+static int select_main(struct osmo_select_ctx *ctx, int polling)
 {
 	fd_set readset, writeset, exceptset;
+	unsigned long generation;
 	int rc;
 	struct timeval no_time = {0, 0};
 
+#ifdef HAVE_SYS_EPOLL_H
+	if (ctx->backend == OSMO_SELECT_BACKEND_EPOLL) {
+		if (ctx->epoll_fd < 0 && epoll_init(ctx) < 0)
+			return 0;
+		return epoll_main(ctx, polling);
+	}
+#endif
+
 	FD_ZERO(&readset);
 	FD_ZERO(&writeset);
 	FD_ZERO(&exceptset);
@@ -246,15 +810,201 @@ int osmo_select_main(int polling)
 
 	if (!polling)
 		osmo_timers_prepare();
-	rc = select(maxfd+1, &readset, &writeset, &exceptset, polling ? &no_time : osmo_timers_nearest());
+	rc = select(ctx->maxfd+1, &readset, &writeset, &exceptset, polling ? &no_time : osmo_timers_nearest());
 	if (rc < 0)
 		return 0;
+	generation = ctx->generation;
+
+	if (ctx->stats)
+		stats_iter_begin(ctx->stats);
+
+	/* read the clock once for timers and all call-backs */
+	osmo_timers_freeze_now();
 
 	/* fire timers */
 	osmo_timers_update();
 
 	/* call registered callback functions */
-	return osmo_fd_disp_fds(&readset, &writeset, &exceptset);
+	rc = fd_disp_fds(ctx, &readset, &writeset, &exceptset, generation);
+
+	osmo_timers_thaw_now();
+
+	if (ctx->stats)
+		stats_iter_end(ctx->stats);
+
+	return rc;
+}
+
+/*! select main loop integration
+ *  \param[in] polling should we pollonly (1) or block on select (0)
+ *  \returns 0 if no fd handled; 1 if fd handled; negative in case of error
+ *
+ *  Runs one iteration of the \ref osmo_select_ctx of the calling thread.
+ */
+int osmo_select_main(int polling)
+{
+	return select_main(select_ctx(), polling);
+}
+
+/*! run one iteration of the given event loop context
+ *  \param[in] ctx event loop context to run
+ *  \param[in] polling should we pollonly (1) or block on select (0)
+ *  \returns 0 if no fd handled; 1 if fd handled; negative in case of error
+ *
+ *  \a ctx is made the context of the calling thread for the duration of
+ *  the call, so that call-backs registering fds or scheduling timers
+ *  operate on \a ctx as well.
+ */
+int osmo_select_main_ctx(struct osmo_select_ctx *ctx, int polling)
+{
+	struct osmo_select_ctx *prev;
+	int rc;
+
+	if (ctx == select_ctx())
+		return select_main(ctx, polling);
+
+	prev = osmo_select_ctx_switch(ctx);
+	rc = select_main(ctx, polling);
+	osmo_select_ctx_switch(prev);
+
+	return rc;
+}
+
+/*! Allocate a new, empty event loop context
+ *  \param[in] talloc_ctx talloc context to allocate from
+ *  \returns newly allocated context; NULL on error
+ *
+ *  The context owns its own set of osmo_fds and timers, and uses the
+ *  compile-time default back-end.  Use osmo_select_main_ctx() to run it,
+ *  or osmo_select_ctx_switch() to make it the context of a thread.
+ */
+struct osmo_select_ctx *osmo_select_ctx_alloc(void *talloc_ctx)
+{
+	struct osmo_select_ctx *ctx;
+
+	ctx = talloc_zero(talloc_ctx, struct osmo_select_ctx);
+	if (!ctx)
+		return NULL;
+
+	INIT_LLIST_HEAD(&ctx->fds);
+	ctx->idx = __atomic_fetch_add(&select_ctx_count, 1, __ATOMIC_RELAXED);
+	ctx->backend = SELECT_DEFAULT_BACKEND;
+#ifdef HAVE_SYS_EPOLL_H
+	ctx->epoll_fd = -1;
+#endif
+	ctx->timers = osmo_timers_ctx_alloc(ctx);
+	if (!ctx->timers) {
+		talloc_free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+/*! Free an event loop context allocated by osmo_select_ctx_alloc()
+ *  \param[in] ctx context to free
+ *
+ *  The context must not be active in any thread.  Registered osmo_fds
+ *  are not closed, and pending timers are forgotten without firing.
+ */
+void osmo_select_ctx_free(struct osmo_select_ctx *ctx)
+{
+	if (!ctx || ctx == &select_default)
+		return;
+	if (ctx->stats) {
+		rate_ctr_group_free(ctx->stats->ctrg);
+		osmo_stat_item_group_free(ctx->stats->statg);
+	}
+#ifdef HAVE_SYS_EPOLL_H
+	epoll_exit(ctx);
+#endif
+	talloc_free(ctx->fd_table);
+	talloc_free(ctx);
+}
+
+/*! Make the calling thread operate on the given event loop context
+ *  \param[in] ctx context to use; NULL for the process-wide default
+ *  \returns context used by the calling thread so far
+ *
+ *  All osmo_fd_*() functions, osmo_select_main() and all timer functions
+ *  operate on the context of the calling thread.  Unless switched, this
+ *  is the default context shared by all threads, which is what
+ *  single-threaded programs use.  An osmo_fd or timer must always be
+ *  unregistered/deleted from within the context it was added to.
+ */
+struct osmo_select_ctx *osmo_select_ctx_switch(struct osmo_select_ctx *ctx)
+{
+	struct osmo_select_ctx *prev = select_ctx();
+
+	select_cur = ctx;
+	osmo_timers_ctx_switch(ctx ? ctx->timers : NULL);
+
+	return prev;
+}
+
+/*! Get the event loop context of the calling thread
+ *  \returns context of the calling thread; never NULL */
+struct osmo_select_ctx *osmo_select_ctx_get(void)
+{
+	return select_ctx();
+}
+
+/*! Enable instrumentation of the calling thread's event loop
+ *  \param[in] slow_us threshold for counting call-backs/iterations as slow (us)
+ *  \returns 0 on success; negative in case of error
+ *
+ *  Allocates a "select" rate counter group and stat item group, indexed
+ *  by the context (0 for the default context).  They record the time
+ *  spent per loop iteration, the longest fd call-back of each iteration
+ *  with its fd and priv_nr, the number of timers fired, their largest
+ *  lateness and the longest timer call-back.  While disabled, the only
+ *  cost is one branch per iteration and per call-back.
+ */
+int osmo_select_stats_enable(unsigned int slow_us)
+{
+	struct osmo_select_ctx *ctx = select_ctx();
+	struct select_stats *st = ctx->stats;
+
+	if (!st) {
+		st = talloc_zero(ctx == &select_default ? NULL : ctx, struct select_stats);
+		if (!st)
+			return -ENOMEM;
+		st->ctrg = rate_ctr_group_alloc(st, &select_ctrg_desc, ctx->idx);
+		st->statg = osmo_stat_item_group_alloc(st, &select_statg_desc, ctx->idx);
+		if (!st->ctrg || !st->statg) {
+			if (st->ctrg)
+				rate_ctr_group_free(st->ctrg);
+			if (st->statg)
+				osmo_stat_item_group_free(st->statg);
+			talloc_free(st);
+			return -ENOMEM;
+		}
+	}
+
+	st->slow_ns = (uint64_t)slow_us * 1000;
+	ctx->stats = st;
+	osmo_timers_set_stats(&st->timers);
+
+	return 0;
+}
+
+/*! Disable instrumentation of the calling thread's event loop
+ *
+ *  Must not be called from within a call-back.  The counter groups
+ *  allocated by osmo_select_stats_enable() are freed.
+ */
+void osmo_select_stats_disable(void)
+{
+	struct osmo_select_ctx *ctx = select_ctx();
+
+	if (!ctx->stats)
+		return;
+
+	osmo_timers_set_stats(NULL);
+	rate_ctr_group_free(ctx->stats->ctrg);
+	osmo_stat_item_group_free(ctx->stats->statg);
+	talloc_free(ctx->stats);
+	ctx->stats = NULL;
 }
 
 /*! find an osmo_fd based on the integer fd
@@ -262,13 +1012,11 @@ int osmo_select_main(int polling)
  *  \returns \ref osmo_fd for \ref fd; NULL in case it doesn't exist */
 struct osmo_fd *osmo_fd_get_by_fd(int fd)
 {
-	struct osmo_fd *ofd;
+	struct osmo_select_ctx *ctx = select_ctx();
 
-	llist_for_each_entry(ofd, &osmo_fds, list) {
-		if (ofd->fd == fd)
-			return ofd;
-	}
-	return NULL;
+	if (fd < 0 || fd >= ctx->fd_table_size)
+		return NULL;
+	return ctx->fd_table[fd].ofd;
 }
 
 #ifdef HAVE_SYS_TIMERFD_H
@@ -35,10 +35,12 @@
 #include <osmocom/core/select.h>
 #include <osmocom/core/socket.h>
 #include <osmocom/core/talloc.h>
+#include <osmocom/core/msgb.h>
 
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include <netinet/in.h>
@@ -872,6 +874,89 @@ int osmo_sock_local_ip(char *local_ip, const char *remote_ip)
 	return 0;
 }
 
+/*! Describe the fragments of a (chained) msgb in an iovec array
+ *  \param[in] msg msgb or head of a chained msgb, see msgb_frag_append()
+ *  \param[out] iov caller-allocated iovec array
+ *  \param[in] iov_len number of entries in \a iov
+ *  \returns number of entries used; -EMSGSIZE if \a iov is too small
+ *
+ *  Empty fragments are skipped.
+ */
+int osmo_sock_msgb_iov(const struct msgb *msg, struct iovec *iov, unsigned int iov_len)
+{
+	unsigned int n = 0;
+
+	for (; msg; msg = msg->frag_next) {
+		if (!msg->len)
+			continue;
+		if (n >= iov_len)
+			return -EMSGSIZE;
+		iov[n].iov_base = msg->data;
+		iov[n].iov_len = msg->len;
+		n++;
+	}
+
+	return n;
+}
+
+/*! Write a (chained) msgb to a file descriptor with a single writev()
+ *  \param[in] fd file descriptor to write to
+ *  \param[in] msg msgb or head of a chained msgb; not freed
+ *  \returns number of bytes written; negative errno on error
+ */
+int osmo_sock_writev_msgb(int fd, const struct msgb *msg)
+{
+	struct iovec iov[OSMO_SOCK_MSGB_IOV_MAX];
+	int n, rc;
+
+	/* no need for an iovec in the common case */
+	if (!msg->frag_next)
+		rc = write(fd, msg->data, msg->len);
+	else {
+		n = osmo_sock_msgb_iov(msg, iov, ARRAY_SIZE(iov));
+		if (n < 0)
+			return n;
+		rc = writev(fd, iov, n);
+	}
+	if (rc < 0)
+		return -errno;
+	return rc;
+}
+
+/*! Send a (chained) msgb on a socket with a single sendmsg()
+ *  \param[in] fd socket to send on
+ *  \param[in] msg msgb or head of a chained msgb; not freed
+ *  \param[in] flags flags passed to sendmsg()
+ *  \param[in] dst destination address; NULL for connected sockets
+ *  \param[in] dst_len length of \a dst
+ *  \returns number of bytes sent; negative errno on error
+ */
+int osmo_sock_sendto_msgb(int fd, const struct msgb *msg, int flags,
+			  const struct sockaddr *dst, unsigned int dst_len)
+{
+	struct iovec iov[OSMO_SOCK_MSGB_IOV_MAX];
+	struct msghdr mh = {
+		.msg_name = (void *) dst,
+		.msg_namelen = dst ? dst_len : 0,
+		.msg_iov = iov,
+	};
+	int n, rc;
+
+	/* no need for an iovec in the common case */
+	if (!msg->frag_next)
+		rc = sendto(fd, msg->data, msg->len, flags, dst, mh.msg_namelen);
+	else {
+		n = osmo_sock_msgb_iov(msg, iov, ARRAY_SIZE(iov));
+		if (n < 0)
+			return n;
+		mh.msg_iovlen = n;
+		rc = sendmsg(fd, &mh, flags);
+	}
+	if (rc < 0)
+		return -errno;
+	return rc;
+}
+
 #endif /* HAVE_SYS_SOCKET_H */
 
 /*! @} */
@@ -35,19 +35,243 @@
 #include <assert.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
+#include <errno.h>
 #include <osmocom/core/timer.h>
 #include <osmocom/core/timer_compat.h>
 #include <osmocom/core/linuxlist.h>
+#include <osmocom/core/talloc.h>
 
-/* These store the amount of time that we wait until next timer expires. */
-static struct timeval nearest;
-static struct timeval *nearest_p;
+/*
+ * Hierarchical timing wheel, as used by the Linux kernel before 4.8: one
+ * root level of 256 one-millisecond slots, plus four levels of 64 slots
+ * each covering 64 times the range of the level below.  Timers are kept
+ * in the slot list via their 'list' member, which makes adding and
+ * deleting a timer O(1).  Timers of the upper levels are cascaded down
+ * whenever the root level wraps around.
+ */
+#define WHEEL_ROOT_BITS	8
+#define WHEEL_LVL_BITS	6
+#define WHEEL_NUM_LVLS	4
+#define WHEEL_ROOT_SIZE	(1 << WHEEL_ROOT_BITS)
+#define WHEEL_LVL_SIZE	(1 << WHEEL_LVL_BITS)
+#define WHEEL_ROOT_MASK	(WHEEL_ROOT_SIZE - 1)
+#define WHEEL_LVL_MASK	(WHEEL_LVL_SIZE - 1)
+#define WHEEL_LVL_SHIFT(lvl)	(WHEEL_ROOT_BITS + (lvl) * WHEEL_LVL_BITS)
+/* maximum distance of an expiry (in ticks) the wheel can represent */
+#define WHEEL_MAX_IDX	((1ULL << WHEEL_LVL_SHIFT(WHEEL_NUM_LVLS)) - 1)
+
+/*! state of all timers of one event loop */
+struct osmo_timers_ctx {
+	/* These store the amount of time that we wait until next timer expires. */
+	struct timeval nearest;
+	struct timeval *nearest_p;
+
+	struct rb_root timer_root;
+
+	/* current time, if sampled once for the whole main loop iteration */
+	struct timespec now_cache;
+	bool now_cached;
+
+	enum osmo_timer_backend backend;
+
+	/* measurements of osmo_timers_update(), if enabled */
+	struct osmo_timers_stats *stats;
+
+	struct {
+		/* next tick (in milliseconds) to be processed */
+		uint64_t jiffies;
+		/* number of active timers in the wheel */
+		unsigned int count;
+		struct llist_head root[WHEEL_ROOT_SIZE];
+		struct llist_head lvl[WHEEL_NUM_LVLS][WHEEL_LVL_SIZE];
+	} wheel;
+};
+
+/* used by all threads that did not switch to a context of their own */
+static struct osmo_timers_ctx timers_default = {
+	.timer_root = RB_ROOT,
+	.backend = OSMO_TIMER_BACKEND_RBTREE,
+};
+
+static __thread struct osmo_timers_ctx *timers_cur;
+
+static unsigned int timer_slack_permille;
+
+static inline struct osmo_timers_ctx *timers_ctx(void)
+{
+	return timers_cur ? timers_cur : &timers_default;
+}
+
+static inline uint64_t ts2ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+/* osmo_timer_list.timeout is a struct timeval for compatibility, but
+ * holds a CLOCK_MONOTONIC time like all timespecs in here.  Its expiry
+ * tick is rounded up so that we never fire early. */
+static inline uint64_t tv2tick(const struct timeval *tv)
+{
+	return (uint64_t)tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
+}
 
-static struct rb_root timer_root = RB_ROOT;
+static inline uint64_t tv2ns(const struct timeval *tv)
+{
+	return (uint64_t)tv->tv_sec * 1000000000 + (uint64_t)tv->tv_usec * 1000;
+}
+
+static inline void tv2ts(const struct timeval *tv, struct timespec *ts)
+{
+	ts->tv_sec = tv->tv_sec;
+	ts->tv_nsec = tv->tv_usec * 1000;
+}
+
+/* obtain the current CLOCK_MONOTONIC time, from the cache if possible */
+static void timer_now(struct osmo_timers_ctx *tc, struct timespec *now)
+{
+	if (tc->now_cached)
+		*now = tc->now_cache;
+	else
+		osmo_clock_gettime(CLOCK_MONOTONIC, now);
+}
+
+static uint64_t now_ms(struct osmo_timers_ctx *tc)
+{
+	struct timespec now;
+
+	timer_now(tc, &now);
+	return ts2ns(&now) / 1000000;
+}
+
+static void wheel_init(struct osmo_timers_ctx *tc)
+{
+	int i, lvl;
+
+	for (i = 0; i < WHEEL_ROOT_SIZE; i++)
+		INIT_LLIST_HEAD(&tc->wheel.root[i]);
+	for (lvl = 0; lvl < WHEEL_NUM_LVLS; lvl++) {
+		for (i = 0; i < WHEEL_LVL_SIZE; i++)
+			INIT_LLIST_HEAD(&tc->wheel.lvl[lvl][i]);
+	}
+	tc->wheel.count = 0;
+	tc->wheel.jiffies = now_ms(tc);
+}
+
+static void wheel_add(struct osmo_timers_ctx *tc, struct osmo_timer_list *timer)
+{
+	uint64_t expires = tv2tick(&timer->timeout);
+	uint64_t idx;
+	struct llist_head *vec;
+	int lvl;
+
+	/* already expired: fire on the next tick we process */
+	if (expires < tc->wheel.jiffies)
+		expires = tc->wheel.jiffies;
+	idx = expires - tc->wheel.jiffies;
+
+	if (idx < WHEEL_ROOT_SIZE) {
+		vec = &tc->wheel.root[expires & WHEEL_ROOT_MASK];
+	} else {
+		/* too far in the future: park it in the last level, from
+		 * where it is cascaded down with its real expiry later */
+		if (idx > WHEEL_MAX_IDX)
+			expires = tc->wheel.jiffies + WHEEL_MAX_IDX;
+		for (lvl = 0; lvl < WHEEL_NUM_LVLS - 1; lvl++) {
+			if (idx < (1ULL << WHEEL_LVL_SHIFT(lvl + 1)))
+				break;
+		}
+		vec = &tc->wheel.lvl[lvl][(expires >> WHEEL_LVL_SHIFT(lvl)) & WHEEL_LVL_MASK];
+	}
+
+	/* most recently added first, which gives the same firing order for
+	 * identical expiries as the rb-tree back-end */
+	llist_add(&timer->list, vec);
+}
 
-static void __add_timer(struct osmo_timer_list *timer)
+/* re-distribute all timers of one upper level slot to the levels below */
+static unsigned int wheel_cascade(struct osmo_timers_ctx *tc, int lvl, unsigned int index)
 {
-	struct rb_node **new = &(timer_root.rb_node);
+	struct osmo_timer_list *this;
+	LLIST_HEAD(cascade);
+
+	llist_splice_init(&tc->wheel.lvl[lvl][index], &cascade);
+	/* re-add from the tail to keep the order within the slot */
+	while (!llist_empty(&cascade)) {
+		this = llist_last_entry(&cascade, struct osmo_timer_list, list);
+		llist_del(&this->list);
+		wheel_add(tc, this);
+	}
+
+	return index;
+}
+
+/* move all timers expiring up to (and including) tick \a now to \a expired */
+static void wheel_run(struct osmo_timers_ctx *tc, uint64_t now, struct llist_head *expired)
+{
+	/* nothing to do, just jump ahead */
+	if (!tc->wheel.count) {
+		if (tc->wheel.jiffies <= now)
+			tc->wheel.jiffies = now + 1;
+		return;
+	}
+
+	while (tc->wheel.jiffies <= now) {
+		unsigned int index = tc->wheel.jiffies & WHEEL_ROOT_MASK;
+		int lvl;
+
+		if (!index) {
+			for (lvl = 0; lvl < WHEEL_NUM_LVLS; lvl++) {
+				unsigned int i = (tc->wheel.jiffies >> WHEEL_LVL_SHIFT(lvl)) & WHEEL_LVL_MASK;
+				if (wheel_cascade(tc, lvl, i))
+					break;
+			}
+		}
+		llist_splice_init(&tc->wheel.root[index], expired);
+		tc->wheel.jiffies++;
+	}
+}
+
+/* determine the next tick at which the wheel has work to do, which is
+ * either the expiry of a root level timer or a cascade of an upper level
+ * slot that contains timers */
+static bool wheel_next_tick(struct osmo_timers_ctx *tc, uint64_t *next)
+{
+	uint64_t best = UINT64_MAX;
+	int i, lvl;
+
+	if (!tc->wheel.count)
+		return false;
+
+	for (i = 0; i < WHEEL_ROOT_SIZE; i++) {
+		if (!llist_empty(&tc->wheel.root[(tc->wheel.jiffies + i) & WHEEL_ROOT_MASK])) {
+			best = tc->wheel.jiffies + i;
+			break;
+		}
+	}
+
+	for (lvl = 0; lvl < WHEEL_NUM_LVLS; lvl++) {
+		unsigned int shift = WHEEL_LVL_SHIFT(lvl);
+		uint64_t base = tc->wheel.jiffies >> shift;
+		/* the current slot is only still pending if we are exactly
+		 * at its cascade point */
+		i = (tc->wheel.jiffies & ((1ULL << shift) - 1)) ? 1 : 0;
+		for (; i <= WHEEL_LVL_SIZE; i++) {
+			if (!llist_empty(&tc->wheel.lvl[lvl][(base + i) & WHEEL_LVL_MASK])) {
+				if (((base + i) << shift) < best)
+					best = (base + i) << shift;
+				break;
+			}
+		}
+	}
+
+	*next = best;
+	return true;
+}
+
+static void __add_timer(struct osmo_timers_ctx *tc, struct osmo_timer_list *timer)
+{
+	struct rb_node **new = &(tc->timer_root.rb_node);
 	struct rb_node *parent = NULL;
 
 	while (*new) {
@@ -63,7 +287,7 @@ static void __add_timer(struct osmo_timer_list *timer)
 	}
 
 	rb_link_node(&timer->node, parent, new);
-	rb_insert_color(&timer->node, &timer_root);
+	rb_insert_color(&timer->node, &tc->timer_root);
 }
 
 /*! set up timer callback and data
@@ -83,10 +307,19 @@ void osmo_timer_setup(struct osmo_timer_list *timer, void (*cb)(void *data),
  */
 void osmo_timer_add(struct osmo_timer_list *timer)
 {
+	struct osmo_timers_ctx *tc = timers_ctx();
+
 	osmo_timer_del(timer);
 	timer->active = 1;
 	INIT_LLIST_HEAD(&timer->list);
-	__add_timer(timer);
+	if (tc->backend == OSMO_TIMER_BACKEND_WHEEL) {
+		/* nothing pending, so we can skip all the idle ticks */
+		if (!tc->wheel.count)
+			tc->wheel.jiffies = now_ms(tc);
+		tc->wheel.count++;
+		wheel_add(tc, timer);
+	} else
+		__add_timer(tc, timer);
 }
 
 /*! schedule a timer at a given future relative time
@@ -102,12 +335,33 @@ void osmo_timer_add(struct osmo_timer_list *timer)
 void
 osmo_timer_schedule(struct osmo_timer_list *timer, int seconds, int microseconds)
 {
-	struct timeval current_time;
+	struct timespec current_time;
+	int64_t delay, expires;
+
+	timer_now(timers_ctx(), &current_time);
+	delay = (int64_t)seconds * 1000000000 + (int64_t)microseconds * 1000;
+	expires = ts2ns(&current_time) + delay;
+
+	if (timer_slack_permille && delay > 0) {
+		/* round the expiry up to a multiple of the largest power of
+		 * two within the permitted slack, so that timers scheduled
+		 * around the same time expire together */
+		uint64_t slack = delay * timer_slack_permille / 1000;
+		uint64_t gran = 1;
+
+		while (gran * 2 <= slack)
+			gran *= 2;
+		expires = (expires + gran - 1) & ~(gran - 1);
+	}
 
-	osmo_gettimeofday(&current_time, NULL);
-	timer->timeout.tv_sec = seconds;
-	timer->timeout.tv_usec = microseconds;
-	timeradd(&timer->timeout, &current_time, &timer->timeout);
+	/* round up to the microseconds of the timeval, never fire early */
+	expires = (expires + 999) / 1000;
+	timer->timeout.tv_sec = expires / 1000000;
+	timer->timeout.tv_usec = expires % 1000000;
+	if (timer->timeout.tv_usec < 0) {
+		timer->timeout.tv_sec--;
+		timer->timeout.tv_usec += 1000000;
+	}
 	osmo_timer_add(timer);
 }
 
@@ -119,9 +373,17 @@ osmo_timer_schedule(struct osmo_timer_list *timer, int seconds, int microseconds
  */
 void osmo_timer_del(struct osmo_timer_list *timer)
 {
+	struct osmo_timers_ctx *tc = timers_ctx();
+
 	if (timer->active) {
 		timer->active = 0;
-		rb_erase(&timer->node, &timer_root);
+		if (tc->backend == OSMO_TIMER_BACKEND_WHEEL) {
+			/* removes it from its wheel slot or the eviction list */
+			llist_del_init(&timer->list);
+			tc->wheel.count--;
+			return;
+		}
+		rb_erase(&timer->node, &tc->timer_root);
 		/* make sure this is not already scheduled for removal. */
 		if (!llist_empty(&timer->list))
 			llist_del_init(&timer->list);
@@ -142,25 +404,37 @@ int osmo_timer_pending(struct osmo_timer_list *timer)
 
 /*! compute the remaining time of a timer
  *  \param[in] timer the to-be-checked timer
- *  \param[in] now the current time (NULL if not known)
+ *  \param[in] now the current time as returned by osmo_gettimeofday()
+ *	(NULL if not known)
  *  \param[out] remaining remaining time until timer fires
  *  \return 0 if timer has not expired yet, -1 if it has
  *
  *  This function can be used to determine the amount of time
- *  remaining until the expiration of the timer.
+ *  remaining until the expiration of the timer.  Timers expire by
+ *  CLOCK_MONOTONIC, so \a now is converted with the current offset of
+ *  the wall-clock time to it; passing NULL avoids that.
  */
 int osmo_timer_remaining(const struct osmo_timer_list *timer,
 			 const struct timeval *now,
 			 struct timeval *remaining)
 {
-	struct timeval current_time;
-
-	if (!now)
-		osmo_gettimeofday(&current_time, NULL);
-	else
-		current_time = *now;
+	struct timespec current_time, timeout, rem;
+	struct timeval wall, diff;
+
+	timer_now(timers_ctx(), &current_time);
+	if (now) {
+		/* move the monotonic time by how far now is from the
+		 * current wall-clock time */
+		osmo_gettimeofday(&wall, NULL);
+		timersub(now, &wall, &diff);
+		tv2ts(&diff, &rem);
+		timespecadd(&current_time, &rem, &current_time);
+	}
 
-	timersub(&timer->timeout, &current_time, remaining);
+	tv2ts(&timer->timeout, &timeout);
+	timespecsub(&timeout, &current_time, &rem);
+	remaining->tv_sec = rem.tv_sec;
+	remaining->tv_usec = rem.tv_nsec / 1000;
 
 	if (remaining->tv_sec < 0)
 		return -1;
@@ -178,64 +452,135 @@ int osmo_timer_remaining(const struct osmo_timer_list *timer,
  */
 struct timeval *osmo_timers_nearest(void)
 {
-	/* nearest_p is exactly what we need already: NULL if nothing is
+	/* tc->nearest_p is exactly what we need already: NULL if nothing is
 	 * waiting, {0,0} if we must dispatch immediately, and the correct
 	 * delay if we need to wait */
-	return nearest_p;
+	return timers_ctx()->nearest_p;
 }
 
-static void update_nearest(struct timeval *cand, struct timeval *current)
+static void update_nearest(struct osmo_timers_ctx *tc, struct timespec *cand,
+			   struct timespec *current)
 {
+	struct timespec delta;
+
 	if (cand->tv_sec != LONG_MAX) {
-		if (timercmp(cand, current, >))
-			timersub(cand, current, &nearest);
-		else {
+		if (timespeccmp(cand, current, >)) {
+			timespecsub(cand, current, &delta);
+			/* round up, select() would wake us too early otherwise */
+			tc->nearest.tv_sec = delta.tv_sec;
+			tc->nearest.tv_usec = (delta.tv_nsec + 999) / 1000;
+			if (tc->nearest.tv_usec >= 1000000) {
+				tc->nearest.tv_sec++;
+				tc->nearest.tv_usec -= 1000000;
+			}
+		} else {
 			/* loop again inmediately */
-			timerclear(&nearest);
+			timerclear(&tc->nearest);
 		}
-		nearest_p = &nearest;
+		tc->nearest_p = &tc->nearest;
 	} else {
-		nearest_p = NULL;
+		tc->nearest_p = NULL;
 	}
 }
 
-/*! Find the nearest time and update nearest_p */
+/*! Find the nearest time and update tc->nearest_p */
 void osmo_timers_prepare(void)
 {
+	struct osmo_timers_ctx *tc = timers_ctx();
 	struct rb_node *node;
-	struct timeval current;
+	struct timespec current;
+
+	/* always sample the clock here: the cached time of the previous
+	 * iteration is stale by the time spent in its call-backs */
+	osmo_clock_gettime(CLOCK_MONOTONIC, &current);
 
-	osmo_gettimeofday(&current, NULL);
+	if (tc->backend == OSMO_TIMER_BACKEND_WHEEL) {
+		struct timespec next;
+		uint64_t tick;
 
-	node = rb_first(&timer_root);
+		if (!wheel_next_tick(tc, &tick)) {
+			tc->nearest_p = NULL;
+			return;
+		}
+		next.tv_sec = tick / 1000;
+		next.tv_nsec = (tick % 1000) * 1000000;
+		update_nearest(tc, &next, &current);
+		return;
+	}
+
+	node = rb_first(&tc->timer_root);
 	if (node) {
 		struct osmo_timer_list *this;
+		struct timespec timeout;
+
 		this = container_of(node, struct osmo_timer_list, node);
-		update_nearest(&this->timeout, &current);
+		tv2ts(&this->timeout, &timeout);
+		update_nearest(tc, &timeout, &current);
 	} else {
-		nearest_p = NULL;
+		tc->nearest_p = NULL;
 	}
 }
 
+/* fire a timer while recording its lateness and call-back duration */
+static void timer_fire_measured(struct osmo_timers_ctx *tc,
+				struct osmo_timer_list *timer,
+				const struct timespec *current_time)
+{
+	struct osmo_timers_stats *stats = tc->stats;
+	struct timespec before, after;
+	uint64_t late, duration;
+
+	/* expiries are rounded up by the wheel, so this may be "early" */
+	if (ts2ns(current_time) < tv2ns(&timer->timeout))
+		late = 0;
+	else
+		late = ts2ns(current_time) - tv2ns(&timer->timeout);
+	if (late > stats->late_max_ns)
+		stats->late_max_ns = late;
+	stats->fired++;
+
+	if (!timer->cb)
+		return;
+
+	osmo_clock_gettime(CLOCK_MONOTONIC, &before);
+	timer->cb(timer->data);
+	osmo_clock_gettime(CLOCK_MONOTONIC, &after);
+
+	duration = ts2ns(&after) - ts2ns(&before);
+	if (duration > stats->cb_max_ns)
+		stats->cb_max_ns = duration;
+}
+
 /*! fire all timers... and remove them */
 int osmo_timers_update(void)
 {
-	struct timeval current_time;
+	struct osmo_timers_ctx *tc = timers_ctx();
+	struct timespec current_time;
 	struct rb_node *node;
 	struct llist_head timer_eviction_list;
 	struct osmo_timer_list *this;
+	bool froze_now = false;
 	int work = 0;
 
-	osmo_gettimeofday(&current_time, NULL);
+	/* let timers re-scheduled from the call-backs use the same time */
+	if (!tc->now_cached) {
+		osmo_timers_freeze_now();
+		froze_now = true;
+	}
+	current_time = tc->now_cache;
 
 	INIT_LLIST_HEAD(&timer_eviction_list);
-	for (node = rb_first(&timer_root); node; node = rb_next(node)) {
-		this = container_of(node, struct osmo_timer_list, node);
+	if (tc->backend == OSMO_TIMER_BACKEND_WHEEL)
+		wheel_run(tc, ts2ns(&current_time) / 1000000, &timer_eviction_list);
+	else {
+		for (node = rb_first(&tc->timer_root); node; node = rb_next(node)) {
+			this = container_of(node, struct osmo_timer_list, node);
 
-		if (timercmp(&this->timeout, &current_time, >))
-			break;
+			if (tv2ns(&this->timeout) > ts2ns(&current_time))
+				break;
 
-		llist_add(&this->list, &timer_eviction_list);
+			llist_add(&this->list, &timer_eviction_list);
+		}
 	}
 
 	/*
@@ -253,26 +598,170 @@ int osmo_timers_update(void)
 restart:
 	llist_for_each_entry(this, &timer_eviction_list, list) {
 		osmo_timer_del(this);
-		if (this->cb)
+		if (tc->stats)
+			timer_fire_measured(tc, this, &current_time);
+		else if (this->cb)
 			this->cb(this->data);
 		work = 1;
 		goto restart;
 	}
 
+	if (froze_now)
+		osmo_timers_thaw_now();
+
 	return work;
 }
 
+/*! Sample the current time once and use it for all timer operations
+ *
+ *  Until osmo_timers_thaw_now() is called, osmo_timer_schedule(),
+ *  osmo_timer_remaining() and osmo_timers_update() use the time sampled
+ *  here instead of reading the clock again.  osmo_select_main() uses this
+ *  to read the clock only once per iteration, so that (re-)scheduling
+ *  timers from call-backs does not cost a clock read each time.
+ */
+void osmo_timers_freeze_now(void)
+{
+	struct osmo_timers_ctx *tc = timers_ctx();
+
+	osmo_clock_gettime(CLOCK_MONOTONIC, &tc->now_cache);
+	tc->now_cached = true;
+}
+
+/*! Stop using the time sampled by osmo_timers_freeze_now() */
+void osmo_timers_thaw_now(void)
+{
+	timers_ctx()->now_cached = false;
+}
+
 /*! Check how many timers we have in the system
  *  \returns number of \ref osmo_timer_list registered */
 int osmo_timers_check(void)
 {
+	struct osmo_timers_ctx *tc = timers_ctx();
 	struct rb_node *node;
 	int i = 0;
 
-	for (node = rb_first(&timer_root); node; node = rb_next(node)) {
+	if (tc->backend == OSMO_TIMER_BACKEND_WHEEL)
+		return tc->wheel.count;
+
+	for (node = rb_first(&tc->timer_root); node; node = rb_next(node)) {
 		i++;
 	}
 	return i;
 }
 
+/*! Select the data structure used to manage timers
+ *  \param[in] backend timer back-end to use from now on
+ *  \returns 0 on success; -EBUSY if timers are pending; -EINVAL otherwise
+ *
+ *  The back-end can only be changed while no timer is pending.  The
+ *  rb-tree back-end has O(log n) add/delete and exact expiry; the timer
+ *  wheel has O(1) add/delete and millisecond resolution, rounding
+ *  expiries up to the next millisecond.
+ */
+int osmo_timers_set_backend(enum osmo_timer_backend backend)
+{
+	struct osmo_timers_ctx *tc = timers_ctx();
+
+	if (osmo_timers_check())
+		return -EBUSY;
+
+	switch (backend) {
+	case OSMO_TIMER_BACKEND_RBTREE:
+		break;
+	case OSMO_TIMER_BACKEND_WHEEL:
+		wheel_init(tc);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	tc->backend = backend;
+	return 0;
+}
+
+/*! Get the data structure currently used to manage timers
+ *  \returns currently active timer back-end */
+enum osmo_timer_backend osmo_timers_get_backend(void)
+{
+	return timers_ctx()->backend;
+}
+
+/*! Permit timers to expire later than requested in order to coalesce them
+ *  \param[in] permille slack in 1/1000 of the relative timeout; 0 disables
+ *
+ *  With a slack configured, osmo_timer_schedule() rounds the expiry of a
+ *  timer up to a coarse boundary not further away than the slack, so
+ *  that timers scheduled around the same time expire (and wake up the
+ *  process) together.  osmo_timer_add() with an explicit timeout is not
+ *  affected.
+ */
+void osmo_timers_set_slack(unsigned int permille)
+{
+	timer_slack_permille = permille;
+}
+
+/*! Record measurements of osmo_timers_update()
+ *  \param[in] stats where to accumulate measurements; NULL to disable
+ *
+ *  While enabled, each osmo_timers_update() of the calling thread's timer
+ *  context adds to \a stats, which the caller is expected to evaluate and
+ *  reset as needed.  This costs two clock reads per fired timer.
+ */
+void osmo_timers_set_stats(struct osmo_timers_stats *stats)
+{
+	timers_ctx()->stats = stats;
+}
+
+/*! Allocate a new, empty timer context
+ *  \param[in] talloc_ctx talloc context to allocate from
+ *  \returns newly allocated timer context; NULL on error
+ *
+ *  Usually there is no need to call this directly: every
+ *  \ref osmo_select_ctx comes with a timer context of its own.
+ */
+struct osmo_timers_ctx *osmo_timers_ctx_alloc(void *talloc_ctx)
+{
+	struct osmo_timers_ctx *tc;
+
+	tc = talloc_zero(talloc_ctx, struct osmo_timers_ctx);
+	if (!tc)
+		return NULL;
+	tc->timer_root = (struct rb_root) RB_ROOT;
+	tc->backend = OSMO_TIMER_BACKEND_RBTREE;
+
+	return tc;
+}
+
+/*! Free a timer context allocated by osmo_timers_ctx_alloc()
+ *  \param[in] tc timer context to free
+ *
+ *  The context must not be active in any thread.  Timers still pending
+ *  in it are forgotten without firing.
+ */
+void osmo_timers_ctx_free(struct osmo_timers_ctx *tc)
+{
+	if (tc == &timers_default)
+		return;
+	talloc_free(tc);
+}
+
+/*! Make the calling thread operate on the given timer context
+ *  \param[in] tc timer context to use; NULL for the default one
+ *  \returns timer context used by the calling thread so far
+ *
+ *  All osmo_timer_*() and osmo_timers_*() functions operate on the timer
+ *  context of the calling thread, which is the process-wide default
+ *  context unless this function was called.  A timer must always be
+ *  deleted from within the context it was added to.
+ */
+struct osmo_timers_ctx *osmo_timers_ctx_switch(struct osmo_timers_ctx *tc)
+{
+	struct osmo_timers_ctx *prev = timers_ctx();
+
+	timers_cur = tc;
+	return prev;
+}
+
 /*! @} */
@@ -68,7 +68,10 @@ int osmo_gettimeofday(struct timeval *tv, struct timezone *tz)
 }
 
 /*! convenience function to advance the fake time.
- * Add the given values to osmo_gettimeofday_override_time. */
+ * Add the given values to osmo_gettimeofday_override_time.
+ *
+ * This does not move osmo_timer_list timers, which run on CLOCK_MONOTONIC;
+ * step those with osmo_clock_override_add(CLOCK_MONOTONIC, ...). */
 void osmo_gettimeofday_override_add(time_t secs, suseconds_t usecs)
 {
 	struct timeval val = { secs, usecs };
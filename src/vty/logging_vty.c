@@ -31,6 +31,7 @@
 #include <osmocom/core/utils.h>
 #include <osmocom/core/strrb.h>
 #include <osmocom/core/loggingrb.h>
+#include <osmocom/core/logging_binary.h>
 #include <osmocom/core/gsmtap.h>
 
 #include <osmocom/vty/command.h>
@@ -237,6 +238,21 @@ DEFUN(logging_prnt_level,
 	return CMD_SUCCESS;
 }
 
+DEFUN(logging_dedup,
+      logging_dedup_cmd,
+      "logging deduplicate <0-60000>",
+      LOGGING_STR "Suppress log lines identical to the previous one\n"
+      "Time window in milliseconds, 0 to disable\n")
+{
+	struct log_target *tgt = osmo_log_vty2tgt(vty);
+
+	if (!tgt)
+		return CMD_WARNING;
+
+	log_set_dedup_window(tgt, atoi(argv[0]));
+	return CMD_SUCCESS;
+}
+
 static const struct value_string logging_print_file_args[] = {
 	{ LOG_FILENAME_NONE, "0" },
 	{ LOG_FILENAME_PATH, "1" },
@@ -297,6 +313,7 @@ DEFUN(logging_level,
 
 	tgt->categories[category].enabled = 1;
 	tgt->categories[category].loglevel = level;
+	log_cache_update();
 
 	return CMD_SUCCESS;
 }
@@ -702,6 +719,103 @@ DEFUN(cfg_no_log_file, cfg_no_log_file_cmd,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_log_binary_file, cfg_log_binary_file_cmd,
+	"log binary-file .FILENAME",
+	LOG_STR "Logging to binary file, see osmo-log-decode\n" "Filename\n")
+{
+	const char *fname = argv[0];
+	struct log_target *tgt;
+
+	tgt = log_target_find(LOG_TGT_TYPE_BINARY, fname);
+	if (!tgt) {
+		tgt = log_target_create_binary(fname);
+		if (!tgt) {
+			vty_out(vty, "%% Unable to create file `%s'%s",
+				fname, VTY_NEWLINE);
+			return CMD_WARNING;
+		}
+		log_add_target(tgt);
+	}
+
+	vty->index = tgt;
+	vty->node = CFG_LOG_NODE;
+
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_log_binary_file, cfg_no_log_binary_file_cmd,
+	"no log binary-file .FILENAME",
+	NO_STR LOG_STR "Logging to binary file, see osmo-log-decode\n" "Filename\n")
+{
+	const char *fname = argv[0];
+	struct log_target *tgt;
+
+	tgt = log_target_find(LOG_TGT_TYPE_BINARY, fname);
+	if (!tgt) {
+		vty_out(vty, "%% No such log file `%s'%s",
+			fname, VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	log_target_destroy(tgt);
+
+	return CMD_SUCCESS;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+DEFUN(cfg_log_ring_file, cfg_log_ring_file_cmd,
+	"log ring-file <16-1048576> .FILENAME",
+	LOG_STR "Logging to memory-mapped ring buffer file, see osmo-log-ring\n"
+	"Number of log lines kept\n" "Filename\n")
+{
+	unsigned int num_slots = atoi(argv[0]);
+	const char *fname = argv[1];
+	struct log_target *tgt;
+
+	/* the number of slots is rounded up to a power of two */
+	tgt = log_target_find(LOG_TGT_TYPE_RB_FILE, fname);
+	if (tgt && (tgt->tgt_rb_file.hdr->num_slots < num_slots ||
+		    tgt->tgt_rb_file.hdr->num_slots / 2 >= num_slots)) {
+		log_target_destroy(tgt);
+		tgt = NULL;
+	}
+	if (!tgt) {
+		tgt = log_target_create_rb_file(fname, num_slots, LOG_RB_FILE_SLOT_SIZE);
+		if (!tgt) {
+			vty_out(vty, "%% Unable to create file `%s'%s",
+				fname, VTY_NEWLINE);
+			return CMD_WARNING;
+		}
+		log_add_target(tgt);
+	}
+
+	vty->index = tgt;
+	vty->node = CFG_LOG_NODE;
+
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_log_ring_file, cfg_no_log_ring_file_cmd,
+	"no log ring-file .FILENAME",
+	NO_STR LOG_STR "Logging to memory-mapped ring buffer file, see osmo-log-ring\n"
+	"Filename\n")
+{
+	const char *fname = argv[0];
+	struct log_target *tgt;
+
+	tgt = log_target_find(LOG_TGT_TYPE_RB_FILE, fname);
+	if (!tgt) {
+		vty_out(vty, "%% No such log file `%s'%s",
+			fname, VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	log_target_destroy(tgt);
+
+	return CMD_SUCCESS;
+}
+#endif /* HAVE_SYS_MMAN_H */
+
 DEFUN(cfg_log_alarms, cfg_log_alarms_cmd,
 	"log alarms <2-32700>",
 	LOG_STR "Logging alarms to osmo_strrb\n"
@@ -768,6 +882,13 @@ static int config_write_log_single(struct vty *vty, struct log_target *tgt)
 	case LOG_TGT_TYPE_FILE:
 		vty_out(vty, "log file %s%s", tgt->tgt_file.fname, VTY_NEWLINE);
 		break;
+	case LOG_TGT_TYPE_BINARY:
+		vty_out(vty, "log binary-file %s%s", tgt->tgt_binary.fname, VTY_NEWLINE);
+		break;
+	case LOG_TGT_TYPE_RB_FILE:
+		vty_out(vty, "log ring-file %u %s%s", tgt->tgt_rb_file.hdr->num_slots,
+			tgt->tgt_rb_file.fname, VTY_NEWLINE);
+		break;
 	case LOG_TGT_TYPE_STRRB:
 		vty_out(vty, "log alarms %zu%s",
 			log_target_rb_avail_size(tgt), VTY_NEWLINE);
@@ -798,6 +919,8 @@ static int config_write_log_single(struct vty *vty, struct log_target *tgt)
 	vty_out(vty, "  logging print file %s%s",
 		get_value_string(logging_print_file_args, tgt->print_filename2),
 		VTY_NEWLINE);
+	if (tgt->dedup.window_ms)
+		vty_out(vty, "  logging deduplicate %u%s", tgt->dedup.window_ms, VTY_NEWLINE);
 
 	/* stupid old osmo logging API uses uppercase strings... */
 	osmo_str2lower(level_lower, log_level_str(tgt->loglevel));
@@ -850,6 +973,7 @@ void logging_vty_add_cmds()
 	install_element_ve(&logging_prnt_cat_hex_cmd);
 	install_element_ve(&logging_prnt_level_cmd);
 	install_element_ve(&logging_prnt_file_cmd);
+	install_element_ve(&logging_dedup_cmd);
 	install_element_ve(&logging_set_category_mask_cmd);
 	install_element_ve(&logging_set_category_mask_old_cmd);
 
@@ -869,12 +993,19 @@ void logging_vty_add_cmds()
 	install_element(CFG_LOG_NODE, &logging_prnt_cat_hex_cmd);
 	install_element(CFG_LOG_NODE, &logging_prnt_level_cmd);
 	install_element(CFG_LOG_NODE, &logging_prnt_file_cmd);
+	install_element(CFG_LOG_NODE, &logging_dedup_cmd);
 	install_element(CFG_LOG_NODE, &logging_level_cmd);
 
 	install_element(CONFIG_NODE, &cfg_log_stderr_cmd);
 	install_element(CONFIG_NODE, &cfg_no_log_stderr_cmd);
 	install_element(CONFIG_NODE, &cfg_log_file_cmd);
 	install_element(CONFIG_NODE, &cfg_no_log_file_cmd);
+	install_element(CONFIG_NODE, &cfg_log_binary_file_cmd);
+	install_element(CONFIG_NODE, &cfg_no_log_binary_file_cmd);
+#ifdef HAVE_SYS_MMAN_H
+	install_element(CONFIG_NODE, &cfg_log_ring_file_cmd);
+	install_element(CONFIG_NODE, &cfg_no_log_ring_file_cmd);
+#endif
 	install_element(CONFIG_NODE, &cfg_log_alarms_cmd);
 	install_element(CONFIG_NODE, &cfg_no_log_alarms_cmd);
 #ifdef HAVE_SYSLOG_H
@@ -22,9 +22,23 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <errno.h>
+#include <string.h>
+#include <unistd.h>
 #include <osmocom/core/write_queue.h>
 #include <osmocom/core/logging.h>
+#include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/stats.h>
+#include <osmocom/core/stat_item.h>
+#include <osmocom/core/socket.h>
+
+#include "../config.h"
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
 
 /*! \addtogroup write_queue
  *  @{
@@ -32,6 +46,241 @@
  *
  * \file write_queue.c */
 
+enum wqueue_stat_item_id {
+	WQUEUE_STAT_BATCH,
+	WQUEUE_STAT_DEPTH,
+	WQUEUE_STAT_DEPTH_BYTES,
+};
+
+static const struct osmo_stat_item_desc wqueue_stat_description[] = {
+	[WQUEUE_STAT_BATCH]	= { "batch.size", "Messages written per writable event", OSMO_STAT_ITEM_NO_UNIT, 16, 0 },
+	[WQUEUE_STAT_DEPTH]	= { "depth", "Messages in the queue", OSMO_STAT_ITEM_NO_UNIT, 16, 0 },
+	[WQUEUE_STAT_DEPTH_BYTES] = { "depth.bytes", "Bytes in the queue", "bytes", 16, 0 },
+};
+
+static const struct osmo_stat_item_group_desc wqueue_statg_desc = {
+	.group_name_prefix = "wqueue",
+	.group_description = "Write Queue Statistics",
+	.num_items = ARRAY_SIZE(wqueue_stat_description),
+	.item_desc = wqueue_stat_description,
+	.class_id = OSMO_STATS_CLASS_PEER,
+};
+
+enum wqueue_ctr_id {
+	WQUEUE_CTR_DROP_MSGS,
+	WQUEUE_CTR_DROP_BYTES,
+	WQUEUE_CTR_CONGESTED,
+};
+
+static const struct rate_ctr_desc wqueue_ctr_description[] = {
+	[WQUEUE_CTR_DROP_MSGS]	= { "msgs:dropped", "Messages rejected or lost" },
+	[WQUEUE_CTR_DROP_BYTES]	= { "bytes:dropped", "Bytes rejected or lost" },
+	[WQUEUE_CTR_CONGESTED]	= { "congested", "Reached the high watermark" },
+};
+
+static const struct rate_ctr_group_desc wqueue_ctrg_desc = {
+	.group_name_prefix = "wqueue",
+	.group_description = "Write Queue Counters",
+	.num_ctr = ARRAY_SIZE(wqueue_ctr_description),
+	.ctr_desc = wqueue_ctr_description,
+	.class_id = OSMO_STATS_CLASS_PEER,
+};
+
+/* account for a msgb that was rejected, or removed without being written */
+static void wqueue_count_drop(struct osmo_wqueue *queue, unsigned int len)
+{
+	if (!queue->ctrg)
+		return;
+	rate_ctr_inc(&queue->ctrg->ctr[WQUEUE_CTR_DROP_MSGS]);
+	rate_ctr_add(&queue->ctrg->ctr[WQUEUE_CTR_DROP_BYTES], len);
+}
+
+static void wqueue_publish_depth(struct osmo_wqueue *queue)
+{
+	if (!queue->statg)
+		return;
+	osmo_stat_item_set(queue->statg->items[WQUEUE_STAT_DEPTH], queue->current_length);
+	osmo_stat_item_set(queue->statg->items[WQUEUE_STAT_DEPTH_BYTES], queue->current_bytes);
+}
+
+/* publish the depth after writing and signal leaving the congested state */
+static void wqueue_update(struct osmo_wqueue *queue)
+{
+	wqueue_publish_depth(queue);
+
+	if (queue->congested && queue->current_bytes <= queue->low_bytes) {
+		queue->congested = false;
+		if (queue->decongested_cb)
+			queue->decongested_cb(queue);
+	}
+}
+
+/* write_cb only gets to see the head of a chained msgb, so copy the
+ * fragments into it first */
+static int wqueue_linearize(struct osmo_wqueue *queue, struct msgb *msg)
+{
+	if (!msg->frag_next || msgb_linearize(msg) == 0)
+		return 0;
+
+	LOGP(DLGLOBAL, LOGL_ERROR, "wqueue(%p): chained msgb exceeds the "
+	     "tailroom of its head, can't pass it to write_cb\n", queue);
+	return -EMSGSIZE;
+}
+
+#ifdef HAVE_SYS_SOCKET_H
+/* iovec entries available to one batch */
+#define WQUEUE_BATCH_IOV	256
+
+/* remove a msgb that was written, or failed to be written if 'lost' */
+static void wqueue_drop_head(struct osmo_wqueue *queue, bool lost)
+{
+	struct msgb *msg = msgb_dequeue(&queue->msg_queue);
+	unsigned int len = msgb_chain_len(msg);
+
+	--queue->current_length;
+	queue->current_bytes -= len;
+	if (lost)
+		wqueue_count_drop(queue, len);
+	msgb_free(msg);
+}
+
+/* consume 'len' written bytes from the fragments of a partially written msgb */
+static void wqueue_pull(struct osmo_wqueue *queue, struct msgb *msg, unsigned int len)
+{
+	unsigned int n;
+
+	queue->current_bytes -= len;
+	for (; msg && len; msg = msg->frag_next) {
+		n = len < msg->len ? len : msg->len;
+		msgb_pull(msg, n);
+		len -= n;
+	}
+}
+
+/* send up to batch_max datagrams with one sendmmsg() */
+static int wqueue_write_dgram(struct osmo_wqueue *queue)
+{
+	struct mmsghdr mmsg[OSMO_WQUEUE_BATCH_MAX];
+	struct iovec iov[WQUEUE_BATCH_IOV];
+	unsigned int n = 0, used = 0, i;
+	struct msgb *msg;
+	int rc;
+
+	llist_for_each_entry(msg, &queue->msg_queue, list) {
+		if (n >= queue->batch_max)
+			break;
+		rc = osmo_sock_msgb_iov(msg, &iov[used], WQUEUE_BATCH_IOV - used);
+		if (rc < 0)
+			break;
+		memset(&mmsg[n], 0, sizeof(mmsg[n]));
+		mmsg[n].msg_hdr.msg_iov = &iov[used];
+		mmsg[n].msg_hdr.msg_iovlen = rc;
+		used += rc;
+		n++;
+	}
+
+	/* a single msgb with more fragments than we can send */
+	if (!n) {
+		wqueue_drop_head(queue, true);
+		return -EMSGSIZE;
+	}
+
+#ifdef HAVE_SENDMMSG
+	rc = sendmmsg(queue->bfd.fd, mmsg, n, 0);
+#else
+	for (rc = 0; rc < n; rc++) {
+		if (sendmsg(queue->bfd.fd, &mmsg[rc].msg_hdr, 0) < 0)
+			break;
+	}
+	if (rc == 0)
+		rc = -1;
+#endif
+	if (rc < 0) {
+		rc = -errno;
+		if (rc == -EAGAIN)
+			return 0;
+		/* like in the write_cb case, the message is lost */
+		wqueue_drop_head(queue, true);
+		return rc;
+	}
+
+	for (i = 0; i < rc; i++)
+		wqueue_drop_head(queue, false);
+	return rc;
+}
+
+/* write up to batch_max msgbs with one writev(), some of them maybe partially */
+static int wqueue_write_stream(struct osmo_wqueue *queue)
+{
+	struct iovec iov[WQUEUE_BATCH_IOV];
+	unsigned int n = 0, used = 0, done = 0;
+	struct msgb *msg;
+	ssize_t rc;
+
+	llist_for_each_entry(msg, &queue->msg_queue, list) {
+		if (n >= queue->batch_max)
+			break;
+		rc = osmo_sock_msgb_iov(msg, &iov[used], WQUEUE_BATCH_IOV - used);
+		if (rc < 0)
+			break;
+		used += rc;
+		n++;
+	}
+
+	if (!n) {
+		wqueue_drop_head(queue, true);
+		return -EMSGSIZE;
+	}
+
+	rc = writev(queue->bfd.fd, iov, used);
+	if (rc < 0) {
+		rc = -errno;
+		if (rc == -EAGAIN)
+			return 0;
+		wqueue_drop_head(queue, true);
+		return rc;
+	}
+
+	/* release what was written completely, keep the rest of a partially
+	 * written msgb at the head of the queue */
+	while (rc > 0 && !llist_empty(&queue->msg_queue)) {
+		msg = llist_entry(queue->msg_queue.next, struct msgb, list);
+		if (rc < msgb_chain_len(msg)) {
+			wqueue_pull(queue, msg, rc);
+			break;
+		}
+		rc -= msgb_chain_len(msg);
+		wqueue_drop_head(queue, false);
+		done++;
+	}
+
+	return done;
+}
+
+static int wqueue_write_batch(struct osmo_wqueue *queue)
+{
+	int rc;
+
+	if (queue->batch_dgram)
+		rc = wqueue_write_dgram(queue);
+	else
+		rc = wqueue_write_stream(queue);
+
+	if (rc < 0)
+		LOGP(DLGLOBAL, LOGL_ERROR, "wqueue(%p): write failed: %s\n",
+		     queue, strerror(-rc));
+	else if (queue->statg)
+		osmo_stat_item_set(queue->statg->items[WQUEUE_STAT_BATCH], rc);
+
+	return rc;
+}
+#else
+static int wqueue_write_batch(struct osmo_wqueue *queue)
+{
+	return -ENOTSUP;
+}
+#endif /* HAVE_SYS_SOCKET_H */
+
 /*! Select loop function for write queue handling
  *  \param[in] fd osmocom file descriptor
  *  \param[in] what bit-mask of events that have happened
@@ -65,11 +314,26 @@ int osmo_wqueue_bfd_cb(struct osmo_fd *fd, unsigned int what)
 		fd->when &= ~BSC_FD_WRITE;
 
 		/* the queue might have been emptied */
-		if (!llist_empty(&queue->msg_queue)) {
+		if (queue->batch_max > 1 && !llist_empty(&queue->msg_queue)) {
+			wqueue_write_batch(queue);
+
+			if (!llist_empty(&queue->msg_queue))
+				fd->when |= BSC_FD_WRITE;
+			wqueue_update(queue);
+		} else if (!llist_empty(&queue->msg_queue)) {
+			unsigned int len;
+
 			--queue->current_length;
 
 			msg = msgb_dequeue(&queue->msg_queue);
-			rc = queue->write_cb(fd, msg);
+			len = msgb_chain_len(msg);
+			queue->current_bytes -= len;
+			/* may have been queued in batch mode */
+			rc = wqueue_linearize(queue, msg);
+			if (rc < 0)
+				wqueue_count_drop(queue, len);
+			else
+				rc = queue->write_cb(fd, msg);
 			msgb_free(msg);
 
 			if (rc == -EBADF)
@@ -77,6 +341,7 @@ int osmo_wqueue_bfd_cb(struct osmo_fd *fd, unsigned int what)
 
 			if (!llist_empty(&queue->msg_queue))
 				fd->when |= BSC_FD_WRITE;
+			wqueue_update(queue);
 		}
 	}
 
@@ -96,6 +361,17 @@ void osmo_wqueue_init(struct osmo_wqueue *queue, int max_length)
 	queue->read_cb = NULL;
 	queue->write_cb = NULL;
 	queue->except_cb = NULL;
+	queue->batch_max = 0;
+	queue->batch_dgram = false;
+	queue->statg = NULL;
+	queue->max_bytes = 0;
+	queue->current_bytes = 0;
+	queue->high_bytes = 0;
+	queue->low_bytes = 0;
+	queue->congested = false;
+	queue->congested_cb = NULL;
+	queue->decongested_cb = NULL;
+	queue->ctrg = NULL;
 	queue->bfd.cb = osmo_wqueue_bfd_cb;
 	INIT_LLIST_HEAD(&queue->msg_queue);
 }
@@ -104,19 +380,54 @@ void osmo_wqueue_init(struct osmo_wqueue *queue, int max_length)
  *  \param[in] queue Write queue to be used
  *  \param[in] data to-be-enqueued message buffer
  *  \returns 0 on success; negative on error
+ *
+ *  The msgb is rejected if the queue holds max_length msgbs already, or
+ *  if it would exceed max_bytes.  Reaching the high watermark calls the
+ *  congested_cb, see osmo_wqueue_set_watermarks().
+ *
+ *  Unless in batch mode, the fragments of a chained msgb are copied into
+ *  its head for write_cb; the msgb is rejected with -EMSGSIZE if the
+ *  tailroom of its head is too small for that.
  */
 int osmo_wqueue_enqueue(struct osmo_wqueue *queue, struct msgb *data)
 {
+	unsigned int len = msgb_chain_len(data);
+
 	if (queue->current_length >= queue->max_length) {
 		LOGP(DLGLOBAL, LOGL_ERROR,
 			"wqueue(%p) is full. Rejecting msgb\n", queue);
+		wqueue_count_drop(queue, len);
+		return -ENOSPC;
+	}
+
+	if (queue->max_bytes && queue->current_bytes + len > queue->max_bytes) {
+		LOGP(DLGLOBAL, LOGL_ERROR,
+			"wqueue(%p) is full (%u bytes). Rejecting msgb\n",
+			queue, queue->current_bytes);
+		wqueue_count_drop(queue, len);
 		return -ENOSPC;
 	}
 
+	if (queue->batch_max <= 1 && wqueue_linearize(queue, data) < 0) {
+		wqueue_count_drop(queue, len);
+		return -EMSGSIZE;
+	}
+
 	++queue->current_length;
+	queue->current_bytes += len;
 	msgb_enqueue(&queue->msg_queue, data);
 	queue->bfd.when |= BSC_FD_WRITE;
 
+	wqueue_publish_depth(queue);
+
+	if (!queue->congested && queue->high_bytes && queue->current_bytes >= queue->high_bytes) {
+		queue->congested = true;
+		if (queue->ctrg)
+			rate_ctr_inc(&queue->ctrg->ctr[WQUEUE_CTR_CONGESTED]);
+		if (queue->congested_cb)
+			queue->congested_cb(queue);
+	}
+
 	return 0;
 }
 
@@ -133,7 +444,101 @@ void osmo_wqueue_clear(struct osmo_wqueue *queue)
 	}
 
 	queue->current_length = 0;
+	queue->current_bytes = 0;
+	/* no decongested_cb here, the queue is typically being torn down */
+	queue->congested = false;
 	queue->bfd.when &= ~BSC_FD_WRITE;
 }
 
+/*! Set the byte watermarks of a write queue
+ *  \param[in] queue write queue
+ *  \param[in] high_bytes queue size that triggers congested_cb; 0 to disable
+ *  \param[in] low_bytes queue size that triggers decongested_cb
+ *  \returns 0 on success; -EINVAL if \a low_bytes exceeds \a high_bytes
+ *
+ *  Once the number of queued bytes reaches \a high_bytes, the queue is
+ *  congested and its congested_cb is called.  Producers should then stop
+ *  generating data for this queue, rather than having it rejected, until
+ *  decongested_cb is called after the queue drained to \a low_bytes.
+ *  Each call-back is called once per transition.
+ */
+int osmo_wqueue_set_watermarks(struct osmo_wqueue *queue, unsigned int high_bytes,
+			       unsigned int low_bytes)
+{
+	if (low_bytes > high_bytes)
+		return -EINVAL;
+
+	queue->high_bytes = high_bytes;
+	queue->low_bytes = low_bytes;
+	return 0;
+}
+
+/*! Enable writing several msgbs per writable event
+ *  \param[in] queue write queue; its fd must be set up already
+ *  \param[in] batch_max maximum number of msgbs per event; 0 or 1 to use write_cb
+ *  \returns 0 on success; -EINVAL if \a batch_max is too large; -ENOTSUP
+ *
+ *  In batch mode, the write queue transmits the msgbs itself instead of
+ *  calling write_cb: up to \a batch_max queued msgbs are sent with a single
+ *  sendmmsg() on datagram sockets, or written with a single writev() on
+ *  stream sockets and other fds.  Datagram sockets must be connected.
+ *  Partially written msgbs stay at the head of the queue.  A msgb that
+ *  fails to be sent is dropped, as in the write_cb case.  The number of
+ *  msgbs written per event is reported in the "batch.size" stat item, see
+ *  osmo_wqueue_stats_alloc().
+ */
+int osmo_wqueue_set_batch(struct osmo_wqueue *queue, unsigned int batch_max)
+{
+#ifdef HAVE_SYS_SOCKET_H
+	int type;
+	socklen_t len = sizeof(type);
+
+	if (batch_max > OSMO_WQUEUE_BATCH_MAX)
+		return -EINVAL;
+
+	queue->batch_max = batch_max;
+	queue->batch_dgram = getsockopt(queue->bfd.fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0
+			     && type == SOCK_DGRAM;
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+/*! Allocate the stat items and counters of a write queue
+ *  \param[in] queue write queue
+ *  \param[in] ctx talloc context to allocate from
+ *  \param[in] idx index of the "wqueue" stat item and counter groups
+ *  \returns 0 on success; -ENOMEM on error
+ *
+ *  Must be released with osmo_wqueue_stats_free().
+ */
+int osmo_wqueue_stats_alloc(struct osmo_wqueue *queue, void *ctx, unsigned int idx)
+{
+	queue->statg = osmo_stat_item_group_alloc(ctx, &wqueue_statg_desc, idx);
+	if (!queue->statg)
+		return -ENOMEM;
+	queue->ctrg = rate_ctr_group_alloc(ctx, &wqueue_ctrg_desc, idx);
+	if (!queue->ctrg) {
+		osmo_wqueue_stats_free(queue);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/*! Release the stat items and counters of a write queue
+ *  \param[in] queue write queue
+ */
+void osmo_wqueue_stats_free(struct osmo_wqueue *queue)
+{
+	if (queue->statg) {
+		osmo_stat_item_group_free(queue->statg);
+		queue->statg = NULL;
+	}
+	if (queue->ctrg) {
+		rate_ctr_group_free(queue->ctrg);
+		queue->ctrg = NULL;
+	}
+}
+
 /*! @} */
@@ -0,0 +1,189 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/* Measure the cost of looking up BSSGP BVC contexts by BVCI+NSEI and by
+ * RA ID+Cell ID as the number of BVCs grows, as seen by an SGSN or Gb
+ * proxy serving many cells.  For reference, the same lookups are done by
+ * a linear walk over all contexts, newest first, which is what the lookup
+ * functions did before the contexts were indexed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/application.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/gprs/gprs_bssgp.h>
+
+/* BVCs per NSE */
+#define BVC_PER_NSE	16
+
+static unsigned int num_lookups = 200000;
+
+/* all contexts in order of creation */
+static struct bssgp_bvc_ctx **bvcs;
+static unsigned int num_bvcs;
+
+/* not in any public header */
+struct bssgp_bvc_ctx *btsctx_alloc(uint16_t bvci, uint16_t nsei);
+
+static struct log_info info = {};
+
+int bssgp_prim_cb(struct osmo_prim_hdr *oph, void *ctx)
+{
+	return 0;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bvc_keys(unsigned int i, uint16_t *bvci, uint16_t *nsei,
+		     struct gprs_ra_id *raid, uint16_t *cid)
+{
+	*bvci = 2 + i;
+	*nsei = 100 + i / BVC_PER_NSE;
+	memset(raid, 0, sizeof(*raid));
+	raid->mcc = 901;
+	raid->mnc = 70;
+	raid->lac = 1000 + i / BVC_PER_NSE;
+	raid->rac = i % BVC_PER_NSE;
+	*cid = 10000 + i;
+}
+
+static struct bssgp_bvc_ctx *list_by_bvci_nsei(uint16_t bvci, uint16_t nsei)
+{
+	unsigned int i;
+
+	for (i = num_bvcs; i-- > 0; ) {
+		if (bvcs[i]->nsei == nsei && bvcs[i]->bvci == bvci)
+			return bvcs[i];
+	}
+	return NULL;
+}
+
+static struct bssgp_bvc_ctx *list_by_raid_cid(const struct gprs_ra_id *raid, uint16_t cid)
+{
+	unsigned int i;
+
+	for (i = num_bvcs; i-- > 0; ) {
+		if (!memcmp(&bvcs[i]->ra_id, raid, sizeof(bvcs[i]->ra_id)) &&
+		    bvcs[i]->cell_id == cid)
+			return bvcs[i];
+	}
+	return NULL;
+}
+
+enum bench_lookup {
+	BY_BVCI_NSEI,
+	BY_RAID_CID,
+};
+
+static double run_lookups(unsigned int num_bvc, enum bench_lookup by, bool list)
+{
+	struct bssgp_bvc_ctx *bctx;
+	struct gprs_ra_id raid;
+	uint16_t bvci, nsei, cid;
+	double start, end;
+	unsigned int i;
+
+	srand(42);
+	start = now_sec();
+	for (i = 0; i < num_lookups; i++) {
+		bvc_keys(rand() % num_bvc, &bvci, &nsei, &raid, &cid);
+		if (by == BY_BVCI_NSEI)
+			bctx = list ? list_by_bvci_nsei(bvci, nsei) : btsctx_by_bvci_nsei(bvci, nsei);
+		else
+			bctx = list ? list_by_raid_cid(&raid, cid) : btsctx_by_raid_cid(&raid, cid);
+		OSMO_ASSERT(bctx && bctx->bvci == bvci);
+	}
+	end = now_sec();
+
+	return (end - start) * 1e9 / num_lookups;
+}
+
+static void run_bench(unsigned int num_bvc)
+{
+	struct bssgp_bvc_ctx *bctx;
+	struct gprs_ra_id raid;
+	uint16_t bvci, nsei, cid;
+	unsigned int i;
+
+	bvcs = talloc_zero_array(NULL, struct bssgp_bvc_ctx *, num_bvc);
+	OSMO_ASSERT(bvcs);
+	for (i = 0; i < num_bvc; i++) {
+		bvc_keys(i, &bvci, &nsei, &raid, &cid);
+		bctx = btsctx_alloc(bvci, nsei);
+		OSMO_ASSERT(bctx);
+		bctx->ra_id = raid;
+		bctx->cell_id = cid;
+		bssgp_bvc_ctx_rehash(bctx);
+		bvcs[num_bvcs++] = bctx;
+	}
+
+	printf("%6u BVCs: bvci+nsei %8.1f ns/lookup (list %9.1f), "
+	       "raid+cid %8.1f ns/lookup (list %9.1f)\n", num_bvc,
+	       run_lookups(num_bvc, BY_BVCI_NSEI, false),
+	       run_lookups(num_bvc, BY_BVCI_NSEI, true),
+	       run_lookups(num_bvc, BY_RAID_CID, false),
+	       run_lookups(num_bvc, BY_RAID_CID, true));
+
+	for (i = 0; i < num_bvcs; i++)
+		talloc_free(bvcs[i]);
+	talloc_free(bvcs);
+	num_bvcs = 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int max_bvc = 16384;
+	unsigned int num_bvc;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:o:")) != -1) {
+		switch (c) {
+		case 'n':
+			max_bvc = atoi(optarg);
+			break;
+		case 'o':
+			num_lookups = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n max_bvcs] [-o lookups]\n",
+				argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (!max_bvc || max_bvc > 65534) {
+		fprintf(stderr, "max_bvcs must be between 1 and 65534\n");
+		exit(EXIT_FAILURE);
+	}
+
+	osmo_init_logging2(NULL, &info);
+
+	for (num_bvc = 1; num_bvc < max_bvc; num_bvc *= 4)
+		run_bench(num_bvc);
+	run_bench(max_bvc);
+
+	return 0;
+}
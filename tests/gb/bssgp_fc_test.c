@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
 #include <string.h>
 #include <getopt.h>
 #include <unistd.h>
@@ -13,6 +15,7 @@
 #include <osmocom/core/utils.h>
 #include <osmocom/core/logging.h>
 #include <osmocom/core/talloc.h>
+#include <osmocom/core/rate_ctr.h>
 #include <osmocom/gprs/gprs_bssgp.h>
 
 static unsigned long in_ctr = 1;
@@ -35,12 +38,17 @@ static int fc_out_cb(struct bssgp_flow_control *fc, struct msgb *msg,
 {
 	unsigned int csecs = get_centisec_diff();
 
-	printf("%u: FC OUT Nr %lu\n", csecs, (unsigned long) msg->cb[0]);
+	if (msg->cb[1])
+		printf("%u: FC OUT Nr %lu (bucket %lu)\n", csecs,
+		       (unsigned long) msg->cb[0], (unsigned long) msg->cb[1]);
+	else
+		printf("%u: FC OUT Nr %lu\n", csecs, (unsigned long) msg->cb[0]);
 	msgb_free(msg);
 	return 0;
 }
 
-static void fc_in(struct bssgp_flow_control *fc, unsigned int pdu_len)
+static void fc_in(struct bssgp_flow_control *fc, unsigned int pdu_len,
+		  unsigned int bucket)
 {
 	struct msgb *msg;
 	unsigned int csecs = get_centisec_diff();
@@ -48,8 +56,12 @@ static void fc_in(struct bssgp_flow_control *fc, unsigned int pdu_len)
 
 	msg = msgb_alloc(1, "fc test");
 	msg->cb[0] = in_ctr++;
+	msg->cb[1] = bucket;
 
-	printf("%u: FC IN Nr %lu\n", csecs, msg->cb[0]);
+	if (bucket)
+		printf("%u: FC IN Nr %lu (bucket %u)\n", csecs, msg->cb[0], bucket);
+	else
+		printf("%u: FC IN Nr %lu\n", csecs, msg->cb[0]);
 	rc = bssgp_fc_in(fc, msg, pdu_len, NULL);
 	switch (rc) {
 	case 0:
@@ -68,11 +80,39 @@ static void fc_in(struct bssgp_flow_control *fc, unsigned int pdu_len)
 }
 
 
+static bool fc_queues_empty(struct bssgp_flow_control **fc, unsigned int num_fc)
+{
+	unsigned int j;
+
+	for (j = 0; j < num_fc; j++) {
+		if (!llist_empty(&fc[j]->queue))
+			return false;
+	}
+	return true;
+}
+
+/* queueing delay histogram of the flow control scheduler */
+static void dump_delays(void)
+{
+	struct rate_ctr_group *ctrg = rate_ctr_get_group_by_name_idx("bssgp:fc", 0);
+	int i;
+
+	if (!ctrg)
+		return;
+
+	for (i = 0; i < ctrg->desc->num_ctr; i++)
+		printf("%s: %" PRIu64 "\n", ctrg->desc->ctr_desc[i].name,
+		       ctrg->ctr[i].current);
+}
+
+/* num_fc > 1 feeds PDUs to several flow control instances in turn, which
+ * are all served by the same scheduler */
 static void test_fc(uint32_t bucket_size_max, uint32_t bucket_leak_rate,
 		    uint32_t max_queue_depth, uint32_t pdu_len,
-		    uint32_t pdu_count)
+		    uint32_t pdu_count, unsigned int num_fc)
 {
-	struct bssgp_flow_control *fc = talloc_zero(ctx, struct bssgp_flow_control);
+	struct bssgp_flow_control **fc = talloc_zero_array(ctx, struct bssgp_flow_control *, num_fc);
+	unsigned int j;
 	int i;
 
 	osmo_gettimeofday_override_time = (struct timeval){
@@ -80,16 +120,28 @@ static void test_fc(uint32_t bucket_size_max, uint32_t bucket_leak_rate,
 		.tv_usec = 423423,
 	};
 	osmo_gettimeofday_override = true;
+	/* timers run on the monotonic clock, keep it in lockstep */
+	osmo_clock_override_enable(CLOCK_MONOTONIC, true);
+	*osmo_clock_override_gettimespec(CLOCK_MONOTONIC) = (struct timespec){
+		.tv_sec = 1486385000,
+		.tv_nsec = 423423000,
+	};
 
-	bssgp_fc_init(fc, bucket_size_max, bucket_leak_rate, max_queue_depth,
-		      fc_out_cb);
+	/* each one must be a talloc context of its own, the queue elements
+	 * are allocated from it */
+	for (j = 0; j < num_fc; j++) {
+		fc[j] = talloc_zero(fc, struct bssgp_flow_control);
+		bssgp_fc_init(fc[j], bucket_size_max, bucket_leak_rate,
+			      max_queue_depth, fc_out_cb);
+	}
 
 	osmo_gettimeofday(&tv_start, NULL);
 
 	/* Fill the queue with PDUs, possibly beyond the queue being full. If it is full, additional PDUs
 	 * are discarded. */
 	for (i = 0; i < pdu_count; i++) {
-		fc_in(fc, pdu_len);
+		for (j = 0; j < num_fc; j++)
+			fc_in(fc[j], pdu_len, num_fc > 1 ? j + 1 : 0);
 		osmo_timers_check();
 		osmo_timers_prepare();
 		osmo_timers_update();
@@ -97,15 +149,19 @@ static void test_fc(uint32_t bucket_size_max, uint32_t bucket_leak_rate,
 
 	while (1) {
 		osmo_gettimeofday_override_add(0, 100000);
+		osmo_clock_override_add(CLOCK_MONOTONIC, 0, 100000000);
 
 		osmo_timers_check();
 		osmo_timers_prepare();
 		osmo_timers_update();
 
-		if (llist_empty(&fc->queue))
+		if (fc_queues_empty(fc, num_fc))
 			break;
 	}
 
+	if (num_fc > 1)
+		dump_delays();
+
 	talloc_free(fc);
 }
 
@@ -116,6 +172,8 @@ static void help(void)
 	printf(" -r --bucket-leak-rate N  Bucket leak rate in octets/sec\n");
 	printf(" -d --max-queue-depth N   Maximum length of pending PDU queue (msgs)\n");
 	printf(" -l --pdu-length N        Length of each PDU in octets\n");
+	printf(" -c --pdu-count N         Number of PDUs per bucket\n");
+	printf(" -b --buckets N           Number of flow control buckets\n");
 }
 
 int bssgp_prim_cb(struct osmo_prim_hdr *oph, void *ctx)
@@ -132,6 +190,7 @@ int main(int argc, char **argv)
 	uint32_t max_queue_depth = 5; /* messages */
 	uint32_t pdu_length = 10; /* octets */
 	uint32_t pdu_count = 20; /* messages */
+	unsigned int num_fc = 1;
 	int c;
 	void *tall_msgb_ctx;
 	ctx = talloc_named_const(NULL, 0, "bssgp_fc_test");
@@ -142,6 +201,7 @@ int main(int argc, char **argv)
 		{ "max-queue-depth", 1, 0, 'd' },
 		{ "pdu-length", 1, 0, 'l' },
 		{ "pdu-count", 1, 0, 'c' },
+		{ "buckets", 1, 0, 'b' },
 		{ "help", 0, 0, 'h' },
 		{ 0, 0, 0, 0 }
 	};
@@ -152,7 +212,7 @@ int main(int argc, char **argv)
 
 	tall_msgb_ctx = msgb_talloc_ctx_init(ctx, 0);
 
-	while ((c = getopt_long(argc, argv, "s:r:d:l:c:",
+	while ((c = getopt_long(argc, argv, "s:r:d:l:c:b:",
 				long_options, NULL)) != -1) {
 		switch (c) {
 		case 's':
@@ -170,6 +230,9 @@ int main(int argc, char **argv)
 		case 'c':
 			pdu_count = atoi(optarg);
 			break;
+		case 'b':
+			num_fc = atoi(optarg);
+			break;
 		case 'h':
 			help();
 			exit(EXIT_SUCCESS);
@@ -179,6 +242,11 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (num_fc < 1) {
+		fprintf(stderr, "At least one bucket is needed!\n");
+		exit(EXIT_FAILURE);
+	}
+
 	/* bucket leak rate less than 100 not supported! */
 	if (bucket_leak_rate < 100) {
 		fprintf(stderr, "Bucket leak rate < 100 not supported!\n");
@@ -187,10 +255,13 @@ int main(int argc, char **argv)
 
 	printf("===== BSSGP flow-control test START\n");
 	printf("size-max=%u oct, leak-rate=%u oct/s, "
-		"queue-len=%u msgs, pdu_len=%u oct, pdu_cnt=%u\n\n", bucket_size_max,
+		"queue-len=%u msgs, pdu_len=%u oct, pdu_cnt=%u\n", bucket_size_max,
 		bucket_leak_rate, max_queue_depth, pdu_length, pdu_count);
+	if (num_fc > 1)
+		printf("buckets=%u\n", num_fc);
+	printf("\n");
 	test_fc(bucket_size_max, bucket_leak_rate, max_queue_depth,
-		pdu_length, pdu_count);
+		pdu_length, pdu_count, num_fc);
 	printf("msgb ctx: %zu b in %zu blocks (0 b in 1 block == just the context)\n",
 	       talloc_total_size(tall_msgb_ctx),
 	       talloc_total_blocks(tall_msgb_ctx));
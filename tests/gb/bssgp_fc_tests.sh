@@ -13,3 +13,6 @@ $T -l 1000
 # test with 100 byte PDUs (10 second)
 $T -s 100
 
+
+# test with three buckets served by the same scheduler
+$T -b 3 -s 50 -c 8
@@ -0,0 +1,202 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/* Forward NS-UNITDATA PDUs from a BSS to an SGSN the way a Gb proxy does,
+ * either by copying each received msgb with bssgp_msgb_copy() or with
+ * gprs_ns_fwd_msgb(), and report the time and bytes copied per PDU.
+ *
+ * The PDUs enter through gprs_ns_rcvmsg() and leave through sendto(), which
+ * is overridden to count them instead of sending them.  A PDU that is not
+ * sent from the received msgb was copied; msgb_copy() copies the complete
+ * data area of the received msgb. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/application.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/gprs/gprs_msgb.h>
+#include <osmocom/gprs/gprs_ns.h>
+#include <osmocom/gprs/gprs_bssgp.h>
+
+#define BSS_ADDR	0x0a000001
+#define SGSN_ADDR	0x0a000002
+#define BSS_NSEI	0x1000
+#define SGSN_NSEI	0x0100
+
+static unsigned int num_pdus = 1000000;
+static bool fwd_in_place;
+
+/* the msgb currently being received */
+static struct msgb *rx_msg;
+static unsigned long long pdus_sent, bytes_sent, bytes_copied;
+
+static struct log_info info = {};
+
+/* from gprs_ns.c, not declared in any header */
+int gprs_ns_rcvmsg(struct gprs_ns_inst *nsi, struct msgb *msg,
+		   struct sockaddr_in *saddr, enum gprs_ns_ll ll);
+
+int bssgp_prim_cb(struct osmo_prim_hdr *oph, void *ctx)
+{
+	return 0;
+}
+
+/* override */
+ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
+	       const struct sockaddr *dest_addr, socklen_t addrlen)
+{
+	const uint8_t *p = buf;
+
+	pdus_sent++;
+	bytes_sent += len;
+	if (p < rx_msg->head || p >= rx_msg->head + rx_msg->data_len)
+		bytes_copied += rx_msg->data_len;
+
+	return len;
+}
+
+static int fwd_cb(enum gprs_ns_evt event, struct gprs_nsvc *nsvc,
+		  struct msgb *msg, uint16_t bvci)
+{
+	struct msgb *copy;
+
+	if (event != GPRS_NS_EVT_UNIT_DATA)
+		return 0;
+
+	if (fwd_in_place)
+		return gprs_ns_fwd_msgb(nsvc->nsi, msg, SGSN_NSEI, bvci);
+
+	copy = bssgp_msgb_copy(msg, "fwd bench");
+	if (!copy)
+		return -ENOMEM;
+	msgb_pull(copy, msgb_bssgph(copy) - copy->data);
+	msgb_nsei(copy) = SGSN_NSEI;
+	return gprs_ns_sendmsg(nsvc->nsi, copy);
+}
+
+static struct gprs_nsvc *add_nsvc(struct gprs_ns_inst *nsi, uint16_t nsvci,
+				  uint16_t nsei, uint32_t addr)
+{
+	struct gprs_nsvc *nsvc = gprs_nsvc_create(nsi, nsvci);
+
+	nsvc->nsei = nsei;
+	nsvc->ll = GPRS_NS_LL_UDP;
+	nsvc->ip.bts_addr.sin_family = AF_INET;
+	nsvc->ip.bts_addr.sin_addr.s_addr = htonl(addr);
+	nsvc->ip.bts_addr.sin_port = htons(23000);
+	nsvc->state = NSE_S_ALIVE;
+	gprs_nsvc_rehash(nsvc);
+
+	return nsvc;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_bench(struct gprs_ns_inst *nsi, unsigned int pdu_len, bool in_place)
+{
+	struct sockaddr_in saddr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(BSS_ADDR),
+		.sin_port = htons(23000),
+	};
+	double start, end;
+	unsigned int i;
+	uint8_t *nsh;
+
+	fwd_in_place = in_place;
+	pdus_sent = bytes_sent = bytes_copied = 0;
+
+	start = now_sec();
+	for (i = 0; i < num_pdus; i++) {
+		/* like the NS/UDP receive path */
+		rx_msg = msgb_alloc_headroom(NS_ALLOC_SIZE, NS_ALLOC_HEADROOM, "Gb/NS/IP/Rx");
+		OSMO_ASSERT(rx_msg);
+		rx_msg->l2h = nsh = msgb_put(rx_msg, 4 + pdu_len);
+		nsh[0] = NS_PDUT_UNITDATA;
+		nsh[1] = 0;
+		nsh[2] = 0;
+		nsh[3] = 2 + i % 64;
+		/* BSSGP UL-UNITDATA */
+		nsh[4] = BSSGP_PDUT_UL_UNITDATA;
+
+		gprs_ns_rcvmsg(nsi, rx_msg, &saddr, GPRS_NS_LL_UDP);
+		msgb_free(rx_msg);
+	}
+	end = now_sec();
+
+	OSMO_ASSERT(pdus_sent == num_pdus);
+	printf("%-8s %4u byte PDUs: %7.1f ns/PDU, %7.1f bytes copied/PDU, %7.1f bytes sent/PDU\n",
+	       in_place ? "in-place" : "copy", pdu_len,
+	       (end - start) * 1e9 / num_pdus, (double)bytes_copied / num_pdus,
+	       (double)bytes_sent / num_pdus);
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned int pdu_lens[] = { 64, 576, 1500 };
+	struct gprs_ns_inst *nsi;
+	unsigned int i;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			num_pdus = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n pdus]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (!num_pdus) {
+		fprintf(stderr, "pdus must be > 0\n");
+		exit(EXIT_FAILURE);
+	}
+
+	osmo_init_logging2(NULL, &info);
+	log_set_log_level(osmo_stderr_target, LOGL_FATAL);
+	msgb_talloc_ctx_init(NULL, 0);
+
+	nsi = gprs_ns_instantiate(fwd_cb, NULL);
+	OSMO_ASSERT(nsi);
+	add_nsvc(nsi, 0x1001, BSS_NSEI, BSS_ADDR);
+	add_nsvc(nsi, 0x2001, SGSN_NSEI, SGSN_ADDR);
+
+	for (i = 0; i < ARRAY_SIZE(pdu_lens); i++) {
+		run_bench(nsi, pdu_lens[i], false);
+		run_bench(nsi, pdu_lens[i], true);
+	}
+
+	gprs_ns_destroy(nsi);
+
+	return 0;
+}
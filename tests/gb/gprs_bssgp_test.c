@@ -289,6 +289,30 @@ static void test_bssgp_msgb_copy()
 	printf("----- %s END\n", __func__);
 }
 
+/* not in any header, see bssgp_bvc_bench.c */
+struct bssgp_bvc_ctx *btsctx_alloc(uint16_t bvci, uint16_t nsei);
+
+static void test_bssgp_bvc_ctx_free(void)
+{
+	struct bssgp_bvc_ctx *bctx;
+
+	printf("----- %s START\n", __func__);
+
+	/* freeing a context unlinks it */
+	bctx = btsctx_alloc(0x1234, 0x5678);
+	OSMO_ASSERT(btsctx_by_bvci_nsei(0x1234, 0x5678) == bctx);
+	talloc_free(bctx);
+	OSMO_ASSERT(btsctx_by_bvci_nsei(0x1234, 0x5678) == NULL);
+
+	/* users unlinking it themselves before freeing it still work */
+	bctx = btsctx_alloc(0x1234, 0x5678);
+	llist_del(&bctx->list);
+	talloc_free(bctx);
+	OSMO_ASSERT(btsctx_by_bvci_nsei(0x1234, 0x5678) == NULL);
+
+	printf("----- %s END\n", __func__);
+}
+
 static struct log_info info = {};
 
 int main(int argc, char **argv)
@@ -317,6 +341,7 @@ int main(int argc, char **argv)
 	test_bssgp_bad_reset();
 	test_bssgp_flow_control_bvc();
 	test_bssgp_msgb_copy();
+	test_bssgp_bvc_ctx_free();
 	printf("===== BSSGP test END\n\n");
 
 	exit(EXIT_SUCCESS);
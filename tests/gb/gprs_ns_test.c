@@ -12,6 +12,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
 #include <string.h>
 #include <getopt.h>
 #include <dlfcn.h>
@@ -25,6 +27,7 @@
 #include <osmocom/core/talloc.h>
 #include <osmocom/core/signal.h>
 #include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/stat_item.h>
 #include <osmocom/gprs/gprs_msgb.h>
 #include <osmocom/gprs/gprs_ns.h>
 #include <osmocom/gprs/gprs_bssgp.h>
@@ -35,6 +38,8 @@
 #define SGSN_NSEI 0x0100
 
 static int sent_pdu_type = 0;
+/* data last passed to sendto() */
+static const void *sent_buf = NULL;
 
 static int gprs_process_message(struct gprs_ns_inst *nsi, const char *text,
 				struct sockaddr_in *peer, const unsigned char* data,
@@ -221,6 +226,7 @@ ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
 		real_sendto = dlsym(RTLD_NEXT, "sendto");
 
 	sent_pdu_type = len > 0 ? ((uint8_t *)buf)[0] : -1;
+	sent_buf = buf;
 
 	if (dest_host == REMOTE_BSS_ADDR)
 		printf("MESSAGE to BSS, msg length %zu\n%s\n\n", len, osmo_hexdump(buf, len));
@@ -232,6 +238,9 @@ ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
 	return len;
 }
 
+/* don't print messages sent with gprs_ns_sendmsg() */
+static bool quiet_ns_sendmsg = false;
+
 /* override */
 int gprs_ns_sendmsg(struct gprs_ns_inst *nsi, struct msgb *msg)
 {
@@ -246,7 +255,9 @@ int gprs_ns_sendmsg(struct gprs_ns_inst *nsi, struct msgb *msg)
 	if (!real_gprs_ns_sendmsg)
 		real_gprs_ns_sendmsg = dlsym(RTLD_NEXT, "gprs_ns_sendmsg");
 
-	if (nsei == SGSN_NSEI)
+	if (quiet_ns_sendmsg)
+		;
+	else if (nsei == SGSN_NSEI)
 		printf("NS UNITDATA MESSAGE to SGSN, BVCI 0x%04x, msg length %zu\n%s\n\n",
 		       bvci, len, osmo_hexdump(buf, len));
 	else
@@ -330,6 +341,57 @@ static int test_signal(unsigned int subsys, unsigned int signal,
 	return 0;
 }
 
+/* Verify that the NS-VC indexes give the same results as walking the
+ * NS-VC list, which is ordered from the newest to the oldest NS-VC */
+static void check_nsvc_index(struct gprs_ns_inst *nsi)
+{
+	struct gprs_nsvc *nsvc, *other, *expected;
+	unsigned int count = 0, hashed = 0;
+	int bkt;
+
+	llist_for_each_entry(nsvc, &nsi->gprs_nsvcs, list) {
+		count++;
+
+		expected = NULL;
+		llist_for_each_entry(other, &nsi->gprs_nsvcs, list) {
+			if (other->nsvci == nsvc->nsvci) {
+				expected = other;
+				break;
+			}
+		}
+		OSMO_ASSERT(gprs_nsvc_by_nsvci(nsi, nsvc->nsvci) == expected);
+
+		expected = NULL;
+		llist_for_each_entry(other, &nsi->gprs_nsvcs, list) {
+			if (other->nsei == nsvc->nsei) {
+				expected = other;
+				break;
+			}
+		}
+		OSMO_ASSERT(gprs_nsvc_by_nsei(nsi, nsvc->nsei) == expected);
+
+		expected = NULL;
+		llist_for_each_entry(other, &nsi->gprs_nsvcs, list) {
+			if (other->ip.bts_addr.sin_addr.s_addr == nsvc->ip.bts_addr.sin_addr.s_addr &&
+			    other->ip.bts_addr.sin_port == nsvc->ip.bts_addr.sin_port) {
+				expected = other;
+				break;
+			}
+		}
+		OSMO_ASSERT(gprs_nsvc_by_rem_addr(nsi, &nsvc->ip.bts_addr) == expected);
+	}
+
+	/* each NS-VC is in each index exactly once, the unknown_nsvc in none */
+	hash_for_each(nsi->nsvc_by_nsvci, bkt, nsvc, nsvci_node)
+		hashed++;
+	hash_for_each(nsi->nsvc_by_nsei, bkt, nsvc, nsei_node)
+		hashed++;
+	hash_for_each(nsi->nsvc_by_addr, bkt, nsvc, addr_node)
+		hashed++;
+	OSMO_ASSERT(hashed == 3 * count);
+	OSMO_ASSERT(!hash_hashed(&nsi->unknown_nsvc->nsvci_node));
+}
+
 static int gprs_process_message(struct gprs_ns_inst *nsi, const char *text, struct sockaddr_in *peer, const unsigned char* data, size_t data_len)
 {
 	struct msgb *msg;
@@ -353,6 +415,7 @@ static int gprs_process_message(struct gprs_ns_inst *nsi, const char *text, stru
 	printf("result (%s) = %d\n\n", text, ret);
 
 	msgb_free(msg);
+	check_nsvc_index(nsi);
 
 	return ret;
 }
@@ -389,6 +452,8 @@ static void gprs_dump_nsi(struct gprs_ns_inst *nsi)
 {
 	struct gprs_nsvc *nsvc;
 
+	check_nsvc_index(nsi);
+
 	printf("Current NS-VCIs:\n");
 	llist_for_each_entry(nsvc, &nsi->gprs_nsvcs, list) {
 		struct sockaddr_in *peer = &(nsvc->ip.bts_addr);
@@ -891,6 +956,234 @@ static void test_sgsn_output()
 	nsi = NULL;
 }
 
+static uint64_t ctr_by_name(struct rate_ctr_group *ctrg, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctrg->desc->num_ctr; i++) {
+		if (!strcmp(ctrg->desc->ctr_desc[i].name, name))
+			return ctrg->ctr[i].current;
+	}
+	OSMO_ASSERT(0);
+}
+
+/* send a UNITDATA with the given LSP, return the NS-VC (index) it went to */
+static int send_lsp(struct gprs_ns_inst *nsi, struct gprs_nsvc **nsvcs,
+		    unsigned int num, uint16_t nsei, uint32_t lsp)
+{
+	uint64_t before[num];
+	struct msgb *msg;
+	unsigned int i;
+	int used = -1;
+
+	for (i = 0; i < num; i++)
+		before[i] = ctr_by_name(nsvcs[i]->ctrg, "unitdata:packets:out");
+
+	msg = gprs_ns_msgb_alloc();
+	memset(msgb_put(msg, 10), 0x2b, 10);
+	msgb_nsei(msg) = nsei;
+	msgb_bvci(msg) = 0x0102;
+	msgb_lsp(msg) = lsp;
+	gprs_ns_sendmsg(nsi, msg);
+
+	for (i = 0; i < num; i++) {
+		if (ctr_by_name(nsvcs[i]->ctrg, "unitdata:packets:out") != before[i]) {
+			OSMO_ASSERT(used == -1);
+			used = i;
+		}
+	}
+	return used;
+}
+
+static void test_load_sharing()
+{
+	struct gprs_ns_inst *nsi = gprs_ns_instantiate(gprs_ns_callback, NULL);
+	struct gprs_nsvc *nsvcs[4];
+	int map[256], count[4];
+	unsigned int i;
+	int vc;
+
+	printf("--- NS load sharing ---\n\n");
+
+	quiet_ns_sendmsg = true;
+
+	for (i = 0; i < ARRAY_SIZE(nsvcs); i++) {
+		nsvcs[i] = gprs_nsvc_create(nsi, 0x1000 + i);
+		nsvcs[i]->nsei = 0x1234;
+		nsvcs[i]->ll = GPRS_NS_LL_UDP;
+		/* no socket, the messages are counted but not sent */
+		nsvcs[i]->ip.bts_addr.sin_family = AF_INET;
+		nsvcs[i]->ip.bts_addr.sin_addr.s_addr = htonl(0x7f000001);
+		nsvcs[i]->ip.bts_addr.sin_port = htons(9);
+		nsvcs[i]->state = NSE_S_ALIVE;
+		gprs_nsvc_rehash(nsvcs[i]);
+	}
+
+	/* every LSP is mapped to one NS-VC, all NS-VCs are used */
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < ARRAY_SIZE(map); i++) {
+		map[i] = send_lsp(nsi, nsvcs, ARRAY_SIZE(nsvcs), 0x1234, i);
+		OSMO_ASSERT(map[i] >= 0);
+		count[map[i]]++;
+		/* and keeps using it */
+		OSMO_ASSERT(send_lsp(nsi, nsvcs, ARRAY_SIZE(nsvcs), 0x1234, i) == map[i]);
+	}
+	for (i = 0; i < ARRAY_SIZE(nsvcs); i++) {
+		printf("NSVCI 0x%04x: %d LSPs\n", nsvcs[i]->nsvci, count[i]);
+		OSMO_ASSERT(count[i] > 0);
+	}
+
+	/* block one NS-VC: only its LSPs move to the others */
+	printf("Blocking NSVCI 0x%04x\n", nsvcs[1]->nsvci);
+	nsvcs[1]->state |= NSE_S_BLOCKED;
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < ARRAY_SIZE(map); i++) {
+		vc = send_lsp(nsi, nsvcs, ARRAY_SIZE(nsvcs), 0x1234, i);
+		OSMO_ASSERT(vc >= 0 && vc != 1);
+		if (map[i] != 1)
+			OSMO_ASSERT(vc == map[i]);
+		count[vc]++;
+	}
+	for (i = 0; i < ARRAY_SIZE(nsvcs); i++)
+		printf("NSVCI 0x%04x: %d LSPs\n", nsvcs[i]->nsvci, count[i]);
+
+	/* unblocking it restores the original distribution */
+	printf("Unblocking NSVCI 0x%04x\n", nsvcs[1]->nsvci);
+	nsvcs[1]->state &= ~NSE_S_BLOCKED;
+	for (i = 0; i < ARRAY_SIZE(map); i++)
+		OSMO_ASSERT(send_lsp(nsi, nsvcs, ARRAY_SIZE(nsvcs), 0x1234, i) == map[i]);
+
+	for (i = 0; i < ARRAY_SIZE(nsvcs); i++)
+		printf("NSVCI 0x%04x: %"PRIu64" packets, %"PRIu64" bytes\n", nsvcs[i]->nsvci,
+		       ctr_by_name(nsvcs[i]->ctrg, "unitdata:packets:out"),
+		       ctr_by_name(nsvcs[i]->ctrg, "unitdata:bytes:out"));
+
+	quiet_ns_sendmsg = false;
+	gprs_ns_destroy(nsi);
+	printf("\n");
+}
+
+static struct msgb *rx_unitdata_msgb(int headroom, uint16_t nsei, uint16_t bvci)
+{
+	static const uint8_t bssgp[] = { 0x01, 0xaa, 0xbb, 0xcc, 0xdd, 0x42 };
+	struct msgb *msg = msgb_alloc_headroom(headroom + 4 + sizeof(bssgp), headroom, "fwd test");
+	uint8_t *nsh;
+
+	msg->l2h = nsh = msgb_put(msg, 4);
+	nsh[0] = NS_PDUT_UNITDATA;
+	nsh[1] = 0;
+	nsh[2] = bvci >> 8;
+	nsh[3] = bvci & 0xff;
+	memcpy(msgb_put(msg, sizeof(bssgp)), bssgp, sizeof(bssgp));
+	msgb_bssgph(msg) = nsh + 4;
+	msgb_nsei(msg) = nsei;
+	msgb_bvci(msg) = bvci;
+	msgb_tlli(msg) = 0x12345678;
+
+	return msg;
+}
+
+static void test_fwd_msgb()
+{
+	struct gprs_ns_inst *nsi = gprs_ns_instantiate(gprs_ns_callback, NULL);
+	struct gprs_nsvc *nsvc;
+	struct msgb *msg;
+	uint8_t *bssgph;
+
+	printf("--- Forwarding BSSGP PDUs ---\n\n");
+
+	nsvc = gprs_nsvc_create(nsi, 0x2001);
+	nsvc->nsei = SGSN_NSEI;
+	nsvc->ll = GPRS_NS_LL_UDP;
+	nsvc->ip.bts_addr.sin_family = AF_INET;
+	nsvc->ip.bts_addr.sin_addr.s_addr = htonl(REMOTE_SGSN_ADDR);
+	nsvc->ip.bts_addr.sin_port = htons(23000);
+	nsvc->state = NSE_S_ALIVE;
+	gprs_nsvc_rehash(nsvc);
+
+	/* as received from a BSS: the NS header is rewritten in place */
+	msg = rx_unitdata_msgb(NS_ALLOC_HEADROOM, 0x1122, 0x3344);
+	bssgph = msgb_bssgph(msg);
+	OSMO_ASSERT(gprs_ns_fwd_msgb(nsi, msg, SGSN_NSEI, 0x0007) == 6 + 4);
+	printf("forwarded in place: %s\n\n", sent_buf == bssgph - 4 ? "yes" : "no");
+	OSMO_ASSERT(msgb_bssgph(msg) == bssgph && msg->data == bssgph);
+	OSMO_ASSERT(msgb_nsei(msg) == 0x1122 && msgb_tlli(msg) == 0x12345678);
+
+	/* the first clone has been sent already, its headroom is free again */
+	OSMO_ASSERT(gprs_ns_fwd_msgb(nsi, msg, SGSN_NSEI, 0x0008) == 6 + 4);
+	printf("forwarded in place: %s\n\n", sent_buf == bssgph - 4 ? "yes" : "no");
+	msgb_free(msg);
+
+	/* without headroom for the NS header, the PDU is copied */
+	msg = rx_unitdata_msgb(0, 0x1122, 0x3344);
+	bssgph = msgb_bssgph(msg);
+	OSMO_ASSERT(gprs_ns_fwd_msgb(nsi, msg, SGSN_NSEI, 0x0009) == 6 + 4);
+	printf("forwarded in place: %s\n\n", sent_buf == bssgph - 4 ? "yes" : "no");
+	msgb_free(msg);
+
+	gprs_ns_destroy(nsi);
+	printf("\n");
+}
+
+static void test_nsip_rx_batch()
+{
+	struct gprs_ns_inst *nsi = gprs_ns_instantiate(gprs_ns_callback, NULL);
+	struct gprs_ns_inst *nsi2;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	/* NS-ALIVE, answered with NS-STATUS as the NS-VC is unknown */
+	uint8_t alive[] = { NS_PDUT_ALIVE };
+	uint8_t big[NS_ALLOC_SIZE] = { NS_PDUT_ALIVE };
+	int fd, i, rc;
+
+	printf("--- Batched NS/UDP receive ---\n\n");
+
+	nsi->nsip.local_ip = 0x7f000001;
+	OSMO_ASSERT(gprs_ns_nsip_listen(nsi) >= 0);
+	OSMO_ASSERT(getsockname(nsi->nsip.fd.fd, (struct sockaddr *)&addr, &addr_len) == 0);
+
+	OSMO_ASSERT(gprs_ns_nsip_set_rx_batch(nsi, GPRS_NS_RX_BATCH_MAX + 1) == -EINVAL);
+	OSMO_ASSERT(gprs_ns_nsip_set_rx_batch(nsi, 8) == 0);
+
+	/* a second instance gets groups of its own */
+	nsi2 = gprs_ns_instantiate(gprs_ns_callback, NULL);
+	OSMO_ASSERT(gprs_ns_nsip_set_rx_batch(nsi2, 8) == 0);
+	OSMO_ASSERT(nsi2->nsip_rx.ctrg->idx != nsi->nsip_rx.ctrg->idx);
+	OSMO_ASSERT(nsi2->nsip_rx.statg->idx != nsi->nsip_rx.statg->idx);
+	gprs_ns_destroy(nsi2);
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	OSMO_ASSERT(fd >= 0);
+	for (i = 0; i < 3; i++)
+		OSMO_ASSERT(sendto(fd, alive, sizeof(alive), 0, (struct sockaddr *)&addr, addr_len) == sizeof(alive));
+	/* does not fit into a msgb */
+	OSMO_ASSERT(sendto(fd, big, sizeof(big), 0, (struct sockaddr *)&addr, addr_len) == sizeof(big));
+
+	rc = nsi->nsip.fd.cb(&nsi->nsip.fd, BSC_FD_READ);
+	printf("read rc = %d\n", rc);
+	printf("rx.batch.size: %d\n",
+	       osmo_stat_item_get_last(nsi->nsip_rx.statg->items[0]));
+	printf("rx:dropped:trunc: %llu\n",
+	       (long long)nsi->nsip_rx.ctrg->ctr[1].current);
+
+	/* the three NS-STATUS answers */
+	for (i = 0; i < 4; i++) {
+		rc = recv(fd, big, sizeof(big), MSG_DONTWAIT);
+		if (rc < 0)
+			break;
+		printf("answer: %s\n", osmo_hexdump(big, rc));
+	}
+
+	close(fd);
+
+	/* closing keeps the configured batch size for listening again */
+	gprs_ns_close(nsi);
+	OSMO_ASSERT(nsi->nsip_rx.batch_max == 8);
+	OSMO_ASSERT(!nsi->nsip_rx.msgs[0]);
+	OSMO_ASSERT(gprs_ns_nsip_set_rx_batch(nsi, 0) == 0);
+	talloc_free(nsi);
+	printf("\n");
+}
 
 int bssgp_prim_cb(struct osmo_prim_hdr *oph, void *ctx)
 {
@@ -920,6 +1213,9 @@ int main(int argc, char **argv)
 	test_sgsn_reset();
 	test_sgsn_reset_invalid_state();
 	test_sgsn_output();
+	test_load_sharing();
+	test_fwd_msgb();
+	test_nsip_rx_batch();
 	printf("===== NS protocol test END\n\n");
 
 	exit(EXIT_SUCCESS);
@@ -0,0 +1,162 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <osmocom/core/it_q.h>
+#include <osmocom/core/select.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/utils.h>
+
+#define NUM_THREADS	4
+#define NUM_POSTS	20000
+
+static unsigned int calls, msgs;
+static unsigned long sum;
+
+static void call_cb(void *arg)
+{
+	calls++;
+	sum += (unsigned long)arg;
+}
+
+static void print_cb(void *arg)
+{
+	printf(" call(%lu)\n", (unsigned long)arg);
+}
+
+static void msg_cb(struct osmo_it_q *q, struct msgb *msg)
+{
+	printf(" msg(%s, len=%u) from queue %s\n", msgb_data(msg),
+	       msgb_length(msg), osmo_it_q_name(q));
+	msgs++;
+	msgb_free(msg);
+}
+
+static void count_msg_cb(struct osmo_it_q *q, struct msgb *msg)
+{
+	msgs++;
+	msgb_free(msg);
+}
+
+static struct msgb *mkmsg(const char *str)
+{
+	struct msgb *msg = msgb_alloc(64, "it_q_test");
+
+	OSMO_ASSERT(msg);
+	strcpy((char *)msgb_put(msg, strlen(str) + 1), str);
+	return msg;
+}
+
+static void test_single(void)
+{
+	struct osmo_it_q *q;
+	unsigned long i;
+
+	printf("Testing single-threaded posting\n");
+	q = osmo_it_q_alloc(NULL, "single", 3, msg_cb, NULL);
+	OSMO_ASSERT(q);
+
+	printf("empty queue:\n");
+	OSMO_ASSERT(osmo_select_main(1) == 0);
+
+	printf("posting in order:\n");
+	OSMO_ASSERT(osmo_it_q_call(q, print_cb, (void *)1) == 0);
+	OSMO_ASSERT(osmo_it_q_enqueue(q, mkmsg("two")) == 0);
+	OSMO_ASSERT(osmo_it_q_call(q, print_cb, (void *)3) == 0);
+	OSMO_ASSERT(osmo_it_q_call(q, NULL, NULL) == -EINVAL);
+	OSMO_ASSERT(osmo_select_main(1) == 1);
+	OSMO_ASSERT(osmo_select_main(1) == 0);
+
+	printf("size is rounded up to 4, fifth post fails:\n");
+	for (i = 0; i < 4; i++)
+		OSMO_ASSERT(osmo_it_q_call(q, print_cb, (void *)(i + 10)) == 0);
+	OSMO_ASSERT(osmo_it_q_call(q, print_cb, (void *)14) == -ENOSPC);
+	printf("draining two manually:\n");
+	OSMO_ASSERT(osmo_it_q_drain(q, 2) == 2);
+	printf("select loop gets the rest:\n");
+	OSMO_ASSERT(osmo_select_main(1) == 1);
+
+	printf("freeing with a msgb still queued\n");
+	OSMO_ASSERT(osmo_it_q_enqueue(q, mkmsg("lost")) == 0);
+	osmo_it_q_free(q);
+}
+
+static void *producer(void *arg)
+{
+	struct osmo_it_q *q = arg;
+	unsigned long i;
+
+	for (i = 1; i <= NUM_POSTS; i++) {
+		while (osmo_it_q_call(q, call_cb, (void *)i) == -ENOSPC)
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+static void test_threads(void)
+{
+	pthread_t threads[NUM_THREADS];
+	struct osmo_it_q *q;
+	struct msgb *msg;
+	int i;
+
+	printf("Testing %d producer threads\n", NUM_THREADS);
+	q = osmo_it_q_alloc(NULL, "threads", 64, count_msg_cb, NULL);
+	OSMO_ASSERT(q);
+	calls = msgs = sum = 0;
+
+	for (i = 0; i < NUM_THREADS; i++)
+		OSMO_ASSERT(pthread_create(&threads[i], NULL, producer, q) == 0);
+
+	/* allocate here, talloc itself is not thread-safe */
+	msg = mkmsg("main");
+	while (osmo_it_q_enqueue(q, msg) == -ENOSPC)
+		osmo_select_main(1);
+
+	while (calls < NUM_THREADS * NUM_POSTS || !msgs)
+		osmo_select_main(0);
+
+	for (i = 0; i < NUM_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	printf("calls=%u msgs=%u sum=%lu (expected %lu)\n", calls, msgs, sum,
+	       (unsigned long)NUM_THREADS * NUM_POSTS * (NUM_POSTS + 1) / 2);
+	/* a producer may have signalled an entry the consumer already took
+	 * on its previous wake-up; such a stale wake-up finds nothing */
+	while (osmo_select_main(1) > 0)
+		;
+	OSMO_ASSERT(calls == NUM_THREADS * NUM_POSTS && msgs == 1);
+
+	osmo_it_q_free(q);
+}
+
+int main(int argc, char **argv)
+{
+	test_single();
+	test_threads();
+
+	printf("Done\n");
+	return 0;
+}
@@ -0,0 +1,113 @@
+/* test for the asynchronous log writer */
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <semaphore.h>
+
+#include <osmocom/core/logging.h>
+#include <osmocom/core/utils.h>
+
+enum {
+	DRLL,
+};
+
+static const struct log_info_cat default_categories[] = {
+	[DRLL] = {
+		.name = "DRLL",
+		.description = "A-bis Radio Link Layer (RLL)",
+		.enabled = 1, .loglevel = LOGL_DEBUG,
+	},
+};
+
+static const struct log_info log_info = {
+	.cat = default_categories,
+	.num_cat = ARRAY_SIZE(default_categories),
+};
+
+/* block the writer thread in the output call-back while set */
+static bool block;
+static sem_t entered, release;
+static unsigned int lines_written;
+
+static void test_output(struct log_target *target, unsigned int level,
+			const char *string)
+{
+	printf("writer: %s", string);
+	__atomic_add_fetch(&lines_written, 1, __ATOMIC_RELEASE);
+
+	if (__atomic_load_n(&block, __ATOMIC_ACQUIRE)) {
+		sem_post(&entered);
+		sem_wait(&release);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct log_target *target;
+	int i;
+
+	sem_init(&entered, 0, 0);
+	sem_init(&release, 0, 0);
+
+	log_init(&log_info, NULL);
+	target = log_target_create();
+	/* written to by the writer thread like a stderr target */
+	target->type = LOG_TGT_TYPE_STDERR;
+	target->output = test_output;
+	log_set_all_filter(target, 1);
+	log_set_print_filename(target, 0);
+	log_set_use_color(target, 0);
+	log_add_target(target);
+
+	OSMO_ASSERT(log_async_start(0) == -EINVAL);
+	OSMO_ASSERT(log_async_start(3) == 0);
+	OSMO_ASSERT(log_async_start(3) == -EALREADY);
+
+	printf("Logging and flushing\n");
+	LOGP(DRLL, LOGL_NOTICE, "line 1\n");
+	LOGP(DRLL, LOGL_NOTICE, "line 2\n");
+	log_async_flush();
+	OSMO_ASSERT(lines_written == 2);
+
+	printf("Logging while the writer is blocked\n");
+	__atomic_store_n(&block, true, __ATOMIC_RELEASE);
+	LOGP(DRLL, LOGL_NOTICE, "blocking\n");
+	sem_wait(&entered);
+	__atomic_store_n(&block, false, __ATOMIC_RELEASE);
+	/* the ring has 4 slots, one of them held by the writer */
+	for (i = 0; i < 8; i++)
+		LOGP(DRLL, LOGL_NOTICE, "queued %d\n", i);
+	printf("dropped: %lu\n", log_async_dropped());
+	sem_post(&release);
+	log_async_flush();
+	/* the drops are reported in front of the next line */
+	LOGP(DRLL, LOGL_NOTICE, "after the drops\n");
+	log_async_flush();
+
+	printf("Logging a fatal message\n");
+	i = lines_written;
+	LOGP(DRLL, LOGL_FATAL, "fatal\n");
+	printf("written without flush: %d\n", lines_written - i);
+
+	printf("Stopping on log_fini()\n");
+	LOGP(DRLL, LOGL_NOTICE, "last line\n");
+	log_fini();
+	printf("dropped: %lu\n", log_async_dropped());
+
+	return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/* Measure the log lines per second the logging core formats, with and
+ * without timestamps and with several targets.  The targets discard the
+ * formatted lines, so this excludes the cost of writing them. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/core/utils.h>
+
+enum {
+	DBENCH,
+};
+
+static const struct log_info_cat bench_categories[] = {
+	[DBENCH] = {
+		.name = "DBENCH",
+		.description = "Benchmark",
+		.enabled = 1, .loglevel = LOGL_DEBUG,
+	},
+};
+
+static const struct log_info bench_info = {
+	.cat = bench_categories,
+	.num_cat = ARRAY_SIZE(bench_categories),
+};
+
+enum bench_ts {
+	TS_NONE,
+	TS_CTIME,
+	TS_EXT,
+};
+
+static unsigned int num_lines = 1000000;
+static size_t bytes;
+
+static void bench_output(struct log_target *target, unsigned int level,
+			 const char *string)
+{
+	bytes += strlen(string);
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_bench(const char *name, enum bench_ts ts, unsigned int num_targets)
+{
+	struct log_target *targets[num_targets];
+	double start, end;
+	unsigned int i;
+
+	for (i = 0; i < num_targets; i++) {
+		targets[i] = log_target_create();
+		OSMO_ASSERT(targets[i]);
+		targets[i]->output = bench_output;
+		log_set_use_color(targets[i], 0);
+		log_set_print_filename2(targets[i], LOG_FILENAME_BASENAME);
+		log_set_print_category(targets[i], 1);
+		log_set_print_level(targets[i], 1);
+		log_set_print_timestamp(targets[i], ts == TS_CTIME);
+		log_set_print_extended_timestamp(targets[i], ts == TS_EXT);
+		log_set_all_filter(targets[i], 1);
+		log_add_target(targets[i]);
+	}
+	bytes = 0;
+
+	start = now_sec();
+	for (i = 0; i < num_lines; i++)
+		LOGP(DBENCH, LOGL_NOTICE, "line %u of %s: %d\n", i, name, -42);
+	end = now_sec();
+
+	printf("%-16s %u target(s), %u lines: %.3f s, %.0f lines/s, %.1f ns/line\n",
+	       name, num_targets, num_lines, end - start, num_lines / (end - start),
+	       (end - start) * 1e9 / num_lines);
+	OSMO_ASSERT(bytes > 0);
+
+	for (i = 0; i < num_targets; i++)
+		log_target_destroy(targets[i]);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			num_lines = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n lines]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (!num_lines) {
+		fprintf(stderr, "lines must be > 0\n");
+		exit(EXIT_FAILURE);
+	}
+
+	log_init(&bench_info, NULL);
+
+	run_bench("no timestamp", TS_NONE, 1);
+	run_bench("timestamp", TS_CTIME, 1);
+	run_bench("ext timestamp", TS_EXT, 1);
+	run_bench("ext timestamp", TS_EXT, 3);
+
+	log_fini();
+
+	return 0;
+}
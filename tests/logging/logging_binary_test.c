@@ -0,0 +1,111 @@
+/* test for the binary log target, decoded by osmo-log-decode */
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <osmocom/core/logging.h>
+#include <osmocom/core/logging_binary.h>
+#include <osmocom/core/utils.h>
+
+#define LOG_FILE	"logging_binary_test.bin"
+
+enum {
+	DRLL,
+	DCC,
+};
+
+static const struct log_info_cat default_categories[] = {
+	[DRLL] = {
+		.name = "DRLL",
+		.description = "A-bis Radio Link Layer (RLL)",
+		.enabled = 1, .loglevel = LOGL_NOTICE,
+	},
+	[DCC] = {
+		.name = "DCC",
+		.description = "Layer3 Call Control (CC)",
+		.enabled = 1, .loglevel = LOGL_INFO,
+	},
+};
+
+static const struct log_info log_info = {
+	.cat = default_categories,
+	.num_cat = ARRAY_SIZE(default_categories),
+};
+
+/* log with a format string that is not a literal */
+static void log_fmt(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	osmo_vlogp(DCC, LOGL_NOTICE, __FILE__, __LINE__, 0, fmt, ap);
+	va_end(ap);
+}
+
+int main(int argc, char **argv)
+{
+	struct log_target *target;
+	char fmt[32];
+	int i;
+
+	unlink(LOG_FILE);
+
+	log_init(&log_info, NULL);
+	target = log_target_create_binary(LOG_FILE);
+	OSMO_ASSERT(target);
+	log_set_all_filter(target, 1);
+	log_add_target(target);
+
+	LOGP(DRLL, LOGL_NOTICE, "int %d uint %u hex %x/%X oct %o char %c\n",
+	     -42, 42u, 0xbeef, 0xbeef, 8, 'x');
+	LOGP(DRLL, LOGL_NOTICE, "length %hhd %hd %ld %lld %zu %jd %td %hhu\n",
+	     (char)-1, (short)-2, -3L, -4LL, (size_t)5, (intmax_t)-6, (ptrdiff_t)7, 0x1ff);
+	LOGP(DCC, LOGL_ERROR, "str '%s' '%-6s' '%.3s' '%.*s'\n", "abc", "ab", "abcdef", 2, "xyz");
+	LOGP(DCC, LOGL_INFO, "float %f %.2e %g %5.1Lf %%\n", 1.5, 12345.678, 0.25, (long double)2.25);
+	LOGP(DCC, LOGL_NOTICE, "width %*d|%-*d|%0*x|\n", 5, 1, 4, 2, 6, 0xab);
+	LOGP(DCC, LOGL_NOTICE, "ptr %p %p\n", NULL, (void *)0x1234);
+	errno = ENOENT;
+	LOGP(DCC, LOGL_NOTICE, "errno %m\n");
+	LOGP(DCC, LOGL_NOTICE, "positional %2$s %1$d\n", 1, "two");
+	LOGP(DRLL, LOGL_DEBUG, "You should not see this\n");
+	LOGP(DRLL, LOGL_NOTICE, "continued: ");
+	LOGPC(DRLL, LOGL_NOTICE, "%d\n", 3);
+	LOGP(DLGLOBAL, LOGL_NOTICE, "library category\n");
+
+	for (i = 0; i < 2; i++)
+		LOGP(DRLL, LOGL_NOTICE, "loop %d\n", i);
+
+	/* same pointer and call site, different format */
+	strcpy(fmt, "buffer A %d\n");
+	log_fmt(fmt, 1);
+	strcpy(fmt, "buffer B %s\n");
+	log_fmt(fmt, "b");
+	strcpy(fmt, "buffer A %d\n");
+	log_fmt(fmt, 2);
+
+	/* appends a new file header */
+	OSMO_ASSERT(log_target_file_reopen(target) == 0);
+	LOGP(DRLL, LOGL_NOTICE, "after reopen %d\n", 4);
+
+	log_fini();
+
+	return 0;
+}
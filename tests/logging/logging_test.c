@@ -21,6 +21,7 @@
 
 #include <osmocom/core/logging.h>
 #include <osmocom/core/utils.h>
+#include <osmocom/core/timer.h>
 
 #include <stdlib.h>
 
@@ -69,9 +70,18 @@ const struct log_info log_info = {
 
 extern struct log_info *osmo_log_info;
 
+static void log_ratelimited(int from, int to)
+{
+	int i;
+
+	for (i = from; i < to; i++)
+		LOGP_RATELIMIT(DLGLOBAL, LOGL_NOTICE, 10, 3, "Rate-limited line %d\n", i);
+}
+
 int main(int argc, char **argv)
 {
 	struct log_target *stderr_target;
+	int i;
 
 	log_init(&log_info, NULL);
 	stderr_target = log_target_create_stderr();
@@ -128,5 +138,44 @@ int main(int argc, char **argv)
 	log_set_category_filter(stderr_target, DLGLOBAL, 1, LOGL_DEBUG);
 	DEBUGP(DLGLOBAL, "You should see this (DLGLOBAL on DEBUG)\n");
 
+	/* The cached levels follow the target configuration */
+	OSMO_ASSERT(!log_cache_drops(DLGLOBAL, LOGL_DEBUG));
+	OSMO_ASSERT(log_cache_drops(DRLL, LOGL_DEBUG));
+	OSMO_ASSERT(log_cache_drops(DLLAPD, LOGL_ERROR));
+	log_set_log_level(stderr_target, LOGL_ERROR);
+	OSMO_ASSERT(log_cache_drops(DLGLOBAL, LOGL_NOTICE));
+	OSMO_ASSERT(!log_cache_drops(DLGLOBAL, LOGL_ERROR));
+	/* out-of-range categories are left to log_check_level() */
+	OSMO_ASSERT(!log_cache_drops(osmo_log_info->num_cat + 1, LOGL_DEBUG));
+	log_del_target(stderr_target);
+	OSMO_ASSERT(log_cache_drops(DLGLOBAL, LOGL_FATAL));
+	log_add_target(stderr_target);
+	log_set_log_level(stderr_target, 0);
+	DEBUGP(DLGLOBAL, "You should see this (DLGLOBAL on DEBUG)\n");
+
+	osmo_clock_override_enable(CLOCK_MONOTONIC, true);
+
+	/* 10 per second, bursts of 3 */
+	log_ratelimited(0, 10);
+	osmo_clock_override_add(CLOCK_MONOTONIC, 0, 200000000);
+	log_ratelimited(10, 13);
+	osmo_clock_override_add(CLOCK_MONOTONIC, 1, 0);
+	log_ratelimited(13, 14);
+
+	log_set_dedup_window(stderr_target, 1000);
+	for (i = 0; i < 5; i++)
+		LOGP(DLGLOBAL, LOGL_NOTICE, "Repeated line\n");
+	LOGP(DLGLOBAL, LOGL_NOTICE, "Other line\n");
+	for (i = 0; i < 2; i++) {
+		LOGP(DLGLOBAL, LOGL_NOTICE, "Repeated line ");
+		LOGPC(DLGLOBAL, LOGL_NOTICE, "with continuation %d\n", i);
+	}
+	osmo_clock_override_add(CLOCK_MONOTONIC, 1, 0);
+	LOGP(DLGLOBAL, LOGL_NOTICE, "Repeated line ");
+	LOGPC(DLGLOBAL, LOGL_NOTICE, "with continuation after the window\n");
+	log_set_dedup_window(stderr_target, 0);
+	LOGP(DLGLOBAL, LOGL_NOTICE, "Repeated line without dedup\n");
+	LOGP(DLGLOBAL, LOGL_NOTICE, "Repeated line without dedup\n");
+
 	return 0;
 }
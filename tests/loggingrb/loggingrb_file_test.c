@@ -0,0 +1,118 @@
+/* test for the memory-mapped ring buffer file log target, read back by
+ * osmo-log-ring after a crash */
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <osmocom/core/logging.h>
+#include <osmocom/core/loggingrb.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/core/utils.h>
+
+#define RING_FILE	"loggingrb_file_test.ring"
+#define NUM_SLOTS	8
+#define SLOT_SIZE	64
+
+enum {
+	DRLL,
+};
+
+static const struct log_info_cat default_categories[] = {
+	[DRLL] = {
+		.name = "DRLL",
+		.description = "A-bis Radio Link Layer (RLL)",
+		.enabled = 1, .loglevel = LOGL_DEBUG,
+	},
+};
+
+static const struct log_info log_info = {
+	.cat = default_categories,
+	.num_cat = ARRAY_SIZE(default_categories),
+};
+
+static struct log_target *ring_target(void)
+{
+	struct log_target *target;
+
+	target = log_target_create_rb_file(RING_FILE, NUM_SLOTS - 1, SLOT_SIZE);
+	OSMO_ASSERT(target);
+	log_set_print_filename2(target, LOG_FILENAME_NONE);
+	log_set_print_category_hex(target, 0);
+	log_set_print_category(target, 1);
+	log_set_use_color(target, 0);
+	log_add_target(target);
+
+	return target;
+}
+
+/* log a line per second, then crash */
+static void child(void)
+{
+	struct rlimit no_core = {};
+	int i;
+
+	setrlimit(RLIMIT_CORE, &no_core);
+	ring_target();
+
+	for (i = 0; i < 12; i++) {
+		if (i == 10)
+			LOGP(DRLL, LOGL_DEBUG, "line %d is too long to fit into a slot of the ring\n", i);
+		else
+			LOGP(DRLL, LOGL_DEBUG, "line %d\n", i);
+		osmo_gettimeofday_override_add(1, 0);
+	}
+
+	signal(SIGSEGV, SIG_DFL);
+	raise(SIGSEGV);
+	exit(0);
+}
+
+int main(int argc, char **argv)
+{
+	struct log_target *target;
+	int status;
+	pid_t pid;
+
+	unlink(RING_FILE);
+	log_init(&log_info, NULL);
+
+	osmo_gettimeofday_override = true;
+	osmo_gettimeofday_override_time.tv_sec = 1000;
+	osmo_gettimeofday_override_time.tv_usec = 0;
+
+	pid = fork();
+	OSMO_ASSERT(pid >= 0);
+	if (pid == 0)
+		child();
+	OSMO_ASSERT(waitpid(pid, &status, 0) == pid);
+	OSMO_ASSERT(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+
+	/* opening the file again keeps the lines of the crashed process */
+	target = ring_target();
+	OSMO_ASSERT(target->tgt_rb_file.hdr->num_slots == NUM_SLOTS);
+	OSMO_ASSERT(target->tgt_rb_file.hdr->head == 12);
+	osmo_gettimeofday_override_time.tv_sec = 1012;
+	LOGP(DRLL, LOGL_DEBUG, "after the restart\n");
+
+	log_fini();
+
+	return 0;
+}
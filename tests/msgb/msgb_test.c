@@ -35,6 +35,7 @@
 		abort(); \
 	}
 
+static void *msgb_ctx;
 static jmp_buf jmp_env;
 static int jmp_env_valid = 0;
 static void osmo_panic_raise(const char *fmt, va_list args)
@@ -277,6 +278,185 @@ static void test_msgb_resize_area()
 	osmo_set_panic_handler(NULL);
 }
 
+/* count the consumers that got their own copy of the payload of msg */
+static int payload_copies(struct msgb *msg, struct msgb **msgs, int num)
+{
+	int i, copies = 0;
+
+	for (i = 0; i < num; i++) {
+		if (msgs[i]->head != msg->head)
+			copies++;
+	}
+	return copies;
+}
+
+static void test_msgb_clone()
+{
+	struct msgb *msg, *msgs[3];
+	size_t blocks = talloc_total_blocks(msgb_ctx);
+	uint8_t *payload;
+	int i;
+
+	printf("Testing msgb_clone\n");
+
+	msg = msgb_alloc_headroom(256, 64, "orig");
+	payload = msgb_put(msg, 20);
+	for (i = 0; i < 20; i++)
+		payload[i] = i;
+	msg->l2h = payload;
+
+	/* fan out with msgb_copy() */
+	for (i = 0; i < ARRAY_SIZE(msgs); i++)
+		msgs[i] = msgb_copy(msg, "copy");
+	printf("msgb_copy() to %d consumers: %d payload copies\n",
+	       (int)ARRAY_SIZE(msgs), payload_copies(msg, msgs, ARRAY_SIZE(msgs)));
+	for (i = 0; i < ARRAY_SIZE(msgs); i++)
+		msgb_free(msgs[i]);
+
+	/* fan out with msgb_clone() */
+	for (i = 0; i < ARRAY_SIZE(msgs); i++) {
+		msgs[i] = msgb_clone(msg, "clone");
+		OSMO_ASSERT(msgb_shared(msgs[i]));
+		OSMO_ASSERT(msgs[i]->data == msg->data);
+		OSMO_ASSERT(msgs[i]->l2h == msg->l2h);
+	}
+	OSMO_ASSERT(msgb_shared(msg));
+	printf("msgb_clone() to %d consumers: %d payload copies\n",
+	       (int)ARRAY_SIZE(msgs), payload_copies(msg, msgs, ARRAY_SIZE(msgs)));
+
+	/* the first one to push gets the headroom in place */
+	msgb_push_u8(msgs[0], 0xaa);
+	printf("push on clone 0: %d payload copies\n",
+	       payload_copies(msg, msgs, ARRAY_SIZE(msgs)));
+	msgb_push_u8(msgs[0], 0xbb);
+	printf("push on clone 0: %d payload copies\n",
+	       payload_copies(msg, msgs, ARRAY_SIZE(msgs)));
+
+	/* everyone else gets a copy on write */
+	msgb_push_u8(msgs[1], 0xcc);
+	printf("push on clone 1: %d payload copies\n",
+	       payload_copies(msg, msgs, ARRAY_SIZE(msgs)));
+	msgb_put_u8(msgs[2], 0xdd);
+	printf("put on clone 2: %d payload copies\n",
+	       payload_copies(msg, msgs, ARRAY_SIZE(msgs)));
+	OSMO_ASSERT(!msgb_shared(msgs[1]) && !msgb_shared(msgs[2]));
+	OSMO_ASSERT(msgs[1]->l2h == msgs[1]->data + 1);
+
+	printf("Orig:    %s\n", msgb_hexdump(msg));
+	for (i = 0; i < ARRAY_SIZE(msgs); i++)
+		printf("Clone %d: %s\n", i, msgb_hexdump(msgs[i]));
+
+	/* the data area outlives the msgb it was allocated with */
+	msgb_free(msg);
+	OSMO_ASSERT(!msgb_shared(msgs[0]));
+	msgb_push_u8(msgs[0], 0xee);
+	printf("Clone 0: %s\n", msgb_hexdump(msgs[0]));
+	for (i = 0; i < ARRAY_SIZE(msgs); i++)
+		msgb_free(msgs[i]);
+
+	OSMO_ASSERT(talloc_total_blocks(msgb_ctx) == blocks);
+}
+
+static void test_msgb_chain()
+{
+	struct msgb *msg, *hdr, *copy;
+	size_t blocks = talloc_total_blocks(msgb_ctx);
+	int rc;
+
+	printf("Testing chained msgbs\n");
+
+	msg = msgb_alloc(32, "payload");
+	memcpy(msgb_put(msg, 4), "\x01\x02\x03\x04", 4);
+	hdr = msgb_alloc(4, "hdr");
+	msgb_put_u8(hdr, 0xaa);
+	msg = msgb_frag_prepend(msg, hdr);
+	OSMO_ASSERT(msg == hdr);
+	msgb_frag_append(msg, msgb_alloc(16, "trailer"));
+	msgb_put_u8(msg->frag_next->frag_next, 0xbb);
+
+	printf("fragments=%u length=%u chain_len=%u\n",
+	       msgb_frag_count(msg), msgb_length(msg), msgb_chain_len(msg));
+
+	/* copies and clones contain all fragments */
+	copy = msgb_copy(msg, "copy");
+	OSMO_ASSERT(msgb_frag_count(copy) == 3 && msgb_chain_len(copy) == 6);
+	msgb_free(copy);
+	copy = msgb_clone(msg, "clone");
+	OSMO_ASSERT(msgb_frag_count(copy) == 3 && msgb_chain_len(copy) == 6);
+	msgb_free(copy);
+
+	/* not enough tailroom in the head fragment */
+	rc = msgb_linearize(msg);
+	printf("linearize into 4 byte head: rc=%d\n", rc);
+	OSMO_ASSERT(msgb_frag_count(msg) == 3);
+
+	/* the payload fragment has enough tailroom */
+	rc = msgb_linearize(msg->frag_next);
+	printf("linearize payload fragment: rc=%d fragments=%u\n", rc,
+	       msgb_frag_count(msg));
+	printf("Payload: %s\n", msgb_hexdump(msg->frag_next));
+
+	msgb_free(msg);
+	OSMO_ASSERT(talloc_total_blocks(msgb_ctx) == blocks);
+}
+
+static void test_msgb_pool()
+{
+	struct msgb_pool_stats st;
+	struct msgb *msg, *msg2, *msgs[5];
+	int i, rc;
+
+	printf("Testing the msgb pool\n");
+
+	OSMO_ASSERT(msgb_pool_get_stats(&st) == -ENODEV);
+	OSMO_ASSERT(msgb_pool_enable(4) == 0);
+	OSMO_ASSERT(msgb_pool_enable(4) == -EALREADY);
+
+	/* the first allocation misses, the buffer is cached on free */
+	msg = msgb_alloc(200, "pool1");
+	OSMO_ASSERT(msg->data_len == 200);
+	OSMO_ASSERT(msgb_tailroom(msg) == 200);
+	msgb_put(msg, 10);
+	msg->l2h = msg->data;
+	msg->cb[0] = 42;
+	msgb_free(msg);
+
+	/* the next one of the same size class is served from the free-list
+	 * with a clean header */
+	msg2 = msgb_alloc_headroom(220, 20, "pool2");
+	OSMO_ASSERT(msg2 == msg);
+	OSMO_ASSERT(talloc_parent(msg2) == msgb_ctx);
+	OSMO_ASSERT(!strcmp(talloc_get_name(msg2), "pool2"));
+	OSMO_ASSERT(msg2->data_len == 220);
+	OSMO_ASSERT(msgb_headroom(msg2) == 20);
+	OSMO_ASSERT(msgb_length(msg2) == 0);
+	OSMO_ASSERT(msg2->l2h == NULL && msg2->cb[0] == 0);
+	msgb_free(msg2);
+
+	/* no more than max_cached buffers per size class are kept */
+	for (i = 0; i < ARRAY_SIZE(msgs); i++)
+		msgs[i] = msgb_alloc(300, "pool3");
+	for (i = 0; i < ARRAY_SIZE(msgs); i++)
+		msgb_free(msgs[i]);
+
+	/* sizes beyond the largest class are not pooled */
+	msgb_free(msgb_alloc(10000, "pool4"));
+
+	/* msgbs carrying talloc children are not cached */
+	msg = msgb_alloc(50, "pool5");
+	talloc_zero_size(msg, 8);
+	msgb_free(msg);
+
+	rc = msgb_pool_get_stats(&st);
+	OSMO_ASSERT(rc == 0);
+	printf("hits=%llu misses=%llu cached=%u cached_high=%u\n",
+	       (unsigned long long)st.hits, (unsigned long long)st.misses,
+	       st.cached, st.cached_high);
+
+	msgb_pool_disable();
+	OSMO_ASSERT(msgb_pool_get_stats(&st) == -ENODEV);
+}
+
 static void test_msgb_printf()
 {
 	struct msgb *msg;
@@ -387,13 +567,16 @@ int main(int argc, char **argv)
 {
 	void *ctx = talloc_named_const(NULL, 0, "msgb_test");
 	osmo_init_logging2(ctx, &info);
-	msgb_talloc_ctx_init(ctx, 0);
+	msgb_ctx = msgb_talloc_ctx_init(ctx, 0);
 
 	test_msgb_api();
 	test_msgb_api_errors();
 	test_msgb_copy();
 	test_msgb_resize_area();
 	test_msgb_printf();
+	test_msgb_clone();
+	test_msgb_chain();
+	test_msgb_pool();
 
 	printf("Success.\n");
 
@@ -0,0 +1,372 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/* test routines for the osmo_fd select loop back-ends */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <osmocom/core/select.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/stat_item.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/core/utils.h>
+
+static struct osmo_fd ofd_a, ofd_b, ofd_w;
+static int pipe_a[2], pipe_b[2], pipe_w[2];
+static int unregister_b_from_a;
+static int b_unregistered;
+
+static int test_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	char buf[16];
+
+	/* the dispatch order among ready fds is back-end specific */
+	if (!unregister_b_from_a)
+		printf(" cb(%s, what=0x%x)\n", (const char *)ofd->data, what);
+	if (ofd == &ofd_b)
+		OSMO_ASSERT(!b_unregistered);
+
+	if (what & BSC_FD_READ)
+		OSMO_ASSERT(read(ofd->fd, buf, sizeof(buf)) > 0);
+	if (what & BSC_FD_WRITE)
+		osmo_fd_write_disable(ofd);
+
+	if (ofd == &ofd_a && unregister_b_from_a) {
+		osmo_fd_unregister(&ofd_b);
+		b_unregistered = 1;
+	}
+
+	return 0;
+}
+
+static void setup_fds(void)
+{
+	OSMO_ASSERT(pipe(pipe_a) == 0);
+	OSMO_ASSERT(pipe(pipe_b) == 0);
+	OSMO_ASSERT(pipe(pipe_w) == 0);
+
+	osmo_fd_setup(&ofd_a, pipe_a[0], BSC_FD_READ, test_cb, "A", 0);
+	osmo_fd_setup(&ofd_b, pipe_b[0], BSC_FD_READ, test_cb, "B", 0);
+	osmo_fd_setup(&ofd_w, pipe_w[1], 0, test_cb, "W", 0);
+	OSMO_ASSERT(osmo_fd_register(&ofd_a) == 0);
+	OSMO_ASSERT(osmo_fd_register(&ofd_b) == 0);
+	OSMO_ASSERT(osmo_fd_register(&ofd_w) == 0);
+}
+
+static void teardown_fds(void)
+{
+	osmo_fd_close(&ofd_a);
+	/* already unregistered by test_dispatch() */
+	close(ofd_b.fd);
+	osmo_fd_close(&ofd_w);
+	close(pipe_a[1]);
+	close(pipe_b[1]);
+	close(pipe_w[0]);
+}
+
+static struct osmo_fd reuse_a, reuse_b, reuse_c;
+static int reuse_iteration, reuse_c_registered_in;
+
+static int reuse_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	char buf[16];
+	int p[2];
+
+	OSMO_ASSERT(read(ofd->fd, buf, sizeof(buf)) > 0);
+
+	if (ofd == &reuse_a && reuse_b.fd >= 0) {
+		/* close B and register C with the very same fd number,
+		 * readable right away */
+		int fd = reuse_b.fd;
+		osmo_fd_close(&reuse_b);
+		OSMO_ASSERT(pipe(p) == 0);
+		if (p[0] != fd) {
+			OSMO_ASSERT(dup2(p[0], fd) == fd);
+			close(p[0]);
+		}
+		OSMO_ASSERT(write(p[1], "c", 1) == 1);
+		close(p[1]);
+		osmo_fd_setup(&reuse_c, fd, BSC_FD_READ, reuse_cb, "C", 0);
+		OSMO_ASSERT(osmo_fd_register(&reuse_c) == 0);
+		reuse_c_registered_in = reuse_iteration;
+	}
+	if (ofd == &reuse_c) {
+		/* must not be called with the events of B */
+		OSMO_ASSERT(reuse_iteration > reuse_c_registered_in);
+		printf(" C dispatched in the next iteration\n");
+		osmo_fd_unregister(&reuse_c);
+	}
+
+	return 0;
+}
+
+static void test_fd_reuse(void)
+{
+	int pa[2], pb[2];
+	struct osmo_fd dup;
+
+	printf("A closes B, re-uses its fd number for C:\n");
+	OSMO_ASSERT(pipe(pa) == 0);
+	OSMO_ASSERT(pipe(pb) == 0);
+	osmo_fd_setup(&reuse_a, pa[0], BSC_FD_READ, reuse_cb, "A", 0);
+	osmo_fd_setup(&reuse_b, pb[0], BSC_FD_READ, reuse_cb, "B", 0);
+	OSMO_ASSERT(osmo_fd_register(&reuse_a) == 0);
+	OSMO_ASSERT(osmo_fd_register(&reuse_b) == 0);
+
+	/* lookups by fd number, double registration */
+	OSMO_ASSERT(osmo_fd_get_by_fd(pa[0]) == &reuse_a);
+	OSMO_ASSERT(osmo_fd_get_by_fd(pb[0]) == &reuse_b);
+	OSMO_ASSERT(osmo_fd_get_by_fd(-1) == NULL);
+	OSMO_ASSERT(osmo_fd_get_by_fd(10000) == NULL);
+	OSMO_ASSERT(osmo_fd_register(&reuse_a) == 0);
+	osmo_fd_setup(&dup, pa[0], BSC_FD_READ, reuse_cb, "dup", 0);
+	OSMO_ASSERT(osmo_fd_register(&dup) == -EEXIST);
+	OSMO_ASSERT(!osmo_fd_is_registered(&dup));
+
+	OSMO_ASSERT(write(pa[1], "a", 1) == 1);
+	/* B is closed before it could read this, or after reading it */
+	OSMO_ASSERT(write(pb[1], "b", 1) == 1);
+	for (reuse_iteration = 0; reuse_iteration < 3; reuse_iteration++)
+		osmo_select_main(1);
+	OSMO_ASSERT(!osmo_fd_is_registered(&reuse_c));
+
+	/* unregistering after resetting the fd number still frees it */
+	reuse_a.fd = -1;
+	OSMO_ASSERT(osmo_fd_is_registered(&reuse_a));
+	osmo_fd_unregister(&reuse_a);
+	OSMO_ASSERT(osmo_fd_get_by_fd(pa[0]) == NULL);
+	OSMO_ASSERT(osmo_fd_register(&dup) == 0);
+	osmo_fd_unregister(&dup);
+
+	close(pa[0]);
+	close(reuse_c.fd);
+	close(pa[1]);
+	close(pb[1]);
+}
+
+static void test_dispatch(const char *name)
+{
+	int rc;
+
+	printf("Testing dispatch with %s back-end\n", name);
+	setup_fds();
+
+	printf("nothing ready:\n");
+	rc = osmo_select_main(1);
+	OSMO_ASSERT(rc == 0);
+
+	printf("A readable:\n");
+	OSMO_ASSERT(write(pipe_a[1], "a", 1) == 1);
+	rc = osmo_select_main(1);
+	OSMO_ASSERT(rc == 1);
+
+	printf("W becomes interested in writing:\n");
+	osmo_fd_write_enable(&ofd_w);
+	rc = osmo_select_main(1);
+	OSMO_ASSERT(rc == 1);
+	rc = osmo_select_main(1);
+	OSMO_ASSERT(rc == 0);
+
+	printf("W interested again, 'when' assigned directly:\n");
+	ofd_w.when |= BSC_FD_WRITE;
+	rc = osmo_select_main(1);
+	OSMO_ASSERT(rc == 1);
+
+	printf("A not interested, 'when' assigned directly:\n");
+	ofd_a.when = 0;
+	OSMO_ASSERT(write(pipe_a[1], "a", 1) == 1);
+	rc = osmo_select_main(1);
+	OSMO_ASSERT(rc == 0);
+	ofd_a.when = BSC_FD_READ;
+	rc = osmo_select_main(1);
+	OSMO_ASSERT(rc == 1);
+
+	printf("A and B readable, A unregisters B:\n");
+	OSMO_ASSERT(write(pipe_a[1], "a", 1) == 1);
+	OSMO_ASSERT(write(pipe_b[1], "b", 1) == 1);
+	unregister_b_from_a = 1;
+	/* B may be dispatched before A, which is fine, but never after */
+	rc = osmo_select_main(1);
+	OSMO_ASSERT(rc == 1);
+	OSMO_ASSERT(b_unregistered);
+	OSMO_ASSERT(!osmo_fd_is_registered(&ofd_b));
+	unregister_b_from_a = 0;
+	b_unregistered = 0;
+
+	teardown_fds();
+
+	test_fd_reuse();
+}
+
+static struct osmo_select_ctx *own_ctx;
+
+static int ctx_fd_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	char buf[16];
+
+	printf(" fd cb(%s, what=0x%x), in own context: %d\n",
+	       (const char *)ofd->data, what, osmo_select_ctx_get() == own_ctx);
+	OSMO_ASSERT(read(ofd->fd, buf, sizeof(buf)) > 0);
+	return 0;
+}
+
+static void ctx_timer_cb(void *data)
+{
+	printf(" timer cb(%s), in own context: %d\n",
+	       (const char *)data, osmo_select_ctx_get() == own_ctx);
+}
+
+static void test_ctx(void)
+{
+	struct osmo_select_ctx *def, *prev;
+	struct osmo_fd ofd;
+	struct osmo_timer_list timer;
+	int p[2];
+	int rc;
+
+	printf("Testing separate event loop contexts\n");
+	def = osmo_select_ctx_get();
+	own_ctx = osmo_select_ctx_alloc(NULL);
+	OSMO_ASSERT(own_ctx);
+
+	OSMO_ASSERT(pipe(p) == 0);
+	osmo_fd_setup(&ofd, p[0], BSC_FD_READ, ctx_fd_cb, "C", 0);
+	osmo_timer_setup(&timer, ctx_timer_cb, "C");
+
+	prev = osmo_select_ctx_switch(own_ctx);
+	OSMO_ASSERT(prev == def);
+	OSMO_ASSERT(osmo_fd_register(&ofd) == 0);
+	osmo_timer_schedule(&timer, 0, 0);
+	OSMO_ASSERT(osmo_timers_check() == 1);
+	OSMO_ASSERT(osmo_select_ctx_switch(prev) == own_ctx);
+
+	printf("default context does not see them:\n");
+	OSMO_ASSERT(!osmo_fd_is_registered(&ofd));
+	OSMO_ASSERT(osmo_timers_check() == 0);
+	OSMO_ASSERT(write(p[1], "c", 1) == 1);
+	rc = osmo_select_main(1);
+	OSMO_ASSERT(rc == 0);
+
+	printf("running the own context:\n");
+	rc = osmo_select_main_ctx(own_ctx, 1);
+	OSMO_ASSERT(rc == 1);
+	OSMO_ASSERT(osmo_select_ctx_get() == def);
+
+	osmo_select_ctx_switch(own_ctx);
+	OSMO_ASSERT(osmo_timers_check() == 0);
+	osmo_fd_close(&ofd);
+	osmo_select_ctx_switch(NULL);
+	OSMO_ASSERT(osmo_select_ctx_get() == def);
+
+	close(p[1]);
+	osmo_select_ctx_free(own_ctx);
+}
+
+static int slow_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	char buf[16];
+
+	OSMO_ASSERT(read(ofd->fd, buf, sizeof(buf)) > 0);
+	/* pretend to be busy for 3ms */
+	osmo_clock_override_add(CLOCK_MONOTONIC, 0, 3000000);
+	return 0;
+}
+
+static void busy_timer_cb(void *data)
+{
+	osmo_clock_override_add(CLOCK_MONOTONIC, 0, 1000000);
+}
+
+static void test_stats(void)
+{
+	struct rate_ctr_group *ctrg;
+	struct osmo_stat_item_group *statg;
+	struct osmo_timer_list timer;
+	struct osmo_fd ofd;
+	int p[2];
+
+	printf("Testing instrumentation\n");
+	osmo_clock_override_enable(CLOCK_MONOTONIC, true);
+
+	OSMO_ASSERT(rate_ctr_get_group_by_name_idx("select", 0) == NULL);
+	OSMO_ASSERT(osmo_select_stats_enable(2000) == 0);
+	ctrg = rate_ctr_get_group_by_name_idx("select", 0);
+	statg = osmo_stat_item_get_group_by_name_idx("select", 0);
+	OSMO_ASSERT(ctrg && statg);
+
+	OSMO_ASSERT(pipe(p) == 0);
+	osmo_fd_setup(&ofd, p[0], BSC_FD_READ, slow_cb, NULL, 7);
+	OSMO_ASSERT(osmo_fd_register(&ofd) == 0);
+	osmo_timer_setup(&timer, busy_timer_cb, NULL);
+	osmo_timer_schedule(&timer, 0, 500);
+	osmo_clock_override_add(CLOCK_MONOTONIC, 0, 1500000);
+	OSMO_ASSERT(write(p[1], "s", 1) == 1);
+
+	OSMO_ASSERT(osmo_select_main(1) == 1);
+	/* idle iteration */
+	OSMO_ASSERT(osmo_select_main(1) == 0);
+
+	printf("iterations=%"PRIu64" slow=%"PRIu64" callbacks=%"PRIu64" fd_slow=%"PRIu64" timers=%"PRIu64"\n",
+	       ctrg->ctr[0].current, ctrg->ctr[1].current, ctrg->ctr[2].current,
+	       ctrg->ctr[3].current, ctrg->ctr[4].current);
+	printf("busy=%dus fd_cb_max=%dus (fd matches: %d, priv_nr=%d)\n",
+	       osmo_stat_item_get_last(osmo_stat_item_get_by_name(statg, "loop.busy")),
+	       osmo_stat_item_get_last(osmo_stat_item_get_by_name(statg, "fd.cb_max")),
+	       osmo_stat_item_get_last(osmo_stat_item_get_by_name(statg, "fd.cb_max_fd")) == ofd.fd,
+	       osmo_stat_item_get_last(osmo_stat_item_get_by_name(statg, "fd.cb_max_priv")));
+	printf("timers fired=%d late_max=%dus cb_max=%dus\n",
+	       osmo_stat_item_get_last(osmo_stat_item_get_by_name(statg, "timer.fired")),
+	       osmo_stat_item_get_last(osmo_stat_item_get_by_name(statg, "timer.late_max")),
+	       osmo_stat_item_get_last(osmo_stat_item_get_by_name(statg, "timer.cb_max")));
+
+	osmo_select_stats_disable();
+	OSMO_ASSERT(rate_ctr_get_group_by_name_idx("select", 0) == NULL);
+
+	osmo_fd_close(&ofd);
+	close(p[1]);
+	osmo_clock_override_enable(CLOCK_MONOTONIC, false);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct log_info log_info = {};
+	int rc;
+
+	log_init(&log_info, NULL);
+
+	OSMO_ASSERT(osmo_select_set_backend(OSMO_SELECT_BACKEND_SELECT) == 0);
+	OSMO_ASSERT(osmo_select_get_backend() == OSMO_SELECT_BACKEND_SELECT);
+	test_dispatch("select");
+
+	rc = osmo_select_set_backend(OSMO_SELECT_BACKEND_EPOLL);
+	if (rc == -ENOTSUP) {
+		/* keep the expected output identical without epoll */
+		test_dispatch("epoll");
+	} else {
+		OSMO_ASSERT(rc == 0);
+		OSMO_ASSERT(osmo_select_get_backend() == OSMO_SELECT_BACKEND_EPOLL);
+		test_dispatch("epoll");
+	}
+
+	test_ctx();
+	test_stats();
+
+	printf("Done\n");
+	return 0;
+}
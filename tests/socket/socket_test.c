@@ -23,6 +23,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -32,6 +33,7 @@
 #include <osmocom/core/utils.h>
 #include <osmocom/core/socket.h>
 #include <osmocom/core/logging.h>
+#include <osmocom/core/msgb.h>
 
 #include "../config.h"
 
@@ -125,6 +127,54 @@ static int test_sockinit2(void)
 	return 0;
 }
 
+static struct msgb *frag_alloc(const char *str)
+{
+	struct msgb *msg = msgb_alloc(64, "frag");
+	memcpy(msgb_put(msg, strlen(str)), str, strlen(str));
+	return msg;
+}
+
+static int test_sock_msgb_chain(void)
+{
+	struct msgb *msg, *frag;
+	char buf[64];
+	int sv[2], rc, i;
+
+	printf("Checking osmo_sock_writev_msgb() with a chained msgb\n");
+	rc = socketpair(AF_UNIX, SOCK_DGRAM, 0, sv);
+	OSMO_ASSERT(rc == 0);
+
+	msg = frag_alloc("payload");
+	msg = msgb_frag_prepend(msg, frag_alloc("hdr:"));
+	msgb_frag_append(msg, msgb_alloc(16, "empty"));
+	msgb_frag_append(msg, frag_alloc(":trailer"));
+	OSMO_ASSERT(msgb_frag_count(msg) == 4);
+
+	rc = osmo_sock_writev_msgb(sv[0], msg);
+	OSMO_ASSERT(rc == msgb_chain_len(msg));
+	rc = read(sv[1], buf, sizeof(buf));
+	printf("read %d bytes: %.*s\n", rc, rc, buf);
+
+	printf("Checking osmo_sock_sendto_msgb() with a chained msgb\n");
+	rc = osmo_sock_sendto_msgb(sv[0], msg, 0, NULL, 0);
+	OSMO_ASSERT(rc == msgb_chain_len(msg));
+	rc = read(sv[1], buf, sizeof(buf));
+	printf("read %d bytes: %.*s\n", rc, rc, buf);
+
+	printf("Checking chained msgb with too many fragments\n");
+	for (i = 0; i < OSMO_SOCK_MSGB_IOV_MAX; i++) {
+		frag = frag_alloc("x");
+		msgb_frag_append(msg, frag);
+	}
+	rc = osmo_sock_writev_msgb(sv[0], msg);
+	OSMO_ASSERT(rc == -EMSGSIZE);
+
+	msgb_free(msg);
+	close(sv[0]);
+	close(sv[1]);
+
+	return 0;
+}
 
 const struct log_info_cat default_categories[] = {
 };
@@ -143,6 +193,7 @@ int main(int argc, char *argv[])
 
 	test_sockinit();
 	test_sockinit2();
+	test_sock_msgb_chain();
 
 	return EXIT_SUCCESS;
 }
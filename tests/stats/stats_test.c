@@ -30,6 +30,7 @@
 
 #include <stdio.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 enum test_ctr {
 	TEST_A_CTR,
@@ -474,6 +475,81 @@ static void test_reporting()
 	printf("End test: %s\n", __func__);
 }
 
+#define SHARDED_THREADS	4
+#define SHARDED_INCS	100000
+
+static void *sharded_thread(void *arg)
+{
+	struct rate_ctr_group *ctrg = arg;
+	int i;
+
+	for (i = 0; i < SHARDED_INCS; i++) {
+		rate_ctr_inc_sharded(&ctrg->ctr[TEST_A_CTR]);
+		rate_ctr_add_sharded(&ctrg->ctr[TEST_B_CTR], 2);
+	}
+
+	return NULL;
+}
+
+static int print_ctr(struct rate_ctr_group *ctrg, struct rate_ctr *ctr,
+		     const struct rate_ctr_desc *desc, void *data)
+{
+	printf("  %s: %" PRIu64 "\n", desc->name, ctr->current);
+	return 0;
+}
+
+static void test_rate_ctr_sharded(void)
+{
+	struct rate_ctr_group *ctrg;
+	pthread_t threads[SHARDED_THREADS];
+	int64_t diff = 0;
+	uint64_t b;
+	int i;
+
+	printf("Start test: %s\n", __func__);
+
+	/* two threads get a row of their own, the others share one */
+	ctrg = rate_ctr_group_alloc_sharded(NULL, &ctrg_desc, 10, 2);
+	OSMO_ASSERT(ctrg);
+
+	for (i = 0; i < SHARDED_THREADS; i++)
+		OSMO_ASSERT(pthread_create(&threads[i], NULL, sharded_thread, ctrg) == 0);
+
+	/* the owning thread may count and collect at the same time */
+	for (i = 0; i < 1000; i++) {
+		rate_ctr_inc(&ctrg->ctr[TEST_A_CTR]);
+		diff += rate_ctr_difference(&ctrg->ctr[TEST_A_CTR]);
+	}
+
+	for (i = 0; i < SHARDED_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	diff += rate_ctr_difference(&ctrg->ctr[TEST_A_CTR]);
+	OSMO_ASSERT(diff == SHARDED_THREADS * SHARDED_INCS + 1000);
+
+	b = rate_ctr_get(&ctrg->ctr[TEST_B_CTR]);
+	rate_ctr_inc_sharded(&ctrg->ctr[TEST_B_CTR]);
+	OSMO_ASSERT(rate_ctr_get(&ctrg->ctr[TEST_B_CTR]) == b + 1);
+	rate_ctr_inc_sharded(&ctrg->ctr[TEST_B_CTR]);
+	printf("after %d threads:\n", SHARDED_THREADS);
+	rate_ctr_for_each_counter(ctrg, print_ctr, NULL);
+
+	rate_ctr_group_free(ctrg);
+
+	/* without shards, the counter is updated atomically */
+	ctrg = rate_ctr_group_alloc(NULL, &ctrg_desc, 10);
+	OSMO_ASSERT(ctrg);
+	for (i = 0; i < SHARDED_THREADS; i++)
+		OSMO_ASSERT(pthread_create(&threads[i], NULL, sharded_thread, ctrg) == 0);
+	for (i = 0; i < SHARDED_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	printf("after %d threads, not sharded:\n", SHARDED_THREADS);
+	rate_ctr_for_each_counter(ctrg, print_ctr, NULL);
+	rate_ctr_group_free(ctrg);
+
+	printf("End test: %s\n", __func__);
+}
+
 int main(int argc, char **argv)
 {
 	static const struct log_info log_info = {};
@@ -483,5 +559,6 @@ int main(int argc, char **argv)
 
 	stat_test();
 	test_reporting();
+	test_rate_ctr_sharded();
 	return 0;
 }
@@ -0,0 +1,135 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/* Compare the timer back-ends under a re-arm heavy workload, as seen with
+ * LAPD T200/T203, NS and BSSGP timers: a large number of timers which are
+ * mostly re-scheduled or deleted long before they expire. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/core/utils.h>
+
+static unsigned int num_timers = 100000;
+static unsigned int num_ops = 5000000;
+/* re-arm operations per simulated main loop iteration */
+static unsigned int ops_per_iter = 100;
+
+static unsigned int fired;
+
+static void timer_cb(void *data)
+{
+	fired++;
+}
+
+/* timeouts between 100ms and 10s, in microseconds */
+static void random_timeout(int *secs, int *usecs)
+{
+	unsigned int us = 100000 + rand() % 9900000;
+	*secs = us / 1000000;
+	*usecs = us % 1000000;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_bench(const char *name, enum osmo_timer_backend backend)
+{
+	struct osmo_timer_list *timers;
+	double start, end;
+	int secs, usecs;
+	unsigned int i;
+
+	OSMO_ASSERT(osmo_timers_set_backend(backend) == 0);
+	timers = talloc_zero_array(NULL, struct osmo_timer_list, num_timers);
+	OSMO_ASSERT(timers);
+	srand(42);
+	fired = 0;
+
+	for (i = 0; i < num_timers; i++) {
+		osmo_timer_setup(&timers[i], timer_cb, NULL);
+		random_timeout(&secs, &usecs);
+		osmo_timer_schedule(&timers[i], secs, usecs);
+	}
+
+	start = now_sec();
+	for (i = 0; i < num_ops; i++) {
+		struct osmo_timer_list *t = &timers[rand() % num_timers];
+
+		if (rand() % 8 == 0)
+			osmo_timer_del(t);
+		else {
+			random_timeout(&secs, &usecs);
+			osmo_timer_schedule(t, secs, usecs);
+		}
+
+		if (i % ops_per_iter == 0) {
+			osmo_clock_override_add(CLOCK_MONOTONIC, 0, 1000000);
+			osmo_timers_prepare();
+			osmo_timers_update();
+		}
+	}
+	end = now_sec();
+
+	printf("%-8s %u timers, %u ops: %.3f s, %.1f ns/op, %u fired\n",
+	       name, num_timers, num_ops, end - start,
+	       (end - start) * 1e9 / num_ops, fired);
+
+	for (i = 0; i < num_timers; i++)
+		osmo_timer_del(&timers[i]);
+	talloc_free(timers);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "n:o:i:")) != -1) {
+		switch (c) {
+		case 'n':
+			num_timers = atoi(optarg);
+			break;
+		case 'o':
+			num_ops = atoi(optarg);
+			break;
+		case 'i':
+			ops_per_iter = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n timers] [-o ops] [-i ops_per_iteration]\n",
+				argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (!num_timers || !ops_per_iter) {
+		fprintf(stderr, "timers and ops_per_iteration must be > 0\n");
+		exit(EXIT_FAILURE);
+	}
+
+	osmo_clock_override_enable(CLOCK_MONOTONIC, true);
+
+	run_bench("rbtree", OSMO_TIMER_BACKEND_RBTREE);
+	run_bench("wheel", OSMO_TIMER_BACKEND_WHEEL);
+
+	return 0;
+}
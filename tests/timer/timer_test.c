@@ -29,9 +29,11 @@
 #include <unistd.h>
 
 #include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
 #include <osmocom/core/timer.h>
 #include <osmocom/core/select.h>
 #include <osmocom/core/linuxlist.h>
+#include <osmocom/core/timer_compat.h>
 
 #include "../config.h"
 
@@ -46,8 +48,8 @@ static LLIST_HEAD(timer_test_list);
 struct test_timer {
 	struct llist_head head;
 	struct osmo_timer_list timer;
-	struct timeval start;
-	struct timeval stop;
+	struct timespec start;
+	struct timespec stop;
 };
 
 /* number of test steps. We add fact(steps) timers in the whole test. */
@@ -88,15 +90,15 @@ static void main_timer_fired(void *data)
 			printf("timer_test: OOM!\n");
 			return;
 		}
-		osmo_gettimeofday(&v->start, NULL);
+		osmo_clock_gettime(CLOCK_MONOTONIC, &v->start);
 		osmo_timer_setup(&v->timer, secondary_timer_fired, v);
 		unsigned int seconds = (i & 0x7) + 1;
 		v->stop.tv_sec = v->start.tv_sec + seconds;
-		v->stop.tv_usec = v->start.tv_usec;
+		v->stop.tv_nsec = v->start.tv_nsec;
 		osmo_timer_schedule(&v->timer, seconds, 0);
 		llist_add(&v->head, &timer_test_list);
 		printf("scheduled timer at %d.%06d\n",
-		       (int)v->stop.tv_sec, (int)v->stop.tv_usec);
+		       (int)v->stop.tv_sec, (int)v->stop.tv_nsec / 1000);
 	}
 	printf("added %d timers in step %u (expired=%u)\n",
 		add_in_this_step, *step, expired_timers);
@@ -108,33 +110,33 @@ static void main_timer_fired(void *data)
 static void secondary_timer_fired(void *data)
 {
 	struct test_timer *v = data, *this, *tmp;
-	struct timeval current, res;
-	struct timeval precision = { 0, TIME_BETWEEN_TIMER_CHECKS + 1};
+	struct timespec current, res;
+	struct timespec precision = { 0, (TIME_BETWEEN_TIMER_CHECKS + 1) * 1000 };
 	int i, deleted;
 
-	osmo_gettimeofday(&current, NULL);
+	osmo_clock_gettime(CLOCK_MONOTONIC, &current);
 
-	timersub(&current, &v->stop, &res);
-	if (timercmp(&res, &precision, >)) {
+	timespecsub(&current, &v->stop, &res);
+	if (timespeccmp(&res, &precision, >)) {
 		printf("ERROR: timer has expired too late:"
 		       " wanted %d.%06d now %d.%06d diff %d.%06d\n",
-		       (int)v->stop.tv_sec, (int)v->stop.tv_usec,
-		       (int)current.tv_sec, (int)current.tv_usec,
-		       (int)res.tv_sec, (int)res.tv_usec);
+		       (int)v->stop.tv_sec, (int)v->stop.tv_nsec / 1000,
+		       (int)current.tv_sec, (int)current.tv_nsec / 1000,
+		       (int)res.tv_sec, (int)res.tv_nsec / 1000);
 		too_late++;
 	}
-	else if (timercmp(&current, &v->stop, <)) {
+	else if (timespeccmp(&current, &v->stop, <)) {
 		printf("ERROR: timer has expired too soon:"
 		       " wanted %d.%06d now %d.%06d diff %d.%06d\n",
-		       (int)v->stop.tv_sec, (int)v->stop.tv_usec,
-		       (int)current.tv_sec, (int)current.tv_usec,
-		       (int)res.tv_sec, (int)res.tv_usec);
+		       (int)v->stop.tv_sec, (int)v->stop.tv_nsec / 1000,
+		       (int)current.tv_sec, (int)current.tv_nsec / 1000,
+		       (int)res.tv_sec, (int)res.tv_nsec / 1000);
 		too_soon++;
 	}
 	else
 		printf("timer fired on time: %d.%06d (+ %d.%06d)\n",
-		       (int)v->stop.tv_sec, (int)v->stop.tv_usec,
-		       (int)res.tv_sec, (int)res.tv_usec);
+		       (int)v->stop.tv_sec, (int)v->stop.tv_nsec / 1000,
+		       (int)res.tv_sec, (int)res.tv_nsec / 1000);
 
 	llist_del(&v->head);
 	talloc_free(data);
@@ -162,15 +164,50 @@ static void secondary_timer_fired(void *data)
 	       total_timers - expired_timers);
 }
 
+/* osmo_timer_remaining() takes an osmo_gettimeofday() time for now */
+static void test_timer_remaining(void)
+{
+	struct osmo_timer_list t;
+	struct timeval now, rem;
+
+	osmo_gettimeofday_override = true;
+	osmo_gettimeofday_override_time.tv_sec = 1000000;
+	osmo_gettimeofday_override_time.tv_usec = 0;
+
+	osmo_timer_setup(&t, main_timer_fired, NULL);
+	osmo_timer_schedule(&t, 5, 0);
+
+	OSMO_ASSERT(osmo_timer_remaining(&t, NULL, &rem) == 0);
+	OSMO_ASSERT(rem.tv_sec == 5 && rem.tv_usec == 0);
+
+	now = osmo_gettimeofday_override_time;
+	now.tv_sec += 2;
+	OSMO_ASSERT(osmo_timer_remaining(&t, &now, &rem) == 0);
+	OSMO_ASSERT(rem.tv_sec == 3 && rem.tv_usec == 0);
+
+	now.tv_sec += 4;
+	OSMO_ASSERT(osmo_timer_remaining(&t, &now, &rem) < 0);
+
+	osmo_timer_del(&t);
+	osmo_gettimeofday_override = false;
+}
+
 int main(int argc, char *argv[])
 {
 	int c;
 	int steps;
+	struct timespec *mono;
 
-	osmo_gettimeofday_override = true;
+	osmo_clock_override_enable(CLOCK_MONOTONIC, true);
+	mono = osmo_clock_override_gettimespec(CLOCK_MONOTONIC);
+	mono->tv_sec = 23;
+	mono->tv_nsec = 424242000;
 
-	while ((c = getopt_long(argc, argv, "s:", NULL, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "s:w", NULL, NULL)) != -1) {
 	switch(c) {
+		case 'w':
+			OSMO_ASSERT(osmo_timers_set_backend(OSMO_TIMER_BACKEND_WHEEL) == 0);
+			break;
 		case 's':
 			timer_nsteps = atoi(optarg);
 			if (timer_nsteps <= 0) {
@@ -191,16 +228,17 @@ int main(int argc, char *argv[])
 	       " %d steps of %d msecs each\n",
 	       timer_nsteps, steps, TIME_BETWEEN_TIMER_CHECKS / 1000);
 
+	test_timer_remaining();
+
 	osmo_timer_setup(&main_timer, main_timer_fired, &main_timer_step);
 	osmo_timer_schedule(&main_timer, 1, 0);
 
 #ifdef HAVE_SYS_SELECT_H
 	while (steps--) {
-		printf("%d.%06d\n", (int)osmo_gettimeofday_override_time.tv_sec,
-		       (int)osmo_gettimeofday_override_time.tv_usec);
+		printf("%d.%06d\n", (int)mono->tv_sec, (int)mono->tv_nsec / 1000);
 		osmo_timers_prepare();
 		osmo_timers_update();
-		osmo_gettimeofday_override_add(0, TIME_BETWEEN_TIMER_CHECKS);
+		osmo_clock_override_add(CLOCK_MONOTONIC, 0, TIME_BETWEEN_TIMER_CHECKS * 1000);
 	}
 #else
 	printf("Select not supported on this platform!\n");
@@ -1,5 +1,15 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
 #include <osmocom/core/logging.h>
 #include <osmocom/core/utils.h>
+#include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/stat_item.h>
 #include <osmocom/core/write_queue.h>
 
 static const struct log_info_cat default_categories[] = {
@@ -65,6 +75,212 @@ static void test_wqueue_limit(void)
 	osmo_wqueue_clear(&wqueue);
 }
 
+static struct msgb *batch_msg(const char *text)
+{
+	struct msgb *msg = msgb_alloc(64, "batch");
+	strcpy((char *) msgb_put(msg, strlen(text)), text);
+	return msg;
+}
+
+static void test_wqueue_batch_dgram(void)
+{
+	struct osmo_wqueue wqueue;
+	struct msgb *msg;
+	char buf[64];
+	int sv[2];
+	int i, rc;
+
+	printf("Testing batched datagram write\n");
+
+	OSMO_ASSERT(socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) == 0);
+	osmo_wqueue_init(&wqueue, 16);
+	wqueue.bfd.fd = sv[0];
+	OSMO_ASSERT(osmo_wqueue_set_batch(&wqueue, OSMO_WQUEUE_BATCH_MAX + 1) == -EINVAL);
+	OSMO_ASSERT(osmo_wqueue_set_batch(&wqueue, 4) == 0);
+	OSMO_ASSERT(wqueue.batch_dgram);
+	OSMO_ASSERT(osmo_wqueue_stats_alloc(&wqueue, NULL, 0) == 0);
+
+	for (i = 0; i < 6; i++) {
+		snprintf(buf, sizeof(buf), "dgram %d", i);
+		msg = batch_msg(buf);
+		/* one of them is a chain, sent as a single datagram */
+		if (i == 2)
+			msgb_frag_append(msg, batch_msg(" (2nd fragment)"));
+		OSMO_ASSERT(osmo_wqueue_enqueue(&wqueue, msg) == 0);
+	}
+	OSMO_ASSERT(wqueue.bfd.when & BSC_FD_WRITE);
+
+	/* first event writes a full batch */
+	osmo_wqueue_bfd_cb(&wqueue.bfd, BSC_FD_WRITE);
+	OSMO_ASSERT(wqueue.current_length == 2);
+	OSMO_ASSERT(wqueue.bfd.when & BSC_FD_WRITE);
+	printf("batch.size: %d\n", osmo_stat_item_get_last(wqueue.statg->items[0]));
+
+	/* second event writes the rest */
+	osmo_wqueue_bfd_cb(&wqueue.bfd, BSC_FD_WRITE);
+	OSMO_ASSERT(wqueue.current_length == 0);
+	OSMO_ASSERT(!(wqueue.bfd.when & BSC_FD_WRITE));
+	printf("batch.size: %d\n", osmo_stat_item_get_last(wqueue.statg->items[0]));
+
+	for (i = 0; i < 6; i++) {
+		rc = recv(sv[1], buf, sizeof(buf) - 1, MSG_DONTWAIT);
+		OSMO_ASSERT(rc > 0);
+		buf[rc] = '\0';
+		printf("received '%s'\n", buf);
+	}
+	OSMO_ASSERT(recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT) < 0);
+
+	osmo_wqueue_stats_free(&wqueue);
+	OSMO_ASSERT(wqueue.statg == NULL);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+static void test_wqueue_batch_stream(void)
+{
+	struct osmo_wqueue wqueue;
+	struct msgb *msg;
+	uint8_t buf[8 * 1000];
+	unsigned int total = 0;
+	int sndbuf = 2048;
+	int sv[2];
+	int i, rc;
+
+	printf("Testing batched stream write\n");
+
+	OSMO_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	OSMO_ASSERT(fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0);
+	/* small send buffer, so that writev() only writes some of the data */
+	OSMO_ASSERT(setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) == 0);
+
+	osmo_wqueue_init(&wqueue, 16);
+	wqueue.bfd.fd = sv[0];
+	OSMO_ASSERT(osmo_wqueue_set_batch(&wqueue, 8) == 0);
+	OSMO_ASSERT(!wqueue.batch_dgram);
+
+	for (i = 0; i < 8; i++) {
+		msg = msgb_alloc(1000, "stream");
+		memset(msgb_put(msg, 1000), i, 1000);
+		OSMO_ASSERT(osmo_wqueue_enqueue(&wqueue, msg) == 0);
+	}
+
+	/* keep writing and reading until everything arrived */
+	for (i = 0; i < 100 && wqueue.current_length; i++) {
+		osmo_wqueue_bfd_cb(&wqueue.bfd, BSC_FD_WRITE);
+		while ((rc = recv(sv[1], buf + total, sizeof(buf) - total, MSG_DONTWAIT)) > 0)
+			total += rc;
+	}
+	OSMO_ASSERT(!(wqueue.bfd.when & BSC_FD_WRITE));
+
+	printf("received %u bytes\n", total);
+	OSMO_ASSERT(total == sizeof(buf));
+	for (i = 0; i < sizeof(buf); i++)
+		OSMO_ASSERT(buf[i] == i / 1000);
+
+	close(sv[0]);
+	close(sv[1]);
+}
+
+static void congested_cb(struct osmo_wqueue *queue)
+{
+	printf("congested at %u bytes\n", queue->current_bytes);
+}
+
+static void decongested_cb(struct osmo_wqueue *queue)
+{
+	printf("decongested at %u bytes\n", queue->current_bytes);
+}
+
+static int watermark_write_cb(struct osmo_fd *fd, struct msgb *msg)
+{
+	return 0;
+}
+
+static void test_wqueue_watermarks(void)
+{
+	struct osmo_wqueue wqueue;
+	struct msgb *msg;
+	int i;
+
+	printf("Testing byte watermarks\n");
+
+	osmo_wqueue_init(&wqueue, 16);
+	wqueue.write_cb = watermark_write_cb;
+	wqueue.congested_cb = congested_cb;
+	wqueue.decongested_cb = decongested_cb;
+	wqueue.max_bytes = 100;
+	OSMO_ASSERT(osmo_wqueue_set_watermarks(&wqueue, 10, 20) == -EINVAL);
+	OSMO_ASSERT(osmo_wqueue_set_watermarks(&wqueue, 60, 20) == 0);
+	OSMO_ASSERT(osmo_wqueue_stats_alloc(&wqueue, NULL, 1) == 0);
+
+	/* fill up to the byte limit, crossing the high watermark once */
+	for (i = 0; i < 4; i++) {
+		msg = msgb_alloc(64, "watermark");
+		msgb_put(msg, 25);
+		OSMO_ASSERT(osmo_wqueue_enqueue(&wqueue, msg) == 0);
+		printf("enqueued: %u msgs, %u bytes\n", wqueue.current_length, wqueue.current_bytes);
+	}
+	OSMO_ASSERT(wqueue.congested);
+
+	/* anything beyond max_bytes is rejected */
+	msg = msgb_alloc(64, "watermark");
+	msgb_put(msg, 1);
+	OSMO_ASSERT(osmo_wqueue_enqueue(&wqueue, msg) == -ENOSPC);
+	msgb_free(msg);
+	OSMO_ASSERT(wqueue.current_bytes == 100);
+
+	/* drain, dropping below the low watermark once */
+	while (wqueue.current_length) {
+		osmo_wqueue_bfd_cb(&wqueue.bfd, BSC_FD_WRITE);
+		printf("written: %u msgs, %u bytes\n", wqueue.current_length, wqueue.current_bytes);
+	}
+	OSMO_ASSERT(!wqueue.congested);
+
+	printf("depth.bytes: %d\n", osmo_stat_item_get_last(wqueue.statg->items[2]));
+	printf("msgs:dropped: %"PRIu64"\n", wqueue.ctrg->ctr[0].current);
+	printf("bytes:dropped: %"PRIu64"\n", wqueue.ctrg->ctr[1].current);
+	printf("congested: %"PRIu64"\n", wqueue.ctrg->ctr[2].current);
+
+	osmo_wqueue_stats_free(&wqueue);
+	osmo_wqueue_clear(&wqueue);
+}
+
+static int chain_write_cb(struct osmo_fd *fd, struct msgb *msg)
+{
+	OSMO_ASSERT(!msg->frag_next);
+	printf("write_cb: '%.*s'\n", msgb_length(msg), (const char *) msgb_data(msg));
+	return 0;
+}
+
+static void test_wqueue_chain(void)
+{
+	struct osmo_wqueue wqueue;
+	struct msgb *msg;
+
+	printf("Testing chained msgbs with write_cb\n");
+
+	osmo_wqueue_init(&wqueue, 16);
+	wqueue.write_cb = chain_write_cb;
+
+	/* fragments are copied into the head */
+	msg = batch_msg("head");
+	msgb_frag_append(msg, batch_msg(" and tail"));
+	OSMO_ASSERT(osmo_wqueue_enqueue(&wqueue, msg) == 0);
+	OSMO_ASSERT(wqueue.current_bytes == 13);
+	osmo_wqueue_bfd_cb(&wqueue.bfd, BSC_FD_WRITE);
+	OSMO_ASSERT(wqueue.current_length == 0);
+
+	/* a head without enough tailroom is rejected */
+	msg = msgb_alloc(4, "chain");
+	memcpy(msgb_put(msg, 4), "head", 4);
+	msgb_frag_append(msg, batch_msg(" and tail"));
+	OSMO_ASSERT(osmo_wqueue_enqueue(&wqueue, msg) == -EMSGSIZE);
+	msgb_free(msg);
+	OSMO_ASSERT(wqueue.current_length == 0 && wqueue.current_bytes == 0);
+
+	osmo_wqueue_clear(&wqueue);
+}
+
 int main(int argc, char **argv)
 {
 	struct log_target *stderr_target;
@@ -75,6 +291,10 @@ int main(int argc, char **argv)
 	log_set_print_filename(stderr_target, 0);
 
 	test_wqueue_limit();
+	test_wqueue_batch_dgram();
+	test_wqueue_batch_stream();
+	test_wqueue_watermarks();
+	test_wqueue_chain();
 
 	printf("Done\n");
 	return 0;
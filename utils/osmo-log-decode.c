@@ -0,0 +1,445 @@
+/*! \file osmo-log-decode.c
+ * Utility program to decode binary log files to text. */
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+
+#include <osmocom/core/utils.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/core/logging_binary.h>
+
+enum print_file {
+	PRINT_FILE_NONE,
+	PRINT_FILE_PATH,
+	PRINT_FILE_BASENAME,
+};
+
+static bool print_timestamp = true;
+static bool print_category = true;
+static bool print_level = true;
+static enum print_file print_file = PRINT_FILE_PATH;
+
+struct site {
+	char *file;
+	char *format;
+	uint32_t line;
+};
+
+/* state of the binary log file being decoded */
+static char *cats[UINT16_MAX + 1];
+static struct site *sites;
+static size_t num_sites;
+
+struct args {
+	const uint8_t *data;
+	size_t len;
+};
+
+static bool get_arg(struct args *args, void *dst, size_t len)
+{
+	if (args->len < len)
+		return false;
+	memcpy(dst, args->data, len);
+	args->data += len;
+	args->len -= len;
+	return true;
+}
+
+static void reset(void)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(cats); i++) {
+		free(cats[i]);
+		cats[i] = NULL;
+	}
+	for (i = 0; i < num_sites; i++) {
+		free(sites[i].file);
+		free(sites[i].format);
+	}
+	free(sites);
+	sites = NULL;
+	num_sites = 0;
+}
+
+static const char *level_name(unsigned int level)
+{
+	if (level >= LOGL_FATAL)
+		return "FATAL";
+	if (level >= LOGL_ERROR)
+		return "ERROR";
+	if (level >= LOGL_NOTICE)
+		return "NOTICE";
+	if (level >= LOGL_INFO)
+		return "INFO";
+	return "DEBUG";
+}
+
+/* print one conversion; false if the arguments are exhausted */
+static bool print_conv(const struct log_bin_conv *conv, const char *end,
+		       struct args *args)
+{
+	char spec[64], str[UINT16_MAX + 1];
+	int32_t star;
+	int64_t i64;
+	uint16_t len;
+	double d;
+	int n;
+
+	/* '%', the flags and the field width and precision */
+	n = snprintf(spec, sizeof(spec), "%%%.*s", (int)(conv->width - conv->flags), conv->flags);
+	if (conv->width_star) {
+		if (!get_arg(args, &star, sizeof(star)))
+			return false;
+		n += snprintf(spec + n, sizeof(spec) - n, "%d", star);
+	} else
+		n += snprintf(spec + n, sizeof(spec) - n, "%.*s", (int)(conv->prec - conv->width), conv->width);
+	if (conv->prec_star) {
+		if (!get_arg(args, &star, sizeof(star)))
+			return false;
+		/* a negative precision is taken as if it were omitted */
+		if (star >= 0)
+			n += snprintf(spec + n, sizeof(spec) - n, ".%d", star);
+	} else
+		n += snprintf(spec + n, sizeof(spec) - n, "%.*s", (int)(conv->len_mod - conv->prec), conv->prec);
+	if (n >= sizeof(spec) - 4)
+		return false;
+
+	switch (conv->conv) {
+	case 'd':
+	case 'i':
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+		if (!get_arg(args, &i64, sizeof(i64)))
+			return false;
+		switch (conv->len) {
+		case LOG_BIN_LEN_NONE:
+		case LOG_BIN_LEN_HH:
+		case LOG_BIN_LEN_H:
+			/* keep the length modifier, it truncates the value */
+			snprintf(spec + n, sizeof(spec) - n, "%.*s%c",
+				 (int)(end - 1 - conv->len_mod), conv->len_mod, conv->conv);
+			printf(spec, (int)i64);
+			break;
+		default:
+			/* the writer's long may differ from ours */
+			snprintf(spec + n, sizeof(spec) - n, "ll%c", conv->conv);
+			printf(spec, (long long)i64);
+			break;
+		}
+		break;
+	case 'c':
+		if (!get_arg(args, &i64, sizeof(i64)))
+			return false;
+		snprintf(spec + n, sizeof(spec) - n, "c");
+		printf(spec, (int)i64);
+		break;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		if (!get_arg(args, &d, sizeof(d)))
+			return false;
+		snprintf(spec + n, sizeof(spec) - n, "%c", conv->conv);
+		printf(spec, d);
+		break;
+	case 'p':
+		if (!get_arg(args, &i64, sizeof(i64)))
+			return false;
+		if (i64) {
+			/* like glibc's %p, as the pointer size may differ */
+			char alt[sizeof(spec) + 1];
+			snprintf(spec + n, sizeof(spec) - n, "llx");
+			snprintf(alt, sizeof(alt), "%%#%s", spec + 1);
+			printf(alt, (unsigned long long)i64);
+		} else
+			printf("(nil)");
+		break;
+	case 's':
+	case 'm':
+		if (!get_arg(args, &len, sizeof(len)) || !get_arg(args, str, len))
+			return false;
+		str[len] = '\0';
+		snprintf(spec + n, sizeof(spec) - n, "s");
+		printf(spec, str);
+		break;
+	case '%':
+		printf("%%");
+		break;
+	}
+
+	return true;
+}
+
+static void print_event(const struct log_bin_log *ev, struct args *args)
+{
+	const struct site *site;
+	struct log_bin_conv conv;
+	const char *p, *end;
+
+	if (ev->site >= num_sites || !sites[ev->site].format) {
+		fprintf(stderr, "Event references unknown log statement %u\n", ev->site);
+		return;
+	}
+	site = &sites[ev->site];
+
+	if (!(ev->flags & LOG_BIN_F_CONT)) {
+		if (print_timestamp) {
+			time_t sec = ev->time_us / 1000000;
+			struct tm tm;
+			localtime_r(&sec, &tm);
+			printf("%04d%02d%02d%02d%02d%02d%03d ",
+			       tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+			       tm.tm_hour, tm.tm_min, tm.tm_sec,
+			       (int)(ev->time_us % 1000000 / 1000));
+		}
+		if (print_category)
+			printf("%s ", cats[ev->subsys] ? cats[ev->subsys] : "<unknown>");
+		if (print_level)
+			printf("%s ", level_name(ev->level));
+		switch (print_file) {
+		case PRINT_FILE_NONE:
+			break;
+		case PRINT_FILE_PATH:
+			printf("%s:%u ", site->file, site->line);
+			break;
+		case PRINT_FILE_BASENAME:
+			p = strrchr(site->file, '/');
+			printf("%s:%u ", p && p[1] ? p + 1 : site->file, site->line);
+			break;
+		}
+	}
+
+	for (p = site->format; *p; p = end) {
+		if (*p != '%') {
+			end = strchr(p, '%');
+			if (!end)
+				end = p + strlen(p);
+			fwrite(p, 1, end - p, stdout);
+			continue;
+		}
+		end = log_bin_parse_conv(p, &conv);
+		if (!end) {
+			/* not written by the log target */
+			fputs(p, stdout);
+			break;
+		}
+		if (!print_conv(&conv, end, args)) {
+			printf("[...]\n");
+			break;
+		}
+	}
+}
+
+static int add_cat(const uint8_t *data, size_t len)
+{
+	struct log_bin_cat cat;
+
+	if (len <= sizeof(cat) || data[len - 1] != '\0')
+		return -EINVAL;
+	memcpy(&cat, data, sizeof(cat));
+	free(cats[cat.subsys]);
+	cats[cat.subsys] = strdup((const char *)data + sizeof(cat));
+	return 0;
+}
+
+static int add_site(const uint8_t *data, size_t len)
+{
+	struct log_bin_site hdr;
+	const char *file, *format;
+
+	if (len <= sizeof(hdr) || data[len - 1] != '\0')
+		return -EINVAL;
+	memcpy(&hdr, data, sizeof(hdr));
+	file = (const char *)data + sizeof(hdr);
+	format = file + strlen(file) + 1;
+	if (format >= (const char *)data + len)
+		return -EINVAL;
+
+	/* the writer assigns ids in order, the table grows by at most one */
+	if (hdr.id > num_sites)
+		return -EINVAL;
+	if (hdr.id == num_sites) {
+		size_t num = num_sites ? num_sites * 2 : 64;
+		struct site *s = realloc(sites, num * sizeof(*s));
+		if (!s)
+			return -ENOMEM;
+		memset(s + num_sites, 0, (num - num_sites) * sizeof(*s));
+		sites = s;
+		num_sites = num;
+	}
+	free(sites[hdr.id].file);
+	free(sites[hdr.id].format);
+	sites[hdr.id].file = strdup(file);
+	sites[hdr.id].format = strdup(format);
+	sites[hdr.id].line = hdr.line;
+	return 0;
+}
+
+static int check_file_hdr(const struct log_bin_file_hdr *fh)
+{
+	if (memcmp(fh->magic, LOG_BIN_MAGIC, sizeof(fh->magic))) {
+		fprintf(stderr, "Not a binary log file\n");
+		return -EINVAL;
+	}
+	if (fh->byte_order != LOG_BIN_BYTE_ORDER) {
+		fprintf(stderr, "Binary log file has a different byte order\n");
+		return -EINVAL;
+	}
+	if (fh->version != LOG_BIN_VERSION) {
+		fprintf(stderr, "Unsupported binary log file version %u\n", fh->version);
+		return -EINVAL;
+	}
+	reset();
+	return 0;
+}
+
+static int decode(FILE *in)
+{
+	static uint8_t data[UINT16_MAX];
+	struct log_bin_file_hdr fh;
+	struct log_bin_rec_hdr rh;
+	struct args args;
+	int rc;
+
+	if (fread(&fh, sizeof(fh), 1, in) != 1 || check_file_hdr(&fh) < 0)
+		return -EINVAL;
+
+	while (fread(&rh, sizeof(rh), 1, in) == 1) {
+		/* the file was re-opened and a new header appended */
+		if (rh.type == LOG_BIN_MAGIC[0]) {
+			memcpy(&fh, &rh, sizeof(rh));
+			if (fread((uint8_t *)&fh + sizeof(rh), sizeof(fh) - sizeof(rh), 1, in) != 1 ||
+			    check_file_hdr(&fh) < 0)
+				return -EINVAL;
+			continue;
+		}
+
+		if (fread(data, 1, rh.len, in) != rh.len) {
+			/* e.g. the writer was killed */
+			fprintf(stderr, "Binary log file ends with an incomplete record\n");
+			break;
+		}
+
+		switch (rh.type) {
+		case LOG_BIN_REC_CAT:
+			rc = add_cat(data, rh.len);
+			break;
+		case LOG_BIN_REC_SITE:
+			rc = add_site(data, rh.len);
+			break;
+		case LOG_BIN_REC_LOG:
+			if (rh.len < sizeof(struct log_bin_log)) {
+				rc = -EINVAL;
+				break;
+			}
+			args.data = data + sizeof(struct log_bin_log);
+			args.len = rh.len - sizeof(struct log_bin_log);
+			print_event((const struct log_bin_log *)data, &args);
+			rc = 0;
+			break;
+		default:
+			/* skip records added by later versions */
+			rc = 0;
+			break;
+		}
+		if (rc < 0) {
+			fprintf(stderr, "Invalid record of type %u\n", rh.type);
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+static void help(const char *progname)
+{
+	printf("Usage: %s [-t] [-c] [-l] [-f (path|basename|none)] [FILE...]\n",
+		progname);
+	printf("Decode binary log files, or stdin, to text.\n");
+	printf("  -t\tDon't print timestamps\n");
+	printf("  -c\tDon't print the category\n");
+	printf("  -l\tDon't print the log level\n");
+	printf("  -f\tHow to print the source file (default: path)\n");
+}
+
+int main(int argc, char **argv)
+{
+	int opt, i, rc = 0;
+
+	while ((opt = getopt(argc, argv, "tclf:h")) != -1) {
+		switch (opt) {
+		case 't':
+			print_timestamp = false;
+			break;
+		case 'c':
+			print_category = false;
+			break;
+		case 'l':
+			print_level = false;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "path"))
+				print_file = PRINT_FILE_PATH;
+			else if (!strcmp(optarg, "basename"))
+				print_file = PRINT_FILE_BASENAME;
+			else if (!strcmp(optarg, "none"))
+				print_file = PRINT_FILE_NONE;
+			else {
+				help(argv[0]);
+				exit(2);
+			}
+			break;
+		case 'h':
+			help(argv[0]);
+			exit(0);
+		default:
+			help(argv[0]);
+			exit(2);
+		}
+	}
+
+	if (optind >= argc)
+		return decode(stdin) < 0 ? 1 : 0;
+
+	for (i = optind; i < argc; i++) {
+		FILE *in = fopen(argv[i], "r");
+
+		if (!in) {
+			fprintf(stderr, "Unable to open %s: %s\n", argv[i], strerror(errno));
+			rc = 1;
+			continue;
+		}
+		if (decode(in) < 0)
+			rc = 1;
+		fclose(in);
+	}
+
+	return rc;
+}
@@ -0,0 +1,199 @@
+/*! \file osmo-log-ring.c
+ * Utility program to print the log lines of a ring buffer file. */
+/*
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+
+#include <osmocom/core/utils.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/core/loggingrb.h>
+
+static bool print_timestamp = true;
+/* only print lines logged this many seconds before the last line; 0 for all */
+static unsigned long seconds;
+
+static uint8_t *read_file(FILE *in, size_t *len)
+{
+	uint8_t *data = NULL, *d;
+	size_t size = 0, n;
+
+	*len = 0;
+	do {
+		if (*len == size) {
+			size = size ? size * 2 : 1 << 20;
+			d = realloc(data, size);
+			if (!d) {
+				free(data);
+				return NULL;
+			}
+			data = d;
+		}
+		n = fread(data + *len, 1, size - *len, in);
+		*len += n;
+	} while (n);
+
+	if (ferror(in)) {
+		free(data);
+		return NULL;
+	}
+	return data;
+}
+
+static const struct log_rb_file_slot *get_slot(const uint8_t *data,
+					       const struct log_rb_file_hdr *hdr,
+					       uint64_t pos)
+{
+	const struct log_rb_file_slot *slot;
+
+	slot = (const struct log_rb_file_slot *)(data + hdr->hdr_len +
+						 (pos & (hdr->num_slots - 1)) * hdr->slot_size);
+	/* empty, being written when the process died, or already overwritten */
+	if (slot->seq != pos + 1)
+		return NULL;
+	return slot;
+}
+
+static void print_slot(const struct log_rb_file_hdr *hdr, const struct log_rb_file_slot *slot)
+{
+	size_t len = OSMO_MIN((size_t)slot->len, hdr->slot_size - sizeof(*slot));
+
+	if (print_timestamp) {
+		time_t sec = slot->time_us / 1000000;
+		struct tm tm;
+		localtime_r(&sec, &tm);
+		printf("%04d%02d%02d%02d%02d%02d%03d ",
+		       tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+		       tm.tm_hour, tm.tm_min, tm.tm_sec,
+		       (int)(slot->time_us % 1000000 / 1000));
+	}
+	fwrite(slot->text, 1, len, stdout);
+	/* truncated lines lack the newline */
+	if (!len || slot->text[len - 1] != '\n')
+		putchar('\n');
+}
+
+static int dump(const char *fname)
+{
+	const struct log_rb_file_hdr *hdr;
+	const struct log_rb_file_slot *slot;
+	uint64_t pos, first, last_us = 0;
+	unsigned int incomplete = 0;
+	uint8_t *data;
+	size_t len;
+	FILE *in;
+
+	in = fopen(fname, "r");
+	if (!in) {
+		fprintf(stderr, "Unable to open %s: %s\n", fname, strerror(errno));
+		return -errno;
+	}
+	data = read_file(in, &len);
+	fclose(in);
+	if (!data) {
+		fprintf(stderr, "Unable to read %s\n", fname);
+		return -EIO;
+	}
+
+	hdr = (const struct log_rb_file_hdr *)data;
+	if (len < sizeof(*hdr) || memcmp(hdr->magic, LOG_RB_FILE_MAGIC, sizeof(hdr->magic))) {
+		fprintf(stderr, "%s is not a log ring buffer file\n", fname);
+		goto err;
+	}
+	if (hdr->version != LOG_RB_FILE_VERSION) {
+		fprintf(stderr, "Unsupported log ring buffer file version %u\n", hdr->version);
+		goto err;
+	}
+	if (hdr->hdr_len < sizeof(*hdr) || hdr->slot_size <= sizeof(*slot) ||
+	    !hdr->num_slots || (hdr->num_slots & (hdr->num_slots - 1)) ||
+	    len < hdr->hdr_len + (uint64_t)hdr->num_slots * hdr->slot_size) {
+		fprintf(stderr, "%s is truncated or corrupt\n", fname);
+		goto err;
+	}
+
+	/* head counts the slots ever taken; the last num_slots are in the file */
+	first = hdr->head > hdr->num_slots ? hdr->head - hdr->num_slots : 0;
+
+	for (pos = first; pos < hdr->head; pos++) {
+		slot = get_slot(data, hdr, pos);
+		if (slot && slot->time_us > last_us)
+			last_us = slot->time_us;
+	}
+
+	for (pos = first; pos < hdr->head; pos++) {
+		slot = get_slot(data, hdr, pos);
+		if (!slot) {
+			incomplete++;
+			continue;
+		}
+		if (seconds && slot->time_us + seconds * 1000000 < last_us)
+			continue;
+		print_slot(hdr, slot);
+	}
+
+	if (incomplete)
+		fprintf(stderr, "%u log lines were incomplete or overwritten\n", incomplete);
+
+	free(data);
+	return 0;
+
+err:
+	free(data);
+	return -EINVAL;
+}
+
+static void help(const char *progname)
+{
+	printf("Usage: %s [-t] [-s SECONDS] FILE\n", progname);
+	printf("Print the log lines kept in a log ring buffer file, oldest first.\n");
+	printf("  -t\tDon't print timestamps\n");
+	printf("  -s\tOnly print the last SECONDS seconds before the last line\n");
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "ts:h")) != -1) {
+		switch (opt) {
+		case 't':
+			print_timestamp = false;
+			break;
+		case 's':
+			seconds = strtoul(optarg, NULL, 10);
+			break;
+		case 'h':
+			help(argv[0]);
+			exit(0);
+		default:
+			help(argv[0]);
+			exit(2);
+		}
+	}
+
+	if (optind != argc - 1) {
+		help(argv[0]);
+		exit(2);
+	}
+
+	return dump(argv[optind]) < 0 ? 1 : 0;
+}